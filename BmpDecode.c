@@ -0,0 +1,343 @@
+/* Specialized full-color bitmap decoders */
+/* The bit depth and the two compression layers give a dozen ways to
+   decode a tBMP, and a decoder that checks all three for every pixel
+   spends more time branching than decoding.  Instead, the macros below
+   stamp out one decoder for every combination that we support, with
+   the depth and the layers fixed at compile time, and
+   GetBmpRgbDecoder() picks one from a table indexed by the format
+   word.
+
+   The RLE8 decoders also fuse the palette lookup into the run
+   decoding: a repeat run looks up its color once and fills it, rather
+   than filling indices first and looking each one up afterward.
+
+   DecodeBitmapRgbGeneric() is the unspecialized version, kept as a
+   reference for benchmarks.  16-bit and 24-bit pixels are converted
+   the same way as in the bitmap view (see BmpView.c).  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "PalExpand.h"
+#include "BmpDecode.h"
+
+#define DST_ROW(dst, stride, y) \
+	((PalColor*)((unsigned char*)(dst) + (size_t)(y) * (stride)))
+
+static void ExpandRaw1(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst);
+static void ExpandRaw4(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst);
+static void ExpandRaw8(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst);
+static void ExpandRaw16(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst);
+static void ExpandRaw24(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst);
+static int GetRowData(const MhkBitmap* bmp, bool lz,
+	const unsigned char** data, size_t* size, unsigned char** unpacked);
+static PalColor GenericPixel(const MhkBitmap* bmp, const PalExpander* pe,
+	const unsigned char* row, unsigned x);
+
+/* Defines a decoder for rows without secondary compression.  */
+#define DEFINE_RAW_DECODER(name, expand, lz) \
+static int name(const MhkBitmap* bmp, const PalExpander* pe, \
+	PalColor* dst, size_t stride) \
+{ \
+	const unsigned char* data; \
+	unsigned char* unpacked; \
+	size_t size; \
+	unsigned y; \
+	int result = GetRowData(bmp, lz, &data, &size, &unpacked); \
+	if (result != MHK_OK) \
+		return result; \
+	if (bmp->bytesPerRow < BmpRowSize(bmp) || \
+		size < (size_t)bmp->bytesPerRow * bmp->height) \
+		result = MHK_EFORMAT; \
+	else \
+	{ \
+		for (y = 0; y < bmp->height; y++) \
+			expand(data + (size_t)y * bmp->bytesPerRow, bmp->width, pe, \
+				DST_ROW(dst, stride, y)); \
+	} \
+	free(unpacked); \
+	return result; \
+}
+
+/* Defines a decoder for 8-bit RLE8 rows, which looks up colors as it
+   decodes the runs.  */
+#define DEFINE_RLE8_DECODER(name, lz) \
+static int name(const MhkBitmap* bmp, const PalExpander* pe, \
+	PalColor* dst, size_t stride) \
+{ \
+	const PalColor* lut = pe->lut; \
+	const unsigned char* data; \
+	unsigned char* unpacked; \
+	size_t size; \
+	size_t pos = 0; \
+	unsigned y; \
+	int result = GetRowData(bmp, lz, &data, &size, &unpacked); \
+	if (result != MHK_OK) \
+		return result; \
+	for (y = 0; y < bmp->height && result == MHK_OK; y++) \
+	{ \
+		const unsigned char* src; \
+		const unsigned char* rowEnd; \
+		PalColor* out = DST_ROW(dst, stride, y); \
+		unsigned remaining = bmp->width; \
+		size_t rowLen; \
+		if (size - pos < 2 || \
+			size - pos - 2 < (rowLen = MHK_GET16(data + pos))) \
+		{ \
+			result = MHK_EFORMAT; \
+			break; \
+		} \
+		src = data + pos + 2; \
+		rowEnd = src + rowLen; \
+		pos += 2 + rowLen; \
+		while (remaining > 0) \
+		{ \
+			unsigned code, runLen, i; \
+			if (src >= rowEnd) \
+			{ \
+				result = MHK_EFORMAT; \
+				break; \
+			} \
+			code = *src++; \
+			runLen = (code & 0x7f) + 1; \
+			if (runLen > remaining) \
+				runLen = remaining; \
+			if (code & 0x80) \
+			{ \
+				PalColor color; \
+				if (src >= rowEnd) \
+				{ \
+					result = MHK_EFORMAT; \
+					break; \
+				} \
+				color = lut[*src++]; \
+				for (i = 0; i < runLen; i++) \
+					out[i] = color; \
+			} \
+			else \
+			{ \
+				if ((size_t)(rowEnd - src) < runLen) \
+				{ \
+					result = MHK_EFORMAT; \
+					break; \
+				} \
+				pe->kernel(pe, src, runLen, out); \
+				src += (code & 0x7f) + 1; \
+			} \
+			out += runLen; \
+			remaining -= runLen; \
+		} \
+	} \
+	free(unpacked); \
+	return result; \
+}
+
+DEFINE_RAW_DECODER(DecodeRaw1, ExpandRaw1, false)
+DEFINE_RAW_DECODER(DecodeRaw4, ExpandRaw4, false)
+DEFINE_RAW_DECODER(DecodeRaw8, ExpandRaw8, false)
+DEFINE_RAW_DECODER(DecodeRaw16, ExpandRaw16, false)
+DEFINE_RAW_DECODER(DecodeRaw24, ExpandRaw24, false)
+DEFINE_RAW_DECODER(DecodeLzRaw1, ExpandRaw1, true)
+DEFINE_RAW_DECODER(DecodeLzRaw4, ExpandRaw4, true)
+DEFINE_RAW_DECODER(DecodeLzRaw8, ExpandRaw8, true)
+DEFINE_RAW_DECODER(DecodeLzRaw16, ExpandRaw16, true)
+DEFINE_RAW_DECODER(DecodeLzRaw24, ExpandRaw24, true)
+DEFINE_RLE8_DECODER(DecodeRle8, false)
+DEFINE_RLE8_DECODER(DecodeLzRle8, true)
+
+/* Indexed by depth code, then primary (none, LZ), then secondary
+   (none, RLE8).  */
+static const BmpRgbDecoder decoders[5][2][2] =
+{
+	{ { DecodeRaw1, NULL }, { DecodeLzRaw1, NULL } },
+	{ { DecodeRaw4, NULL }, { DecodeLzRaw4, NULL } },
+	{ { DecodeRaw8, DecodeRle8 }, { DecodeLzRaw8, DecodeLzRle8 } },
+	{ { DecodeRaw16, NULL }, { DecodeLzRaw16, NULL } },
+	{ { DecodeRaw24, NULL }, { DecodeLzRaw24, NULL } }
+};
+
+/* Returns the specialized decoder for a format word, or NULL if the
+   format is not supported.  */
+BmpRgbDecoder GetBmpRgbDecoder(unsigned format)
+{
+	unsigned depth = format & BMP_BPP_MASK;
+	unsigned primary = format & BMP_1ST_MASK;
+	unsigned secondary = format & BMP_2ND_MASK;
+	if (depth > BMP_BPP24)
+		return NULL;
+	if (primary != BMP_1ST_NONE && primary != BMP_1ST_LZ)
+		return NULL;
+	if (secondary != BMP_2ND_NONE && secondary != BMP_2ND_RLE8)
+		return NULL;
+	return decoders[depth][primary == BMP_1ST_LZ]
+		[secondary == BMP_2ND_RLE8];
+}
+
+/* Prepares "pe" with the inline palette of an indexed bitmap, or with
+   a gray ramp if it has none.  Returns false for direct color
+   bitmaps.  */
+bool InitBmpPalExpander(const MhkBitmap* bmp, PalExpander* pe)
+{
+	PalColor lut[256];
+	unsigned i;
+
+	if (bmp->bpp > 8)
+		return false;
+	if (bmp->numColors > 0)
+	{
+		for (i = 0; i < bmp->numColors; i++)
+			lut[i] = (PalColor)bmp->palette[i];
+		return InitPalExpander(pe, bmp->bpp, lut, bmp->numColors);
+	}
+	for (i = 0; i < (1U << bmp->bpp); i++)
+	{
+		PalColor level = i * 255 / ((1 << bmp->bpp) - 1);
+		lut[i] = (level << 16) | (level << 8) | level;
+	}
+	return InitPalExpander(pe, bmp->bpp, lut, 1 << bmp->bpp);
+}
+
+/* Decodes a whole bitmap to 32-bit colors with the decoder that is
+   specialized for its format.  Returns an MhkError code.  */
+int DecodeBitmapRgb(const MhkBitmap* bmp, PalColor* dst, size_t stride)
+{
+	BmpRgbDecoder decoder = GetBmpRgbDecoder(bmp->format);
+	PalExpander pe;
+	if (decoder == NULL)
+		return MHK_EUNSUPPORTED;
+	InitBmpPalExpander(bmp, &pe);
+	return decoder(bmp, &pe, dst, stride);
+}
+
+/* Decodes the pixel indices with DecodeBitmap(), then converts them
+   one pixel at a time, checking the depth for every pixel.  */
+int DecodeBitmapRgbGeneric(const MhkBitmap* bmp, const PalExpander* pe,
+	PalColor* dst, size_t stride)
+{
+	size_t rowSize = BmpRowSize(bmp);
+	unsigned char* pixels;
+	unsigned x, y;
+	int result;
+
+	pixels = (unsigned char*)malloc(rowSize * bmp->height + 1);
+	if (pixels == NULL)
+		return MHK_ENOMEM;
+	result = DecodeBitmap(bmp, pixels, rowSize);
+	if (result == MHK_OK)
+	{
+		for (y = 0; y < bmp->height; y++)
+		{
+			PalColor* out = DST_ROW(dst, stride, y);
+			for (x = 0; x < bmp->width; x++)
+				out[x] = GenericPixel(bmp, pe, pixels + y * rowSize, x);
+		}
+	}
+	free(pixels);
+	return result;
+}
+
+static void ExpandRaw1(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst)
+{
+	PalColor c0 = pe->lut[0], c1 = pe->lut[1];
+	unsigned x;
+	for (x = 0; x < width; x++)
+		dst[x] = (src[x>>3] & (0x80 >> (x & 7))) ? c1 : c0;
+}
+
+static void ExpandRaw4(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst)
+{
+	const PalColor* lut = pe->lut;
+	unsigned x;
+	for (x = 0; x + 2 <= width; x += 2, src++)
+	{
+		dst[x] = lut[*src >> 4];
+		dst[x+1] = lut[*src & 0xf];
+	}
+	if (x < width)
+		dst[x] = lut[*src >> 4];
+}
+
+static void ExpandRaw8(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst)
+{
+	pe->kernel(pe, src, width, dst);
+}
+
+static void ExpandRaw16(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst)
+{
+	unsigned x;
+	(void)pe;
+	for (x = 0; x < width; x++, src += 2)
+	{
+		unsigned pixel = (src[0] << 8) | src[1];
+		PalColor r = (pixel >> 10) & 0x1f;
+		PalColor g = (pixel >> 5) & 0x1f;
+		PalColor b = pixel & 0x1f;
+		dst[x] = (((r << 3) | (r >> 2)) << 16) |
+			(((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2));
+	}
+}
+
+static void ExpandRaw24(const unsigned char* src, unsigned width,
+	const PalExpander* pe, PalColor* dst)
+{
+	unsigned x;
+	(void)pe;
+	for (x = 0; x < width; x++, src += 3)
+		dst[x] = ((PalColor)src[2] << 16) | ((PalColor)src[1] << 8) | src[0];
+}
+
+/* Gets the input of the secondary layer, unpacking it first if "lz"
+   is set.  "unpacked" receives the buffer to free, if any.  */
+static int GetRowData(const MhkBitmap* bmp, bool lz,
+	const unsigned char** data, size_t* size, unsigned char** unpacked)
+{
+	*unpacked = NULL;
+	if (lz)
+	{
+		int result = UnpackBitmapLz(bmp, unpacked, size);
+		*data = *unpacked;
+		return result;
+	}
+	*data = bmp->data;
+	*size = bmp->dataSize;
+	return MHK_OK;
+}
+
+static PalColor GenericPixel(const MhkBitmap* bmp, const PalExpander* pe,
+	const unsigned char* row, unsigned x)
+{
+	switch (bmp->bpp)
+	{
+	case 1:
+		return pe->lut[(row[x>>3] >> (7 - (x & 7))) & 1];
+	case 4:
+		return pe->lut[(row[x>>1] >> ((x & 1) ? 0 : 4)) & 0xf];
+	case 8:
+		return pe->lut[row[x]];
+	case 16:
+	{
+		PalColor color;
+		ExpandRaw16(row + x * 2, 1, pe, &color);
+		return color;
+	}
+	case 24:
+	{
+		PalColor color;
+		ExpandRaw24(row + x * 3, 1, pe, &color);
+		return color;
+	}
+	}
+	return 0;
+}
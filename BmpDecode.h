@@ -0,0 +1,22 @@
+/* Specialized full-color bitmap decoder interface */
+/* Include "bool.h", "MhkBitmap.h", and "PalExpand.h" before this
+   header.  */
+
+#ifndef BMPDECODE_H
+#define BMPDECODE_H
+
+#include <stddef.h>
+
+/* Decodes a whole bitmap to 32-bit colors.  "pe" supplies the colors
+   of indexed bitmaps and is ignored otherwise.  "stride" is in
+   bytes.  Returns an MhkError code.  */
+typedef int (*BmpRgbDecoder)(const MhkBitmap* bmp, const PalExpander* pe,
+	PalColor* dst, size_t stride);
+
+BmpRgbDecoder GetBmpRgbDecoder(unsigned format);
+bool InitBmpPalExpander(const MhkBitmap* bmp, PalExpander* pe);
+int DecodeBitmapRgb(const MhkBitmap* bmp, PalColor* dst, size_t stride);
+int DecodeBitmapRgbGeneric(const MhkBitmap* bmp, const PalExpander* pe,
+	PalColor* dst, size_t stride);
+
+#endif /* not BMPDECODE_H */
@@ -0,0 +1,167 @@
+/* Bitmap pixel editing */
+/* Holds the decoded pixels of a tBMP resource while they are edited,
+   and remembers which rows were written to.  Saving then re-encodes
+   only those rows when the compression allows it (see
+   SpliceBitmapRows()), so saving after a small edit costs about as
+   much as copying the resource.  Bitmaps with LZ compression are
+   encoded again in full.  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "BmpEdit.h"
+
+struct BmpEdit_t
+{
+	unsigned char* rsrc; /* Last saved resource */
+	size_t size;
+	MhkBitmap bmp; /* Parsed from "rsrc" */
+	unsigned char* pixels;
+	size_t rowSize;
+	unsigned char* dirty; /* Nonzero for rows changed since saving */
+	unsigned numDirty;
+};
+
+/* Decodes a tBMP resource for editing.  The resource data is copied,
+   so it does not have to stay around.  Returns an MhkError code.  */
+int OpenBmpEdit(const unsigned char* rsrc, size_t size, BmpEdit** edit)
+{
+	BmpEdit* ed;
+	int result;
+
+	ed = (BmpEdit*)calloc(1, sizeof(BmpEdit));
+	if (ed == NULL)
+		return MHK_ENOMEM;
+	result = MHK_ENOMEM;
+	ed->rsrc = (unsigned char*)malloc(size + 1);
+	if (ed->rsrc == NULL)
+		goto fail;
+	memcpy(ed->rsrc, rsrc, size);
+	ed->size = size;
+	result = ParseBitmap(ed->rsrc, size, &ed->bmp);
+	if (result != MHK_OK)
+		goto fail;
+	if (!BmpCanEncode(ed->bmp.format))
+	{
+		result = MHK_EUNSUPPORTED;
+		goto fail;
+	}
+	result = MHK_ENOMEM;
+	ed->rowSize = BmpRowSize(&ed->bmp);
+	ed->pixels = (unsigned char*)malloc(ed->rowSize * ed->bmp.height + 1);
+	ed->dirty = (unsigned char*)calloc(ed->bmp.height + 1, 1);
+	if (ed->pixels == NULL || ed->dirty == NULL)
+		goto fail;
+	result = DecodeBitmap(&ed->bmp, ed->pixels, ed->rowSize);
+	if (result != MHK_OK)
+		goto fail;
+	*edit = ed;
+	return MHK_OK;
+
+fail:
+	FreeBmpEdit(ed);
+	return result;
+}
+
+/* Returns the header and palette of the bitmap being edited.  */
+const MhkBitmap* GetBmpEditBitmap(const BmpEdit* edit)
+{
+	return &edit->bmp;
+}
+
+/* Returns the packed pixels of row "y" for reading.  */
+const unsigned char* GetBmpEditRow(const BmpEdit* edit, unsigned y)
+{
+	return edit->pixels + y * edit->rowSize;
+}
+
+/* Returns the packed pixels of row "y" for writing, and marks the row
+   as changed.  */
+unsigned char* EditBmpRow(BmpEdit* edit, unsigned y)
+{
+	if (!edit->dirty[y])
+	{
+		edit->dirty[y] = 1;
+		edit->numDirty++;
+	}
+	return edit->pixels + y * edit->rowSize;
+}
+
+/* Returns the number of rows changed since the bitmap was opened or
+   last saved.  */
+unsigned BmpEditDirtyRows(const BmpEdit* edit)
+{
+	return edit->numDirty;
+}
+
+/* Encodes the edited bitmap into a new resource, which is allocated
+   with malloc() and returned in "out".  "lzChain" is passed on to
+   LzPack() if the bitmap must be encoded in full.  The number of rows
+   that were actually encoded is stored in "rowsEncoded" if it is not
+   NULL.  Returns an MhkError code.  */
+int SaveBmpEdit(BmpEdit* edit, unsigned lzChain, unsigned char** out,
+	size_t* outSize, unsigned* rowsEncoded)
+{
+	unsigned char* res;
+	unsigned char* copy;
+	size_t resSize;
+	unsigned encoded = edit->numDirty;
+	int result;
+
+	if (edit->numDirty == 0)
+	{
+		result = MHK_OK;
+		res = (unsigned char*)malloc(edit->size + 1);
+		if (res == NULL)
+			return MHK_ENOMEM;
+		memcpy(res, edit->rsrc, edit->size);
+		resSize = edit->size;
+	}
+	else
+	{
+		result = SpliceBitmapRows(edit->rsrc, edit->size, edit->pixels,
+			edit->rowSize, edit->dirty, &res, &resSize);
+		if (result == MHK_EUNSUPPORTED)
+		{
+			result = EncodeBitmap(&edit->bmp, edit->pixels, edit->rowSize,
+				lzChain, &res, &resSize);
+			encoded = edit->bmp.height;
+		}
+		if (result != MHK_OK)
+			return result;
+	}
+
+	/* Keep a copy to splice the next edits into.  */
+	copy = (unsigned char*)malloc(resSize + 1);
+	if (copy == NULL)
+	{
+		free(res);
+		return MHK_ENOMEM;
+	}
+	memcpy(copy, res, resSize);
+	free(edit->rsrc);
+	edit->rsrc = copy;
+	edit->size = resSize;
+	ParseBitmap(edit->rsrc, edit->size, &edit->bmp);
+	memset(edit->dirty, 0, edit->bmp.height);
+	edit->numDirty = 0;
+
+	*out = res;
+	*outSize = resSize;
+	if (rowsEncoded != NULL)
+		*rowsEncoded = encoded;
+	return MHK_OK;
+}
+
+void FreeBmpEdit(BmpEdit* edit)
+{
+	if (edit == NULL)
+		return;
+	free(edit->rsrc);
+	free(edit->pixels);
+	free(edit->dirty);
+	free(edit);
+}
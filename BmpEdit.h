@@ -0,0 +1,20 @@
+/* Bitmap pixel editing interface */
+/* Include "bool.h" and "MhkBitmap.h" before this header.  */
+
+#ifndef BMPEDIT_H
+#define BMPEDIT_H
+
+#include <stddef.h>
+
+typedef struct BmpEdit_t BmpEdit;
+
+int OpenBmpEdit(const unsigned char* rsrc, size_t size, BmpEdit** edit);
+const MhkBitmap* GetBmpEditBitmap(const BmpEdit* edit);
+const unsigned char* GetBmpEditRow(const BmpEdit* edit, unsigned y);
+unsigned char* EditBmpRow(BmpEdit* edit, unsigned y);
+unsigned BmpEditDirtyRows(const BmpEdit* edit);
+int SaveBmpEdit(BmpEdit* edit, unsigned lzChain, unsigned char** out,
+	size_t* outSize, unsigned* rowsEncoded);
+void FreeBmpEdit(BmpEdit* edit);
+
+#endif /* not BMPEDIT_H */
@@ -0,0 +1,270 @@
+/* Bitmap import */
+/* Turns full-color artwork into 8-bit tBMP resources.  Each image is
+   either quantized to its own inline palette (see Quantize.c), or a
+   whole batch shares one palette that goes into a separate tPAL
+   resource, as the games do for sets of related bitmaps.  The
+   compression is chosen automatically like the "Optimize Bitmap
+   Compression" command does.
+
+   Batches are processed on a work pool in two passes over the files,
+   so that only a few images are in memory at any time:
+
+   1. Every worker counts the colors of its share of the files into
+      its own histogram, and the histograms are merged.  This pass is
+      skipped without a shared palette.
+   2. Every file is loaded again, remapped (or quantized by itself),
+      and encoded as a separate work item.  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "WorkPool.h"
+#include "BmpOptimize.h"
+#include "PalExpand.h"
+#include "Quantize.h"
+#include "ImageFile.h"
+#include "BmpImport.h"
+
+typedef struct HistJob_t HistJob;
+typedef struct EncodeFileJob_t EncodeFileJob;
+
+struct HistJob_t
+{
+	ImportFile* files;
+	unsigned numFiles;
+	unsigned first; /* Files "first", "first" + "step", and so on */
+	unsigned step;
+	ColorHist* hist;
+};
+
+struct EncodeFileJob_t
+{
+	ImportFile* file;
+	const ImportOptions* opts;
+	const ColorMap* map; /* Shared palette, or NULL */
+	const unsigned long* palette;
+};
+
+static void CountFileColors(void* arg);
+static void EncodeFile(void* arg);
+
+void InitImportOptions(ImportOptions* opts)
+{
+	InitQuantOptions(&opts->quant);
+	InitAutoCmpOptions(&opts->cmp);
+	opts->sharedPalette = false;
+}
+
+/* Quantizes an image and encodes it as a tBMP resource.  "stride" is
+   in bytes.  On success, "*out" must be freed by the caller.  Returns
+   an MhkError code.  */
+int ImportBitmap(const PalColor* pixels, unsigned width, unsigned height,
+	size_t stride, const ImportOptions* opts, WorkPool* pool,
+	unsigned char** out, size_t* outSize)
+{
+	unsigned long palette[256];
+	unsigned numColors;
+	unsigned char* indices;
+	int error;
+
+	/* Fail before doing any work on images that cannot be stored.  The
+	   result has 8 bits per pixel, so the width is the row size before
+	   padding.  */
+	if (width > BMP_MAX_ROW_SIZE || height > BMP_MAX_DIM)
+		return MHK_EUNSUPPORTED;
+	indices = (unsigned char*)malloc((size_t)width * height + 1);
+	if (indices == NULL)
+		return MHK_ENOMEM;
+	error = QuantizeImage(pixels, width, height, stride, &opts->quant,
+						  palette, &numColors, indices, width);
+	if (error == MHK_OK)
+		error = EncodeIndexedBitmap(indices, width, height, palette,
+			numColors, &opts->cmp, pool, out, outSize);
+	free(indices);
+	return error;
+}
+
+/* Imports a batch of BMP files.  With a shared palette, the palette is
+   returned in "palette" and "numColors", and the bitmaps do not have
+   an inline palette; otherwise "*numColors" is set to zero.  The
+   results are stored in "files"; the caller frees their data, also on
+   failure.  Returns MHK_OK if every file was imported, or else the
+   first error.  */
+int ImportBitmapFiles(ImportFile* files, unsigned numFiles,
+	const ImportOptions* opts, WorkPool* pool, unsigned long* palette,
+	unsigned* numColors)
+{
+	ColorMap map;
+	EncodeFileJob* jobs;
+	unsigned i;
+	int error = MHK_OK;
+
+	*numColors = 0;
+	for (i = 0; i < numFiles; i++)
+	{
+		files[i].data = NULL;
+		files[i].size = 0;
+		files[i].error = MHK_OK;
+	}
+
+	if (opts->sharedPalette)
+	{
+		unsigned numJobs = WorkPoolSize(pool);
+		HistJob* histJobs;
+		if (numJobs > numFiles)
+			numJobs = numFiles;
+		if (numJobs == 0)
+			numJobs = 1;
+		histJobs = (HistJob*)calloc(numJobs, sizeof(HistJob));
+		if (histJobs == NULL)
+			return MHK_ENOMEM;
+		for (i = 0; i < numJobs; i++)
+		{
+			histJobs[i].files = files;
+			histJobs[i].numFiles = numFiles;
+			histJobs[i].first = i;
+			histJobs[i].step = numJobs;
+			histJobs[i].hist = CreateColorHist();
+			if (histJobs[i].hist == NULL)
+				error = MHK_ENOMEM;
+		}
+		if (error == MHK_OK)
+		{
+			for (i = 0; i < numJobs; i++)
+				SubmitWork(pool, CountFileColors, &histJobs[i]);
+			WaitWorkPool(pool);
+			for (i = 1; i < numJobs; i++)
+				MergeColorHist(histJobs[0].hist, histJobs[i].hist);
+			for (i = 0; i < numFiles && error == MHK_OK; i++)
+				error = files[i].error;
+		}
+		if (error == MHK_OK)
+			error = BuildHistPalette(histJobs[0].hist,
+				opts->quant.maxColors, palette, numColors);
+		for (i = 0; i < numJobs; i++)
+			FreeColorHist(histJobs[i].hist);
+		free(histJobs);
+		if (error != MHK_OK)
+			return error;
+		InitColorMap(&map, palette, *numColors);
+	}
+
+	jobs = (EncodeFileJob*)malloc((numFiles + 1) * sizeof(EncodeFileJob));
+	if (jobs == NULL)
+		return MHK_ENOMEM;
+	for (i = 0; i < numFiles; i++)
+	{
+		jobs[i].file = &files[i];
+		jobs[i].opts = opts;
+		jobs[i].map = opts->sharedPalette ? &map : NULL;
+		jobs[i].palette = palette;
+		SubmitWork(pool, EncodeFile, &jobs[i]);
+	}
+	WaitWorkPool(pool);
+	free(jobs);
+	for (i = 0; i < numFiles && error == MHK_OK; i++)
+		error = files[i].error;
+	return error;
+}
+
+/* Encodes one byte per pixel palette indices as an 8-bit tBMP
+   resource with the best compression.  The palette is stored inline
+   unless "numColors" is zero.  Returns an MhkError code.  */
+int EncodeIndexedBitmap(const unsigned char* indices, unsigned width,
+	unsigned height, const unsigned long* palette, unsigned numColors,
+	const AutoCmpOptions* opts, WorkPool* pool, unsigned char** out,
+	size_t* outSize)
+{
+	MhkBitmap bmp;
+	AutoCmpResult result;
+	int error;
+
+	memset(&bmp, 0, sizeof(MhkBitmap));
+	bmp.width = width;
+	bmp.height = height;
+	bmp.format = BMP_BPP8;
+	bmp.bpp = 8;
+	bmp.rgbBits = 8;
+	if (numColors > 0)
+	{
+		bmp.format |= BMP_HAS_CLUT;
+		bmp.numColors = numColors;
+		memcpy(bmp.palette, palette, numColors * sizeof(unsigned long));
+	}
+	error = AutoCompressBitmap(&bmp, indices, width, opts, pool, &result);
+	if (error == MHK_OK)
+	{
+		*out = result.cands[result.best].data;
+		*outSize = result.cands[result.best].size;
+		result.cands[result.best].data = NULL;
+	}
+	FreeAutoCmpResult(&result);
+	return error;
+}
+
+static void CountFileColors(void* arg)
+{
+	HistJob* job = (HistJob*)arg;
+	unsigned i;
+	for (i = job->first; i < job->numFiles; i += job->step)
+	{
+		ImportFile* file = &job->files[i];
+		PalColor* pixels;
+		file->error = LoadBmpFile(file->fileName, &pixels, &file->width,
+								  &file->height);
+		if (file->error != MHK_OK)
+			continue;
+		AddColorHist(job->hist, pixels, file->width, file->height,
+					 file->width * sizeof(PalColor));
+		free(pixels);
+	}
+}
+
+static void EncodeFile(void* arg)
+{
+	EncodeFileJob* job = (EncodeFileJob*)arg;
+	ImportFile* file = job->file;
+	PalColor* pixels;
+	unsigned char* indices;
+	size_t stride;
+
+	file->error = LoadBmpFile(file->fileName, &pixels, &file->width,
+							  &file->height);
+	if (file->error != MHK_OK)
+		return;
+	stride = file->width * sizeof(PalColor);
+	if (job->map == NULL)
+	{
+		/* The pool is busy with the other files, so encode the
+		   compression candidates right here.  */
+		file->error = ImportBitmap(pixels, file->width, file->height,
+			stride, job->opts, NULL, &file->data, &file->size);
+		free(pixels);
+		return;
+	}
+
+	if (file->width > BMP_MAX_ROW_SIZE || file->height > BMP_MAX_DIM)
+		file->error = MHK_EUNSUPPORTED;
+	else
+	{
+		indices = (unsigned char*)malloc(
+			(size_t)file->width * file->height + 1);
+		if (indices == NULL)
+			file->error = MHK_ENOMEM;
+		else
+		{
+			file->error = RemapImage(job->map, pixels, file->width,
+				file->height, stride, job->opts->quant.dither, indices,
+				file->width);
+			if (file->error == MHK_OK)
+				file->error = EncodeIndexedBitmap(indices, file->width,
+					file->height, job->palette, 0, &job->opts->cmp, NULL,
+					&file->data, &file->size);
+			free(indices);
+		}
+	}
+	free(pixels);
+}
@@ -0,0 +1,44 @@
+/* Bitmap import interface */
+/* Include "bool.h", "MhkBitmap.h", "WorkPool.h", "BmpOptimize.h",
+   "PalExpand.h", and "Quantize.h" before this header.  */
+
+#ifndef BMPIMPORT_H
+#define BMPIMPORT_H
+
+#include <stddef.h>
+
+typedef struct ImportOptions_t ImportOptions;
+typedef struct ImportFile_t ImportFile;
+
+struct ImportOptions_t
+{
+	QuantOptions quant;
+	AutoCmpOptions cmp;
+	bool sharedPalette; /* One palette for all files of a batch */
+};
+
+/* One image of a batch import.  Only "fileName" is set by the
+   caller.  */
+struct ImportFile_t
+{
+	const char* fileName;
+	unsigned width;
+	unsigned height;
+	unsigned char* data; /* Encoded tBMP resource, or NULL */
+	size_t size;
+	int error;
+};
+
+void InitImportOptions(ImportOptions* opts);
+int ImportBitmap(const PalColor* pixels, unsigned width, unsigned height,
+	size_t stride, const ImportOptions* opts, WorkPool* pool,
+	unsigned char** out, size_t* outSize);
+int ImportBitmapFiles(ImportFile* files, unsigned numFiles,
+	const ImportOptions* opts, WorkPool* pool, unsigned long* palette,
+	unsigned* numColors);
+int EncodeIndexedBitmap(const unsigned char* indices, unsigned width,
+	unsigned height, const unsigned long* palette, unsigned numColors,
+	const AutoCmpOptions* opts, WorkPool* pool, unsigned char** out,
+	size_t* outSize);
+
+#endif /* not BMPIMPORT_H */
@@ -0,0 +1,384 @@
+/* Automatic bitmap compression selection */
+
+/* Rather than making the user pick the primary and secondary
+   compression by hand, every combination that we can encode for the
+   bitmap's depth is tried and the best one is kept.  "Best" either
+   means the smallest output, or the cheapest to decode among the
+   outputs that are within a tolerance of the smallest.  The same
+   selection can be run over every bitmap of an archive at once.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "WorkPool.h"
+#include "BmpOptimize.h"
+
+typedef struct EncodeJob_t EncodeJob;
+typedef struct RecompressJob_t RecompressJob;
+
+struct EncodeJob_t
+{
+	const MhkBitmap* bmp;
+	const unsigned char* pixels;
+	size_t stride;
+	unsigned lzChain;
+	AutoCmpCandidate* cand;
+};
+
+struct RecompressJob_t
+{
+	MhkFile* file;
+	const AutoCmpOptions* opts;
+	int error;
+	unsigned oldFormat;
+	unsigned newFormat;
+	unsigned char* newData; /* NULL if the old data is kept */
+	size_t newSize;
+};
+
+static void EncodeCandidate(void* arg);
+static void RecompressBitmap(void* arg);
+
+static const char* cmpNames[16] =
+{
+	"None", "RLE8", "MSRLE8", "RLE Unknown",
+	"LZ", "LZ + RLE8", "LZ + MSRLE8", "LZ + RLE Unknown",
+	"LZ Unknown", "LZ Unknown + RLE8", "LZ Unknown + MSRLE8",
+	"LZ Unknown + RLE Unknown",
+	"Riven", "Riven + RLE8", "Riven + MSRLE8", "Riven + RLE Unknown"
+};
+
+void InitAutoCmpOptions(AutoCmpOptions* opts)
+{
+	opts->policy = AUTOCMP_SMALLEST;
+	opts->tolerance = 5;
+	opts->lzChain = 256;
+}
+
+/* Returns a relative cost of decoding a bitmap with the given
+   compression.  Each layer adds a pass over the data, and LZ is
+   costlier per byte than RLE8.  */
+unsigned BmpDecodeCost(unsigned format)
+{
+	unsigned cost = 1;
+	if ((format & BMP_1ST_MASK) != BMP_1ST_NONE)
+		cost += 2;
+	if ((format & BMP_2ND_MASK) != BMP_2ND_NONE)
+		cost += 1;
+	return cost;
+}
+
+/* Maps the compression bits of a format word to an index from 0 to
+   15.  */
+unsigned BmpCmpIndex(unsigned format)
+{
+	unsigned primary;
+	switch (format & BMP_1ST_MASK)
+	{
+	case BMP_1ST_NONE: primary = 0; break;
+	case BMP_1ST_LZ: primary = 1; break;
+	case BMP_1ST_LZU: primary = 2; break;
+	default: primary = 3; break;
+	}
+	return primary * 4 + ((format & BMP_2ND_MASK) >> 4) % 4;
+}
+
+const char* BmpCmpName(unsigned format)
+{
+	return cmpNames[BmpCmpIndex(format)];
+}
+
+/* Encodes the given pixels with every compression that is valid for
+   the bitmap's depth, keeping the rest of the format word.  If "pool"
+   is not NULL, the candidates are encoded in parallel; the pool must
+   not be in use by anything else, since this waits for it to go idle.
+   On return, "result->best" is the candidate chosen by "opts".  Free
+   the result with FreeAutoCmpResult().  Returns an MhkError code,
+   which is only an error if no candidate could be encoded.  */
+int AutoCompressBitmap(const MhkBitmap* bmp, const unsigned char* pixels,
+	size_t stride, const AutoCmpOptions* opts, WorkPool* pool,
+	AutoCmpResult* result)
+{
+	static const unsigned primaries[2] = { BMP_1ST_NONE, BMP_1ST_LZ };
+	static const unsigned secondaries[2] = { BMP_2ND_NONE, BMP_2ND_RLE8 };
+	EncodeJob jobs[AUTOCMP_MAX_CANDS];
+	unsigned baseFormat = bmp->format & ~(BMP_1ST_MASK | BMP_2ND_MASK);
+	unsigned numSecondaries = (bmp->bpp == 8) ? 2 : 1;
+	unsigned i, j;
+
+	memset(result, 0, sizeof(AutoCmpResult));
+	for (i = 0; i < 2; i++)
+	{
+		for (j = 0; j < numSecondaries; j++)
+		{
+			AutoCmpCandidate* cand = &result->cands[result->numCands];
+			EncodeJob* job = &jobs[result->numCands];
+			cand->format = baseFormat | primaries[i] | secondaries[j];
+			cand->error = MHK_OK;
+			job->bmp = bmp;
+			job->pixels = pixels;
+			job->stride = stride;
+			job->lzChain = opts->lzChain;
+			job->cand = cand;
+			result->numCands++;
+		}
+	}
+
+	for (i = 0; i < result->numCands; i++)
+		SubmitWork(pool, EncodeCandidate, &jobs[i]);
+	WaitWorkPool(pool);
+
+	result->best = PickAutoCmpCandidate(result, opts, 0, 0);
+	if (result->best < 0)
+		return result->cands[0].error;
+	return MHK_OK;
+}
+
+/* Chooses among the encoded candidates according to "opts".  If
+   "oldSize" is not zero, the existing encoding with "oldFormat" takes
+   part in the choice and wins ties, so that nothing is rewritten
+   without a gain.  Returns the index of the chosen candidate, or -1
+   if the existing encoding should be kept (or nothing was
+   encoded).  */
+int PickAutoCmpCandidate(const AutoCmpResult* result,
+	const AutoCmpOptions* opts, unsigned oldFormat, size_t oldSize)
+{
+	size_t smallest = oldSize;
+	size_t limit;
+	int best = -1;
+	bool haveBest;
+	size_t bestSize = oldSize;
+	unsigned bestCost = BmpDecodeCost(oldFormat);
+	unsigned i;
+
+	for (i = 0; i < result->numCands; i++)
+	{
+		const AutoCmpCandidate* cand = &result->cands[i];
+		if (cand->error == MHK_OK && (smallest == 0 || cand->size < smallest))
+			smallest = cand->size;
+	}
+	if (opts->policy == AUTOCMP_FASTEST)
+		limit = smallest + smallest / 100 * opts->tolerance +
+			smallest % 100 * opts->tolerance / 100;
+	else
+		limit = smallest;
+
+	/* The existing encoding may be disqualified by the limit.  */
+	haveBest = oldSize != 0 && oldSize <= limit;
+
+	for (i = 0; i < result->numCands; i++)
+	{
+		const AutoCmpCandidate* cand = &result->cands[i];
+		unsigned cost = BmpDecodeCost(cand->format);
+		bool better;
+		if (cand->error != MHK_OK || cand->size > limit)
+			continue;
+		if (!haveBest)
+			better = true;
+		else if (opts->policy == AUTOCMP_FASTEST)
+			better = cost < bestCost ||
+				(cost == bestCost && cand->size < bestSize);
+		else
+			better = cand->size < bestSize ||
+				(cand->size == bestSize && cost < bestCost);
+		if (better)
+		{
+			best = i;
+			haveBest = true;
+			bestSize = cand->size;
+			bestCost = cost;
+		}
+	}
+	return best;
+}
+
+void FreeAutoCmpResult(AutoCmpResult* result)
+{
+	unsigned i;
+	for (i = 0; i < result->numCands; i++)
+	{
+		free(result->cands[i].data);
+		result->cands[i].data = NULL;
+	}
+}
+
+/* Runs the automatic compression selection over every tBMP of the
+   archive and replaces the data of the bitmaps that improve.  The
+   bitmaps are processed in parallel on "pool", which may be NULL.
+   Bitmaps that cannot be decoded are left alone.  Returns an MhkError
+   code.  */
+int RecompressArchiveBitmaps(MhkArchive* archive,
+	const AutoCmpOptions* opts, WorkPool* pool, RecompressReport* report)
+{
+	RecompressJob* jobs;
+	bool* seen;
+	unsigned numJobs = 0;
+	unsigned i;
+
+	memset(report, 0, sizeof(RecompressReport));
+	jobs = (RecompressJob*)calloc(archive->numFiles + 1,
+								  sizeof(RecompressJob));
+	seen = (bool*)calloc(archive->numFiles + 1, sizeof(bool));
+	if (jobs == NULL || seen == NULL)
+	{
+		free(jobs);
+		free(seen);
+		return MHK_ENOMEM;
+	}
+
+	/* Files can be shared by several resources, so only queue each
+	   file once.  */
+	for (i = 0; i < archive->numResources; i++)
+	{
+		MhkResource* rsrc = &archive->resources[i];
+		if (rsrc->type != MHK_TBMP || seen[rsrc->file])
+			continue;
+		seen[rsrc->file] = true;
+		jobs[numJobs].file = &archive->files[rsrc->file];
+		jobs[numJobs].opts = opts;
+		numJobs++;
+	}
+	for (i = 0; i < numJobs; i++)
+		SubmitWork(pool, RecompressBitmap, &jobs[i]);
+	WaitWorkPool(pool);
+
+	for (i = 0; i < numJobs; i++)
+	{
+		RecompressJob* job = &jobs[i];
+		BmpCmpStats* stats;
+		unsigned long oldSize = job->file->size;
+
+		report->numBitmaps++;
+		if (job->error != MHK_OK)
+		{
+			report->numSkipped++;
+			continue;
+		}
+		report->oldBytes += oldSize;
+		if (job->newData != NULL)
+		{
+			ReplaceMhkFileData(job->file, job->newData, job->newSize);
+			report->numChanged++;
+		}
+		else
+			job->newFormat = job->oldFormat;
+		report->newBytes += job->file->size;
+		stats = &report->byType[BmpCmpIndex(job->newFormat)];
+		stats->count++;
+		stats->oldBytes += oldSize;
+		stats->newBytes += job->file->size;
+	}
+
+	free(jobs);
+	free(seen);
+	return MHK_OK;
+}
+
+/* Writes a human-readable summary of the report into "buf", which
+   is always zero-terminated.  Returns the length of the text.  */
+size_t FormatRecompressReport(const RecompressReport* report,
+	char* buf, size_t bufSize)
+{
+	char line[128];
+	size_t len = 0;
+	unsigned i;
+
+	if (bufSize == 0)
+		return 0;
+	buf[0] = '\0';
+	for (i = 0; i < 18; i++)
+	{
+		size_t lineLen;
+		if (i == 0)
+			sprintf(line, "%u bitmaps, %u recompressed, %u skipped\n",
+					report->numBitmaps, report->numChanged,
+					report->numSkipped);
+		else if (i <= 16)
+		{
+			const BmpCmpStats* stats = &report->byType[i-1];
+			if (stats->count == 0)
+				continue;
+			sprintf(line, "%-24s %6u  %10lu -> %10lu  (%ld saved)\n",
+					cmpNames[i-1], stats->count, stats->oldBytes,
+					stats->newBytes,
+					(long)stats->oldBytes - (long)stats->newBytes);
+		}
+		else
+			sprintf(line, "%-24s %6u  %10lu -> %10lu  (%ld saved)\n",
+					"Total", report->numBitmaps - report->numSkipped,
+					report->oldBytes, report->newBytes,
+					(long)report->oldBytes - (long)report->newBytes);
+		lineLen = strlen(line);
+		if (len + lineLen >= bufSize)
+			break;
+		memcpy(buf + len, line, lineLen + 1);
+		len += lineLen;
+	}
+	return len;
+}
+
+static void EncodeCandidate(void* arg)
+{
+	EncodeJob* job = (EncodeJob*)arg;
+	MhkBitmap bmp = *job->bmp;
+	bmp.format = job->cand->format;
+	job->cand->error = EncodeBitmap(&bmp, job->pixels, job->stride,
+		job->lzChain, &job->cand->data, &job->cand->size);
+}
+
+static void RecompressBitmap(void* arg)
+{
+	RecompressJob* job = (RecompressJob*)arg;
+	MhkBitmap bmp;
+	unsigned char* pixels;
+	size_t rowSize;
+	AutoCmpResult result;
+	int best;
+
+	job->error = ParseBitmap(job->file->data, job->file->size, &bmp);
+	if (job->error != MHK_OK)
+		return;
+	job->oldFormat = bmp.format;
+	if (!BmpCanDecode(bmp.format))
+	{
+		job->error = MHK_EUNSUPPORTED;
+		return;
+	}
+
+	rowSize = BmpRowSize(&bmp);
+	pixels = (unsigned char*)malloc(rowSize * bmp.height + 1);
+	if (pixels == NULL)
+	{
+		job->error = MHK_ENOMEM;
+		return;
+	}
+	job->error = DecodeBitmap(&bmp, pixels, rowSize);
+	if (job->error != MHK_OK)
+	{
+		free(pixels);
+		return;
+	}
+	job->error = AutoCompressBitmap(&bmp, pixels, rowSize, job->opts,
+									NULL, &result);
+	free(pixels);
+	if (job->error != MHK_OK)
+	{
+		FreeAutoCmpResult(&result);
+		return;
+	}
+
+	best = PickAutoCmpCandidate(&result, job->opts, bmp.format,
+								job->file->size);
+	if (best >= 0)
+	{
+		job->newFormat = result.cands[best].format;
+		job->newData = result.cands[best].data;
+		job->newSize = result.cands[best].size;
+		result.cands[best].data = NULL;
+	}
+	FreeAutoCmpResult(&result);
+}
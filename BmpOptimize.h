@@ -0,0 +1,84 @@
+/* Automatic bitmap compression selection interface */
+/* Include "bool.h", "MhkArchive.h", "MhkBitmap.h", and "WorkPool.h"
+   before this header.  */
+
+#ifndef BMPOPTIMIZE_H
+#define BMPOPTIMIZE_H
+
+#include <stddef.h>
+
+enum AutoCmpPolicy
+{
+	AUTOCMP_SMALLEST, /* Keep the smallest output */
+	AUTOCMP_FASTEST /* Keep the fastest to decode within the tolerance */
+};
+
+/* There are at most two secondary times two primary compressions
+   that we can encode.  */
+#define AUTOCMP_MAX_CANDS 4
+
+typedef struct AutoCmpOptions_t AutoCmpOptions;
+typedef struct AutoCmpCandidate_t AutoCmpCandidate;
+typedef struct AutoCmpResult_t AutoCmpResult;
+typedef struct BmpCmpStats_t BmpCmpStats;
+typedef struct RecompressReport_t RecompressReport;
+
+struct AutoCmpOptions_t
+{
+	int policy; /* See AutoCmpPolicy */
+	unsigned tolerance; /* Percent larger than the smallest output that
+						   AUTOCMP_FASTEST may accept */
+	unsigned lzChain; /* Match search effort, see LzPack() */
+};
+
+struct AutoCmpCandidate_t
+{
+	unsigned format; /* Full format word */
+	unsigned char* data; /* Encoded resource */
+	size_t size;
+	int error;
+};
+
+struct AutoCmpResult_t
+{
+	unsigned numCands;
+	AutoCmpCandidate cands[AUTOCMP_MAX_CANDS];
+	int best; /* Index of the chosen candidate, or -1 */
+};
+
+/* Totals for the bitmaps that ended up with one compression type.  */
+struct BmpCmpStats_t
+{
+	unsigned count;
+	unsigned long oldBytes;
+	unsigned long newBytes;
+};
+
+struct RecompressReport_t
+{
+	unsigned numBitmaps;
+	unsigned numChanged;
+	unsigned numSkipped; /* Undecodable or corrupt */
+	unsigned long oldBytes;
+	unsigned long newBytes;
+	/* Indexed by the primary and secondary compression, see
+	   BmpCmpIndex().  */
+	BmpCmpStats byType[16];
+};
+
+void InitAutoCmpOptions(AutoCmpOptions* opts);
+unsigned BmpDecodeCost(unsigned format);
+unsigned BmpCmpIndex(unsigned format);
+const char* BmpCmpName(unsigned format);
+int AutoCompressBitmap(const MhkBitmap* bmp, const unsigned char* pixels,
+	size_t stride, const AutoCmpOptions* opts, WorkPool* pool,
+	AutoCmpResult* result);
+int PickAutoCmpCandidate(const AutoCmpResult* result,
+	const AutoCmpOptions* opts, unsigned oldFormat, size_t oldSize);
+void FreeAutoCmpResult(AutoCmpResult* result);
+int RecompressArchiveBitmaps(MhkArchive* archive,
+	const AutoCmpOptions* opts, WorkPool* pool, RecompressReport* report);
+size_t FormatRecompressReport(const RecompressReport* report,
+	char* buf, size_t bufSize);
+
+#endif /* not BMPOPTIMIZE_H */
@@ -0,0 +1,809 @@
+/* Survey of the unknown bitmap compressions */
+
+/* The bitmap parameters dialog lists an unknown RLE variant
+   (BMP_2ND_RLEU) and an unknown LZ variant (BMP_1ST_LZU) that nothing
+   decodes yet.  The survey collects what can be learned from the data
+   of every such bitmap without knowing the format: byte frequencies,
+   runs of equal bytes, whether the rows carry u16 byte counts like
+   RLE8, and which header words hold the unpacked or packed size.
+
+   It also runs every bitmap through a set of candidate decoders,
+   which are small variations on RLE8 and on the Mohawk LZ format and
+   its LZSS relatives.  A candidate "fits" a bitmap when it consumes
+   all of the data (give or take a padding byte) and produces exactly
+   the rows that the header promises.  A candidate that fits every
+   bitmap of a kind is a good guess for the real format, and one that
+   fits none of them can be crossed off.
+
+   The bitmaps are independent, so every one of them is a separate job
+   for the work pool, with its own totals that are merged at the
+   end.  */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "WorkPool.h"
+#include "BmpSurvey.h"
+
+/* How the code bytes of a run-length candidate are read */
+enum RleCodes
+{
+	RLE_MOHAWK, /* High bit: run of (code & 0x7f) + 1, else literals */
+	RLE_INVERTED, /* High bit: literals, else a run */
+	RLE_PACKBITS, /* 0-127: code + 1 literals, 129-255: run of 257 - code */
+	RLE_PAIRS /* Always a run of code + 1 */
+};
+
+typedef struct RleCandidate_t RleCandidate;
+typedef struct LzCandidate_t LzCandidate;
+typedef struct SurveyJob_t SurveyJob;
+
+struct RleCandidate_t
+{
+	const char* name;
+	int codes; /* See RleCodes */
+	bool rowCounts; /* Does every row start with a u16 byte count? */
+};
+
+/* An LZSS layout with eight flags to a flag byte, least significant
+   bit first, and matches of at least three bytes in a 16-bit word.
+   The low "posBits" bits of the word hold the match position and the
+   rest hold the length minus three.  The position is either a
+   distance back from the output position, minus one, or a ring buffer
+   position minus "bias" like in MhkLz.c.  */
+struct LzCandidate_t
+{
+	const char* name;
+	unsigned header; /* Size of the header, which starts with the u32
+						unpacked size */
+	unsigned posBits;
+	unsigned bias;
+	bool relative;
+	bool littleEndian; /* Byte order of the match words */
+	bool clearLiteral; /* Does a clear flag bit mean a literal? */
+};
+
+struct SurveyJob_t
+{
+	const MhkFile* file;
+	const char* archive;
+	unsigned short id;
+	int match;
+	SurveyStats stats;
+};
+
+#define LZ_MIN_LENGTH 3
+
+static const char* const kindNames[SURVEY_NUM_KINDS] =
+	{ "RLE Unknown", "LZ Unknown" };
+
+static const RleCandidate rleCands[] =
+{
+	{ "rle8", RLE_MOHAWK, true },
+	{ "rle8-flat", RLE_MOHAWK, false },
+	{ "inverted", RLE_INVERTED, true },
+	{ "inverted-flat", RLE_INVERTED, false },
+	{ "packbits", RLE_PACKBITS, true },
+	{ "packbits-flat", RLE_PACKBITS, false },
+	{ "pairs", RLE_PAIRS, true },
+	{ "pairs-flat", RLE_PAIRS, false }
+};
+#define NUM_RLE_CANDS (sizeof(rleCands) / sizeof(RleCandidate))
+
+static const LzCandidate lzCands[] =
+{
+	{ "lz", 10, 10, 66, false, false, false },
+	{ "lz-bare", 0, 10, 66, false, false, false },
+	{ "lz-le", 10, 10, 66, false, true, false },
+	{ "lz-clear", 10, 10, 66, false, false, true },
+	{ "lz-dist", 10, 10, 0, true, false, false },
+	{ "lzss4k", 10, 12, 18, false, false, false },
+	{ "lzss4k-dist", 10, 12, 0, true, false, false },
+	{ "lzss4k-bare", 0, 12, 18, false, true, false }
+};
+#define NUM_LZ_CANDS (sizeof(lzCands) / sizeof(LzCandidate))
+
+static const char* const runNames[SURVEY_RUN_BUCKETS] =
+{
+	"1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65-128", "129-256",
+	"257+"
+};
+
+static void SurveyJobFunc(void* arg);
+static void CountBytes(const unsigned char* data, size_t size,
+	SurveyStats* stats);
+static void CountHeaderWords(const MhkBitmap* bmp, SurveyStats* stats);
+static void CountRowStarts(const unsigned char* data, size_t size,
+	unsigned height, SurveyStats* stats);
+static const unsigned char* ExpandRle(int codes, const unsigned char* src,
+	const unsigned char* srcEnd, unsigned char* dst, size_t dstSize);
+static bool TryRle(const RleCandidate* cand, const unsigned char* src,
+	size_t size, size_t rowSize, unsigned height, unsigned char* dst);
+static bool FitRle(const RleCandidate* cand, const MhkBitmap* bmp,
+	const unsigned char* src, size_t size, unsigned char* scratch);
+static bool ExpandLz(const LzCandidate* cand, const unsigned char* src,
+	size_t srcSize, unsigned char* dst, size_t dstCap, size_t* outSize,
+	size_t* srcUsed);
+static bool FitLz(const LzCandidate* cand, const MhkBitmap* bmp,
+	size_t bound, unsigned char* unpacked, unsigned char* scratch);
+static size_t UnpackedBound(const MhkBitmap* bmp);
+static size_t AppendLine(char* buf, size_t bufSize, size_t len,
+	const char* line);
+static size_t AppendTopBytes(char* buf, size_t bufSize, size_t len,
+	const char* title, const unsigned long* freq);
+
+/* Returns the SurveyKind of a bitmap with the given format word, or -1
+   if it has no unknown compression to survey.  An unknown RLE layer
+   under Riven compression cannot be reached, so it is left out.  */
+int SurveyBitmapKind(unsigned format)
+{
+	unsigned primary = format & BMP_1ST_MASK;
+	if (primary == BMP_1ST_LZU)
+		return SURVEY_LZU;
+	if ((format & BMP_2ND_MASK) == BMP_2ND_RLEU &&
+		(primary == BMP_1ST_NONE || primary == BMP_1ST_LZ))
+		return SURVEY_RLEU;
+	return -1;
+}
+
+unsigned SurveyCandCount(int kind)
+{
+	return kind == SURVEY_RLEU ? NUM_RLE_CANDS : NUM_LZ_CANDS;
+}
+
+const char* SurveyCandName(int kind, unsigned cand)
+{
+	return kind == SURVEY_RLEU ? rleCands[cand].name : lzCands[cand].name;
+}
+
+void InitSurveyStats(SurveyStats* stats, int kind)
+{
+	memset(stats, 0, sizeof(SurveyStats));
+	stats->kind = kind;
+}
+
+/* Adds a bitmap of kind "stats->kind" to the totals and tries every
+   candidate decoder on it.  The first candidate that fit is stored in
+   "match", or -1 if none did.  Returns an MhkError code, and a bitmap
+   that could not be surveyed is counted as corrupt.  */
+int SurveyBitmap(const MhkBitmap* bmp, SurveyStats* stats, int* match)
+{
+	const unsigned char* data = bmp->data;
+	size_t dataSize = bmp->dataSize;
+	unsigned char* unpacked = NULL;
+	unsigned char* scratch = NULL;
+	unsigned char* output = NULL;
+	size_t bound = UnpackedBound(bmp);
+	size_t rowSize = BmpRowSize(bmp);
+	unsigned i;
+	int error = MHK_OK;
+
+	*match = -1;
+	stats->numBitmaps++;
+	if (SurveyBitmapKind(bmp->format) != stats->kind)
+	{
+		stats->numCorrupt++;
+		return MHK_EUNSUPPORTED;
+	}
+	if (stats->kind == SURVEY_RLEU &&
+		(bmp->format & BMP_1ST_MASK) == BMP_1ST_LZ)
+	{
+		error = UnpackBitmapLz(bmp, &unpacked, &dataSize);
+		if (error != MHK_OK)
+		{
+			stats->numCorrupt++;
+			return error;
+		}
+		data = unpacked;
+	}
+
+	/* The candidates may decode rows of either the packed row size or
+	   the header's row size.  */
+	if (rowSize < bmp->bytesPerRow)
+		rowSize = bmp->bytesPerRow;
+	scratch = (unsigned char*)malloc(rowSize * bmp->height + 1);
+	if (stats->kind == SURVEY_LZU)
+		output = (unsigned char*)malloc(bound);
+	if (scratch == NULL || (stats->kind == SURVEY_LZU && output == NULL))
+	{
+		free(unpacked);
+		free(scratch);
+		free(output);
+		stats->numCorrupt++;
+		return MHK_ENOMEM;
+	}
+
+	stats->numBytes += dataSize;
+	CountBytes(data, dataSize, stats);
+	CountRowStarts(data, dataSize, bmp->height, stats);
+	if (stats->kind == SURVEY_LZU)
+	{
+		CountHeaderWords(bmp, stats);
+		for (i = 0; i < NUM_LZ_CANDS; i++)
+		{
+			if (!FitLz(&lzCands[i], bmp, bound, output, scratch))
+				continue;
+			stats->candFits[i]++;
+			if (*match < 0)
+				*match = (int)i;
+		}
+	}
+	else
+	{
+		for (i = 0; i < NUM_RLE_CANDS; i++)
+		{
+			if (!FitRle(&rleCands[i], bmp, data, dataSize, scratch))
+				continue;
+			stats->candFits[i]++;
+			if (*match < 0)
+				*match = (int)i;
+		}
+	}
+
+	free(unpacked);
+	free(scratch);
+	free(output);
+	return MHK_OK;
+}
+
+/* Adds the totals of "src" to "dst", which must be of the same kind.
+   The samples of "src" fill up the free sample slots of "dst".  */
+void MergeSurveyStats(SurveyStats* dst, const SurveyStats* src)
+{
+	unsigned i, j;
+
+	dst->numBitmaps += src->numBitmaps;
+	dst->numCorrupt += src->numCorrupt;
+	dst->numBytes += src->numBytes;
+	for (i = 0; i < 256; i++)
+	{
+		dst->byteFreq[i] += src->byteFreq[i];
+		dst->rowStartFreq[i] += src->rowStartFreq[i];
+	}
+	for (i = 0; i < SURVEY_RUN_BUCKETS; i++)
+		dst->runFreq[i] += src->runFreq[i];
+	dst->numRowCounts += src->numRowCounts;
+	for (i = 0; i < 2; i++)
+	{
+		for (j = 0; j < SURVEY_HEADER_WORDS; j++)
+		{
+			dst->hdrUnpacked[i][j] += src->hdrUnpacked[i][j];
+			dst->hdrPacked[i][j] += src->hdrPacked[i][j];
+		}
+	}
+	for (i = 0; i < SURVEY_MAX_CANDS; i++)
+		dst->candFits[i] += src->candFits[i];
+	for (i = 0; i < src->numSamples &&
+		dst->numSamples < SURVEY_MAX_SAMPLES; i++)
+		dst->samples[dst->numSamples++] = src->samples[i];
+}
+
+/* Surveys every bitmap with an unknown compression in all of the
+   archives at once, so that the pool is kept busy across archive
+   boundaries.  "names" labels the samples and must outlive "stats",
+   which has SURVEY_NUM_KINDS entries.  Returns an MhkError code.  */
+int SurveyArchives(MhkArchive* const* archives, const char* const* names,
+	unsigned numArchives, WorkPool* pool, SurveyStats* stats)
+{
+	SurveyJob* jobs;
+	bool* seen;
+	size_t maxJobs = 0, maxFiles = 0;
+	unsigned numJobs = 0;
+	unsigned a, i;
+
+	for (i = 0; i < SURVEY_NUM_KINDS; i++)
+		InitSurveyStats(&stats[i], (int)i);
+	for (a = 0; a < numArchives; a++)
+	{
+		maxJobs += archives[a]->numFiles;
+		if (maxFiles < archives[a]->numFiles)
+			maxFiles = archives[a]->numFiles;
+	}
+	jobs = (SurveyJob*)malloc((maxJobs + 1) * sizeof(SurveyJob));
+	seen = (bool*)malloc((maxFiles + 1) * sizeof(bool));
+	if (jobs == NULL || seen == NULL)
+	{
+		free(jobs);
+		free(seen);
+		return MHK_ENOMEM;
+	}
+
+	/* Only the format word is needed to pick the bitmaps, so that is
+	   read here rather than in the jobs.  Files can be shared by
+	   several resources, so each file is only surveyed once.  */
+	for (a = 0; a < numArchives; a++)
+	{
+		MhkArchive* archive = archives[a];
+		memset(seen, 0, (maxFiles + 1) * sizeof(bool));
+		for (i = 0; i < archive->numResources; i++)
+		{
+			MhkResource* rsrc = &archive->resources[i];
+			const MhkFile* file = &archive->files[rsrc->file];
+			int kind;
+			if (rsrc->type != MHK_TBMP || seen[rsrc->file] ||
+				file->size < BMP_HEADER_SIZE)
+				continue;
+			seen[rsrc->file] = true;
+			kind = SurveyBitmapKind(MHK_GET16(file->data + 6));
+			if (kind < 0)
+				continue;
+			jobs[numJobs].file = file;
+			jobs[numJobs].archive = names[a];
+			jobs[numJobs].id = rsrc->id;
+			InitSurveyStats(&jobs[numJobs].stats, kind);
+			numJobs++;
+		}
+	}
+	for (i = 0; i < numJobs; i++)
+		SubmitWork(pool, SurveyJobFunc, &jobs[i]);
+	WaitWorkPool(pool);
+
+	for (i = 0; i < numJobs; i++)
+		MergeSurveyStats(&stats[jobs[i].stats.kind], &jobs[i].stats);
+	free(jobs);
+	free(seen);
+	return MHK_OK;
+}
+
+/* Writes a human-readable summary of the survey of one kind into
+   "buf", which is always zero-terminated.  Returns the length of the
+   text.  */
+size_t FormatSurveyReport(const SurveyStats* stats, char* buf,
+	size_t bufSize)
+{
+	char line[256];
+	size_t len = 0;
+	unsigned i, j;
+
+	if (bufSize == 0)
+		return 0;
+	buf[0] = '\0';
+	sprintf(line, "%s: %u bitmaps, %u corrupt, %lu bytes\n",
+		kindNames[stats->kind], stats->numBitmaps, stats->numCorrupt,
+		stats->numBytes);
+	len = AppendLine(buf, bufSize, len, line);
+	if (stats->numBytes == 0)
+		return len;
+
+	{
+		double entropy = 0;
+		unsigned long runs = 0;
+		for (i = 0; i < 256; i++)
+		{
+			double p = (double)stats->byteFreq[i] / stats->numBytes;
+			if (p > 0)
+				entropy -= p * log(p) / log(2.0);
+		}
+		sprintf(line, "Entropy: %.2f bits per byte\n", entropy);
+		len = AppendLine(buf, bufSize, len, line);
+		len = AppendTopBytes(buf, bufSize, len, "Common bytes:",
+			stats->byteFreq);
+
+		for (i = 0; i < SURVEY_RUN_BUCKETS; i++)
+			runs += stats->runFreq[i];
+		strcpy(line, "Runs of equal bytes:");
+		for (i = 0; i < SURVEY_RUN_BUCKETS; i++)
+		{
+			if (stats->runFreq[i] == 0)
+				continue;
+			sprintf(line + strlen(line), " %s %.1f%%", runNames[i],
+				100.0 * stats->runFreq[i] / runs);
+		}
+		strcat(line, "\n");
+		len = AppendLine(buf, bufSize, len, line);
+	}
+
+	sprintf(line, "Rows with u16 byte counts: %u of %u bitmaps\n",
+		stats->numRowCounts, stats->numBitmaps);
+	len = AppendLine(buf, bufSize, len, line);
+	if (stats->numRowCounts > 0)
+		len = AppendTopBytes(buf, bufSize, len, "Common row start bytes:",
+			stats->rowStartFreq);
+	for (i = 0; i < 2; i++)
+	{
+		for (j = 0; j < SURVEY_HEADER_WORDS; j++)
+		{
+			if (stats->hdrUnpacked[i][j] == 0 && stats->hdrPacked[i][j] == 0)
+				continue;
+			sprintf(line, "%s u32 at +%u: unpacked size %u times, "
+				"packed size %u times\n", i ? "LE" : "BE", j * 2,
+				stats->hdrUnpacked[i][j], stats->hdrPacked[i][j]);
+			len = AppendLine(buf, bufSize, len, line);
+		}
+	}
+
+	len = AppendLine(buf, bufSize, len, "Candidate decoders that fit:\n");
+	for (i = 0; i < SurveyCandCount(stats->kind); i++)
+	{
+		sprintf(line, "  %-14s %6u\n", SurveyCandName(stats->kind, i),
+			stats->candFits[i]);
+		len = AppendLine(buf, bufSize, len, line);
+	}
+	if (stats->numSamples > 0)
+		len = AppendLine(buf, bufSize, len, "Samples:\n");
+	for (i = 0; i < stats->numSamples; i++)
+	{
+		const SurveySample* sample = &stats->samples[i];
+		sprintf(line, "  %.80s #%u: %ux%u, %u bytes per row, format "
+			"0x%04x, %lu bytes, %s\n", sample->archive, sample->id,
+			sample->width, sample->height, sample->bytesPerRow,
+			sample->format, sample->size, sample->match < 0 ? "no fit" :
+			SurveyCandName(stats->kind, sample->match));
+		len = AppendLine(buf, bufSize, len, line);
+	}
+	return len;
+}
+
+static void SurveyJobFunc(void* arg)
+{
+	SurveyJob* job = (SurveyJob*)arg;
+	SurveySample* sample = &job->stats.samples[0];
+	MhkBitmap bmp;
+
+	job->match = -1;
+	if (ParseBitmap(job->file->data, job->file->size, &bmp) != MHK_OK)
+	{
+		job->stats.numBitmaps++;
+		job->stats.numCorrupt++;
+		return;
+	}
+	SurveyBitmap(&bmp, &job->stats, &job->match);
+	sample->archive = job->archive;
+	sample->id = job->id;
+	sample->width = bmp.width;
+	sample->height = bmp.height;
+	sample->bytesPerRow = bmp.bytesPerRow;
+	sample->format = bmp.format;
+	sample->size = (unsigned long)bmp.dataSize;
+	sample->match = job->match;
+	job->stats.numSamples = 1;
+}
+
+static void CountBytes(const unsigned char* data, size_t size,
+	SurveyStats* stats)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t run = 1;
+		unsigned bucket = 0;
+		while (i + run < size && data[i + run] == data[i])
+			run++;
+		stats->byteFreq[data[i]] += run;
+		while (bucket + 1 < SURVEY_RUN_BUCKETS &&
+			   ((size_t)1 << bucket) < run)
+			bucket++;
+		stats->runFreq[bucket]++;
+		i += run;
+	}
+}
+
+/* Looks for the unpacked and packed sizes among the first words of
+   the data, in both byte orders.  */
+static void CountHeaderWords(const MhkBitmap* bmp, SurveyStats* stats)
+{
+	const unsigned char* p = bmp->data;
+	unsigned long unpacked = 0;
+	unsigned j;
+
+	if ((bmp->format & BMP_2ND_MASK) == BMP_2ND_NONE)
+		unpacked = (unsigned long)bmp->bytesPerRow * bmp->height;
+	for (j = 0; j < SURVEY_HEADER_WORDS; j++)
+	{
+		unsigned long words[2];
+		unsigned e;
+		if (j * 2 + 4 > bmp->dataSize)
+			break;
+		words[0] = MHK_GET32(p + j * 2);
+		words[1] = p[j*2] | ((unsigned long)p[j*2+1] << 8) |
+			((unsigned long)p[j*2+2] << 16) |
+			((unsigned long)p[j*2+3] << 24);
+		for (e = 0; e < 2; e++)
+		{
+			if (unpacked != 0 && words[e] == unpacked)
+				stats->hdrUnpacked[e][j]++;
+			if (words[e] <= bmp->dataSize && words[e] + 16 >= bmp->dataSize)
+				stats->hdrPacked[e][j]++;
+		}
+	}
+}
+
+/* Checks whether the data is a chain of "height" rows that each start
+   with a u16 byte count and end exactly at the end of the data, and if
+   so, counts the first byte of every row.  */
+static void CountRowStarts(const unsigned char* data, size_t size,
+	unsigned height, SurveyStats* stats)
+{
+	size_t pos = 0;
+	unsigned y;
+
+	for (y = 0; y < height; y++)
+	{
+		if (size - pos < 2)
+			return;
+		pos += 2 + MHK_GET16(data + pos);
+		if (pos > size)
+			return;
+	}
+	if (size - pos > 1)
+		return;
+	stats->numRowCounts++;
+	for (pos = 0, y = 0; y < height; y++)
+	{
+		size_t rowLen = MHK_GET16(data + pos);
+		if (rowLen > 0)
+			stats->rowStartFreq[data[pos + 2]]++;
+		pos += 2 + rowLen;
+	}
+}
+
+/* Decodes run-length codes from "src" into exactly "dstSize" bytes.
+   Returns the end of the codes, or NULL if the codes run out early or
+   overshoot "dstSize".  */
+static const unsigned char* ExpandRle(int codes, const unsigned char* src,
+	const unsigned char* srcEnd, unsigned char* dst, size_t dstSize)
+{
+	size_t pos = 0;
+	while (pos < dstSize)
+	{
+		unsigned code;
+		unsigned count;
+		bool run;
+
+		if (src >= srcEnd)
+			return NULL;
+		code = *src++;
+		switch (codes)
+		{
+		case RLE_MOHAWK:
+			run = (code & 0x80) != 0;
+			count = (code & 0x7f) + 1;
+			break;
+		case RLE_INVERTED:
+			run = (code & 0x80) == 0;
+			count = (code & 0x7f) + 1;
+			break;
+		case RLE_PACKBITS:
+			if (code == 0x80)
+				continue; /* No-op */
+			run = code > 0x80;
+			count = run ? 257 - code : code + 1;
+			break;
+		default:
+			run = true;
+			count = code + 1;
+			break;
+		}
+		if (count > dstSize - pos)
+			return NULL;
+		if (run)
+		{
+			if (src >= srcEnd)
+				return NULL;
+			memset(dst + pos, *src++, count);
+		}
+		else
+		{
+			if ((size_t)(srcEnd - src) < count)
+				return NULL;
+			memcpy(dst + pos, src, count);
+			src += count;
+		}
+		pos += count;
+	}
+	return src;
+}
+
+/* Returns whether "size" bytes of "src" decode to exactly "height" rows
+   of "rowSize" bytes with a run-length candidate.  One byte of padding
+   is allowed at the end.  */
+static bool TryRle(const RleCandidate* cand, const unsigned char* src,
+	size_t size, size_t rowSize, unsigned height, unsigned char* dst)
+{
+	const unsigned char* srcEnd = src + size;
+	unsigned y;
+
+	if (!cand->rowCounts)
+	{
+		src = ExpandRle(cand->codes, src, srcEnd, dst, rowSize * height);
+		return src != NULL && srcEnd - src <= 1;
+	}
+	for (y = 0; y < height; y++)
+	{
+		size_t rowLen;
+		if (srcEnd - src < 2)
+			return false;
+		rowLen = MHK_GET16(src);
+		src += 2;
+		if (rowLen > (size_t)(srcEnd - src))
+			return false;
+		if (ExpandRle(cand->codes, src, src + rowLen, dst + y * rowSize,
+			rowSize) != src + rowLen)
+			return false;
+		src += rowLen;
+	}
+	return srcEnd - src <= 1;
+}
+
+/* Tries a run-length candidate with the packed row size, and then
+   with the header's row size if that is different.  "scratch" holds
+   the larger of the two for every row.  */
+static bool FitRle(const RleCandidate* cand, const MhkBitmap* bmp,
+	const unsigned char* src, size_t size, unsigned char* scratch)
+{
+	size_t rowSize = BmpRowSize(bmp);
+	if (TryRle(cand, src, size, rowSize, bmp->height, scratch))
+		return true;
+	return bmp->bytesPerRow != rowSize &&
+		TryRle(cand, src, size, bmp->bytesPerRow, bmp->height, scratch);
+}
+
+/* Unpacks an LZSS stream with the layout of "cand" until the input
+   ends or "dstCap" bytes are out.  Returns false if the stream is
+   broken or needs more room.  */
+static bool ExpandLz(const LzCandidate* cand, const unsigned char* src,
+	size_t srcSize, unsigned char* dst, size_t dstCap, size_t* outSize,
+	size_t* srcUsed)
+{
+	const unsigned char* start = src;
+	const unsigned char* srcEnd = src + srcSize;
+	unsigned ringMask = (1u << cand->posBits) - 1;
+	unsigned literalBit = cand->clearLiteral ? 0 : 1;
+	size_t outPos = 0;
+	unsigned flags = 0;
+
+	while (outPos < dstCap)
+	{
+		flags >>= 1;
+		if (!(flags & 0x100))
+		{
+			if (src >= srcEnd)
+				break;
+			flags = *src++ | 0xff00;
+		}
+		/* The last flag byte usually has bits to spare, so running out
+		   of input in front of an item is the normal end.  */
+		if (src >= srcEnd)
+			break;
+		if ((flags & 1) == literalBit)
+			dst[outPos++] = *src++;
+		else
+		{
+			unsigned word;
+			unsigned length;
+			unsigned pos;
+			size_t distance;
+
+			if (srcEnd - src < 2)
+				return false;
+			word = cand->littleEndian ? src[0] | (src[1] << 8) :
+				(src[0] << 8) | src[1];
+			src += 2;
+			length = (word >> cand->posBits) + LZ_MIN_LENGTH;
+			pos = word & ringMask;
+			if (cand->relative)
+				distance = (size_t)pos + 1;
+			else
+				distance = (((outPos & ringMask) - pos - cand->bias - 1) &
+					ringMask) + 1;
+			if (length > dstCap - outPos)
+				return false;
+			for (; length > 0 && distance > outPos; length--)
+				dst[outPos++] = 0;
+			for (; length > 0; length--, outPos++)
+				dst[outPos] = dst[outPos - distance];
+		}
+	}
+	*outSize = outPos;
+	*srcUsed = src - start;
+	return true;
+}
+
+/* Returns whether an LZ candidate unpacks the whole data of a bitmap
+   into something that the bitmap's secondary compression accepts.
+   "unpacked" holds "bound" bytes.  */
+static bool FitLz(const LzCandidate* cand, const MhkBitmap* bmp,
+	size_t bound, unsigned char* unpacked, unsigned char* scratch)
+{
+	const unsigned char* src = bmp->data;
+	size_t srcSize = bmp->dataSize;
+	size_t dstCap = bound;
+	size_t exact = 0; /* Unpacked size, if it is known up front */
+	size_t outSize, srcUsed;
+	unsigned i;
+
+	if ((bmp->format & BMP_2ND_MASK) == BMP_2ND_NONE)
+		exact = (size_t)bmp->bytesPerRow * bmp->height;
+	if (cand->header > 0)
+	{
+		if (srcSize < cand->header)
+			return false;
+		dstCap = MHK_GET32(src);
+		if (dstCap > bound || (exact != 0 && dstCap != exact))
+			return false;
+		src += cand->header;
+		srcSize -= cand->header;
+	}
+	else if (exact != 0)
+		dstCap = exact;
+	if (!ExpandLz(cand, src, srcSize, unpacked, dstCap, &outSize, &srcUsed))
+		return false;
+	if (srcSize - srcUsed > 1)
+		return false;
+
+	switch (bmp->format & BMP_2ND_MASK)
+	{
+	case BMP_2ND_NONE:
+		return outSize == exact;
+	case BMP_2ND_RLE8:
+		return (cand->header == 0 || outSize == dstCap) &&
+			FitRle(&rleCands[0], bmp, unpacked, outSize, scratch);
+	case BMP_2ND_RLEU:
+		if (cand->header > 0 && outSize != dstCap)
+			return false;
+		for (i = 0; i < NUM_RLE_CANDS; i++)
+		{
+			if (FitRle(&rleCands[i], bmp, unpacked, outSize, scratch))
+				return true;
+		}
+		return false;
+	}
+	return false;
+}
+
+/* Returns an upper limit for the unpacked size of the secondary layer,
+   with room for the worst case of any of the candidates.  */
+static size_t UnpackedBound(const MhkBitmap* bmp)
+{
+	size_t rowSize = BmpRowSize(bmp);
+	return ((size_t)bmp->bytesPerRow + rowSize * 2 + 4) *
+		(bmp->height + 1) + 1024;
+}
+
+static size_t AppendLine(char* buf, size_t bufSize, size_t len,
+	const char* line)
+{
+	size_t lineLen = strlen(line);
+	if (len + lineLen >= bufSize)
+		return len;
+	memcpy(buf + len, line, lineLen + 1);
+	return len + lineLen;
+}
+
+/* Appends a line with the eight most common bytes of a histogram and
+   their share of the total.  */
+static size_t AppendTopBytes(char* buf, size_t bufSize, size_t len,
+	const char* title, const unsigned long* freq)
+{
+	char line[256];
+	bool used[256];
+	unsigned long total = 0;
+	unsigned i, n;
+
+	for (i = 0; i < 256; i++)
+		total += freq[i];
+	memset(used, 0, sizeof(used));
+	strcpy(line, title);
+	for (n = 0; n < 8; n++)
+	{
+		int best = -1;
+		for (i = 0; i < 256; i++)
+		{
+			if (!used[i] && freq[i] > 0 &&
+				(best < 0 || freq[i] > freq[best]))
+				best = (int)i;
+		}
+		if (best < 0)
+			break;
+		used[best] = true;
+		sprintf(line + strlen(line), " %02x %.1f%%", best,
+			100.0 * freq[best] / total);
+	}
+	strcat(line, "\n");
+	return AppendLine(buf, bufSize, len, line);
+}
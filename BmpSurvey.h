@@ -0,0 +1,75 @@
+/* Unknown bitmap compression survey interface */
+/* Include "bool.h", "MhkArchive.h", "MhkBitmap.h", and "WorkPool.h"
+   before this header.  */
+
+#ifndef BMPSURVEY_H
+#define BMPSURVEY_H
+
+#include <stddef.h>
+
+enum SurveyKind
+{
+	SURVEY_RLEU, /* BMP_2ND_RLEU under no or known LZ compression */
+	SURVEY_LZU, /* BMP_1ST_LZU with any secondary compression */
+	SURVEY_NUM_KINDS
+};
+
+#define SURVEY_MAX_CANDS	8
+#define SURVEY_RUN_BUCKETS	10 /* Runs of 1, 2, 3-4, ..., 129-256, more */
+#define SURVEY_HEADER_WORDS	7 /* u32 words at offsets 0, 2, ..., 12 */
+#define SURVEY_MAX_SAMPLES	12
+
+typedef struct SurveySample_t SurveySample;
+typedef struct SurveyStats_t SurveyStats;
+
+/* One of the first bitmaps that were surveyed, for looking at by
+   hand.  */
+struct SurveySample_t
+{
+	const char* archive;
+	unsigned short id;
+	unsigned width;
+	unsigned height;
+	unsigned bytesPerRow;
+	unsigned format;
+	unsigned long size; /* Compressed data after the header */
+	int match; /* First candidate decoder that fit, or -1 */
+};
+
+/* Totals over all the surveyed bitmaps of one kind.  The statistics
+   are about the data of the unknown layer, so for BMP_2ND_RLEU the
+   known LZ layer has already been undone.  */
+struct SurveyStats_t
+{
+	int kind; /* See SurveyKind */
+	unsigned numBitmaps;
+	unsigned numCorrupt; /* Header or known layer could not be read */
+	unsigned long numBytes;
+	unsigned long byteFreq[256];
+	unsigned long runFreq[SURVEY_RUN_BUCKETS]; /* Runs of equal bytes */
+	/* Bitmaps whose data is a chain of u16 byte counts, one for each
+	   row, like RLE8, and the first byte of all those rows.  */
+	unsigned numRowCounts;
+	unsigned long rowStartFreq[256];
+	/* Header words equal to the unpacked size (only known without
+	   secondary compression) or within 16 bytes of the packed size,
+	   indexed by [little endian][offset / 2].  */
+	unsigned hdrUnpacked[2][SURVEY_HEADER_WORDS];
+	unsigned hdrPacked[2][SURVEY_HEADER_WORDS];
+	unsigned candFits[SURVEY_MAX_CANDS];
+	unsigned numSamples;
+	SurveySample samples[SURVEY_MAX_SAMPLES];
+};
+
+int SurveyBitmapKind(unsigned format);
+unsigned SurveyCandCount(int kind);
+const char* SurveyCandName(int kind, unsigned cand);
+void InitSurveyStats(SurveyStats* stats, int kind);
+int SurveyBitmap(const MhkBitmap* bmp, SurveyStats* stats, int* match);
+void MergeSurveyStats(SurveyStats* dst, const SurveyStats* src);
+int SurveyArchives(MhkArchive* const* archives, const char* const* names,
+	unsigned numArchives, WorkPool* pool, SurveyStats* stats);
+size_t FormatSurveyReport(const SurveyStats* stats, char* buf,
+	size_t bufSize);
+
+#endif /* not BMPSURVEY_H */
@@ -0,0 +1,619 @@
+/* Bitmap view window */
+/* Displays a tBMP resource without ever decoding the whole bitmap.
+   Painting asks StreamBitmap() for just the rows and columns of the
+   update region, expands the palette of each row as it arrives
+   straight into a 32-bit DIB section, and then blits that.  Scrolling
+   moves the pixels that are already on screen with ScrollWindowEx(),
+   so only the strips that are scrolled into view get decoded.
+
+   The bitmap data is not copied: the caller must keep the resource
+   data alive until the view is given another bitmap.
+
+   While a palette is being edited, the view can keep the decoded
+   indices of the whole bitmap resident instead.  A palette change
+   then only runs the expansion over the visible area, which is fast
+   enough to follow a slider as it is dragged.
+
+   Other zoom factors are drawn from a tiled pyramid of reduced copies
+   (see MipPyramid.c).  The level nearest the zoom factor from above is
+   stretched to the screen, so no tile is ever shrunk by more than
+   half, and only the tiles inside the update region are touched.
+   Holding Ctrl while turning the mouse wheel zooms around the cursor,
+   and dragging with the left button pans.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "PalExpand.h"
+#include "BmpDecode.h"
+#include "MipPyramid.h"
+#include "ScrollBar.h"
+#include "BmpView.h"
+
+#ifndef WM_MOUSEWHEEL
+#define WM_MOUSEWHEEL 0x020A
+#define WHEEL_DELTA 120
+#endif
+
+#define SCROLL_LINE 16 /* Pixels per scroll bar arrow click */
+#define PYRAMID_BYTES (48L << 20) /* Pyramid tiles kept after painting */
+
+/* Zoom factors in 256ths */
+static const unsigned zoomScales[] =
+	{ 16, 32, 64, 128, 192, 256, 384, 512, 768, 1024, 2048, 4096 };
+#define NUM_ZOOMS (sizeof(zoomScales) / sizeof(zoomScales[0]))
+#define ZOOM_ACTUAL 5 /* Index of 100% */
+
+typedef struct BmpView_t BmpView;
+typedef struct PaintSink_t PaintSink;
+
+struct BmpView_t
+{
+	bool hasBitmap;
+	MhkBitmap bmp;
+	PalExpander pe; /* For indexed bitmaps */
+	unsigned char* indices; /* Resident decoded pixels, or NULL */
+	unsigned zoom; /* Index into zoomScales */
+	MipPyramid* pyr; /* For zoom factors other than 100%, or NULL */
+	int xPos, yPos; /* Scroll position, in screen pixels */
+	int clientWidth, clientHeight;
+	bool dragging;
+	POINT dragStart; /* Cursor and scroll position when dragging began */
+	int dragX, dragY;
+};
+
+/* Where StreamBitmap() rows go while painting.  */
+struct PaintSink_t
+{
+	const BmpView* view;
+	PalColor* bits; /* Top-down 32-bit DIB */
+	unsigned width; /* Of both the DIB and the clipping rectangle */
+	unsigned left, top; /* Bitmap position of the DIB's origin */
+};
+
+LRESULT CALLBACK BmpViewProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam);
+static void PaintBmpView(HWND hwnd, BmpView* view);
+static bool PaintZoomed(HDC hdc, const RECT* update, BmpView* view);
+static void PyramidSource(void* ctx, unsigned top, unsigned height,
+	PalColor* dst, size_t stride);
+static void PaintRowSink(void* ctx, unsigned y, const unsigned char* row);
+static void ExpandRow(const BmpView* view, const unsigned char* row,
+	unsigned left, unsigned right, PalColor* dst);
+static int DisplayWidth(const BmpView* view);
+static int DisplayHeight(const BmpView* view);
+static void ZoomBmpView(HWND hwnd, BmpView* view, unsigned zoom,
+	int anchorX, int anchorY);
+static void UpdateScrollBars(HWND hwnd, BmpView* view);
+static void ScrollBmpView(HWND hwnd, BmpView* view, int newX, int newY);
+
+BOOL RegisterBmpView(HINSTANCE hInstance)
+{
+	WNDCLASSEX wcex;
+	wcex.cbSize = sizeof(WNDCLASSEX);
+	wcex.style = 0;
+	wcex.lpfnWndProc = BmpViewProc;
+	wcex.cbClsExtra = 0;
+	wcex.cbWndExtra = 0;
+	wcex.hInstance = hInstance;
+	wcex.hIcon = NULL;
+	wcex.hCursor = LoadCursor(NULL, IDC_ARROW);
+	wcex.hbrBackground = NULL; /* Everything is drawn in WM_PAINT */
+	wcex.lpszMenuName = NULL;
+	wcex.lpszClassName = BMPVIEW_CLASS;
+	wcex.hIconSm = NULL;
+	return RegisterClassEx(&wcex) != 0;
+}
+
+/* Displays "bmp", or nothing if "bmp" is NULL.  The view is scrolled
+   back to the top left corner.  */
+void SetBmpViewBitmap(HWND hwnd, const MhkBitmap* bmp)
+{
+	BmpView* view = (BmpView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+
+	if (view == NULL)
+		return;
+	free(view->indices);
+	view->indices = NULL;
+	FreeMipPyramid(view->pyr);
+	view->pyr = NULL;
+	view->hasBitmap = (bmp != NULL && BmpCanDecode(bmp->format));
+	view->xPos = 0;
+	view->yPos = 0;
+	if (view->hasBitmap)
+	{
+		view->bmp = *bmp;
+		InitBmpPalExpander(bmp, &view->pe);
+	}
+	UpdateScrollBars(hwnd, view);
+	InvalidateRect(hwnd, NULL, FALSE);
+}
+
+/* Decodes the whole bitmap once and keeps the pixels in memory, or
+   frees them again.  Only indexed bitmaps can be made resident.
+   Returns false if the pixels could not be decoded.  */
+bool SetBmpViewResident(HWND hwnd, bool resident)
+{
+	BmpView* view = (BmpView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	size_t rowSize;
+
+	if (view == NULL || !view->hasBitmap || view->bmp.bpp > 8)
+		return false;
+	if (!resident)
+	{
+		free(view->indices);
+		view->indices = NULL;
+		return true;
+	}
+	if (view->indices != NULL)
+		return true;
+	rowSize = BmpRowSize(&view->bmp);
+	view->indices = (unsigned char*)malloc(rowSize * view->bmp.height + 1);
+	if (view->indices == NULL)
+		return false;
+	if (DecodeBitmap(&view->bmp, view->indices, rowSize) != MHK_OK)
+	{
+		free(view->indices);
+		view->indices = NULL;
+		return false;
+	}
+	return true;
+}
+
+/* Changes the colors of an indexed bitmap and redraws it.  */
+void SetBmpViewPalette(HWND hwnd, const unsigned long* palette,
+	unsigned numColors)
+{
+	BmpView* view = (BmpView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	PalColor lut[256];
+	unsigned i;
+
+	if (view == NULL || !view->hasBitmap || view->bmp.bpp > 8)
+		return;
+	for (i = 0; i < numColors && i < 256; i++)
+		lut[i] = (PalColor)palette[i];
+	InitPalExpander(&view->pe, view->bmp.bpp, lut, i);
+	if (view->pyr != NULL)
+		ClearMipPyramid(view->pyr);
+	InvalidateRect(hwnd, NULL, FALSE);
+}
+
+/* Copies the colors that the view currently uses for an indexed
+   bitmap.  Returns the number of colors, or zero if the bitmap is not
+   indexed.  */
+unsigned GetBmpViewPalette(HWND hwnd, unsigned long* palette)
+{
+	BmpView* view = (BmpView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	unsigned numColors;
+	unsigned i;
+
+	if (view == NULL || !view->hasBitmap || view->bmp.bpp > 8)
+		return 0;
+	numColors = view->bmp.numColors;
+	if (numColors == 0)
+		numColors = 1 << view->bmp.bpp;
+	for (i = 0; i < numColors; i++)
+		palette[i] = view->pe.lut[i];
+	return numColors;
+}
+
+LRESULT CALLBACK BmpViewProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam)
+{
+	BmpView* view = (BmpView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	switch (uMsg)
+	{
+	case WM_CREATE:
+		view = (BmpView*)malloc(sizeof(BmpView));
+		if (view == NULL)
+			return -1;
+		memset(view, 0, sizeof(BmpView));
+		view->zoom = ZOOM_ACTUAL;
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)view);
+		return 0;
+	case WM_DESTROY:
+		free(view->indices);
+		FreeMipPyramid(view->pyr);
+		free(view);
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+		return 0;
+	case WM_SIZE:
+		view->clientWidth = LOWORD(lParam);
+		view->clientHeight = HIWORD(lParam);
+		UpdateScrollBars(hwnd, view);
+		/* Resizing can shift the scroll position.  */
+		ScrollBmpView(hwnd, view, view->xPos, view->yPos);
+		return 0;
+	case WM_ERASEBKGND:
+		return 1;
+	case WM_PAINT:
+		PaintBmpView(hwnd, view);
+		return 0;
+	case WM_HSCROLL:
+		ScrollBmpView(hwnd, view,
+			ScrollBarPos(hwnd, SB_HORZ, LOWORD(wParam), SCROLL_LINE),
+			view->yPos);
+		return 0;
+	case WM_VSCROLL:
+		ScrollBmpView(hwnd, view, view->xPos,
+			ScrollBarPos(hwnd, SB_VERT, LOWORD(wParam), SCROLL_LINE));
+		return 0;
+	case WM_MOUSEWHEEL:
+	{
+		UINT lines = 3;
+		if (LOWORD(wParam) & MK_CONTROL)
+		{
+			/* Zoom one step per notch, keeping the point under the
+			   cursor in place.  */
+			POINT pt;
+			int delta = (short)HIWORD(wParam) / WHEEL_DELTA;
+			int zoom = (int)view->zoom + delta;
+			if (zoom < 0)
+				zoom = 0;
+			if (zoom >= (int)NUM_ZOOMS)
+				zoom = NUM_ZOOMS - 1;
+			pt.x = (short)LOWORD(lParam);
+			pt.y = (short)HIWORD(lParam);
+			ScreenToClient(hwnd, &pt);
+			ZoomBmpView(hwnd, view, zoom, pt.x, pt.y);
+			return 0;
+		}
+		SystemParametersInfo(SPI_GETWHEELSCROLLLINES, 0, &lines, 0);
+		ScrollBmpView(hwnd, view, view->xPos, view->yPos -
+			(short)HIWORD(wParam) * (int)lines * SCROLL_LINE / WHEEL_DELTA);
+		return 0;
+	}
+	case WM_LBUTTONDOWN:
+		SetCapture(hwnd);
+		view->dragging = true;
+		view->dragStart.x = (short)LOWORD(lParam);
+		view->dragStart.y = (short)HIWORD(lParam);
+		view->dragX = view->xPos;
+		view->dragY = view->yPos;
+		return 0;
+	case WM_MOUSEMOVE:
+		if (view->dragging)
+			ScrollBmpView(hwnd, view,
+				view->dragX - ((short)LOWORD(lParam) - view->dragStart.x),
+				view->dragY - ((short)HIWORD(lParam) - view->dragStart.y));
+		return 0;
+	case WM_LBUTTONUP:
+		if (view->dragging)
+			ReleaseCapture();
+		return 0;
+	case WM_CAPTURECHANGED:
+		view->dragging = false;
+		return 0;
+	}
+	return DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
+
+/* Decodes only the part of the bitmap inside the update region, or
+   expands it from the resident pixels.  Other zoom factors are drawn
+   from the pyramid.  */
+static void PaintBmpView(HWND hwnd, BmpView* view)
+{
+	PAINTSTRUCT ps;
+	BmpRect clip;
+	RECT bmpRt;
+
+	BeginPaint(hwnd, &ps);
+	SetRectEmpty(&bmpRt);
+	if (view->hasBitmap && view->zoom != ZOOM_ACTUAL)
+	{
+		if (PaintZoomed(ps.hdc, &ps.rcPaint, view))
+			SetRect(&bmpRt, -view->xPos, -view->yPos,
+				DisplayWidth(view) - view->xPos,
+				DisplayHeight(view) - view->yPos);
+	}
+	else if (view->hasBitmap)
+	{
+		clip.left = ps.rcPaint.left + view->xPos;
+		clip.top = ps.rcPaint.top + view->yPos;
+		clip.right = ps.rcPaint.right + view->xPos;
+		clip.bottom = ps.rcPaint.bottom + view->yPos;
+		if (clip.right > view->bmp.width)
+			clip.right = view->bmp.width;
+		if (clip.bottom > view->bmp.height)
+			clip.bottom = view->bmp.height;
+		SetRect(&bmpRt, -view->xPos, -view->yPos,
+			view->bmp.width - view->xPos, view->bmp.height - view->yPos);
+	}
+
+	if (view->hasBitmap && view->zoom == ZOOM_ACTUAL &&
+		clip.left < clip.right && clip.top < clip.bottom)
+	{
+		BITMAPINFO bmi;
+		PaintSink sink;
+		HBITMAP hDib;
+		void* bits;
+
+		memset(&bmi, 0, sizeof(BITMAPINFO));
+		bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		bmi.bmiHeader.biWidth = clip.right - clip.left;
+		bmi.bmiHeader.biHeight = -(LONG)(clip.bottom - clip.top);
+		bmi.bmiHeader.biPlanes = 1;
+		bmi.bmiHeader.biBitCount = 32;
+		bmi.bmiHeader.biCompression = BI_RGB;
+		hDib = CreateDIBSection(ps.hdc, &bmi, DIB_RGB_COLORS, &bits,
+			NULL, 0);
+		if (hDib != NULL)
+		{
+			HDC hMemDC = CreateCompatibleDC(ps.hdc);
+			HGDIOBJ hOldBmp;
+
+			sink.view = view;
+			sink.bits = (PalColor*)bits;
+			sink.width = clip.right - clip.left;
+			sink.left = clip.left;
+			sink.top = clip.top;
+			/* Rows that fail to decode stay black.  */
+			GdiFlush();
+			if (view->indices != NULL)
+			{
+				size_t rowSize = BmpRowSize(&view->bmp);
+				unsigned y;
+				for (y = clip.top; y < clip.bottom; y++)
+					PaintRowSink(&sink, y, view->indices + y * rowSize);
+			}
+			else
+				StreamBitmap(&view->bmp, &clip, PaintRowSink, &sink);
+
+			hOldBmp = SelectObject(hMemDC, hDib);
+			BitBlt(ps.hdc, clip.left - view->xPos, clip.top - view->yPos,
+				clip.right - clip.left, clip.bottom - clip.top,
+				hMemDC, 0, 0, SRCCOPY);
+			SelectObject(hMemDC, hOldBmp);
+			DeleteDC(hMemDC);
+			DeleteObject(hDib);
+		}
+	}
+
+	/* Fill whatever is not covered by the bitmap.  */
+	ExcludeClipRect(ps.hdc, bmpRt.left, bmpRt.top, bmpRt.right, bmpRt.bottom);
+	FillRect(ps.hdc, &ps.rcPaint, GetSysColorBrush(COLOR_APPWORKSPACE));
+	EndPaint(hwnd, &ps);
+}
+
+/* Draws the pyramid tiles inside "update" at the current zoom factor.
+   Returns false if the pyramid could not be made.  */
+static bool PaintZoomed(HDC hdc, const RECT* update, BmpView* view)
+{
+	unsigned long scale = zoomScales[view->zoom];
+	unsigned level = 0, levelWidth, levelHeight;
+	unsigned long step; /* Screen pixels per level pixel, in 256ths */
+	unsigned tx0, ty0, tx1, ty1, tx, ty;
+	BITMAPINFO bmi;
+
+	if (view->pyr == NULL)
+		view->pyr = CreateMipPyramid(view->bmp.width, view->bmp.height,
+			PyramidSource, view);
+	if (view->pyr == NULL)
+		return false;
+	while (level + 1 < MipLevelCount(view->pyr) &&
+		   (scale << (level + 1)) <= 256)
+		level++;
+	GetMipLevelSize(view->pyr, level, &levelWidth, &levelHeight);
+	step = scale << level;
+
+	/* Tiles that the update rectangle touches */
+	if (update->right + view->xPos <= 0 || update->bottom + view->yPos <= 0)
+		return true;
+	tx0 = (unsigned)((unsigned long)(max(update->left + view->xPos, 0)) *
+		256 / step) / MIP_TILE_SIZE;
+	ty0 = (unsigned)((unsigned long)(max(update->top + view->yPos, 0)) *
+		256 / step) / MIP_TILE_SIZE;
+	tx1 = (unsigned)(((unsigned long)(update->right + view->xPos) * 256 +
+		step - 1) / step + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+	ty1 = (unsigned)(((unsigned long)(update->bottom + view->yPos) * 256 +
+		step - 1) / step + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+	if (tx1 > (levelWidth + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE)
+		tx1 = (levelWidth + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+	if (ty1 > (levelHeight + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE)
+		ty1 = (levelHeight + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+
+	memset(&bmi, 0, sizeof(BITMAPINFO));
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+	SetStretchBltMode(hdc, COLORONCOLOR);
+	for (ty = ty0; ty < ty1; ty++)
+	{
+		for (tx = tx0; tx < tx1; tx++)
+		{
+			unsigned width, height;
+			int left, top, right, bottom;
+			const PalColor* tile = GetMipTile(view->pyr, level, tx, ty,
+				&width, &height);
+			if (tile == NULL)
+				continue;
+			/* Edges come from the same formula for neighboring tiles,
+			   so no seams open up between them.  */
+			left = (int)((unsigned long)tx * MIP_TILE_SIZE * step / 256) -
+				view->xPos;
+			top = (int)((unsigned long)ty * MIP_TILE_SIZE * step / 256) -
+				view->yPos;
+			right = (int)(((unsigned long)tx * MIP_TILE_SIZE + width) *
+				step / 256) - view->xPos;
+			bottom = (int)(((unsigned long)ty * MIP_TILE_SIZE + height) *
+				step / 256) - view->yPos;
+			if (right <= left || bottom <= top)
+				continue;
+			bmi.bmiHeader.biWidth = width;
+			bmi.bmiHeader.biHeight = -(LONG)height;
+			StretchDIBits(hdc, left, top, right - left, bottom - top,
+				0, 0, width, height, tile, &bmi, DIB_RGB_COLORS, SRCCOPY);
+		}
+	}
+	TrimMipPyramid(view->pyr, PYRAMID_BYTES);
+	return true;
+}
+
+/* Gives the pyramid full-size rows, from the resident pixels if there
+   are any.  */
+static void PyramidSource(void* ctx, unsigned top, unsigned height,
+	PalColor* dst, size_t stride)
+{
+	BmpView* view = (BmpView*)ctx;
+	PaintSink sink;
+	BmpRect clip;
+
+	/* Rows that fail to decode stay black.  */
+	memset(dst, 0, stride * height);
+	if (view->indices != NULL)
+	{
+		size_t rowSize = BmpRowSize(&view->bmp);
+		unsigned y;
+		for (y = top; y < top + height; y++)
+			ExpandRow(view, view->indices + y * rowSize, 0, view->bmp.width,
+				(PalColor*)((unsigned char*)dst + (y - top) * stride));
+		return;
+	}
+	sink.view = view;
+	sink.bits = dst;
+	sink.width = (unsigned)(stride / sizeof(PalColor));
+	sink.left = 0;
+	sink.top = top;
+	clip.left = 0;
+	clip.top = top;
+	clip.right = view->bmp.width;
+	clip.bottom = top + height;
+	StreamBitmap(&view->bmp, &clip, PaintRowSink, &sink);
+}
+
+static void PaintRowSink(void* ctx, unsigned y, const unsigned char* row)
+{
+	PaintSink* sink = (PaintSink*)ctx;
+	ExpandRow(sink->view, row, sink->left, sink->left + sink->width,
+		sink->bits + (size_t)(y - sink->top) * sink->width);
+}
+
+/* Converts columns "left" through "right" - 1 of a decoded row to DIB
+   colors.  16-bit pixels are taken as big-endian xRGB 1555, and 24-bit
+   pixels as blue, green, red, like the palette entries.  */
+static void ExpandRow(const BmpView* view, const unsigned char* row,
+	unsigned left, unsigned right, PalColor* dst)
+{
+	unsigned x;
+	switch (view->bmp.bpp)
+	{
+	case 1:
+	case 4:
+	case 8:
+		PalExpandRow(&view->pe, row, left, right - left, dst);
+		break;
+	case 16:
+		for (x = left; x < right; x++)
+		{
+			unsigned pixel = (row[x*2] << 8) | row[x*2+1];
+			PalColor r = (pixel >> 10) & 0x1f;
+			PalColor g = (pixel >> 5) & 0x1f;
+			PalColor b = pixel & 0x1f;
+			*dst++ = (((r << 3) | (r >> 2)) << 16) |
+				(((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2));
+		}
+		break;
+	case 24:
+		for (x = left; x < right; x++)
+		{
+			const unsigned char* p = row + x * 3;
+			*dst++ = ((PalColor)p[2] << 16) | ((PalColor)p[1] << 8) | p[0];
+		}
+		break;
+	}
+}
+
+/* Returns the size of the bitmap on screen at the current zoom.  */
+static int DisplayWidth(const BmpView* view)
+{
+	unsigned long width;
+	if (!view->hasBitmap)
+		return 0;
+	width = (unsigned long)view->bmp.width * zoomScales[view->zoom] / 256;
+	return width > 0 ? (int)width : 1;
+}
+
+static int DisplayHeight(const BmpView* view)
+{
+	unsigned long height;
+	if (!view->hasBitmap)
+		return 0;
+	height = (unsigned long)view->bmp.height * zoomScales[view->zoom] / 256;
+	return height > 0 ? (int)height : 1;
+}
+
+/* Changes the zoom factor, keeping the bitmap point at client
+   coordinates ("anchorX", "anchorY") where it is.  */
+static void ZoomBmpView(HWND hwnd, BmpView* view, unsigned zoom,
+	int anchorX, int anchorY)
+{
+	unsigned long oldScale = zoomScales[view->zoom];
+	unsigned long newScale = zoomScales[zoom];
+	int newX, newY;
+
+	if (zoom == view->zoom || !view->hasBitmap)
+		return;
+	newX = (int)((double)(view->xPos + anchorX) * newScale / oldScale) -
+		anchorX;
+	newY = (int)((double)(view->yPos + anchorY) * newScale / oldScale) -
+		anchorY;
+	view->zoom = zoom;
+	UpdateScrollBars(hwnd, view);
+	InvalidateRect(hwnd, NULL, FALSE);
+	/* Clamp to the new size without scrolling the old pixels.  */
+	if (newX > DisplayWidth(view) - view->clientWidth)
+		newX = DisplayWidth(view) - view->clientWidth;
+	if (newY > DisplayHeight(view) - view->clientHeight)
+		newY = DisplayHeight(view) - view->clientHeight;
+	view->xPos = max(newX, 0);
+	view->yPos = max(newY, 0);
+	SetScrollPos(hwnd, SB_HORZ, view->xPos, TRUE);
+	SetScrollPos(hwnd, SB_VERT, view->yPos, TRUE);
+}
+
+static void UpdateScrollBars(HWND hwnd, BmpView* view)
+{
+	SCROLLINFO si;
+	si.cbSize = sizeof(SCROLLINFO);
+	si.fMask = SIF_RANGE | SIF_PAGE | SIF_POS;
+	si.nMin = 0;
+	si.nMax = view->hasBitmap ? DisplayWidth(view) - 1 : 0;
+	si.nPage = view->clientWidth;
+	si.nPos = view->xPos;
+	SetScrollInfo(hwnd, SB_HORZ, &si, TRUE);
+	si.nMax = view->hasBitmap ? DisplayHeight(view) - 1 : 0;
+	si.nPage = view->clientHeight;
+	si.nPos = view->yPos;
+	SetScrollInfo(hwnd, SB_VERT, &si, TRUE);
+}
+
+/* Scrolls to a new position, which is clamped to the bitmap.  The
+   pixels that remain visible are moved rather than decoded again.  */
+static void ScrollBmpView(HWND hwnd, BmpView* view, int newX, int newY)
+{
+	int maxX = 0, maxY = 0;
+	if (view->hasBitmap)
+	{
+		maxX = DisplayWidth(view) - view->clientWidth;
+		maxY = DisplayHeight(view) - view->clientHeight;
+	}
+	if (newX > maxX) newX = maxX;
+	if (newY > maxY) newY = maxY;
+	if (newX < 0) newX = 0;
+	if (newY < 0) newY = 0;
+	if (newX == view->xPos && newY == view->yPos)
+		return;
+	ScrollWindowEx(hwnd, view->xPos - newX, view->yPos - newY,
+		NULL, NULL, NULL, NULL, SW_INVALIDATE);
+	view->xPos = newX;
+	view->yPos = newY;
+	SetScrollPos(hwnd, SB_HORZ, newX, TRUE);
+	SetScrollPos(hwnd, SB_VERT, newY, TRUE);
+}
@@ -0,0 +1,17 @@
+/* Bitmap view window interface */
+/* This is platform dependent code: include windows.h, "bool.h", and
+   "MhkBitmap.h" before this header.  */
+
+#ifndef BMPVIEW_H
+#define BMPVIEW_H
+
+#define BMPVIEW_CLASS "MhkBmpView"
+
+BOOL RegisterBmpView(HINSTANCE hInstance);
+void SetBmpViewBitmap(HWND hwnd, const MhkBitmap* bmp);
+bool SetBmpViewResident(HWND hwnd, bool resident);
+void SetBmpViewPalette(HWND hwnd, const unsigned long* palette,
+	unsigned numColors);
+unsigned GetBmpViewPalette(HWND hwnd, unsigned long* palette);
+
+#endif /* not BMPVIEW_H */
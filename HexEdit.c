@@ -38,12 +38,24 @@
 #include <crtdbg.h>
 
 #include "bool.h"
+#include "PieceTable.h"
+#include "LineIndex.h"
+#include "WorkPool.h"
+#include "LineScan.h"
+#include "UndoJournal.h"
 
 extern HINSTANCE g_hInstance;
 
 const unsigned truncLen = 8192; /* Maximum length of lines before line
 								   breaking is forced */
 #define TRUNC_LEN 8192
+#define SCAN_POOL_SIZE 0x1000000 /* Texts this long are indexed on several
+									threads */
+#define UNDO_MAX_BYTES 0x40000000 /* Undo history budget */
+#define UNDO_MAX_RESIDENT 0x4000000 /* Part of it kept in memory, the rest
+									   is spilled to a temporary file */
+#define HEX_MAX_ROW 64 /* Most bytes shown on one hex row */
+#define HEX_ROW_CHARS(n) (11 + 4 * (n)) /* Offset, hex bytes, and ASCII */
 
 enum UndoEntryType
 {
@@ -52,21 +64,9 @@ enum UndoEntryType
 	UE_REPLACE
 };
 
-struct UndoEntry_t
-{
-	unsigned type; /* Was the operation a insert, delete, or replace? */
-	bool caretFirst; /* Did the caret come before the region beginning? */
-	unsigned opPos; /* Position to change text */
-	char* data; /* If replace, this is the new data */
-	char* oldData; /* Only set on replace operations */
-};
-
-typedef struct UndoEntry_t UndoEntry;
-
 /* Text data and caret variables */
-static char* buffer;
-static unsigned buffSize;
-static bool ownBuffer;
+static PieceTable* pieces;
+static char* handleText; /* Flat copy of the text for EM_GETHANDLE */
 static unsigned textSize;
 static unsigned textPos; /* Byte-wise caret position */
 static unsigned caretLine;
@@ -84,9 +84,7 @@ static bool sameUndoOp; /* Should the next operation be added as part
 						   of the current undo entry? */
 static unsigned regionBegin;
 static bool regionActive;
-static UndoEntry* undoHistory;
-static unsigned numUndo;
-static unsigned curUndo;
+static UndoJournal* undoJournal;
 
 /* Text metric and display varaibles */
 static HFONT hFont;
@@ -101,15 +99,29 @@ static KERNINGPAIR* kernPairs;
 static unsigned leftMargin, rightMargin;
 static unsigned textAreaWidth;
 static unsigned textAreaHeight;
-static unsigned numLines;
-static unsigned* lineStarts; /* This array always maintains an extra
-							    entry that is equal to the text
-							    size. */
+static LineIndex* lines; /* Line starts, with an extra entry that is
+						    equal to the text size */
+static WorkPool* scanPool; /* Made the first time a long text is
+							   indexed */
 static POLYTEXT* norTextRI;
+static const char* visText; /* Text of the visible lines, contiguous for
+							   the text rendering functions */
+static unsigned visStart; /* Text position of "visText" */
+static char* visCopy; /* Holds "visText" when it spans pieces */
+static unsigned visCopySize;
 static POLYTEXT* regTextRI;
 static unsigned numTabStops;
 static unsigned* tabStops;
 static bool wrapWords;
+static bool hexMode; /* Show the text as rows of hex and ASCII bytes */
+static unsigned bytesPerRow;
+static unsigned long hexTopRow; /* First visible hex row */
+static unsigned hexScrollShift; /* Scroll bar units are this many rows,
+								   as a power of two */
+static HFONT hexFont; /* Fixed pitch font for the hex rows */
+static bool hexFontOwned; /* Was "hexFont" created here? */
+static unsigned hexRowHeight;
+static unsigned hexCharWidth;
 
 /* Mouse and mouse wheel scroll variables */
 static UINT w95WheelMsg = 0; /* Message ID for MSH_MOUSEWHEEL */
@@ -200,6 +212,7 @@ static void TruncateLines();
 static void LongestLineLen();
 static void RetruncateLines(bool setUpdLines/** = false*/);
 static void UpdateRenderInfo(bool onlyRegion, bool reindex);
+static void FetchVisText();
 static void UpdateScrollInfo();
 static void ScrollContents(bool offset, unsigned otherType, int amount,
 						   int sBar);
@@ -212,9 +225,8 @@ static void InsertText(char c, const char* str, bool silent);
 static void DeleteText(unsigned p1, unsigned p2, bool silent);
 static void InvalidateLines();
 static void ProcessMiscKey(WPARAM wParam);
-static void AddUndo(); /* Add an operation to the undo queue */
-static void InsertLineStart(unsigned line);
-static void DeleteLineStarts(unsigned begin, unsigned end);
+static UndoEntry* AddUndo(unsigned type, unsigned opPos, unsigned length);
+	/* Add an operation to the undo queue */
 static void CopyRegion();
 static void SkipWord(bool forward);
 static void CalcCaretLine();
@@ -225,9 +237,21 @@ static void ScrollToCaret();
 static void UpdateRegion(bool setRegActive);
 static void TryCursorUnhide();
 static void SortAscending(unsigned* p1, unsigned* p2);
-static void FreeUndoHist();
 static void FreeRenderInfo(bool freeNorRI/** = true*/);
 static void FreeLineInfo();
+static char TextAt(unsigned pos);
+static unsigned LineStart(unsigned line);
+static unsigned NumLines();
+static bool HexViewProc(UINT uMsg, WPARAM wParam, LPARAM lParam,
+	LRESULT* result);
+static void SetHexMode(unsigned newBytesPerRow);
+static void UpdateHexFont();
+static void UpdateHexScrollInfo();
+static void ScrollHexView(bool offset, unsigned otherType, long amount,
+						  int sBar);
+static void PaintHexRows(HDC hDC, const RECT* rt);
+static unsigned long NumHexRows();
+static unsigned NumVisHexRows();
 
 /* Window procedure called by system for CustomTextEdit class windows.
 
@@ -244,6 +268,12 @@ LRESULT CALLBACK TextEditProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 	static HCURSOR hIBeam;
 
 	lastHwnd = hwnd;
+	if (hexMode == true)
+	{
+		LRESULT result;
+		if (HexViewProc(uMsg, wParam, lParam, &result) == true)
+			return result;
+	}
 	switch (uMsg)
 	{
 	/* Window management messages */
@@ -259,7 +289,6 @@ LRESULT CALLBACK TextEditProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 
 		/* Nullify font display pointers. */
 		kernPairs = NULL;
-		lineStarts = NULL;
 		norTextRI = NULL;
 		regTextRI = NULL;
 		regionMask = NULL;
@@ -267,6 +296,13 @@ LRESULT CALLBACK TextEditProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 		tabStops = NULL;
 		/* Set default word wrapping state. */
 		wrapWords = false;
+		/* Start out showing text rather than hex. */
+		hexMode = false;
+		bytesPerRow = 16;
+		hexTopRow = 0;
+		hexScrollShift = 0;
+		hexFont = NULL;
+		hexFontOwned = false;
 		/* Set client to screen coordinate corrector. */
 		scrdiff.x = 0; scrdiff.y = 0;
 		ClientToScreen(hwnd, &scrdiff);
@@ -277,14 +313,27 @@ LRESULT CALLBACK TextEditProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 		hFont = NULL;
 		UpdateFont(NULL);
 
-		/* Initialize buffer. */
-		buffer = (char*)malloc(1000);
-		buffer[0] = '\0';
+		/* Initialize text. */
+		pieces = CreatePieceTable(NULL, 0);
+		lines = CreateLineIndex();
+		undoJournal = CreateUndoJournal(UNDO_MAX_BYTES, UNDO_MAX_RESIDENT);
+		if (pieces == NULL || lines == NULL || undoJournal == NULL)
+		{
+			FreePieceTable(pieces);
+			pieces = NULL;
+			FreeLineIndex(lines);
+			lines = NULL;
+			FreeUndoJournal(undoJournal);
+			undoJournal = NULL;
+			return -1;
+		}
+		handleText = NULL;
+		visText = NULL;
+		visCopy = NULL;
+		visCopySize = 0;
 		/* strcpy(buffer, "This is sample text. It remains here only to give you an example of how real text \
 may look. Really, you should get to doing the right thing, because this is getting \
 kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa                        aaaa\n\tNow you should make sure new line handling is O.K."); */
-		ownBuffer = true;
-		buffSize = 1000;
 		textSize = 0;
 
 		/* Initialize basic text edit. */
@@ -292,12 +341,7 @@ kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
 		wasInsert = false;
 		sameUndoOp = false;
 		regionActive = false;
-		undoHistory = NULL;
-		numUndo = 0;
-		curUndo = 0;
 		regionBegin = 0;
-		if (ownBuffer == true)
-			AddUndo(); /* We want to undo back to an empty buffer */
 
 		/* Initialize mouse. */
 		lBtnDown = false;
@@ -367,20 +411,29 @@ kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
 	case WM_DESTROY:
 		/* Is WM_KILLFOCUS called before WM_DESTROY automatically? */
 		TryCursorUnhide();
-		if (ownBuffer == true)
-		{
-			free(buffer);
-			buffer = NULL;
-		}
-		FreeUndoHist();
+		FreePieceTable(pieces);
+		pieces = NULL;
+		free(handleText);
+		handleText = NULL;
+		free(visCopy);
+		visCopy = NULL;
+		visCopySize = 0;
+		FreeUndoJournal(undoJournal);
+		undoJournal = NULL;
 		free(kernPairs);
 		kernPairs = NULL;
-		free(lineStarts);
-		lineStarts = NULL;
+		FreeLineIndex(lines);
+		lines = NULL;
+		FreeWorkPool(scanPool);
+		scanPool = NULL;
 		FreeRenderInfo(true);
 		free(tabStops);
 		tabStops = NULL;
 		FreeLineInfo();
+		if (hexFontOwned == true)
+			DeleteObject(hexFont);
+		hexFont = NULL;
+		hexFontOwned = false;
 		break;
 	case WM_PAINT:
 	{
@@ -581,9 +634,9 @@ kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
 			EnableMenuItem(hMen, M_COPY, MF_BYCOMMAND | MF_GRAYED);
 			EnableMenuItem(hMen, M_DELETE, MF_BYCOMMAND | MF_GRAYED);
 		}
-		if (curUndo == 0)
+		if (CanStepUndo(undoJournal) == false)
 			EnableMenuItem(hMen, M_UNDO, MF_BYCOMMAND | MF_GRAYED);
-		if (curUndo == numUndo - 1)
+		if (CanStepRedo(undoJournal) == false)
 			EnableMenuItem(hMen, M_REDO, MF_BYCOMMAND | MF_GRAYED);
 		if (textSize == 0)
 			EnableMenuItem(hMen, M_SELECTALL, MF_BYCOMMAND | MF_GRAYED);
@@ -630,17 +683,51 @@ kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
 		}
 		break;
 	case EM_GETHANDLE:
-		return (LRESULT)buffer;
+		/* The text is not stored in one piece, so hand out a copy that
+		   lasts until the next EM_GETHANDLE. */
+		free(handleText);
+		handleText = (char*)malloc(textSize + 1);
+		if (handleText != NULL)
+			handleText[CopyPieceText(pieces, 0, textSize, handleText)] = '\0';
+		return (LRESULT)handleText;
 	case EM_SETHANDLE:
-		if (ownBuffer == true)
+	{
+		const char* newText;
+		const char* textEnd;
+		unsigned newSize;
+		PieceTable* newPieces;
+		/* The text is read in place rather than copied, so "wParam" can
+		   be a mapped view of a file.  It ends at the first null
+		   character or after "lParam" bytes, and must stay valid until
+		   the next EM_SETHANDLE or the window is destroyed.  The hex
+		   view shows binary data, so there it always runs for "lParam"
+		   bytes. */
+		newText = (const char*)wParam;
+		if (hexMode == true)
+			textEnd = NULL;
+		else
+			textEnd = (const char*)memchr(newText, '\0', (size_t)lParam);
+		if (textEnd != NULL)
+			newSize = (unsigned)(textEnd - newText);
+		else
+			newSize = (unsigned)lParam;
+		newPieces = CreatePieceTable(newText, newSize);
+		if (newPieces == NULL)
+			break;
+		FreePieceTable(pieces);
+		pieces = newPieces;
+		textSize = newSize;
+		textPos = 0;
+		if (hexMode == true)
 		{
-			ownBuffer = false;
-			free(buffer);
+			/* The line index is left alone until text mode is
+			   restored. */
+			hexTopRow = 0;
+			xScrollPos = 0;
+			UpdateHexScrollInfo();
+			InvalidateRect(hwnd, NULL, TRUE);
+			break;
 		}
-		buffer = (char*)wParam;
-		buffSize = (unsigned)lParam;
-		textSize = strlen(buffer);
-		textPos = 0;
 		if (regionActive == true)
 		{
 			UpdateRegion(false);
@@ -652,6 +739,7 @@ kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
 		CalcCaretPos();
 		UpdateCaretPos();
 		break;
+	}
 	/* Edit commands */
 	case WM_CUT:
 		if (regionActive == true)
@@ -745,12 +833,17 @@ kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
 		UpdateCaretPos();
 		break;
 	case WM_UNDO:
-		if (curUndo > 0)
+		if (CanStepUndo(undoJournal) == true)
 		{
-			UndoEntry* cuPtr;
-			cuPtr = &undoHistory[curUndo];
+			const UndoEntry* cuPtr;
+			cuPtr = StepUndo(undoJournal);
 			sameUndoOp = false;
-			if (cuPtr->type == UE_INSERT)
+			if (cuPtr == NULL)
+			{
+				/* The undo data could not be read back in. */
+				MessageBeep(MB_OK);
+			}
+			else if (cuPtr->type == UE_INSERT)
 			{
 				regionBegin = cuPtr->opPos;
 				textPos = regionBegin;
@@ -771,37 +864,34 @@ kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
 				textPos = cuPtr->opPos;
 				CalcCaretLine();
 				ScrollToCaret();
-				DeleteText(cuPtr->opPos,
-					cuPtr->opPos + strlen(cuPtr->data), true);
+				DeleteText(cuPtr->opPos, cuPtr->opPos + cuPtr->length, true);
 				UpdateRegion(false);
 			}
 			else
 			{
 				/* Replace text. */
-				DeleteText(cuPtr->opPos,
-					cuPtr->opPos + strlen(cuPtr->data), true);
+				DeleteText(cuPtr->opPos, cuPtr->opPos + cuPtr->length, true);
 				textPos = cuPtr->opPos;
 				InsertText(0, cuPtr->oldData, true);
 			}
-			curUndo--;
-		}
-		if (curUndo == 0)
-			SendMessage(GetParent(hwnd), NM_CANUNDO, 0, FALSE);
-		if (curUndo > 0)
-			SendMessage(GetParent(hwnd), NM_CANUNDO, 0, TRUE);
-		if (curUndo < numUndo - 1)
-			SendMessage(GetParent(hwnd), NM_CANUNDO, 1, TRUE);
-		if (curUndo == numUndo - 1)
-			SendMessage(GetParent(hwnd), NM_CANUNDO, 1, FALSE);
+		}
+		SendMessage(GetParent(hwnd), NM_CANUNDO, 0,
+					CanStepUndo(undoJournal) ? TRUE : FALSE);
+		SendMessage(GetParent(hwnd), NM_CANUNDO, 1,
+					CanStepRedo(undoJournal) ? TRUE : FALSE);
 		break;
 	case EM_REDO:
-		if (curUndo < numUndo - 1)
+		if (CanStepRedo(undoJournal) == true)
 		{
-			UndoEntry* cuPtr;
+			const UndoEntry* cuPtr;
 			sameUndoOp = false;
-			curUndo++;
-			cuPtr = &undoHistory[curUndo];
-			if (cuPtr->type == UE_DELETE)
+			cuPtr = StepRedo(undoJournal);
+			if (cuPtr == NULL)
+			{
+				/* The undo data could not be read back in. */
+				MessageBeep(MB_OK);
+			}
+			else if (cuPtr->type == UE_DELETE)
 			{
 				textPos = cuPtr->opPos;
 				CalcCaretLine();
@@ -814,34 +904,31 @@ kind of boring. aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
 				textPos = cuPtr->opPos;
 				CalcCaretLine();
 				ScrollToCaret();
-				DeleteText(cuPtr->opPos,
-					cuPtr->opPos + strlen(cuPtr->data), true);
+				DeleteText(cuPtr->opPos, cuPtr->opPos + cuPtr->length, true);
 				UpdateRegion(false);
 			}
 			else
 			{
 				/* Replace text. */
-				DeleteText(cuPtr->opPos,
-					cuPtr->opPos + strlen(cuPtr->oldData), true);
+				DeleteText(cuPtr->opPos, cuPtr->opPos + cuPtr->oldLength, true);
 				textPos = cuPtr->opPos;
 				InsertText(0, cuPtr->data, true);
 			}
 		}
-		if (curUndo == 0)
-			SendMessage(GetParent(hwnd), NM_CANUNDO, 0, FALSE);
-		if (curUndo > 0)
-			SendMessage(GetParent(hwnd), NM_CANUNDO, 0, TRUE);
-		if (curUndo < numUndo - 1)
-			SendMessage(GetParent(hwnd), NM_CANUNDO, 1, TRUE);
-		if (curUndo == numUndo - 1)
-			SendMessage(GetParent(hwnd), NM_CANUNDO, 1, FALSE);
+		SendMessage(GetParent(hwnd), NM_CANUNDO, 0,
+					CanStepUndo(undoJournal) ? TRUE : FALSE);
+		SendMessage(GetParent(hwnd), NM_CANUNDO, 1,
+					CanStepRedo(undoJournal) ? TRUE : FALSE);
 		break;
 	case EM_CANUNDO:
-		if (curUndo == 0) return FALSE;
+		if (CanStepUndo(undoJournal) == false) return FALSE;
 		else return TRUE;
 	case EM_CANREDO:
-		if (curUndo == numUndo - 1) return FALSE;
+		if (CanStepRedo(undoJournal) == false) return FALSE;
 		else return TRUE;
+	case EM_SETHEXMODE:
+		SetHexMode((unsigned)wParam);
+		return 0;
 	case WM_SETFONT:
 		FreeRenderInfo(true);
 		UpdateFont((HFONT)wParam);
@@ -1243,8 +1330,8 @@ static void CalcNumVisLines()
 	numVisLines = (textAreaHeight + visLnOffset) / fontHeight;
 	if ((textAreaHeight + visLnOffset) % fontHeight > 0)
 		numVisLines++;
-	if (numVisLines > numLines)
-		numVisLines = numLines;
+	if (numVisLines > NumLines())
+		numVisLines = NumLines();
 }
 
 /* Generates standard tab stops.
@@ -1336,26 +1423,26 @@ static void WrapWords(bool rewrap)
 		unsigned lastTextPos;
 		unsigned testLine;
 		curLine = caretLine;
-		wrapPos = lineStarts[curLine];
+		wrapPos = LineStart(curLine);
 		lastTextPos = textPos;
 		SkipWord(false);
-		if (textPos <= lineStarts[caretLine] && textPos != 0 &&
+		if (textPos <= LineStart(caretLine) && textPos != 0 &&
 			(lastTextPos < textSize || wasInsert == false) &&
-			caretLine > 0 && buffer[lineStarts[caretLine]-1] != '\n')
+			caretLine > 0 && TextAt(LineStart(caretLine)-1) != '\n')
 		{
 			/* Start wrapping words one before the caret line. */
 			curLine--;
-			wrapPos = lineStarts[curLine];
+			wrapPos = LineStart(curLine);
 			beginUpdLine = curLine;
 		}
 		textPos = lastTextPos;
 		/* Search forward for the rewrapping end position. */
 		wrapEnd = 0;
-		for (testLine = curLine + 1; testLine < numLines; testLine++)
+		for (testLine = curLine + 1; testLine < NumLines(); testLine++)
 		{
-			if (buffer[lineStarts[testLine]-1] == '\n')
+			if (TextAt(LineStart(testLine)-1) == '\n')
 			{
-				wrapEnd = lineStarts[testLine];
+				wrapEnd = LineStart(testLine);
 				break;
 			}
 		}
@@ -1365,17 +1452,9 @@ static void WrapWords(bool rewrap)
 	else
 	{
 		/* Reset the necessary variables. */
-		if (lineStarts != NULL)
-		{
-			free(lineStarts);
-			lineStarts = NULL;
-		}
-		numLines = 0;
-		lineStarts = (unsigned*)malloc(sizeof(unsigned) * 20);
+		ResetLineIndex(lines);
 		wrapPos = 0;
-		lineStarts[0] = 0;
-		numLines++;
-		curLine = numLines - 1;
+		curLine = 0;
 		wrapEnd = textSize;
 	}
 
@@ -1386,6 +1465,7 @@ static void WrapWords(bool rewrap)
 		GCP_RESULTS wrapRes;
 		unsigned wrapStride;
 		int charWidths[TRUNC_LEN];
+		char wrapText[TRUNC_LEN];
 		unsigned newLength;
 		unsigned lastSpace;
 		/* Temporary variables */
@@ -1400,20 +1480,21 @@ static void WrapWords(bool rewrap)
 		if (wrapPos + wrapStride > wrapEnd)
 			wrapStride = wrapEnd - wrapPos;
 		wrapRes.nGlyphs = wrapStride;
-		GetCharacterPlacement(hDC, &(buffer[wrapPos]), wrapStride,
+		GetCharacterPlacement(hDC,
+			GetPieceSpan(pieces, wrapPos, wrapStride, wrapText), wrapStride,
 			textAreaWidth, &wrapRes, GCP_MAXEXTENT);
 		wrapPos += wrapRes.nMaxFit;
 		/* Process for tabs. */
 		ProcessTabs(curLine, charWidths, wrapPos);
 		/* Process for newlines and make sure that the line ends with
 		   whitespace, if possible. */
-		for (i = lineStarts[curLine], j = 0;
+		for (i = LineStart(curLine), j = 0;
 			newLength < textAreaWidth && i < wrapPos; i++)
 		{
-			if (buffer[i] == '\t' ||
-				buffer[i] == ' ')
+			if (TextAt(i) == '\t' ||
+				TextAt(i) == ' ')
 				lastSpace = i;
-			if (buffer[i] == '\n')
+			if (TextAt(i) == '\n')
 			{
 				lastSpace = i;
 				break;
@@ -1422,21 +1503,21 @@ static void WrapWords(bool rewrap)
 			j++;
 		}
 
-		if (lastSpace != 0 && (buffer[lastSpace] == ' ' ||
-			buffer[lastSpace] == '\t' || buffer[lastSpace] == '\n'))
+		if (lastSpace != 0 && (TextAt(lastSpace) == ' ' ||
+			TextAt(lastSpace) == '\t' || TextAt(lastSpace) == '\n'))
 			wrapPos = lastSpace + 1;
-		else if (curLine == 0 && (buffer[lastSpace] == ' ' ||
-			buffer[lastSpace] == '\t' || buffer[lastSpace] == '\n'))
+		else if (curLine == 0 && (TextAt(lastSpace) == ' ' ||
+			TextAt(lastSpace) == '\t' || TextAt(lastSpace) == '\n'))
 			wrapPos = lastSpace + 1;
 
 		/* If the line ends with a space, then keep skipping any
 		   subsequent space characters untill a non-space character
 		   is reached. */
-		if (buffer[lastSpace] == ' ')
+		if (TextAt(lastSpace) == ' ')
 		{
-			while (buffer[wrapPos] == ' ')
+			while (TextAt(wrapPos) == ' ')
 				wrapPos++;
-			if (wrapPos > 0 && buffer[wrapPos] == '\0')
+			if (wrapPos > 0 && TextAt(wrapPos) == '\0')
 				break;
 		}
 
@@ -1444,8 +1525,8 @@ static void WrapWords(bool rewrap)
 		/* If we are at the end of the text data, there is not
 		   a newline at the end, and there is spare length
 		   at the end of the window, then we are done wrapping. */
-		if (wrapRes.nMaxFit == wrapStride && buffer[wrapPos-1] != '\n' &&
-			newLength < textAreaWidth && curLine == numLines - 1)
+		if (wrapRes.nMaxFit == wrapStride && TextAt(wrapPos-1) != '\n' &&
+			newLength < textAreaWidth && curLine == NumLines() - 1)
 			break;
 
 		if (rewrap == true)
@@ -1456,10 +1537,10 @@ static void WrapWords(bool rewrap)
 				OutputDebugString("Word wrapping exceeded limits.");
 				break;
 			}
-			if (wrapPos != wrapEnd && lineStarts[curLine+1] == wrapEnd)
+			if (wrapPos != wrapEnd && LineStart(curLine+1) == wrapEnd)
 			{
 				/* We need more space to finish wrapping. */
-				InsertLineStart(curLine + 1);
+				InsertLineStart(lines, curLine + 1);
 				insertedLines = true;
 			}
 			if (wrapPos == wrapEnd)
@@ -1468,14 +1549,14 @@ static void WrapWords(bool rewrap)
 				   current line and the word wrapping end line. */
 				unsigned wrapEndLine;
 				for (wrapEndLine = curLine + 1;
-					 lineStarts[wrapEndLine] < wrapEnd;
+					 LineStart(wrapEndLine) < wrapEnd;
 					 wrapEndLine++);
-				DeleteLineStarts(curLine + 1, wrapEndLine);
+				DeleteLineStarts(lines, curLine + 1, wrapEndLine);
 				if (wrapEndLine - (curLine + 1) > 0)
 					deletedLines = true;
 			}
 			if (wrapPos == wrapEnd && wrapEnd == textSize &&
-				lineStarts[numLines-1] != textSize)
+				LineStart(NumLines()-1) != textSize)
 			{
 				/* If we did not break out of the loop earlier at the
 				   end of the data, then we must add another line
@@ -1486,35 +1567,24 @@ static void WrapWords(bool rewrap)
 				   newline at the end of the data, the line start
 				   reference for that line will be the same as the
 				   text size. */
-				InsertLineStart(curLine + 1);
+				InsertLineStart(lines, curLine + 1);
 				insertedLines = true;
 			}
-			lineStarts[curLine+1] = wrapPos;
+			SetLineStart(lines, curLine + 1, wrapPos);
 			curLine++;
 		}
 		else
 		{
-			lineStarts[numLines] = wrapPos;
-			numLines++;
-			curLine = numLines - 1;
-			if (numLines % 20 == 0)
-			{
-				lineStarts = (unsigned*)realloc(lineStarts,
-					sizeof(unsigned) * (numLines + 20));
-			}
+			AppendLineStart(lines, wrapPos);
+			curLine = NumLines() - 1;
 		}
 	}
-	lineStarts[numLines] = textSize;
-	if ((numLines + 1) % 20 == 0)
-	{
-		lineStarts = (unsigned*)realloc(lineStarts,
-			sizeof(unsigned) * (numLines + 21));
-	}
+	SetLineStart(lines, NumLines(), textSize);
 	ReleaseDC(lastHwnd, hDC);
 	if (insertedLines == false && deletedLines == false)
 		lastWrappedLine = curLine + 1;
 	else
-		lastWrappedLine = numLines;
+		lastWrappedLine = NumLines();
 }
 
 /* Computes the width of tab characters in a line.
@@ -1530,9 +1600,9 @@ static void ProcessTabs(unsigned lineNum, int* charWidths, unsigned endIndex)
 	unsigned j;
 	newLength = 0;
 
-	for (i = lineStarts[lineNum], j = 0; i < endIndex; i++)
+	for (i = LineStart(lineNum), j = 0; i < endIndex; i++)
 	{
-		if (buffer[i] == '\t')
+		if (TextAt(i) == '\t')
 		{
 			/* Change the proper lpDx. */
 			unsigned curTabStop;
@@ -1553,44 +1623,51 @@ static void ProcessTabs(unsigned lineNum, int* charWidths, unsigned endIndex)
    editor. */
 static void TruncateLines()
 {
-	unsigned wrapPos;
+	unsigned long* starts;
+	size_t numStarts;
+	unsigned lineStart;
 	unsigned i;
+	PieceIter iter;
+	bool more;
 
-	/* Reset the necessary variables. */
-	if (lineStarts != NULL)
+	/* Shorter texts are scanned in one piece on this thread, even if
+	   the pool was made for an earlier text.  */
+	if (textSize >= SCAN_POOL_SIZE)
 	{
-		free(lineStarts);
-		lineStarts = NULL;
+		if (scanPool == NULL)
+			scanPool = CreateWorkPool(0);
+		starts = ScanLineStarts(scanPool, pieces, truncLen, &numStarts);
+	}
+	else
+		starts = ScanLineStarts(NULL, pieces, truncLen, &numStarts);
+	if (starts != NULL)
+	{
+		bool built = BuildLineIndex(lines, starts, numStarts, textSize);
+		free(starts);
+		if (built)
+			return;
 	}
-	numLines = 0;
-	lineStarts = (unsigned*)malloc(sizeof(unsigned) * 20);
-
-	lineStarts[0] = 0;
-	numLines++;
 
-	/* Count through string, looking for newlines and lines in need of
-	   truncating. */
-	for (i = 0; i < textSize; i++)
+	/* Out of memory for the list of starts, so count through the
+	   string, looking for newlines and lines in need of truncating. */
+	ResetLineIndex(lines);
+	lineStart = 0;
+	for (more = BeginPieceIter(pieces, 0, &iter); more;
+		 more = NextPieceIter(&iter))
 	{
-		if (buffer[i] == '\n' ||
-			i - lineStarts[numLines-1] == truncLen)
+		unsigned j;
+		for (j = 0; j < iter.length; j++)
 		{
-			/* Start a new line. */
-			lineStarts[numLines] = i;
-			numLines++;
-			if (numLines % 20 == 0)
+			i = (unsigned)iter.pos + j;
+			if (iter.data[j] == '\n' || i - lineStart == truncLen)
 			{
-				lineStarts = (unsigned*)realloc(lineStarts,
-					sizeof(unsigned) * (numLines + 20));
+				/* Start a new line. */
+				AppendLineStart(lines, i);
+				lineStart = i;
 			}
 		}
 	}
-	lineStarts[numLines] = textSize;
-	if ((numLines + 1) % 20 == 0)
-	{
-		lineStarts = (unsigned*)realloc(lineStarts,
-			sizeof(unsigned) * (numLines + 20));
-	}
+	SetLineStart(lines, NumLines(), textSize);
 }
 
 /* Incomplete */
@@ -1601,21 +1678,21 @@ static void RetruncateLines(bool setUpdLines)
 	unsigned curPos;
 	unsigned scanEnd;
 	curLine = caretLine;
-	curPos = lineStarts[caretLine];
-	scanEnd = lineStarts[caretLine+1];
+	curPos = LineStart(caretLine);
+	scanEnd = LineStart(caretLine+1);
 
 	while (curPos < scanEnd)
 	{
-		if (buffer[curPos] == '\n')
+		if (TextAt(curPos) == '\n')
 		{
-			InsertLineStart(curLine + 1);
-			lineStarts[curLine+1] = curPos;
+			InsertLineStart(lines, curLine + 1);
+			SetLineStart(lines, curLine + 1, curPos);
 			curLine++;
 		}
-		if (curPos - lineStarts[curLine] >= truncLen)
+		if (curPos - LineStart(curLine) >= truncLen)
 		{
-			InsertLineStart(curLine + 1);
-			lineStarts[curLine+1] = curPos;
+			InsertLineStart(lines, curLine + 1);
+			SetLineStart(lines, curLine + 1, curPos);
 			curLine++;
 		}
 		curPos++;
@@ -1636,11 +1713,12 @@ static void LongestLineLen()
 	wrapPos = 0;
 	xMaxScroll = 0;
 
-	for (i = 0; i < numLines; i++)
+	for (i = 0; i < NumLines(); i++)
 	{
 		GCP_RESULTS wrapRes;
 		unsigned wrapStride;
 		int charWidths[TRUNC_LEN];
+		char lineText[TRUNC_LEN];
 		unsigned newLength;
 		unsigned j;
 		wrapStride = truncLen;
@@ -1652,7 +1730,8 @@ static void LongestLineLen()
 		if (wrapPos + wrapStride > textSize)
 			wrapStride = textSize - wrapPos;
 		wrapRes.nGlyphs = wrapStride;
-		GetCharacterPlacement(hDC, &(buffer[wrapPos]), wrapStride, 0,
+		GetCharacterPlacement(hDC,
+			GetPieceSpan(pieces, wrapPos, wrapStride, lineText), wrapStride, 0,
 			&wrapRes, 0);
 
 		for (j = 0; j < wrapStride; j++)
@@ -1673,7 +1752,7 @@ static void LongestLineLen()
    caret positioning code. */
 static void UpdateRenderInfo(bool onlyRegion, bool reindex)
 {
-	char* curLinePtr;
+	const char* curLinePtr;
 	unsigned lineSize;
 	GCP_RESULTS charPlac;
 	int* charWidths;
@@ -1709,6 +1788,7 @@ static void UpdateRenderInfo(bool onlyRegion, bool reindex)
 	if (onlyRegion == true)
 		goto regRIUpdate;
 
+	FetchVisText();
 	hDC = GetDC(lastHwnd);
 	SelectObject(hDC, hFont);
 
@@ -1720,13 +1800,13 @@ static void UpdateRenderInfo(bool onlyRegion, bool reindex)
 			/* First enter crude values. */
 			firstVisOffset[i] = xScrollPos;
 			firstVisChars[i] = 0;
-			numVisChars[i] = lineStarts[visLine+i+1] - lineStarts[visLine+i];
+			numVisChars[i] = LineStart(visLine+i+1) - LineStart(visLine+i);
 		}
 		for (i = 0; i < numVisLines; i++)
 		{
 			unsigned j;
 			unsigned curLen;
-			curLinePtr = &(buffer[lineStarts[visLine+i]]);
+			curLinePtr = &visText[LineStart(visLine+i)-visStart];
 			/* Then compute the fine values. */
 			lineSize = numVisChars[i];
 			charWidths = (int*)malloc(sizeof(int) * lineSize);
@@ -1736,7 +1816,7 @@ static void UpdateRenderInfo(bool onlyRegion, bool reindex)
 			charPlac.lpDx = charWidths;
 			charPlac.nGlyphs = lineSize;
 			GetCharacterPlacement(hDC, curLinePtr, lineSize, 0, &charPlac, 0);
-			ProcessTabs(visLine + i, charWidths, lineStarts[visLine+i] +
+			ProcessTabs(visLine + i, charWidths, LineStart(visLine+i) +
 						lineSize);
 
 			curLen = 0;
@@ -1757,13 +1837,22 @@ static void UpdateRenderInfo(bool onlyRegion, bool reindex)
 		}
 	}
 
+	/* Lines that are not updated still need to point at the fetched
+	   text. */
+	for (i = 0; i < beginUpdLine && i < numVisLines; i++)
+	{
+		norTextRI[i].lpstr = &visText[LineStart(visLine+i)-visStart];
+		if (wrapWords == false)
+			norTextRI[i].lpstr += firstVisChars[i];
+	}
+
 	/* Fill in normal text render information. */
 	for (i = beginUpdLine; i < numVisLines; i++)
 	{
-		curLinePtr = &(buffer[lineStarts[visLine+i]]);
+		curLinePtr = &visText[LineStart(visLine+i)-visStart];
 		if (wrapWords == true)
 		{
-			if (lineStarts[visLine+i+1] < lineStarts[visLine+i])
+			if (LineStart(visLine+i+1) < LineStart(visLine+i))
 			{
 				/* A rewrapping discrepancy happened. */
 				WrapWords(false);
@@ -1772,8 +1861,8 @@ static void UpdateRenderInfo(bool onlyRegion, bool reindex)
 				UpdateRenderInfo(onlyRegion, reindex);
 				return;
 			}
-			lineSize = lineStarts[visLine+i+1] - lineStarts[visLine+i];
-			if (lineSize > 0 && buffer[lineStarts[visLine+i+1]-1] == '\n')
+			lineSize = LineStart(visLine+i+1) - LineStart(visLine+i);
+			if (lineSize > 0 && TextAt(LineStart(visLine+i+1)-1) == '\n')
 				lineSize--;
 		}
 		else
@@ -1796,7 +1885,7 @@ static void UpdateRenderInfo(bool onlyRegion, bool reindex)
 		charPlac.lpDx = charWidths;
 		charPlac.nGlyphs = lineSize;
 		GetCharacterPlacement(hDC, curLinePtr, lineSize, 0, &charPlac, 0);
-		ProcessTabs(visLine + i, charWidths, lineStarts[visLine+i] + lineSize);
+		ProcessTabs(visLine + i, charWidths, LineStart(visLine+i) + lineSize);
 
 		norTextRI[i].x = bordWidthX + leftMargin;
 		if (wrapWords == false)
@@ -1831,15 +1920,10 @@ regRIUpdate:
 	SortAscending(&p1, &p2);
 
 	/* Find the number of visible region lines. */
-	for (i = 0; i < numLines; i++)
-	{
-		if (p1 >= lineStarts[i])
-			beginLine = i;
-		if (p2 > lineStarts[i])
-			endLine = i + 1;
-		else if (p2 == lineStarts[i])
-			endLine = i;
-	}
+	beginLine = FindLine(lines, p1);
+	endLine = FindLine(lines, p2);
+	if (p2 > LineStart(endLine))
+		endLine++;
 	if (endLine <= visLine || beginLine >= visLine + numVisLines ||
 		endLine - beginLine == 0)
 	{
@@ -1850,12 +1934,12 @@ regRIUpdate:
 	if (beginLine < visLine)
 	{
 		beginLine = visLine;
-		p1 = lineStarts[beginLine];
+		p1 = LineStart(beginLine);
 	}
 	if (endLine > visLine + numVisLines)
 	{
 		endLine = visLine + numVisLines;
-		p2 = lineStarts[endLine];
+		p2 = LineStart(endLine);
 	}
 	beginLine -= visLine;
 	endLine -= visLine;
@@ -1890,8 +1974,8 @@ regRIUpdate:
 		/* Temporary variables */
 		unsigned j;
 
-		curLineStart = lineStarts[visLine+i];
-		curLineEnd = lineStarts[visLine+i+1];
+		curLineStart = LineStart(visLine+i);
+		curLineEnd = LineStart(visLine+i+1);
 		if (wrapWords == false)
 		{
 			curLineStart += firstVisChars[i];
@@ -1901,16 +1985,16 @@ regRIUpdate:
 			curLineStart = p1;
 		if (i == endLine - 1)
 			curLineEnd = p2;
-		if (curLineEnd > 0 && buffer[curLineEnd-1] == '\n')
+		if (curLineEnd > 0 && TextAt(curLineEnd-1) == '\n')
 			curLineEnd--;
-		curLinePtr = &(buffer[curLineStart]);
+		curLinePtr = &visText[curLineStart-visStart];
 
 		if (wrapWords == true)
 			lineSize = curLineEnd - curLineStart;
 		else
 			lineSize = curLineEnd - curLineStart;
 
-		numLeadChars = curLineStart - lineStarts[visLine+i];
+		numLeadChars = curLineStart - LineStart(visLine+i);
 		if (wrapWords == false)
 		{
 			if (curLineStart > firstVisChars[i])
@@ -1970,6 +2054,48 @@ regRIUpdate:
 	}
 }
 
+/* Gathers the text of the visible lines.
+
+   The text rendering functions need each line in one piece, so the
+   visible text is read in place when it lies in one piece of the
+   text, and copied otherwise.  The pointers in the render info stay
+   valid until the next call. */
+static void FetchVisText()
+{
+	unsigned visEnd;
+	unsigned visSize;
+	visStart = LineStart(visLine);
+	visEnd = LineStart(visLine+numVisLines);
+	if (visEnd < visStart)
+		visEnd = textSize; /* Let UpdateRenderInfo() rewrap */
+	visSize = visEnd - visStart;
+	if (visCopy == NULL || visSize > visCopySize)
+	{
+		char* newCopy;
+		newCopy = (char*)malloc(visSize + 1);
+		if (newCopy != NULL)
+		{
+			free(visCopy);
+			visCopy = newCopy;
+			visCopySize = visSize + 1;
+		}
+		else
+		{
+			/* Out of memory, so keep the old buffer and only show the
+			   lines that fit in it, if any. */
+			unsigned fit;
+			fit = (visCopy != NULL) ? visCopySize - 1 : 0;
+			while (numVisLines > 0 &&
+				   LineStart(visLine+numVisLines) - visStart > fit)
+				numVisLines--;
+			visSize = LineStart(visLine+numVisLines) - visStart;
+			if (endUpdLine > numVisLines)
+				endUpdLine = numVisLines;
+		}
+	}
+	visText = GetPieceSpan(pieces, visStart, visSize, visCopy);
+}
+
 /* Updates the scroll bar info.
 
    The scroll bar info needs to be updated whenever the window size,
@@ -1987,8 +2113,8 @@ static void UpdateScrollInfo()
 	/* Set the vertical scroll bar. */
 	/* nMax refers to the maximum valid value, not the total number of
 	   elements. */
-	if (numLines * fontHeight > 0)
-		si.nMax = numLines * fontHeight - 1;
+	if (NumLines() * fontHeight > 0)
+		si.nMax = NumLines() * fontHeight - 1;
 	else
 		si.nMax = 0;
 	if (textAreaHeight == 0)
@@ -2415,95 +2541,62 @@ static void InsertText(char c, const char* str, bool silent)
 {
 	if (c != 0)
 	{
-		/* Temporary variables */
-		unsigned i;
+		bool replace;
 		/* Add the character. */
-		if (overwrite == false || buffer[textPos] == '\n' ||
-			buffer[textPos] == '\0')
+		replace = (overwrite == true && TextAt(textPos) != '\n' &&
+				   TextAt(textPos) != '\0');
+		/* A replaced character is deleted after inserting its
+		   replacement, so that nothing changes if the insert fails. */
+		if (InsertPieceText(pieces, textPos + (replace ? 1 : 0), &c, 1) ==
+			false)
+		{
+			MessageBeep(MB_OK);
+			return;
+		}
+		if (replace == true)
+			DeletePieceText(pieces, textPos, 1);
+		else
 		{
 			textSize++;
-			if (textSize >= buffSize)
-			{
-				buffSize += 1000;
-				buffer = (char*)realloc(buffer, buffSize);
-				UpdateRenderInfo(false, true);
-			}
-			if (textPos != (textSize - 1))
-			{
-				memmove(&(buffer[textPos+1]), &(buffer[textPos]),
-					textSize - textPos);
-			}
-			else
-				buffer[textPos+1] = '\0';
-
 			/* Correct all line beginning indices. */
-			for (i = caretLine + 1; i < numLines + 1; i++)
-				lineStarts[i]++;
+			ShiftLineStarts(lines, caretLine, 1);
 		}
-		buffer[textPos] = c;
 		textPos++;
 
 		/* Check for undo addition. */
-		if (silent == false && wasInsert == true && sameUndoOp == true)
-		{
-			char* curUndoData;
-			unsigned dataLen;
-			curUndoData = undoHistory[curUndo].data;
-			dataLen = strlen(curUndoData) + 2;
-			curUndoData = (char*)realloc(curUndoData, dataLen);
-			curUndoData[dataLen-2] = c;
-			curUndoData[dataLen-1] = '\0';
-			/* Make sure the reallocation is captured. */
-			undoHistory[curUndo].data = curUndoData;
-		}
-		else if (silent == false)
-		{
-			AddUndo();
-			undoHistory[curUndo].type = UE_DELETE;
-			undoHistory[curUndo].data = (char*)malloc(2);
-			undoHistory[curUndo].data[0] = c;
-			undoHistory[curUndo].data[1] = '\0';
-			undoHistory[curUndo].opPos = textPos - 1;
+		if (silent == false && (wasInsert == false || sameUndoOp == false ||
+			ExtendUndoEntry(undoJournal, textPos - 1, c) == false))
+		{
+			UndoEntry* entry;
+			entry = AddUndo(UE_DELETE, textPos - 1, 1);
+			if (entry != NULL)
+				entry->data[0] = c;
 			sameUndoOp = true;
 		}
 	}
 	else
 	{
 		unsigned insertLen;
-		/* Temporary variables */
-		unsigned i;
-		/* Allocate proper space. */
+		/* Paste the string in. */
 		insertLen = strlen(str);
-		if (textSize + insertLen >= buffSize)
+		if (InsertPieceText(pieces, textPos, str, insertLen) == false)
 		{
-			buffSize = textSize + insertLen;
-			buffSize += 1000 - buffSize % 1000;
-			buffer = (char*)realloc(buffer, buffSize);
-			UpdateRenderInfo(false, true);
+			MessageBeep(MB_OK);
+			return;
 		}
-		if (textPos < textSize)
-			memmove(&(buffer[textPos+insertLen]), &(buffer[textPos]),
-				textSize - textPos);
-		else
-			buffer[textPos+insertLen] = '\0';
-
-		/* Paste the string in. */
-		strncpy(&(buffer[textPos]), str, insertLen);
 		textSize += insertLen;
 		textPos += insertLen;
 
 		/* Correct all line beginning indices. */
-		for (i = caretLine + 1; i < numLines + 1; i++)
-			lineStarts[i] += insertLen;
+		ShiftLineStarts(lines, caretLine, insertLen);
 
 		/* Add an undo entry. */
 		if (silent == false)
 		{
-			AddUndo();
-			undoHistory[curUndo].type = UE_DELETE;
-			undoHistory[curUndo].data = (char*)malloc(insertLen + 1);
-			strcpy(undoHistory[curUndo].data, str);
-			undoHistory[curUndo].opPos = textPos - insertLen;
+			UndoEntry* entry;
+			entry = AddUndo(UE_DELETE, textPos - insertLen, insertLen);
+			if (entry != NULL)
+				memcpy(entry->data, str, insertLen);
 			sameUndoOp = false;
 		}
 	}
@@ -2554,39 +2647,17 @@ static void DeleteText(unsigned p1, unsigned p2, bool silent)
 	/* Check for undo addition. */
 	if (silent == false)
 	{
+		UndoEntry* entry;
 		if (p2 - p1 == 1)
 		{
-			if (wasInsert == false && sameUndoOp == true)
-			{
-				char* curUndoData;
-				unsigned dataLen;
-				curUndoData = undoHistory[curUndo].data;
-				dataLen = strlen(curUndoData) + 2;
-				curUndoData = (char*)realloc(curUndoData, dataLen);
-				if (p1 < undoHistory[curUndo].opPos)
-				{
-					/* Insert at the beginning of the string (move the
-					   null character too). */
-					memmove(&curUndoData[1], curUndoData, dataLen - 1);
-					curUndoData[0] = buffer[p1];
-					undoHistory[curUndo].opPos--;
-				}
-				else
-				{
-					curUndoData[dataLen-2] = buffer[p1];
-					curUndoData[dataLen-1] = '\0';
-				}
-				/* Make sure the reallocation is captured. */
-				undoHistory[curUndo].data = curUndoData;
-			}
-			else
+			/* A deleted character before the entry goes at the
+			   beginning of its text. */
+			if (wasInsert == true || sameUndoOp == false ||
+				ExtendUndoEntry(undoJournal, p1, TextAt(p1)) == false)
 			{
-				AddUndo();
-				undoHistory[curUndo].type = UE_INSERT;
-				undoHistory[curUndo].data = (char*)malloc(2);
-				undoHistory[curUndo].data[0] = buffer[p1];
-				undoHistory[curUndo].data[1] = '\0';
-				undoHistory[curUndo].opPos = p1;
+				entry = AddUndo(UE_INSERT, p1, 1);
+				if (entry != NULL)
+					entry->data[0] = TextAt(p1);
 				sameUndoOp = true;
 			}
 		}
@@ -2594,36 +2665,23 @@ static void DeleteText(unsigned p1, unsigned p2, bool silent)
 		{
 			unsigned delLen;
 			delLen = p2 - p1;
-			AddUndo();
-			undoHistory[curUndo].type = UE_INSERT;
-			undoHistory[curUndo].data = (char*)malloc(delLen + 1);
-			strncpy(undoHistory[curUndo].data, &(buffer[p1]), delLen);
-			undoHistory[curUndo].data[delLen] = '\0';
-			undoHistory[curUndo].opPos = p1;
+			entry = AddUndo(UE_INSERT, p1, delLen);
+			if (entry != NULL)
+				CopyPieceText(pieces, p1, delLen, entry->data);
 			sameUndoOp = false;
 		}
 	}
 
 	/* Delete the range of lines that definitely will become invalid. */
-	lastNumLines = numLines;
-	for (p1Line = 0; p1Line < numLines; p1Line++)
-	{
-		if (p1 < lineStarts[p1Line])
-			break;
-	}
-	p1Line--;
-	for (p2Line = p1Line; p2Line < numLines; p2Line++)
-	{
-		if (p2 < lineStarts[p2Line])
-			break;
-	}
-	p2Line--;
-	DeleteLineStarts(p1Line + 1, p2Line + 1);
+	lastNumLines = NumLines();
+	p1Line = FindLine(lines, p1);
+	p2Line = FindLine(lines, p2);
+	DeleteLineStarts(lines, p1Line + 1, p2Line + 1);
 	if (p2Line > p1Line)
 		deletedLines = true;
 
-	/* Erase the region from p1 to p2 (move null character too). */
-	memmove(&(buffer[p1]), &(buffer[p2]), textSize + 1 - p2);
+	/* Erase the region from p1 to p2. */
+	DeletePieceText(pieces, p1, p2 - p1);
 	textSize -= (p2 - p1);
 	if (textPos >= p2)
 		textPos -= (p2 - p1);
@@ -2631,11 +2689,7 @@ static void DeleteText(unsigned p1, unsigned p2, bool silent)
 		textPos = p1;
 
 	/* Correct line beginning indices after the deleted text. */
-	{
-		unsigned i;
-		for (i = p1Line + 1; i < numLines + 1; i++)
-			lineStarts[i] -= (p2 - p1);
-	}
+	ShiftLineStarts(lines, p1Line, -(long)(p2 - p1));
 
 	/** if (p2 - p1 != 1)
 		CalcCaretLine(); */
@@ -2654,18 +2708,19 @@ static void DeleteText(unsigned p1, unsigned p2, bool silent)
 		RetruncateLines(false);
 
 	if (deletedLines == true)
-		lastWrappedLine = numLines; /* Since we deleted line start
+		lastWrappedLine = NumLines(); /* Since we deleted line start
 									   indices ourselves */
 
 	/* Update the window. */
-	if (lastNumLines + 2 > totVisLines && lastNumLines > numLines &&
-		visLine + numVisLines > numLines)
+	if (lastNumLines + 2 > totVisLines && lastNumLines > NumLines() &&
+		visLine + numVisLines > NumLines())
 	{
-		ScrollContents(true, 0, -(int)(((visLine + numVisLines) - numLines) *
-			fontHeight), SB_VERT);
+		ScrollContents(true, 0,
+			-(int)(((visLine + numVisLines) - NumLines()) * fontHeight),
+			SB_VERT);
 		UpdateScrollInfo();
 		beginUpdLine = 0;
-		endUpdLine = (visLine + numVisLines) - numLines;
+		endUpdLine = (visLine + numVisLines) - NumLines();
 		if (visLnOffset > 0)
 			endUpdLine++;
 		if (deletedLines == true)
@@ -2674,7 +2729,7 @@ static void DeleteText(unsigned p1, unsigned p2, bool silent)
 				beginUpdLine = visLine;
 			beginUpdLine -= visLine; */
 			endUpdLine = lastWrappedLine - visLine;
-			if (lastWrappedLine == numLines &&
+			if (lastWrappedLine == NumLines() &&
 				numVisLines + 1 < totVisLines)
 				InvalidateRect(lastHwnd, NULL, TRUE);
 			InvalidateLines();
@@ -2721,7 +2776,7 @@ static void InvalidateLines()
 	   numLines). */
 	/* Otherwise, the last line that got deleted does not get erased
 	   from screen. */
-	if (visLine + numVisLines > numLines)
+	if (visLine + numVisLines > NumLines())
 		rt.bottom += numVisLines * fontHeight;
 	else
 		rt.bottom += endUpdLine * fontHeight;
@@ -2857,29 +2912,29 @@ static void ProcessMiscKey(WPARAM wParam)
 			cPosCalc = false;
 			break;
 		case VK_HOME: /* Beginning of line */
-			textPos = lineStarts[caretLine];
+			textPos = LineStart(caretLine);
 			break;
 		case VK_END: /* End of line */
-			if (caretLine == numLines - 1)
+			if (caretLine == NumLines() - 1)
 				textPos = textSize;
 			else
-				textPos = lineStarts[caretLine+1] - 1;
+				textPos = LineStart(caretLine+1) - 1;
 			break;
 		case VK_PRIOR: /* Page up */
 			if (textAreaHeight / fontHeight > caretLine)
 				caretLine = 0;
 			else
 				caretLine -= textAreaHeight / fontHeight;
-			textPos = lineStarts[caretLine];
+			textPos = LineStart(caretLine);
 			CalcCaretLine();
 			/** ScrollToCaret(); */
 			ScrollContents(false, SB_PAGEUP, 0, SB_VERT);
 			break;
 		case VK_NEXT: /* Page down */
 			caretLine += textAreaHeight / fontHeight;
-			if (caretLine > numLines - 1)
-				caretLine = numLines - 1;
-			textPos = lineStarts[caretLine];
+			if (caretLine > NumLines() - 1)
+				caretLine = NumLines() - 1;
+			textPos = LineStart(caretLine);
 			CalcCaretLine();
 			/** ScrollToCaret(); */
 			ScrollContents(false, SB_PAGEDOWN, 0, SB_VERT);
@@ -2943,82 +2998,20 @@ static void ProcessMiscKey(WPARAM wParam)
 	}
 }
 
-/* Adds space for an undo entry to the undo queue.
+/* Adds an undo entry with room for "length" bytes of text to the
+   undo queue.
 
-   Once this function is called, variables at "undoHistory[curUndo]"
-   should be set as necessary. */
-static void AddUndo()
+   Once this function is called, the text of the returned entry should
+   be filled in.  NULL is returned if there is no memory for it, in
+   which case the undo history is lost. */
+static UndoEntry* AddUndo(unsigned type, unsigned opPos, unsigned length)
 {
-	if (numUndo == 0)
-	{
-		undoHistory = (UndoEntry*)malloc(sizeof(UndoEntry) * 20);
-		numUndo++;
-	}
-	else if (curUndo != numUndo - 1)
-	{
-		/* Delete all the subsequent undos. */
-		unsigned lastUndo;
-		for (lastUndo = numUndo - 1; lastUndo > curUndo; lastUndo--)
-		{
-			free(undoHistory[lastUndo].data);
-		}
-		/* We want the allocation to be divisible by 20. */
-		numUndo = curUndo + 2;
-		undoHistory = (UndoEntry*)realloc(undoHistory, sizeof(UndoEntry) *
-										  (numUndo + (20 - numUndo % 20)));
-		curUndo++;
-	}
-	else
-	{
-		numUndo++;
-		if (numUndo % 20 == 0)
-		{
-			undoHistory = (UndoEntry*)realloc(undoHistory,
-				sizeof(UndoEntry) * (numUndo + 20));
-		}
-		curUndo++;
-	}
-	undoHistory[curUndo].data = NULL;
-	undoHistory[curUndo].oldData = NULL;
-	SendMessage(GetParent(lastHwnd), NM_CANUNDO, 0, TRUE);
+	UndoEntry* entry;
+	entry = AddUndoEntry(undoJournal, type, opPos, length, 0);
+	SendMessage(GetParent(lastHwnd), NM_CANUNDO, 0,
+				CanStepUndo(undoJournal) ? TRUE : FALSE);
 	SendMessage(GetParent(lastHwnd), NM_CANUNDO, 1, FALSE);
-}
-
-/* Inserts a line start before the specified line.
-
-   This function should only be used by WrapWords() and
-   TruncateLines(), as those are the only functions that should modify
-   the line starts cache. */
-static void InsertLineStart(unsigned line)
-{
-	numLines++;
-	if ((numLines + 1) % 20 == 0)
-	{
-		lineStarts = (unsigned*)realloc(lineStarts,
-			sizeof(unsigned) * (numLines + 21));
-	}
-	memmove(&lineStarts[line+1], &lineStarts[line], sizeof(unsigned) *
-		(numLines - line));
-	lineStarts[numLines] = textSize;
-}
-
-/* Deletes the line starts from the range starting at "begin" to the
-   element before "end".
-
-   This function should only be used by WrapWords() and
-   TruncateLines(), as those are the only functions that should modify
-   the line starts cache. */
-static void DeleteLineStarts(unsigned begin, unsigned end)
-{
-	memmove(&lineStarts[begin], &lineStarts[end], sizeof(unsigned) *
-		(numLines - end));
-	if (end - begin >= numLines)
-		numLines = 1;
-	else
-		numLines -= end - begin;
-	if (begin == 0)
-		lineStarts[0] = 0;
-	lineStarts[numLines] = textSize;
+	return entry;
 }
 
 /* Copies the region to the clipboard. */
@@ -3030,6 +3023,8 @@ static void CopyRegion()
 		unsigned numNewlines;
 		HANDLE clipData;
 		char* clipLock;
+		PieceIter iter;
+		bool more;
 		/* Temporary variables */
 		unsigned i;
 		unsigned j;
@@ -3046,25 +3041,33 @@ static void CopyRegion()
 		/* We will need to convert any newlines to carriage-return
 		   linefeed pairs. */
 		numNewlines = 0;
-		for (i = p1; i < p2; i++)
+		for (more = BeginPieceIter(pieces, p1, &iter);
+			 more && iter.pos < p2; more = NextPieceIter(&iter))
 		{
-			if (buffer[i] == '\n')
-				numNewlines++;
+			for (i = 0; i < iter.length && iter.pos + i < p2; i++)
+			{
+				if (iter.data[i] == '\n')
+					numNewlines++;
+			}
 		}
 		clipData = GlobalAlloc(GMEM_MOVEABLE, p2 - p1 + 1 + numNewlines);
 		clipLock = (char*)GlobalLock(clipData);
-		memcpy(clipLock, buffer + p1, p2 - p1);
-		for (i = p1, j = 0; i < p2; i++)
+		j = 0;
+		for (more = BeginPieceIter(pieces, p1, &iter);
+			 more && iter.pos < p2; more = NextPieceIter(&iter))
 		{
-			if (buffer[i] == '\n')
+			for (i = 0; i < iter.length && iter.pos + i < p2; i++)
 			{
-				clipLock[j] = '\r';
+				if (iter.data[i] == '\n')
+				{
+					clipLock[j] = '\r';
+					j++;
+					clipLock[j] = '\n';
+				}
+				else
+					clipLock[j] = iter.data[i];
 				j++;
-				clipLock[j] = '\n';
 			}
-			else
-				clipLock[j] = buffer[i];
-			j++;
 		}
 		clipLock[p2-p1+numNewlines] = '\0';
 		GlobalUnlock(clipData);
@@ -3081,44 +3084,36 @@ static void SkipWord(bool forward)
 {
 	if (forward == true)
 	{
-		while (buffer[textPos] != ' ' &&
-			   buffer[textPos] != '\t' &&
-			   buffer[textPos] != '\n' && textPos != textSize)
+		while (TextAt(textPos) != ' ' &&
+			   TextAt(textPos) != '\t' &&
+			   TextAt(textPos) != '\n' && textPos != textSize)
 			textPos++;
-		if (textPos + 1 < textSize && (buffer[textPos] == ' ' ||
-			buffer[textPos] == '\t' || buffer[textPos] == '\n'))
+		if (textPos + 1 < textSize && (TextAt(textPos) == ' ' ||
+			TextAt(textPos) == '\t' || TextAt(textPos) == '\n'))
 			textPos++;
 	}
 	else
 	{
-		if (textPos > 0 && (buffer[textPos-1] == ' ' ||
-			buffer[textPos-1] == '\t' || buffer[textPos-1] == '\n'))
+		if (textPos > 0 && (TextAt(textPos-1) == ' ' ||
+			TextAt(textPos-1) == '\t' || TextAt(textPos-1) == '\n'))
 			textPos--;
 		if (textPos > 0)
 			textPos--;
-		while (buffer[textPos] != ' ' &&
-			   buffer[textPos] != '\t' &&
-			   buffer[textPos] != '\n' && textPos != 0)
+		while (TextAt(textPos) != ' ' &&
+			   TextAt(textPos) != '\t' &&
+			   TextAt(textPos) != '\n' && textPos != 0)
 			textPos--;
-		if (buffer[textPos] == ' ' ||
-			buffer[textPos] == '\t' ||
-			buffer[textPos] == '\n')
+		if (TextAt(textPos) == ' ' ||
+			TextAt(textPos) == '\t' ||
+			TextAt(textPos) == '\n')
 			textPos++;
 	}
 }
 
-/* Calculates the caret line by searching from the first line
-   start. */
+/* Calculates the caret line from the text position. */
 static void CalcCaretLine()
 {
-	unsigned newCaretLine;
-	for (newCaretLine = 0; newCaretLine < numLines; newCaretLine++)
-	{
-		if (textPos < lineStarts[newCaretLine])
-			break;
-	}
-	newCaretLine--;
-	caretLine = newCaretLine;
+	caretLine = FindLine(lines, textPos);
 }
 
 /* Calculates the screen position of the caret from the text
@@ -3147,16 +3142,18 @@ static void CalcCaretPos()
 	if (wrapWords == true)
 	{
 		unsigned i;
-		for (i = lineStarts[caretLine]; i < textPos; i++)
+		unsigned lineStart;
+		lineStart = LineStart(caretLine);
+		for (i = lineStart; i < textPos; i++)
 			caretX +=
-				norTextRI[caretLine-visLine].pdx[i-lineStarts[caretLine]];
+				norTextRI[caretLine-visLine].pdx[i-lineStart];
 	}
 	else if (caretLine >= visLine && caretLine < visLine + numVisLines)
 	{
 		unsigned i;
 		unsigned lineStart;
 		caretX = 0;
-		lineStart = lineStarts[caretLine] + firstVisChars[caretLine-visLine];
+		lineStart = LineStart(caretLine) + firstVisChars[caretLine-visLine];
 		for (i = lineStart; i < textPos; i++)
 			caretX +=
 				norTextRI[caretLine-visLine].pdx[i-lineStart];
@@ -3185,7 +3182,7 @@ static void UpdateCaretPos()
 		unsigned i;
 		unsigned lineStart;
 		caretX = 0;
-		lineStart = lineStarts[caretLine] + firstVisChars[caretLine-visLine];
+		lineStart = LineStart(caretLine) + firstVisChars[caretLine-visLine];
 		for (i = lineStart; i < textPos; i++)
 			caretX +=
 				norTextRI[caretLine-visLine].pdx[i-lineStart];
@@ -3208,6 +3205,7 @@ static void TextPosFromPoint()
 	int yPos;
 	int lineTest;
 	unsigned lineEndRef;
+	unsigned lineStart;
 	unsigned visHitLine;
 	oldX = caretX; oldY = caretY;
 	xPos = lastMousePos.x;
@@ -3225,13 +3223,14 @@ static void TextPosFromPoint()
 		caretLine = (unsigned)(visLine - (unsigned)(-lineTest));
 	else
 		caretLine = (unsigned)(visLine + lineTest);
-	if (caretLine > numLines - 1)
-		caretLine = numLines - 1;
+	if (caretLine > NumLines() - 1)
+		caretLine = NumLines() - 1;
 
-	if (caretLine == numLines - 1)
+	if (caretLine == NumLines() - 1)
 		lineEndRef = textSize;
 	else
-		lineEndRef = lineStarts[caretLine+1];
+		lineEndRef = LineStart(caretLine+1);
+	lineStart = LineStart(caretLine);
 
 	/* Scroll vertically, if necessary. */
 	ScrollToCaret();
@@ -3254,55 +3253,55 @@ static void TextPosFromPoint()
 	visHitLine = caretLine - visLine;
 	if (wrapWords == true)
 	{
-	for (textPos = lineStarts[caretLine]; textPos < lineEndRef &&
+	for (textPos = lineStart; textPos < lineEndRef &&
 		 caretX < xPos; textPos++)
 	{
-		if (buffer[textPos] == '\n')
+		if (TextAt(textPos) == '\n')
 			break;
-		caretX += norTextRI[visHitLine].pdx[textPos-lineStarts[caretLine]];
+		caretX += norTextRI[visHitLine].pdx[textPos-lineStart];
 	}
 
 	/* Perform proper rounding. */
-	if (textPos <= lineEndRef && caretX != 0 && buffer[textPos] != '\n')
+	if (textPos <= lineEndRef && caretX != 0 && TextAt(textPos) != '\n')
 	{
 		POLYTEXT* hitRI;
 		int midChar;
 		hitRI = &norTextRI[visHitLine];
 		textPos--;
-		caretX -= hitRI->pdx[textPos-lineStarts[caretLine]];
+		caretX -= hitRI->pdx[textPos-lineStart];
 		midChar = xPos - caretX;
-		if (midChar > hitRI->pdx[textPos-lineStarts[caretLine]] / 2)
+		if (midChar > hitRI->pdx[textPos-lineStart] / 2)
 		{
-			caretX += hitRI->pdx[textPos-lineStarts[caretLine]];
+			caretX += hitRI->pdx[textPos-lineStart];
 			textPos++;
 		}
 	}
 	}
 	else
 	{
-	for (textPos = lineStarts[caretLine] + firstVisChars[visHitLine]; textPos < lineEndRef &&
+	for (textPos = lineStart + firstVisChars[visHitLine]; textPos < lineEndRef &&
 		 caretX < xPos + firstVisOffset[visHitLine]; textPos++)
 	{
-		if (buffer[textPos] == '\n')
+		if (TextAt(textPos) == '\n')
 			break;
-		caretX += norTextRI[visHitLine].pdx[textPos-lineStarts[caretLine]-firstVisChars[visHitLine]];
+		caretX += norTextRI[visHitLine].pdx[textPos-lineStart-firstVisChars[visHitLine]];
 	}
 	caretX -= firstVisOffset[visHitLine];
 
 	/* Perform proper rounding. */
-	if (textPos <= lineEndRef && caretX != 0 && buffer[textPos] != '\n')
+	if (textPos <= lineEndRef && caretX != 0 && TextAt(textPos) != '\n')
 	{
 		POLYTEXT* hitRI;
 		int midChar;
 		hitRI = &norTextRI[visHitLine];
 		textPos--;
 		caretX -= hitRI->
-			pdx[textPos-lineStarts[caretLine]-firstVisChars[visHitLine]];
+			pdx[textPos-lineStart-firstVisChars[visHitLine]];
 		midChar = xPos - caretX;
-		if (midChar > hitRI->pdx[textPos-lineStarts[caretLine]-
+		if (midChar > hitRI->pdx[textPos-lineStart-
 								 firstVisChars[visHitLine]] / 2)
 		{
-			caretX += hitRI->pdx[textPos-lineStarts[caretLine]-
+			caretX += hitRI->pdx[textPos-lineStart-
 								 firstVisChars[visHitLine]];
 			textPos++;
 		}
@@ -3411,25 +3410,6 @@ static void SortAscending(unsigned* p1, unsigned* p2)
 	}
 }
 
-/* Frees the dynamically allocated undo history. */
-static void FreeUndoHist()
-{
-	/* Free all the undo data. */
-	curUndo = 0;
-	while (curUndo < numUndo)
-	{
-		free(undoHistory[curUndo].data);
-		free(undoHistory[curUndo].oldData);
-		curUndo++;
-	}
-
-	/* Do the usual. */
-	free(undoHistory);
-	undoHistory = NULL;
-	numUndo = 0;
-	curUndo = 0;
-}
-
 /* Frees the dynamically allocated render info. */
 static void FreeRenderInfo(bool freeNorRI)
 {
@@ -3467,3 +3447,544 @@ static void FreeLineInfo()
 	free(firstVisOffset);
 	firstVisOffset = NULL;
 }
+
+/* Returns the character at a text position, or a null character at
+   the end of the text. */
+static char TextAt(unsigned pos)
+{
+	return GetPieceChar(pieces, pos);
+}
+
+/* Returns the start of a line, or the text size for the line after
+   the last one. */
+static unsigned LineStart(unsigned line)
+{
+	return (unsigned)GetLineStart(lines, line);
+}
+
+static unsigned NumLines()
+{
+	return (unsigned)CountLines(lines);
+}
+
+/* Processes the messages that behave differently in hex mode.
+   Returns true if the message was handled, with the value to return
+   in "result".
+
+   The hex view is read only and has no caret, so editing and caret
+   messages are swallowed here, and the pointer is an arrow rather
+   than an I-beam.  The text editor's shortcut menu only has editing
+   commands, so a context menu request goes to the parent window
+   instead.  Everything else falls through to the normal processing
+   in TextEditProc(). */
+static bool HexViewProc(UINT uMsg, WPARAM wParam, LPARAM lParam,
+	LRESULT* result)
+{
+	*result = 0;
+	switch (uMsg)
+	{
+	case WM_PAINT:
+	{
+		PAINTSTRUCT ps;
+		HDC hDC;
+		hDC = BeginPaint(lastHwnd, &ps);
+		PaintHexRows(hDC, &ps.rcPaint);
+		EndPaint(lastHwnd, &ps);
+		return true;
+	}
+	case WM_SIZE:
+		winWidth = LOWORD(lParam);
+		winHeight = HIWORD(lParam);
+		FreeRenderInfo(true);
+		CalcTextAreaDims();
+		UpdateHexScrollInfo();
+		InvalidateRect(lastHwnd, NULL, TRUE);
+		return true;
+	case WM_SETFONT:
+		FreeRenderInfo(true);
+		UpdateFont((HFONT)wParam);
+		CalcTextAreaDims();
+		UpdateHexFont();
+		UpdateHexScrollInfo();
+		if (lParam == TRUE)
+			InvalidateRect(lastHwnd, NULL, TRUE);
+		return true;
+	case WM_HSCROLL:
+		ScrollHexView(false, LOWORD(wParam), 0, SB_HORZ);
+		return true;
+	case WM_VSCROLL:
+		ScrollHexView(false, LOWORD(wParam), 0, SB_VERT);
+		return true;
+	case WM_MOUSEWHEEL:
+	{
+		static int rowMod = 0; /* Accumulated partial row scrolls */
+		int offset;
+		if (wheelLines == WHEEL_PAGESCROLL)
+			offset = NumVisHexRows();
+		else
+			offset = wheelLines;
+		offset *= -(short)HIWORD(wParam);
+		offset += rowMod;
+		rowMod = offset % WHEEL_DELTA;
+		offset /= WHEEL_DELTA;
+		ScrollHexView(true, 0, offset, SB_VERT);
+		return true;
+	}
+	case WM_KEYDOWN:
+		switch (wParam)
+		{
+		case VK_UP:
+			ScrollHexView(false, SB_LINEUP, 0, SB_VERT);
+			break;
+		case VK_DOWN:
+			ScrollHexView(false, SB_LINEDOWN, 0, SB_VERT);
+			break;
+		case VK_PRIOR:
+			ScrollHexView(false, SB_PAGEUP, 0, SB_VERT);
+			break;
+		case VK_NEXT:
+			ScrollHexView(false, SB_PAGEDOWN, 0, SB_VERT);
+			break;
+		case VK_HOME:
+			ScrollHexView(false, SB_TOP, 0, SB_VERT);
+			break;
+		case VK_END:
+			ScrollHexView(false, SB_BOTTOM, 0, SB_VERT);
+			break;
+		case VK_LEFT:
+			ScrollHexView(false, SB_LINELEFT, 0, SB_HORZ);
+			break;
+		case VK_RIGHT:
+			ScrollHexView(false, SB_LINERIGHT, 0, SB_HORZ);
+			break;
+		}
+		return true;
+	case WM_SETFOCUS:
+		hasFocus = true;
+		return true;
+	case WM_SETCURSOR:
+		if (LOWORD(lParam) == HTCLIENT)
+		{
+			SetCursor(LoadCursor(NULL, IDC_ARROW));
+			*result = TRUE;
+		}
+		else
+			*result = DefWindowProc(lastHwnd, uMsg, wParam, lParam);
+		return true;
+	case WM_CONTEXTMENU:
+		/* Lets the parent offer its own menu. */
+		*result = DefWindowProc(lastHwnd, uMsg, wParam, lParam);
+		return true;
+	case WM_CHAR:
+	case WM_CUT:
+	case WM_PASTE:
+	case WM_CLEAR:
+	case WM_UNDO:
+	case EM_REDO:
+	case EM_SETSEL:
+	case WM_LBUTTONDOWN:
+	case WM_MBUTTONDOWN:
+		return true;
+	}
+	return false;
+}
+
+/* Switches between the text view and the hex view.
+
+   A nonzero "newBytesPerRow" shows the text as rows of that many
+   bytes, and zero goes back to the text view.  The hex rows are found
+   arithmetically, so the line index is not kept up to date in hex
+   mode and is rebuilt when leaving it. */
+static void SetHexMode(unsigned newBytesPerRow)
+{
+	unsigned long topPos;
+
+	if (newBytesPerRow > HEX_MAX_ROW)
+		newBytesPerRow = HEX_MAX_ROW;
+
+	if (newBytesPerRow != 0)
+	{
+		if (hexMode == false)
+		{
+			/* Start at the top visible line and drop the region and
+			   caret. */
+			topPos = LineStart(visLine);
+			FreeRenderInfo(true);
+			regionActive = false;
+			numRegVisLines = 0;
+			if (hasFocus == true)
+				DestroyCaret();
+			hexMode = true;
+			UpdateHexFont();
+		}
+		else
+			topPos = hexTopRow * bytesPerRow;
+		bytesPerRow = newBytesPerRow;
+		hexTopRow = topPos / bytesPerRow;
+		xScrollPos = 0;
+		UpdateHexScrollInfo();
+	}
+	else if (hexMode == true)
+	{
+		/* Put the caret on the top visible row. */
+		hexMode = false;
+		textPos = hexTopRow * bytesPerRow;
+		if (textPos > textSize)
+			textPos = textSize;
+		xScrollPos = 0;
+		FreeRenderInfo(true);
+		CalcTextAreaDims();
+		GenTabStops();
+		if (wrapWords == true)
+			WrapWords(false);
+		else
+			TruncateLines();
+		visLine = FindLine(lines, textPos);
+		visLnOffset = 0;
+		UpdateScrollInfo();
+		UpdateRenderInfo(false, false);
+		CalcCaretPos();
+		if (hasFocus == true)
+		{
+			CreateCaret(lastHwnd, NULL, fontHeight / 16, fontHeight);
+			ShowCaret(lastHwnd);
+		}
+		UpdateCaretPos();
+	}
+	else
+		return;
+
+	InvalidateRect(lastHwnd, NULL, TRUE);
+	ZeroMemory(&updRect, sizeof(RECT));
+}
+
+/* Picks the font for the hex rows and caches its metrics.
+
+   The rows only line up in a fixed pitch font, so the window font is
+   used only if it is one.  Otherwise, a fixed pitch font of the same
+   height is created. */
+static void UpdateHexFont()
+{
+	TEXTMETRIC tm;
+	HDC hDC;
+
+	if (hexFontOwned == true)
+		DeleteObject(hexFont);
+	hexFontOwned = false;
+
+	if (hFont != NULL && fixedPitch == true)
+		hexFont = hFont;
+	else
+	{
+		hexFont = CreateFont(fontHeight, 0, 0, 0, FW_NORMAL, FALSE, FALSE,
+			FALSE, ANSI_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+			DEFAULT_QUALITY, FIXED_PITCH | FF_MODERN, NULL);
+		if (hexFont != NULL)
+			hexFontOwned = true;
+		else
+			hexFont = (HFONT)GetStockObject(ANSI_FIXED_FONT);
+	}
+
+	hDC = GetDC(lastHwnd);
+	SelectObject(hDC, hexFont);
+	GetTextMetrics(hDC, &tm);
+	ReleaseDC(lastHwnd, hDC);
+	hexRowHeight = tm.tmHeight;
+	hexCharWidth = tm.tmAveCharWidth;
+	if (hexRowHeight == 0)
+		hexRowHeight = 1;
+}
+
+/* Updates the scroll bar info for the hex view.
+
+   The vertical scroll bar counts rows rather than pixels.  Scroll bar
+   positions are ints, so a text with more rows than that scrolls
+   several rows per unit. */
+static void UpdateHexScrollInfo()
+{
+	SCROLLINFO si;
+	unsigned long numRows;
+	unsigned visRows;
+	unsigned rowWidth;
+
+	numRows = NumHexRows();
+	visRows = NumVisHexRows();
+	hexScrollShift = 0;
+	while ((numRows >> hexScrollShift) > 0x7FFFFFFF)
+		hexScrollShift++;
+
+	/* Keep the last row at the bottom of the window at most. */
+	if (numRows <= visRows)
+		hexTopRow = 0;
+	else if (hexTopRow > numRows - visRows)
+		hexTopRow = numRows - visRows;
+
+	si.cbSize = sizeof(SCROLLINFO);
+	si.fMask = SIF_PAGE | SIF_POS | SIF_RANGE | SIF_DISABLENOSCROLL;
+	si.nMin = 0;
+	if (numRows > 0)
+		si.nMax = (int)((numRows - 1) >> hexScrollShift);
+	else
+		si.nMax = 0;
+	si.nPage = visRows >> hexScrollShift;
+	if (si.nPage == 0)
+		si.nPage = 1;
+	si.nPos = (int)(hexTopRow >> hexScrollShift);
+	SetScrollInfo(lastHwnd, SB_VERT, &si, TRUE);
+
+	rowWidth = HEX_ROW_CHARS(bytesPerRow) * hexCharWidth;
+	if (rowWidth <= textAreaWidth)
+		xScrollPos = 0;
+	else if (xScrollPos > rowWidth - textAreaWidth)
+		xScrollPos = rowWidth - textAreaWidth;
+	if (rowWidth > textAreaWidth)
+		si.nMax = rowWidth - 1;
+	else
+		si.nMax = 0;
+	si.nPage = textAreaWidth;
+	si.nPos = xScrollPos;
+	SetScrollInfo(lastHwnd, SB_HORZ, &si, TRUE);
+}
+
+/* Scrolls the hex view.
+
+   This works like ScrollContents(), except that vertical "amount"
+   offsets are in rows.  Only the rows that scroll into view are
+   drawn, so scrolling costs the same no matter how long the text
+   is. */
+static void ScrollHexView(bool offset, unsigned otherType, long amount,
+						  int sBar)
+{
+	SCROLLINFO si;
+	RECT rt;
+
+	si.cbSize = sizeof(SCROLLINFO);
+	si.fMask = SIF_ALL;
+	GetScrollInfo(lastHwnd, sBar, &si);
+
+	rt.left = bordWidthX;
+	rt.top = bordWidthY;
+	rt.right = winWidth - bordWidthX;
+	rt.bottom = winHeight - bordWidthY;
+
+	if (sBar == SB_VERT)
+	{
+		unsigned long oldTopRow;
+		unsigned long maxTopRow;
+		unsigned long numRows;
+		unsigned visRows;
+
+		numRows = NumHexRows();
+		visRows = NumVisHexRows();
+		if (numRows > visRows)
+			maxTopRow = numRows - visRows;
+		else
+			maxTopRow = 0;
+		oldTopRow = hexTopRow;
+
+		if (offset == false)
+		{
+			switch (otherType)
+			{
+			case SB_TOP:
+				hexTopRow = 0;
+				break;
+			case SB_BOTTOM:
+				hexTopRow = maxTopRow;
+				break;
+			case SB_LINEUP:
+				amount = -1;
+				break;
+			case SB_LINEDOWN:
+				amount = 1;
+				break;
+			case SB_PAGEUP:
+				amount = -(long)visRows;
+				break;
+			case SB_PAGEDOWN:
+				amount = visRows;
+				break;
+			case SB_THUMBTRACK:
+				hexTopRow = (unsigned long)si.nTrackPos << hexScrollShift;
+				break;
+			}
+		}
+		if (amount < 0 && (unsigned long)-amount > hexTopRow)
+			hexTopRow = 0;
+		else
+			hexTopRow += amount;
+		if (hexTopRow > maxTopRow)
+			hexTopRow = maxTopRow;
+		if (hexTopRow == oldTopRow)
+			return;
+
+		si.fMask = SIF_POS;
+		si.nPos = (int)(hexTopRow >> hexScrollShift);
+		SetScrollInfo(lastHwnd, SB_VERT, &si, TRUE);
+
+		/* Jumps farther than a window just redraw everything. */
+		if (hexTopRow > oldTopRow + visRows ||
+			oldTopRow > hexTopRow + visRows)
+		{
+			InvalidateRect(lastHwnd, &rt, TRUE);
+		}
+		else
+		{
+			int dy;
+			if (oldTopRow > hexTopRow)
+				dy = (int)(oldTopRow - hexTopRow) * (int)hexRowHeight;
+			else
+				dy = -(int)(hexTopRow - oldTopRow) * (int)hexRowHeight;
+			ScrollWindowEx(lastHwnd, 0, dy, &rt, &rt, NULL, NULL,
+				SW_INVALIDATE | SW_ERASE);
+		}
+	}
+	else
+	{
+		int oldPos;
+		oldPos = si.nPos;
+		if (offset == false)
+		{
+			switch (otherType)
+			{
+			case SB_LEFT:
+				si.nPos = si.nMin;
+				break;
+			case SB_RIGHT:
+				si.nPos = si.nMax;
+				break;
+			case SB_LINELEFT:
+				si.nPos -= hexCharWidth;
+				break;
+			case SB_LINERIGHT:
+				si.nPos += hexCharWidth;
+				break;
+			case SB_PAGELEFT:
+				si.nPos -= si.nPage;
+				break;
+			case SB_PAGERIGHT:
+				si.nPos += si.nPage;
+				break;
+			case SB_THUMBTRACK:
+				si.nPos = si.nTrackPos;
+				break;
+			}
+		}
+		else
+			si.nPos += amount;
+
+		/* Let Windows clamp the position. */
+		si.fMask = SIF_POS;
+		SetScrollInfo(lastHwnd, SB_HORZ, &si, TRUE);
+		GetScrollInfo(lastHwnd, SB_HORZ, &si);
+		if (si.nPos == oldPos)
+			return;
+		xScrollPos = si.nPos;
+		ScrollWindowEx(lastHwnd, oldPos - si.nPos, 0, &rt, &rt,
+			NULL, NULL, SW_INVALIDATE | SW_ERASE);
+	}
+}
+
+/* Draws the hex rows that cross "rt".
+
+   Each row is formatted straight from the text when it lies in one
+   piece, which is always the case for a text set with EM_SETHANDLE
+   that has not been edited. */
+static void PaintHexRows(HDC hDC, const RECT* rt)
+{
+	static const char hexDigits[] = "0123456789ABCDEF";
+	char rowText[HEX_ROW_CHARS(HEX_MAX_ROW)];
+	char rowScratch[HEX_MAX_ROW];
+	unsigned long numRows;
+	unsigned long row, endRow;
+	RECT rowRect;
+
+	SelectObject(hDC, hexFont);
+	SetTextColor(hDC, GetSysColor(COLOR_WINDOWTEXT));
+	SetBkColor(hDC, GetSysColor(COLOR_WINDOW));
+	IntersectClipRect(hDC, bordWidthX, bordWidthY,
+		winWidth - bordWidthX, winHeight - bordWidthY);
+
+	/* Find the rows from the update rectangle. */
+	numRows = NumHexRows();
+	if (rt->bottom <= (int)bordWidthY)
+		return;
+	row = hexTopRow;
+	if (rt->top > (int)bordWidthY)
+		row += (rt->top - bordWidthY) / hexRowHeight;
+	endRow = hexTopRow +
+		(rt->bottom - bordWidthY + hexRowHeight - 1) / hexRowHeight;
+	if (endRow > numRows)
+		endRow = numRows;
+
+	rowRect.left = bordWidthX;
+	rowRect.right = winWidth - bordWidthX;
+	for (; row < endRow; row++)
+	{
+		unsigned long rowPos;
+		unsigned rowSize;
+		const unsigned char* data;
+		char* p;
+		/* Temporary variables */
+		unsigned i;
+
+		rowPos = row * bytesPerRow;
+		rowSize = bytesPerRow;
+		if (textSize - rowPos < rowSize)
+			rowSize = textSize - rowPos;
+		data = (const unsigned char*)
+			GetPieceSpan(pieces, rowPos, rowSize, rowScratch);
+
+		/* Format the offset, hex bytes, and ASCII columns. */
+		p = rowText;
+		for (i = 0; i < 8; i++)
+			*p++ = hexDigits[(rowPos >> (28 - i * 4)) & 0xF];
+		*p++ = ' ';
+		*p++ = ' ';
+		for (i = 0; i < bytesPerRow; i++)
+		{
+			if (i < rowSize)
+			{
+				p[0] = hexDigits[data[i] >> 4];
+				p[1] = hexDigits[data[i] & 0xF];
+			}
+			else
+			{
+				p[0] = ' ';
+				p[1] = ' ';
+			}
+			p[2] = ' ';
+			p += 3;
+		}
+		*p++ = ' ';
+		for (i = 0; i < rowSize; i++)
+		{
+			if (data[i] >= 0x20 && data[i] < 0x7F)
+				*p++ = (char)data[i];
+			else
+				*p++ = '.';
+		}
+
+		rowRect.top = (int)bordWidthY + (row - hexTopRow) * hexRowHeight;
+		rowRect.bottom = rowRect.top + hexRowHeight;
+		ExtTextOut(hDC, bordWidthX + leftMargin - xScrollPos, rowRect.top,
+			ETO_OPAQUE, &rowRect, rowText, (UINT)(p - rowText), NULL);
+	}
+}
+
+/* Returns the number of hex rows, counting a partial last row. */
+static unsigned long NumHexRows()
+{
+	return textSize / bytesPerRow + (textSize % bytesPerRow != 0);
+}
+
+/* Returns the number of hex rows that fit entirely in the window,
+   but at least one. */
+static unsigned NumVisHexRows()
+{
+	unsigned visRows;
+	visRows = textAreaHeight / hexRowHeight;
+	if (visRows == 0)
+		visRows = 1;
+	return visRows;
+}
@@ -0,0 +1,355 @@
+/* Image and palette files */
+/* Reads the common interchange formats that artwork comes in from
+   outside of Mohawk archives.  Palettes are recognized by content
+   rather than by extension:
+
+   - Microsoft RIFF palettes: "RIFF", size, "PAL ", then a "data"
+     chunk holding a LOGPALETTE (u16 version, u16 count, then red,
+     green, blue, and flags bytes for every color), all little-endian.
+   - JASC (Paint Shop Pro) palettes: the text "JASC-PAL", a version
+     line, a count line, and one "red green blue" line per color.
+   - Adobe color tables: 256 red, green, blue triples, optionally
+     followed by a big-endian u16 count and transparent index.
+
+   Colors are returned as 0x00RRGGBB, like MhkBitmap palettes.
+
+   Images are read from Windows BMP files with 1, 4, 8, 24, or 32 bits
+   per pixel and no compression, and returned as top-down rows of
+   PalColor pixels.  They are written as top-down 32-bit BMP files,
+   which keep PalColor rows as they are.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "PalExpand.h"
+#include "ImageFile.h"
+
+#define GET16LE(p) ((unsigned)(p)[0] | ((unsigned)(p)[1] << 8))
+#define GET32LE(p) (GET16LE(p) | ((unsigned long)GET16LE((p) + 2) << 16))
+#define PUT16LE(p, v) ((p)[0] = (unsigned char)(v), \
+	(p)[1] = (unsigned char)((v) >> 8))
+#define PUT32LE(p, v) (PUT16LE(p, (v) & 0xffff), PUT16LE((p) + 2, (v) >> 16))
+#define MAX_PALETTE_FILE 8192
+
+static int ParseRiffPalette(const unsigned char* data, size_t size,
+	unsigned long* palette, unsigned* numColors);
+static int ParseJascPalette(unsigned char* data, size_t size,
+	unsigned long* palette, unsigned* numColors);
+static int ParseBmpFile(const unsigned char* data, size_t size,
+	PalColor** pixels, unsigned* width, unsigned* height);
+
+/* Loads up to 256 colors from a palette file.  Returns an MhkError
+   code.  */
+int LoadPaletteFile(const char* filename, unsigned long* palette,
+	unsigned* numColors)
+{
+	unsigned char data[MAX_PALETTE_FILE + 1];
+	size_t size;
+	FILE* fp;
+	unsigned i;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return MHK_EIO;
+	size = fread(data, 1, sizeof(data), fp);
+	if (ferror(fp))
+	{
+		fclose(fp);
+		return MHK_EIO;
+	}
+	fclose(fp);
+	if (size > MAX_PALETTE_FILE)
+		return MHK_EFORMAT;
+
+	if (size >= 12 && memcmp(data, "RIFF", 4) == 0 &&
+		memcmp(data + 8, "PAL ", 4) == 0)
+		return ParseRiffPalette(data, size, palette, numColors);
+	if (size >= 8 && memcmp(data, "JASC-PAL", 8) == 0)
+		return ParseJascPalette(data, size, palette, numColors);
+	if (size == 768 || size == 772)
+	{
+		*numColors = 256;
+		if (size == 772)
+		{
+			unsigned count = (data[768] << 8) | data[769];
+			if (count > 0 && count <= 256)
+				*numColors = count;
+		}
+		for (i = 0; i < *numColors; i++)
+		{
+			palette[i] = ((unsigned long)data[i*3] << 16) |
+				((unsigned long)data[i*3+1] << 8) | data[i*3+2];
+		}
+		return MHK_OK;
+	}
+	return MHK_EFORMAT;
+}
+
+static int ParseRiffPalette(const unsigned char* data, size_t size,
+	unsigned long* palette, unsigned* numColors)
+{
+	size_t pos = 12;
+	/* Look for the "data" chunk.  */
+	while (pos + 8 <= size)
+	{
+		unsigned long chunkSize = GET32LE(data + pos + 4);
+		if (memcmp(data + pos, "data", 4) == 0)
+		{
+			unsigned count;
+			unsigned i;
+			const unsigned char* entry;
+			if (chunkSize < 4 || chunkSize > size - pos - 8)
+				return MHK_EFORMAT;
+			count = GET16LE(data + pos + 10);
+			if (count == 0 || count > 256 || 4 + count * 4 > chunkSize)
+				return MHK_EFORMAT;
+			entry = data + pos + 12;
+			for (i = 0; i < count; i++, entry += 4)
+			{
+				palette[i] = ((unsigned long)entry[0] << 16) |
+					((unsigned long)entry[1] << 8) | entry[2];
+			}
+			*numColors = count;
+			return MHK_OK;
+		}
+		/* Compare with what is left, since the sum could wrap.  */
+		if (chunkSize > size - pos - 8)
+			break;
+		pos += 8 + chunkSize + (chunkSize & 1);
+	}
+	return MHK_EFORMAT;
+}
+
+static int ParseJascPalette(unsigned char* data, size_t size,
+	unsigned long* palette, unsigned* numColors)
+{
+	char* text;
+	char* line;
+	unsigned lineNum = 0;
+	unsigned count = 0;
+	unsigned i = 0;
+
+	/* "data" has room for a terminator, and strtok() modifies it.  */
+	text = (char*)data;
+	text[size] = '\0';
+	for (line = strtok(text, "\r\n"); line != NULL;
+		 line = strtok(NULL, "\r\n"), lineNum++)
+	{
+		unsigned r, g, b;
+		if (lineNum < 2)
+			continue; /* Signature and version */
+		if (lineNum == 2)
+		{
+			if (sscanf(line, "%u", &count) != 1 || count == 0 ||
+				count > 256)
+				return MHK_EFORMAT;
+			continue;
+		}
+		if (i >= count)
+			break;
+		if (sscanf(line, "%u %u %u", &r, &g, &b) != 3 ||
+			r > 255 || g > 255 || b > 255)
+			return MHK_EFORMAT;
+		palette[i++] = ((unsigned long)r << 16) | (g << 8) | b;
+	}
+	if (count == 0 || i < count)
+		return MHK_EFORMAT;
+	*numColors = count;
+	return MHK_OK;
+}
+
+/* Loads a BMP file.  On success, "*pixels" holds "*width" times
+   "*height" pixels, top row first, and must be freed by the caller.
+   Returns an MhkError code.  */
+int LoadBmpFile(const char* filename, PalColor** pixels, unsigned* width,
+	unsigned* height)
+{
+	unsigned char* data;
+	long size;
+	FILE* fp;
+	int error;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return MHK_EIO;
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+		fseek(fp, 0, SEEK_SET) != 0)
+	{
+		fclose(fp);
+		return MHK_EIO;
+	}
+	data = (unsigned char*)malloc(size + 1);
+	if (data == NULL)
+	{
+		fclose(fp);
+		return MHK_ENOMEM;
+	}
+	if (fread(data, 1, size, fp) != (size_t)size)
+	{
+		free(data);
+		fclose(fp);
+		return MHK_EIO;
+	}
+	fclose(fp);
+	error = ParseBmpFile(data, size, pixels, width, height);
+	free(data);
+	return error;
+}
+
+/* Writes an image to a BMP file.  The rows of "pixels" are "stride"
+   bytes apart.  Returns an MhkError code.  */
+int SaveBmpFile(const char* filename, const PalColor* pixels,
+	unsigned width, unsigned height, size_t stride)
+{
+	unsigned char header[14 + 40];
+	unsigned long imageSize = (unsigned long)width * height * 4;
+	unsigned char* row;
+	FILE* fp;
+	unsigned x, y;
+	bool ok;
+
+	if (width == 0 || height == 0 || width > 0x4000 || height > 0x4000)
+		return MHK_EFORMAT;
+	row = (unsigned char*)malloc((size_t)width * 4);
+	if (row == NULL)
+		return MHK_ENOMEM;
+	memset(header, 0, sizeof(header));
+	header[0] = 'B';
+	header[1] = 'M';
+	PUT32LE(header + 2, sizeof(header) + imageSize);
+	PUT32LE(header + 10, sizeof(header));
+	PUT32LE(header + 14, 40);
+	PUT32LE(header + 18, width);
+	/* A negative height makes the rows top-down.  */
+	PUT32LE(header + 22, (~(unsigned long)height + 1) & 0xffffffffUL);
+	PUT16LE(header + 26, 1);
+	PUT16LE(header + 28, 32);
+	PUT32LE(header + 34, imageSize);
+
+	fp = fopen(filename, "wb");
+	if (fp == NULL)
+	{
+		free(row);
+		return MHK_EIO;
+	}
+	ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+	for (y = 0; y < height && ok; y++)
+	{
+		const PalColor* src = (const PalColor*)
+			((const unsigned char*)pixels + (size_t)y * stride);
+		for (x = 0; x < width; x++)
+			PUT32LE(row + x * 4, src[x]);
+		ok = fwrite(row, 4, width, fp) == width;
+	}
+	if (fclose(fp) != 0)
+		ok = false;
+	free(row);
+	return ok ? MHK_OK : MHK_EIO;
+}
+
+static int ParseBmpFile(const unsigned char* data, size_t size,
+	PalColor** pixels, unsigned* width, unsigned* height)
+{
+	PalColor colors[256];
+	const unsigned char* info;
+	unsigned long offset, infoSize, compression;
+	unsigned long w, h, numColors;
+	bool topDown;
+	unsigned bpp;
+	size_t rowSize;
+	unsigned x, y;
+	PalColor* out;
+
+	/* BITMAPFILEHEADER, then at least a BITMAPINFOHEADER */
+	if (size < 14 + 40 || data[0] != 'B' || data[1] != 'M')
+		return MHK_EFORMAT;
+	offset = GET32LE(data + 10);
+	info = data + 14;
+	infoSize = GET32LE(info);
+	if (infoSize < 40 || infoSize > size - 14)
+		return MHK_EFORMAT;
+	w = GET32LE(info + 4);
+	h = GET32LE(info + 8);
+	/* Rows are stored bottom-up unless the height is negative.  */
+	topDown = (h & 0x80000000UL) != 0;
+	if (topDown)
+		h = (~h + 1) & 0xffffffffUL;
+	bpp = GET16LE(info + 14);
+	compression = GET32LE(info + 16);
+	numColors = GET32LE(info + 32);
+	if (w == 0 || w > 0x4000 || h == 0 || h > 0x4000)
+		return MHK_EFORMAT;
+	if (compression == 3 && bpp == 32)
+	{
+		/* BI_BITFIELDS is fine as long as the masks are the usual
+		   ones.  */
+		const unsigned char* masks =
+			(infoSize >= 52) ? info + 40 : info + infoSize;
+		if (masks + 12 > data + size || GET32LE(masks) != 0xff0000UL ||
+			GET32LE(masks + 4) != 0xff00UL || GET32LE(masks + 8) != 0xffUL)
+			return MHK_EUNSUPPORTED;
+	}
+	else if (compression != 0)
+		return MHK_EUNSUPPORTED;
+	if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24 && bpp != 32)
+		return MHK_EUNSUPPORTED;
+
+	if (bpp <= 8)
+	{
+		const unsigned char* entry = info + infoSize;
+		unsigned i;
+		if (numColors == 0 || numColors > (1UL << bpp))
+			numColors = 1UL << bpp;
+		if (entry + numColors * 4 > data + size)
+			return MHK_EFORMAT;
+		for (i = 0; i < 256; i++)
+			colors[i] = 0;
+		for (i = 0; i < numColors; i++, entry += 4)
+			colors[i] = ((PalColor)entry[2] << 16) |
+				((PalColor)entry[1] << 8) | entry[0];
+	}
+
+	*width = (unsigned)w;
+	*height = (unsigned)h;
+	rowSize = ((w * bpp + 31) / 32) * 4;
+	if (offset > size || rowSize * *height > size - offset)
+		return MHK_EFORMAT;
+	out = (PalColor*)malloc((size_t)*width * *height * sizeof(PalColor));
+	if (out == NULL)
+		return MHK_ENOMEM;
+
+	for (y = 0; y < *height; y++)
+	{
+		const unsigned char* row = data + offset +
+			rowSize * (topDown ? y : *height - 1 - y);
+		PalColor* dst = out + (size_t)y * *width;
+		for (x = 0; x < *width; x++)
+		{
+			switch (bpp)
+			{
+			case 1:
+				dst[x] = colors[(row[x >> 3] >> (7 - (x & 7))) & 1];
+				break;
+			case 4:
+				dst[x] = colors[(row[x >> 1] >> ((x & 1) ? 0 : 4)) & 0xf];
+				break;
+			case 8:
+				dst[x] = colors[row[x]];
+				break;
+			case 24:
+				dst[x] = ((PalColor)row[x*3+2] << 16) |
+					((PalColor)row[x*3+1] << 8) | row[x*3];
+				break;
+			default:
+				dst[x] = ((PalColor)row[x*4+2] << 16) |
+					((PalColor)row[x*4+1] << 8) | row[x*4];
+				break;
+			}
+		}
+	}
+	*pixels = out;
+	return MHK_OK;
+}
@@ -0,0 +1,16 @@
+/* Image and palette file interface */
+/* Include "bool.h" and "PalExpand.h" before this header.  */
+
+#ifndef IMAGEFILE_H
+#define IMAGEFILE_H
+
+#include <stddef.h>
+
+int LoadPaletteFile(const char* filename, unsigned long* palette,
+	unsigned* numColors);
+int LoadBmpFile(const char* filename, PalColor** pixels, unsigned* width,
+	unsigned* height);
+int SaveBmpFile(const char* filename, const PalColor* pixels,
+	unsigned width, unsigned height, size_t stride);
+
+#endif /* not IMAGEFILE_H */
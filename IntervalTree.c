@@ -0,0 +1,180 @@
+/* Interval tree */
+/* Finds the intervals that overlap a range, in time proportional to
+   the logarithm of the number of intervals plus the number found.
+
+   The tree is built once from a set of intervals and does not change;
+   a changed set is indexed again.  That lets it live in two flat
+   arrays instead of linked nodes.  The intervals are sorted by their
+   first position, and the tree over them is implicit: the root of the
+   items from "lo" up to "hi" is the one in the middle, and its
+   subtrees are the halves on either side.  Along with the sorted
+   items, the tree keeps for every node the largest last position in
+   its subtree.  A search can then pass over a whole subtree whose
+   intervals all end before the range, and stop at the first node that
+   starts after it, since everything to its right does too.  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "IntervalTree.h"
+
+struct IntervalTree_t
+{
+	size_t count;
+	Interval* items; /* Sorted by first position */
+	unsigned long* maxLast; /* Largest last position under each node */
+};
+
+static int CompareIntervals(const void* a, const void* b);
+static unsigned long IndexSubtree(IntervalTree* tree, size_t lo, size_t hi);
+static bool VisitSubtree(const IntervalTree* tree, size_t lo, size_t hi,
+	unsigned long qlo, unsigned long qhi, IntervalFunc func, void* param,
+	size_t* found);
+
+/* Indexes a copy of "count" intervals.  Returns NULL if out of
+   memory.  */
+IntervalTree* CreateIntervalTree(const Interval* items, size_t count)
+{
+	IntervalTree* tree;
+	size_t i;
+
+	tree = (IntervalTree*)calloc(1, sizeof(IntervalTree));
+	if (tree == NULL)
+		return NULL;
+	if (count == 0)
+		return tree;
+	tree->items = (Interval*)malloc(count * sizeof(Interval));
+	tree->maxLast = (unsigned long*)malloc(count * sizeof(unsigned long));
+	if (tree->items == NULL || tree->maxLast == NULL)
+	{
+		FreeIntervalTree(tree);
+		return NULL;
+	}
+	memcpy(tree->items, items, count * sizeof(Interval));
+	tree->count = count;
+	/* Intervals usually come in order already.  */
+	for (i = 1; i < count; i++)
+	{
+		if (CompareIntervals(&items[i - 1], &items[i]) > 0)
+		{
+			qsort(tree->items, count, sizeof(Interval), CompareIntervals);
+			break;
+		}
+	}
+	IndexSubtree(tree, 0, count);
+	return tree;
+}
+
+size_t IntervalCount(const IntervalTree* tree)
+{
+	return tree->count;
+}
+
+/* Returns the interval that overlaps the range from "lo" to "hi",
+   inclusive, with the lowest first position, or NULL if none does.  */
+const Interval* FindInterval(const IntervalTree* tree, unsigned long lo,
+	unsigned long hi)
+{
+	size_t begin = 0, end = tree->count;
+	while (begin < end)
+	{
+		size_t mid = begin + (end - begin) / 2;
+		if (tree->maxLast[mid] < lo)
+			return NULL;
+		/* If anything on the left reaches the range, the answer is
+		   there or nowhere, since the rest start later.  */
+		if (begin < mid && tree->maxLast[begin + (mid - begin) / 2] >= lo)
+		{
+			end = mid;
+			continue;
+		}
+		if (tree->items[mid].first > hi)
+			return NULL;
+		if (tree->items[mid].last >= lo)
+			return &tree->items[mid];
+		begin = mid + 1;
+	}
+	return NULL;
+}
+
+/* Calls "func" for every interval that overlaps the range from "lo" to
+   "hi", inclusive, in order of first position, until it returns false.
+   Returns the number of calls.  */
+size_t QueryIntervals(const IntervalTree* tree, unsigned long lo,
+	unsigned long hi, IntervalFunc func, void* param)
+{
+	size_t found = 0;
+	if (lo <= hi)
+		VisitSubtree(tree, 0, tree->count, lo, hi, func, param, &found);
+	return found;
+}
+
+void FreeIntervalTree(IntervalTree* tree)
+{
+	if (tree == NULL)
+		return;
+	free(tree->items);
+	free(tree->maxLast);
+	free(tree);
+}
+
+static int CompareIntervals(const void* a, const void* b)
+{
+	const Interval* ia = (const Interval*)a;
+	const Interval* ib = (const Interval*)b;
+	if (ia->first != ib->first)
+		return ia->first < ib->first ? -1 : 1;
+	if (ia->last != ib->last)
+		return ia->last < ib->last ? -1 : 1;
+	return ia->tag < ib->tag ? -1 : (ia->tag > ib->tag);
+}
+
+/* Fills in the largest last positions of the subtree of the items
+   from "lo" up to "hi", and returns the one of its root.  The depth of
+   the recursion is the height of the tree.  */
+static unsigned long IndexSubtree(IntervalTree* tree, size_t lo, size_t hi)
+{
+	size_t mid;
+	unsigned long maxLast, sub;
+	if (lo >= hi)
+		return 0;
+	mid = lo + (hi - lo) / 2;
+	maxLast = tree->items[mid].last;
+	sub = IndexSubtree(tree, lo, mid);
+	if (sub > maxLast)
+		maxLast = sub;
+	sub = IndexSubtree(tree, mid + 1, hi);
+	if (sub > maxLast)
+		maxLast = sub;
+	tree->maxLast[mid] = maxLast;
+	return maxLast;
+}
+
+/* Visits the subtree of the items from "lo" up to "hi" in order.
+   Returns false if "func" asked to stop.  */
+static bool VisitSubtree(const IntervalTree* tree, size_t lo, size_t hi,
+	unsigned long qlo, unsigned long qhi, IntervalFunc func, void* param,
+	size_t* found)
+{
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		const Interval* item = &tree->items[mid];
+		if (tree->maxLast[mid] < qlo)
+			return true;
+		if (!VisitSubtree(tree, lo, mid, qlo, qhi, func, param, found))
+			return false;
+		if (item->first > qhi)
+			return true;
+		if (item->last >= qlo)
+		{
+			(*found)++;
+			if (!func(item, param))
+				return false;
+		}
+		/* Go on with the right subtree without recursing.  */
+		lo = mid + 1;
+	}
+	return true;
+}
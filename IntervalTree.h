@@ -0,0 +1,31 @@
+/* Interval tree interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef INTERVALTREE_H
+#define INTERVALTREE_H
+
+#include <stddef.h>
+
+typedef struct Interval_t Interval;
+typedef struct IntervalTree_t IntervalTree;
+/* Called for each interval found.  Return false to stop.  */
+typedef bool (*IntervalFunc)(const Interval* item, void* param);
+
+/* A range of positions from "first" to "last", inclusive, so a point
+   has "first" equal to "last".  "tag" is for the caller.  */
+struct Interval_t
+{
+	unsigned long first;
+	unsigned long last;
+	unsigned long tag;
+};
+
+IntervalTree* CreateIntervalTree(const Interval* items, size_t count);
+size_t IntervalCount(const IntervalTree* tree);
+const Interval* FindInterval(const IntervalTree* tree, unsigned long lo,
+	unsigned long hi);
+size_t QueryIntervals(const IntervalTree* tree, unsigned long lo,
+	unsigned long hi, IntervalFunc func, void* param);
+void FreeIntervalTree(IntervalTree* tree);
+
+#endif /* not INTERVALTREE_H */
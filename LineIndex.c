@@ -0,0 +1,404 @@
+/* Line index */
+/* Keeps the start positions of the lines of a text so that looking up
+   a line, finding the line at a position, and moving every line after
+   an edit all take time proportional to the logarithm of the number of
+   lines.
+
+   Rather than the starts themselves, the index stores the length of
+   each line, so an edit only changes the length of the line it is on
+   and the starts after it follow.  The lines are the nodes of a
+   randomized balanced tree (a treap) in text order, and every node
+   keeps the number of lines and the total length of its subtree.  A
+   start is then the sum of the lengths on the way down to its line.
+   Lines are added and removed by splitting the tree at a line and
+   joining the parts again.  The nodes live in one array and refer to
+   each other by index, with index zero standing for no node.
+
+   A whole text is indexed at once by BuildLineIndex(), which lays the
+   lines out as a perfectly balanced tree in one pass instead of adding
+   them one at a time.  */
+
+#include <stdlib.h>
+
+#include "bool.h"
+#include "LineIndex.h"
+
+typedef struct LineNode_t LineNode;
+
+struct LineNode_t
+{
+	size_t left;
+	size_t right;
+	unsigned long priority; /* Parents are higher than their children */
+	unsigned long length; /* Length of this line */
+	unsigned long sum; /* Total length of the subtree */
+	size_t count; /* Number of lines in the subtree */
+};
+
+struct LineIndex_t
+{
+	LineNode* nodes; /* Node zero is the empty tree */
+	size_t numNodes;
+	size_t maxNodes;
+	size_t freeNodes; /* Unused nodes, linked through "left" */
+	size_t root;
+	unsigned long seed;
+};
+
+static void AddLength(LineIndex* index, size_t line, unsigned long delta);
+static size_t NewLine(LineIndex* index);
+static void FreeLines(LineIndex* index, size_t node);
+static void UpdateLine(LineIndex* index, size_t node);
+static void SplitLines(LineIndex* index, size_t node, size_t line,
+	size_t* before, size_t* after);
+static size_t JoinLines(LineIndex* index, size_t before, size_t after);
+static size_t BuildLines(LineIndex* index, size_t begin, size_t end);
+
+/* Returns an index of one empty line, or NULL if out of memory.  */
+LineIndex* CreateLineIndex(void)
+{
+	LineIndex* index;
+	index = (LineIndex*)calloc(1, sizeof(LineIndex));
+	if (index == NULL)
+		return NULL;
+	index->seed = 2463534242UL;
+	index->maxNodes = 64;
+	index->nodes = (LineNode*)calloc(index->maxNodes, sizeof(LineNode));
+	if (index->nodes == NULL)
+	{
+		free(index);
+		return NULL;
+	}
+	ResetLineIndex(index);
+	return index;
+}
+
+/* Goes back to one empty line.  */
+void ResetLineIndex(LineIndex* index)
+{
+	index->numNodes = 1;
+	index->freeNodes = 0;
+	index->root = NewLine(index);
+}
+
+size_t CountLines(const LineIndex* index)
+{
+	return index->nodes[index->root].count;
+}
+
+/* Returns the start of "line", or the end of the text if "line" is
+   the line count.  */
+unsigned long GetLineStart(const LineIndex* index, size_t line)
+{
+	unsigned long start = 0;
+	size_t node = index->root;
+	while (node != 0)
+	{
+		const LineNode* cur = &index->nodes[node];
+		size_t before = index->nodes[cur->left].count;
+		if (line == before)
+			return start + index->nodes[cur->left].sum;
+		if (line < before)
+			node = cur->left;
+		else
+		{
+			start += index->nodes[cur->left].sum + cur->length;
+			line -= before + 1;
+			node = cur->right;
+		}
+	}
+	return start;
+}
+
+/* Moves the start of "line" to "pos" without moving the starts of any
+   other lines.  Setting the entry after the last line sets the end of
+   the text.  */
+void SetLineStart(LineIndex* index, size_t line, unsigned long pos)
+{
+	unsigned long delta;
+	if (line == 0 || line > CountLines(index))
+		return;
+	delta = pos - GetLineStart(index, line);
+	AddLength(index, line - 1, delta);
+	if (line < CountLines(index))
+		AddLength(index, line, 0 - delta);
+}
+
+/* Moves the starts of all the lines after "line", and the end of the
+   text, by "delta".  */
+void ShiftLineStarts(LineIndex* index, size_t line, long delta)
+{
+	if (line < CountLines(index))
+		AddLength(index, line, (unsigned long)delta);
+}
+
+/* Returns the last line that starts at or before "pos".  */
+size_t FindLine(const LineIndex* index, unsigned long pos)
+{
+	unsigned long base = 0;
+	size_t node = index->root;
+	size_t line = 0, found = 0;
+	while (node != 0)
+	{
+		const LineNode* cur = &index->nodes[node];
+		unsigned long start = base + index->nodes[cur->left].sum;
+		if (start <= pos)
+		{
+			found = line + index->nodes[cur->left].count;
+			line = found + 1;
+			base = start + cur->length;
+			node = cur->right;
+		}
+		else
+			node = cur->left;
+	}
+	return found;
+}
+
+/* Adds an empty line before "line", so that the new line and the one
+   that was there start at the same position.  Returns false if out of
+   memory.  */
+bool InsertLineStart(LineIndex* index, size_t line)
+{
+	size_t node, before, after;
+	if (line > CountLines(index))
+		return false;
+	node = NewLine(index);
+	if (node == 0)
+		return false;
+	SplitLines(index, index->root, line, &before, &after);
+	index->root = JoinLines(index, JoinLines(index, before, node), after);
+	return true;
+}
+
+/* Adds a line that starts at "pos" after the last line.  */
+bool AppendLineStart(LineIndex* index, unsigned long pos)
+{
+	size_t line = CountLines(index);
+	size_t node = NewLine(index);
+	unsigned long delta;
+	if (node == 0)
+		return false;
+	delta = pos - index->nodes[index->root].sum;
+	index->root = JoinLines(index, index->root, node);
+	AddLength(index, line - 1, delta);
+	AddLength(index, line, 0 - delta);
+	return true;
+}
+
+/* Deletes the line starts from "begin" up to "end", joining those
+   lines to the one before.  The first line always stays.  */
+void DeleteLineStarts(LineIndex* index, size_t begin, size_t end)
+{
+	size_t before, middle, after;
+	unsigned long length;
+	if (begin == 0)
+		begin = 1;
+	if (end > CountLines(index))
+		end = CountLines(index);
+	if (begin >= end)
+		return;
+	SplitLines(index, index->root, end, &middle, &after);
+	SplitLines(index, middle, begin, &before, &middle);
+	length = index->nodes[middle].sum;
+	FreeLines(index, middle);
+	index->root = JoinLines(index, before, after);
+	AddLength(index, begin - 1, length);
+}
+
+/* Replaces all the lines with "numStarts" lines that start at the
+   positions in "starts", the first of which should be zero, and a text
+   that ends at "end".  Returns false if out of memory, leaving the
+   index unchanged.  */
+bool BuildLineIndex(LineIndex* index, const unsigned long* starts,
+	size_t numStarts, unsigned long end)
+{
+	size_t i;
+	if (numStarts == 0)
+	{
+		ResetLineIndex(index);
+		SetLineStart(index, 1, end);
+		return true;
+	}
+	if (numStarts + 1 > index->maxNodes)
+	{
+		LineNode* nodes = (LineNode*)realloc(index->nodes,
+			(numStarts + 1) * sizeof(LineNode));
+		if (nodes == NULL)
+			return false;
+		index->nodes = nodes;
+		index->maxNodes = numStarts + 1;
+	}
+	for (i = 0; i < numStarts; i++)
+	{
+		unsigned long next = (i + 1 < numStarts) ? starts[i + 1] : end;
+		index->nodes[i + 1].length = next - starts[i];
+	}
+	index->numNodes = numStarts + 1;
+	index->freeNodes = 0;
+	index->root = BuildLines(index, 1, numStarts + 1);
+	return true;
+}
+
+void FreeLineIndex(LineIndex* index)
+{
+	if (index == NULL)
+		return;
+	free(index->nodes);
+	free(index);
+}
+
+/* Adds "delta" to the length of "line".  */
+static void AddLength(LineIndex* index, size_t line, unsigned long delta)
+{
+	size_t node = index->root;
+	while (node != 0)
+	{
+		LineNode* cur = &index->nodes[node];
+		size_t before = index->nodes[cur->left].count;
+		cur->sum += delta;
+		if (line == before)
+		{
+			cur->length += delta;
+			return;
+		}
+		if (line < before)
+			node = cur->left;
+		else
+		{
+			line -= before + 1;
+			node = cur->right;
+		}
+	}
+}
+
+/* Returns a new empty line that is not in the tree yet, or zero if out
+   of memory.  */
+static size_t NewLine(LineIndex* index)
+{
+	size_t node;
+	LineNode* cur;
+	if (index->freeNodes != 0)
+	{
+		node = index->freeNodes;
+		index->freeNodes = index->nodes[node].left;
+	}
+	else
+	{
+		if (index->numNodes >= index->maxNodes)
+		{
+			size_t maxNodes = index->maxNodes * 2;
+			LineNode* nodes = (LineNode*)realloc(index->nodes,
+				maxNodes * sizeof(LineNode));
+			if (nodes == NULL)
+				return 0;
+			index->nodes = nodes;
+			index->maxNodes = maxNodes;
+		}
+		node = index->numNodes++;
+	}
+	/* xorshift32 */
+	index->seed ^= (index->seed << 13) & 0xFFFFFFFFUL;
+	index->seed ^= index->seed >> 17;
+	index->seed ^= (index->seed << 5) & 0xFFFFFFFFUL;
+	cur = &index->nodes[node];
+	cur->left = 0;
+	cur->right = 0;
+	cur->priority = index->seed;
+	cur->length = 0;
+	cur->sum = 0;
+	cur->count = 1;
+	return node;
+}
+
+/* Puts the subtree at "node" on the list of unused nodes.  */
+static void FreeLines(LineIndex* index, size_t node)
+{
+	while (node != 0)
+	{
+		size_t right = index->nodes[node].right;
+		FreeLines(index, index->nodes[node].left);
+		index->nodes[node].left = index->freeNodes;
+		index->freeNodes = node;
+		node = right;
+	}
+}
+
+static void UpdateLine(LineIndex* index, size_t node)
+{
+	LineNode* cur = &index->nodes[node];
+	const LineNode* left = &index->nodes[cur->left];
+	const LineNode* right = &index->nodes[cur->right];
+	cur->sum = left->sum + cur->length + right->sum;
+	cur->count = left->count + 1 + right->count;
+}
+
+/* Splits the subtree at "node" into its first "line" lines and the
+   rest.  */
+static void SplitLines(LineIndex* index, size_t node, size_t line,
+	size_t* before, size_t* after)
+{
+	LineNode* cur;
+	size_t left;
+	if (node == 0)
+	{
+		*before = 0;
+		*after = 0;
+		return;
+	}
+	cur = &index->nodes[node];
+	left = index->nodes[cur->left].count;
+	if (line <= left)
+	{
+		SplitLines(index, cur->left, line, before, &cur->left);
+		*after = node;
+	}
+	else
+	{
+		SplitLines(index, cur->right, line - left - 1, &cur->right, after);
+		*before = node;
+	}
+	UpdateLine(index, node);
+}
+
+/* Joins two subtrees, with the lines of "before" first.  */
+static size_t JoinLines(LineIndex* index, size_t before, size_t after)
+{
+	size_t node;
+	if (before == 0)
+		return after;
+	if (after == 0)
+		return before;
+	if (index->nodes[before].priority > index->nodes[after].priority)
+	{
+		node = JoinLines(index, index->nodes[before].right, after);
+		index->nodes[before].right = node;
+		UpdateLine(index, before);
+		return before;
+	}
+	node = JoinLines(index, before, index->nodes[after].left);
+	index->nodes[after].left = node;
+	UpdateLine(index, after);
+	return after;
+}
+
+/* Makes a balanced subtree of the nodes from "begin" up to "end",
+   whose lengths are already set, and returns its root.  */
+static size_t BuildLines(LineIndex* index, size_t begin, size_t end)
+{
+	size_t mid;
+	LineNode* cur;
+	if (begin >= end)
+		return 0;
+	mid = begin + (end - begin) / 2;
+	cur = &index->nodes[mid];
+	cur->left = BuildLines(index, begin, mid);
+	cur->right = BuildLines(index, mid + 1, end);
+	UpdateLine(index, mid);
+	/* In a treap of random priorities, the root of "count" lines has
+	   the highest of "count" random numbers, which is expected to be
+	   this.  Lines added later then land at the same depths as if
+	   the tree had been built one line at a time.  */
+	cur->priority = 0xFFFFFFFFUL - 0xFFFFFFFFUL / (cur->count + 1);
+	return mid;
+}
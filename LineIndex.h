@@ -0,0 +1,28 @@
+/* Line index interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <stddef.h>
+
+typedef struct LineIndex_t LineIndex;
+
+/* The index holds the start of every line, plus one more entry after
+   the last line for the end of the text, so "line" ranges from zero to
+   the line count.  */
+LineIndex* CreateLineIndex(void);
+void ResetLineIndex(LineIndex* index);
+size_t CountLines(const LineIndex* index);
+unsigned long GetLineStart(const LineIndex* index, size_t line);
+void SetLineStart(LineIndex* index, size_t line, unsigned long pos);
+void ShiftLineStarts(LineIndex* index, size_t line, long delta);
+size_t FindLine(const LineIndex* index, unsigned long pos);
+bool InsertLineStart(LineIndex* index, size_t line);
+bool AppendLineStart(LineIndex* index, unsigned long pos);
+void DeleteLineStarts(LineIndex* index, size_t begin, size_t end);
+bool BuildLineIndex(LineIndex* index, const unsigned long* starts,
+	size_t numStarts, unsigned long end);
+void FreeLineIndex(LineIndex* index);
+
+#endif /* not LINEINDEX_H */
@@ -0,0 +1,416 @@
+/* Line scanner */
+/* Finds the line starts of a whole text for the line index.  The
+   newline search compares a block of bytes at a time against '\n' and
+   turns the result into a bit mask, so a block without newlines costs
+   one compare and one test.  There are three kernels:
+
+   - Scalar: a plain byte loop.
+   - SSE2: 16 bytes per compare.  Counting adds the compare results up
+     in byte lanes and sums the lanes every 255 blocks, so it does not
+     have to look at the mask at all.
+   - AVX2: the same with 32 bytes per compare.
+
+   ScanLineStarts() splits the text into chunks that are searched on
+   the threads of a work pool, if it is given one, each into its own list of newlines.  The
+   lists are then stitched together in order, which is also where the
+   lines that are too long get broken, since that depends on where the
+   previous line started.  */
+
+#include <stdlib.h>
+
+#include "bool.h"
+#include "PieceTable.h"
+#include "WorkPool.h"
+#include "LineScan.h"
+
+#if !defined(LINESCAN_NO_SIMD) && (defined(__i386__) || \
+	defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64))
+#define LINESCAN_X86
+#include <immintrin.h>
+#ifdef __GNUC__
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+#endif
+
+/* Texts are split into chunks of this many bytes for the threads.  */
+#define SCAN_CHUNK 0x400000
+
+typedef struct ScanChunk_t ScanChunk;
+typedef size_t (*CountKernel)(const char* data, size_t length);
+typedef size_t (*FindKernel)(const char* data, size_t length,
+	unsigned long base, unsigned long* found);
+
+/* One chunk of the text and the newlines found in it */
+struct ScanChunk_t
+{
+	const PieceTable* table;
+	unsigned long begin;
+	unsigned long end;
+	unsigned long* found; /* Text positions of the newlines */
+	size_t numFound;
+	bool failed;
+};
+
+static int maxLevel = -1; /* Not detected yet */
+static unsigned curLevel;
+
+static void DetectLineScanLevel(void);
+static void ScanChunkFunc(void* arg);
+static size_t ScalarCount(const char* data, size_t length);
+static size_t ScalarFind(const char* data, size_t length,
+	unsigned long base, unsigned long* found);
+#ifdef LINESCAN_X86
+static unsigned LowestBit(unsigned mask);
+TARGET_SSE2 static size_t Sse2Count(const char* data, size_t length);
+TARGET_SSE2 static size_t Sse2Find(const char* data, size_t length,
+	unsigned long base, unsigned long* found);
+TARGET_AVX2 static size_t Avx2Count(const char* data, size_t length);
+TARGET_AVX2 static size_t Avx2Find(const char* data, size_t length,
+	unsigned long base, unsigned long* found);
+#endif
+
+/* Returns the highest LineScanLevel in use.  */
+unsigned GetLineScanLevel(void)
+{
+	if (maxLevel < 0)
+		DetectLineScanLevel();
+	return curLevel;
+}
+
+/* Limits the newline search to "level" or lower, for benchmarks and
+   for ruling out a misbehaving kernel.  Returns the level that is
+   actually in effect.  */
+unsigned SetLineScanLevel(unsigned level)
+{
+	if (maxLevel < 0)
+		DetectLineScanLevel();
+	curLevel = (level < (unsigned)maxLevel) ? level : (unsigned)maxLevel;
+	return curLevel;
+}
+
+const char* LineScanLevelName(unsigned level)
+{
+	switch (level)
+	{
+	case LINESCAN_SCALAR: return "scalar";
+	case LINESCAN_SSE2: return "SSE2";
+	case LINESCAN_AVX2: return "AVX2";
+	}
+	return "unknown";
+}
+
+/* Returns the number of newlines in "length" bytes of "data".  */
+size_t CountNewlines(const char* data, size_t length)
+{
+	CountKernel kernel = ScalarCount;
+#ifdef LINESCAN_X86
+	unsigned level = GetLineScanLevel();
+	if (level >= LINESCAN_AVX2)
+		kernel = Avx2Count;
+	else if (level >= LINESCAN_SSE2)
+		kernel = Sse2Count;
+#endif
+	return kernel(data, length);
+}
+
+/* Stores the positions of the newlines in "length" bytes of "data" to
+   "found", counting from "base" for the first byte.  "found" must have
+   room for all of them.  Returns the number found.  */
+size_t FindNewlines(const char* data, size_t length, unsigned long base,
+	unsigned long* found)
+{
+	FindKernel kernel = ScalarFind;
+#ifdef LINESCAN_X86
+	unsigned level = GetLineScanLevel();
+	if (level >= LINESCAN_AVX2)
+		kernel = Avx2Find;
+	else if (level >= LINESCAN_SSE2)
+		kernel = Sse2Find;
+#endif
+	return kernel(data, length, base, found);
+}
+
+/* Finds where every line of "table" starts.  A line starts at zero,
+   at every newline, and "limit" bytes after the start of a line that
+   runs longer than that, unless "limit" is zero.  The chunks of the
+   text are searched on "pool"; if it is NULL, the text is searched as
+   one chunk.  Returns the starts
+   in an array to be freed with free(), and their number in
+   "numStarts", or NULL if out of memory.  */
+unsigned long* ScanLineStarts(WorkPool* pool, const PieceTable* table,
+	unsigned long limit, size_t* numStarts)
+{
+	unsigned long size = (unsigned long)PieceTableSize(table);
+	size_t numChunks = (pool != NULL) ? size / SCAN_CHUNK + 1 : 1;
+	ScanChunk* chunks;
+	unsigned long* starts = NULL;
+	unsigned long lineStart;
+	size_t maxStarts, n, i, j;
+
+	/* Detect the kernels before any of the threads need them.  */
+	GetLineScanLevel();
+	chunks = (ScanChunk*)calloc(numChunks, sizeof(ScanChunk));
+	if (chunks == NULL)
+		return NULL;
+	for (i = 0; i < numChunks; i++)
+	{
+		chunks[i].table = table;
+		chunks[i].begin = (unsigned long)i * SCAN_CHUNK;
+		chunks[i].end = (i + 1 < numChunks) ?
+			chunks[i].begin + SCAN_CHUNK : size;
+		SubmitWork(pool, ScanChunkFunc, &chunks[i]);
+	}
+	WaitWorkPool(pool);
+
+	maxStarts = 1;
+	for (i = 0; i < numChunks; i++)
+	{
+		if (chunks[i].failed)
+			goto cleanup;
+		maxStarts += chunks[i].numFound;
+	}
+	/* Every break adds "limit" bytes to the start of the line.  */
+	if (limit != 0)
+		maxStarts += size / limit;
+	starts = (unsigned long*)malloc(maxStarts * sizeof(unsigned long));
+	if (starts == NULL)
+		goto cleanup;
+
+	starts[0] = 0;
+	n = 1;
+	lineStart = 0;
+	for (i = 0; i < numChunks; i++)
+	{
+		for (j = 0; j < chunks[i].numFound; j++)
+		{
+			unsigned long pos = chunks[i].found[j];
+			while (limit != 0 && pos - lineStart > limit)
+			{
+				lineStart += limit;
+				starts[n++] = lineStart;
+			}
+			starts[n++] = pos;
+			lineStart = pos;
+		}
+	}
+	while (limit != 0 && size - lineStart > limit)
+	{
+		lineStart += limit;
+		starts[n++] = lineStart;
+	}
+	*numStarts = n;
+
+cleanup:
+	for (i = 0; i < numChunks; i++)
+		free(chunks[i].found);
+	free(chunks);
+	return starts;
+}
+
+static void DetectLineScanLevel(void)
+{
+	int level = LINESCAN_SCALAR;
+#if defined(LINESCAN_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		level = LINESCAN_SSE2;
+	if (__builtin_cpu_supports("avx2"))
+		level = LINESCAN_AVX2;
+#elif defined(LINESCAN_X86)
+	int info[4];
+	int maxLeaf;
+	__cpuid(info, 0);
+	maxLeaf = info[0];
+	if (maxLeaf >= 1)
+	{
+		bool osAvx;
+		__cpuid(info, 1);
+		if (info[3] & (1 << 26))
+			level = LINESCAN_SSE2;
+		/* AVX needs both the CPU and the OS to save the YMM
+		   registers.  */
+		osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+			(_xgetbv(0) & 6) == 6;
+		if (osAvx && maxLeaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5))
+				level = LINESCAN_AVX2;
+		}
+	}
+#endif
+	maxLevel = level;
+	curLevel = level;
+}
+
+/* Counts the newlines of a chunk, then stores them.  Reading the text
+   twice is cheaper than growing the list as it goes.  */
+static void ScanChunkFunc(void* arg)
+{
+	ScanChunk* chunk = (ScanChunk*)arg;
+	PieceIter iter;
+	size_t count = 0;
+	bool more;
+
+	for (more = BeginPieceIter(chunk->table, chunk->begin, &iter);
+		 more && iter.pos < chunk->end; more = NextPieceIter(&iter))
+	{
+		size_t n = iter.length;
+		if (n > chunk->end - iter.pos)
+			n = chunk->end - iter.pos;
+		count += CountNewlines(iter.data, n);
+	}
+	if (count == 0)
+		return;
+	chunk->found = (unsigned long*)malloc(count * sizeof(unsigned long));
+	if (chunk->found == NULL)
+	{
+		chunk->failed = true;
+		return;
+	}
+	for (more = BeginPieceIter(chunk->table, chunk->begin, &iter);
+		 more && iter.pos < chunk->end; more = NextPieceIter(&iter))
+	{
+		size_t n = iter.length;
+		if (n > chunk->end - iter.pos)
+			n = chunk->end - iter.pos;
+		chunk->numFound += FindNewlines(iter.data, n,
+			(unsigned long)iter.pos, chunk->found + chunk->numFound);
+	}
+}
+
+static size_t ScalarCount(const char* data, size_t length)
+{
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < length; i++)
+		count += (data[i] == '\n');
+	return count;
+}
+
+static size_t ScalarFind(const char* data, size_t length,
+	unsigned long base, unsigned long* found)
+{
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < length; i++)
+	{
+		if (data[i] == '\n')
+			found[count++] = base + (unsigned long)i;
+	}
+	return count;
+}
+
+#ifdef LINESCAN_X86
+
+/* Returns the index of the lowest set bit of a nonzero mask.  */
+static unsigned LowestBit(unsigned mask)
+{
+#ifdef __GNUC__
+	return (unsigned)__builtin_ctz(mask);
+#else
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned)index;
+#endif
+}
+
+TARGET_SSE2 static size_t Sse2Count(const char* data, size_t length)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	size_t count = 0;
+	size_t i = 0;
+	while (i + 16 <= length)
+	{
+		/* Each lane counts down by one per match, so it can take 255
+		   blocks before it wraps.  */
+		__m128i lanes = zero;
+		size_t end = length - i >= 255 * 16 ? i + 255 * 16 : length;
+		__m128i sums;
+		for (; i + 16 <= end; i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+			lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(v, newline));
+		}
+		sums = _mm_sad_epu8(lanes, zero);
+		count += (size_t)_mm_cvtsi128_si32(sums) +
+			(size_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+	}
+	return count + ScalarCount(data + i, length - i);
+}
+
+TARGET_SSE2 static size_t Sse2Find(const char* data, size_t length,
+	unsigned long base, unsigned long* found)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		unsigned mask = (unsigned)_mm_movemask_epi8(
+			_mm_cmpeq_epi8(v, newline));
+		while (mask != 0)
+		{
+			found[count++] = base + (unsigned long)(i + LowestBit(mask));
+			mask &= mask - 1;
+		}
+	}
+	return count + ScalarFind(data + i, length - i,
+		base + (unsigned long)i, found + count);
+}
+
+TARGET_AVX2 static size_t Avx2Count(const char* data, size_t length)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	size_t count = 0;
+	size_t i = 0;
+	while (i + 32 <= length)
+	{
+		__m256i lanes = zero;
+		size_t end = length - i >= 255 * 32 ? i + 255 * 32 : length;
+		__m256i sums;
+		__m128i half;
+		for (; i + 32 <= end; i += 32)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+			lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(v, newline));
+		}
+		sums = _mm256_sad_epu8(lanes, zero);
+		half = _mm_add_epi64(_mm256_castsi256_si128(sums),
+			_mm256_extracti128_si256(sums, 1));
+		count += (size_t)_mm_cvtsi128_si32(half) +
+			(size_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+	}
+	return count + ScalarCount(data + i, length - i);
+}
+
+TARGET_AVX2 static size_t Avx2Find(const char* data, size_t length,
+	unsigned long base, unsigned long* found)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(v, newline));
+		while (mask != 0)
+		{
+			found[count++] = base + (unsigned long)(i + LowestBit(mask));
+			mask &= mask - 1;
+		}
+	}
+	return count + ScalarFind(data + i, length - i,
+		base + (unsigned long)i, found + count);
+}
+
+#endif /* LINESCAN_X86 */
@@ -0,0 +1,30 @@
+/* Line scanner interface */
+/* Include "bool.h", "PieceTable.h", and "WorkPool.h" before this
+   header.  */
+
+#ifndef LINESCAN_H
+#define LINESCAN_H
+
+#include <stddef.h>
+
+/* Instruction set levels of the newline search, in order of
+   preference.  */
+enum LineScanLevel
+{
+	LINESCAN_SCALAR,
+	LINESCAN_SSE2, /* 16 bytes per compare */
+	LINESCAN_AVX2 /* 32 bytes per compare */
+};
+
+#define LINESCAN_NUM_LEVELS 3
+
+unsigned GetLineScanLevel(void);
+unsigned SetLineScanLevel(unsigned level);
+const char* LineScanLevelName(unsigned level);
+size_t CountNewlines(const char* data, size_t length);
+size_t FindNewlines(const char* data, size_t length, unsigned long base,
+	unsigned long* found);
+unsigned long* ScanLineStarts(WorkPool* pool, const PieceTable* table,
+	unsigned long limit, size_t* numStarts);
+
+#endif /* not LINESCAN_H */
@@ -0,0 +1,541 @@
+/* Mohawk archive interface */
+
+/* Brief description
+   *****************
+
+   A Mohawk archive is a big-endian container that maps (type, ID)
+   pairs to resource data, much like a Doom WAD file.  The whole
+   archive is loaded into memory at once, since the archives used by
+   the games are small by today's standards.  Resource data that is
+   not changed simply points into the loaded image, and changed data
+   is allocated separately.
+
+   File layout
+   ***********
+
+   0	'MHWK', u32 size of the rest of the file
+   8	'RSRC', u16 version, u16 compaction, u32 total file size,
+		u32 absolute offset of the resource directory,
+		u16 file table offset, u16 file table size
+
+   The resource directory starts with u16 name list offset and u16
+   number of types, followed by a (u32 tag, u16 resource table
+   offset, u16 name table offset) entry for each type.  A resource
+   table is a u16 count followed by (u16 ID, u16 file index) entries,
+   where the file index starts at one.  A name table is a u16 count
+   followed by (u16 name offset, u16 resource table index) entries.
+   Names are zero-terminated strings inside the name list.  The file
+   table is a u32 count followed by (u32 offset, u16 size, u8 size
+   high byte, u8 flags, u16 unknown) entries.  The low 3 bits of the
+   flags are the highest bits of the size.  All directory offsets are
+   relative to the start of the resource directory, except for name
+   offsets, which are relative to the name list.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+
+#define MHK_HEADER_SIZE 28
+
+static int CompareResources(const void* a, const void* b);
+
+/* Loads and parses the archive in the given file.  On failure, NULL
+   is returned and an MhkError code is stored in "error" if it is not
+   NULL.  */
+MhkArchive* LoadMhkArchive(const char* filename, int* error)
+{
+	FILE* fp;
+	long size;
+	unsigned char* image;
+	MhkArchive* archive;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+	{
+		if (error != NULL)
+			*error = MHK_EIO;
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (size < MHK_HEADER_SIZE)
+	{
+		fclose(fp);
+		if (error != NULL)
+			*error = MHK_EFORMAT;
+		return NULL;
+	}
+
+	image = (unsigned char*)malloc(size);
+	if (image == NULL)
+	{
+		fclose(fp);
+		if (error != NULL)
+			*error = MHK_ENOMEM;
+		return NULL;
+	}
+	if (fread(image, 1, size, fp) != (size_t)size)
+	{
+		fclose(fp);
+		free(image);
+		if (error != NULL)
+			*error = MHK_EIO;
+		return NULL;
+	}
+	fclose(fp);
+
+	archive = ParseMhkArchive(image, size, error);
+	if (archive == NULL)
+		free(image);
+	return archive;
+}
+
+/* Parses an archive image that was allocated with malloc().  The
+   returned archive takes ownership of "image".  On failure, NULL is
+   returned, the caller still owns "image", and an MhkError code is
+   stored in "error" if it is not NULL.  */
+MhkArchive* ParseMhkArchive(unsigned char* image, unsigned long size,
+	int* error)
+{
+	MhkArchive* archive;
+	unsigned char* dir;
+	unsigned long dirOffset;
+	unsigned long dirSize;
+	unsigned fileTableOffset;
+	unsigned nameListOffset;
+	unsigned numTypes;
+	unsigned long numFiles;
+	unsigned i, j;
+	int result = MHK_EFORMAT;
+
+	if (size < MHK_HEADER_SIZE || memcmp(image, "MHWK", 4) != 0 ||
+		memcmp(image + 8, "RSRC", 4) != 0)
+		goto fail;
+	dirOffset = MHK_GET32(image + 20);
+	if (dirOffset >= size)
+		goto fail;
+	dir = image + dirOffset;
+	dirSize = size - dirOffset;
+	fileTableOffset = MHK_GET16(image + 24);
+	if (dirSize < 4 || fileTableOffset + 4 > dirSize)
+		goto fail;
+
+	archive = (MhkArchive*)malloc(sizeof(MhkArchive));
+	if (archive == NULL)
+	{
+		result = MHK_ENOMEM;
+		goto fail;
+	}
+	memset(archive, 0, sizeof(MhkArchive));
+	archive->image = image;
+	archive->imageSize = size;
+	archive->version = MHK_GET16(image + 12);
+	archive->compaction = MHK_GET16(image + 14);
+
+	/* Read the file table.  */
+	numFiles = MHK_GET32(dir + fileTableOffset);
+	if (numFiles > (dirSize - fileTableOffset - 4) / 10)
+		goto fail_free;
+	archive->numFiles = numFiles;
+	archive->files = (MhkFile*)calloc(numFiles + 1, sizeof(MhkFile));
+	if (archive->files == NULL)
+	{
+		result = MHK_ENOMEM;
+		goto fail_free;
+	}
+	for (i = 0; i < numFiles; i++)
+	{
+		unsigned char* entry = dir + fileTableOffset + 4 + i * 10;
+		unsigned long offset = MHK_GET32(entry);
+		MhkFile* file = &archive->files[i];
+		file->flags = entry[7];
+		file->size = MHK_GET16(entry + 4) |
+			((unsigned long)entry[6] << 16) |
+			((unsigned long)(file->flags & 7) << 24);
+		file->unknown = MHK_GET16(entry + 8);
+		if (offset > size || file->size > size - offset)
+			goto fail_free;
+		file->data = image + offset;
+		file->ownData = false;
+	}
+
+	/* Count the resources so that they can be allocated at once.  */
+	nameListOffset = MHK_GET16(dir);
+	numTypes = MHK_GET16(dir + 2);
+	if (4 + numTypes * 8 > dirSize)
+		goto fail_free;
+	for (i = 0; i < numTypes; i++)
+	{
+		unsigned resTableOffset = MHK_GET16(dir + 4 + i * 8 + 4);
+		if (resTableOffset + 2 > dirSize)
+			goto fail_free;
+		archive->numResources += MHK_GET16(dir + resTableOffset);
+	}
+	archive->resources =
+		(MhkResource*)calloc(archive->numResources + 1, sizeof(MhkResource));
+	if (archive->resources == NULL)
+	{
+		result = MHK_ENOMEM;
+		goto fail_free;
+	}
+
+	/* Now read the resource and name tables.  */
+	archive->numResources = 0;
+	for (i = 0; i < numTypes; i++)
+	{
+		unsigned char* typeEntry = dir + 4 + i * 8;
+		unsigned long type = MHK_GET32(typeEntry);
+		unsigned resTableOffset = MHK_GET16(typeEntry + 4);
+		unsigned nameTableOffset = MHK_GET16(typeEntry + 6);
+		unsigned numRes = MHK_GET16(dir + resTableOffset);
+		unsigned numNames;
+		MhkResource* typeRes = archive->resources + archive->numResources;
+
+		if (resTableOffset + 2 + numRes * 4 > dirSize)
+			goto fail_free;
+		for (j = 0; j < numRes; j++)
+		{
+			unsigned char* entry = dir + resTableOffset + 2 + j * 4;
+			unsigned fileIndex = MHK_GET16(entry + 2);
+			if (fileIndex == 0 || fileIndex > numFiles)
+				goto fail_free;
+			typeRes[j].type = type;
+			typeRes[j].id = MHK_GET16(entry);
+			typeRes[j].file = fileIndex - 1;
+			archive->numResources++;
+		}
+
+		if (nameTableOffset + 2 > dirSize)
+			goto fail_free;
+		numNames = MHK_GET16(dir + nameTableOffset);
+		if (nameTableOffset + 2 + numNames * 4 > dirSize)
+			goto fail_free;
+		for (j = 0; j < numNames; j++)
+		{
+			unsigned char* entry = dir + nameTableOffset + 2 + j * 4;
+			unsigned long nameOffset =
+				(unsigned long)nameListOffset + MHK_GET16(entry);
+			unsigned index = MHK_GET16(entry + 2);
+			const unsigned char* nameEnd;
+			if (index >= numRes || nameOffset >= dirSize)
+				goto fail_free;
+			nameEnd = (const unsigned char*)
+				memchr(dir + nameOffset, '\0', dirSize - nameOffset);
+			if (nameEnd == NULL)
+				goto fail_free;
+			free(typeRes[index].name);
+			typeRes[index].name = (char*)malloc(nameEnd - (dir + nameOffset) + 1);
+			if (typeRes[index].name == NULL)
+			{
+				result = MHK_ENOMEM;
+				goto fail_free;
+			}
+			strcpy(typeRes[index].name, (const char*)dir + nameOffset);
+		}
+	}
+
+	qsort(archive->resources, archive->numResources, sizeof(MhkResource),
+		  CompareResources);
+	if (error != NULL)
+		*error = MHK_OK;
+	return archive;
+
+fail_free:
+	/* Don't let FreeMhkArchive() free the caller's image.  */
+	archive->image = NULL;
+	FreeMhkArchive(archive);
+fail:
+	if (error != NULL)
+		*error = result;
+	return NULL;
+}
+
+/* Writes the archive to the given file.  The file data is laid out
+   sequentially after the header with the resource directory at the
+   end, so this can also be used to compact an archive after resources
+   have changed size.  Returns an MhkError code.  */
+int SaveMhkArchive(MhkArchive* archive, const char* filename)
+{
+	FILE* fp;
+	unsigned char* dir;
+	unsigned long dirSize;
+	unsigned long dataSize = 0;
+	unsigned long offset;
+	unsigned numTypes = 0;
+	unsigned long nameListSize = 0;
+	unsigned long fileTableOffset;
+	unsigned char header[MHK_HEADER_SIZE];
+	unsigned i, j;
+	bool success;
+
+	/* Size up the directory.  */
+	for (i = 0; i < archive->numResources; i = j)
+	{
+		numTypes++;
+		for (j = i; j < archive->numResources &&
+				 archive->resources[j].type == archive->resources[i].type; j++)
+		{
+			if (archive->resources[j].name != NULL)
+				nameListSize += strlen(archive->resources[j].name) + 1;
+		}
+	}
+	dirSize = 4 + numTypes * 8 + numTypes * 4 +
+		archive->numResources * 8 + nameListSize;
+	fileTableOffset = dirSize;
+	dirSize += 4 + archive->numFiles * 10;
+	/* Directory offsets are only 16 bits wide.  */
+	if (fileTableOffset > 0xffff)
+		return MHK_EUNSUPPORTED;
+	for (i = 0; i < archive->numFiles; i++)
+		dataSize += archive->files[i].size;
+
+	dir = (unsigned char*)malloc(dirSize);
+	if (dir == NULL)
+		return MHK_ENOMEM;
+
+	/* Build the type, resource, and name tables.  */
+	{
+		unsigned long typePos = 4;
+		unsigned long tablePos = 4 + numTypes * 8;
+		unsigned long nameListPos = fileTableOffset - nameListSize;
+		unsigned long namePos = nameListPos;
+		MHK_PUT16(dir, nameListPos);
+		MHK_PUT16(dir + 2, numTypes);
+		for (i = 0; i < archive->numResources; i = j)
+		{
+			unsigned numRes, numNames = 0;
+			unsigned long nameTablePos;
+			for (j = i; j < archive->numResources &&
+					 archive->resources[j].type == archive->resources[i].type;
+				 j++)
+			{
+				if (archive->resources[j].name != NULL)
+					numNames++;
+			}
+			numRes = j - i;
+			nameTablePos = tablePos + 2 + numRes * 4;
+
+			MHK_PUT32(dir + typePos, archive->resources[i].type);
+			MHK_PUT16(dir + typePos + 4, tablePos);
+			MHK_PUT16(dir + typePos + 6, nameTablePos);
+			typePos += 8;
+
+			MHK_PUT16(dir + tablePos, numRes);
+			MHK_PUT16(dir + nameTablePos, numNames);
+			numNames = 0;
+			for (j = i; j < i + numRes; j++)
+			{
+				MhkResource* rsrc = &archive->resources[j];
+				unsigned char* entry = dir + tablePos + 2 + (j - i) * 4;
+				MHK_PUT16(entry, rsrc->id);
+				MHK_PUT16(entry + 2, rsrc->file + 1);
+				if (rsrc->name != NULL)
+				{
+					entry = dir + nameTablePos + 2 + numNames * 4;
+					MHK_PUT16(entry, namePos - nameListPos);
+					MHK_PUT16(entry + 2, j - i);
+					strcpy((char*)dir + namePos, rsrc->name);
+					namePos += strlen(rsrc->name) + 1;
+					numNames++;
+				}
+			}
+			tablePos = nameTablePos + 2 + numNames * 4;
+		}
+	}
+
+	/* Build the file table.  */
+	MHK_PUT32(dir + fileTableOffset, archive->numFiles);
+	offset = MHK_HEADER_SIZE;
+	for (i = 0; i < archive->numFiles; i++)
+	{
+		MhkFile* file = &archive->files[i];
+		unsigned char* entry = dir + fileTableOffset + 4 + i * 10;
+		MHK_PUT32(entry, offset);
+		MHK_PUT16(entry + 4, file->size & 0xffff);
+		entry[6] = (unsigned char)(file->size >> 16);
+		entry[7] = (unsigned char)((file->flags & ~7) |
+								   ((file->size >> 24) & 7));
+		MHK_PUT16(entry + 8, file->unknown);
+		offset += file->size;
+	}
+
+	memcpy(header, "MHWK", 4);
+	MHK_PUT32(header + 4, MHK_HEADER_SIZE + dataSize + dirSize - 8);
+	memcpy(header + 8, "RSRC", 4);
+	MHK_PUT16(header + 12, archive->version);
+	MHK_PUT16(header + 14, archive->compaction);
+	MHK_PUT32(header + 16, MHK_HEADER_SIZE + dataSize + dirSize);
+	MHK_PUT32(header + 20, MHK_HEADER_SIZE + dataSize);
+	MHK_PUT16(header + 24, fileTableOffset);
+	MHK_PUT16(header + 26, 4 + archive->numFiles * 10);
+
+	fp = fopen(filename, "wb");
+	if (fp == NULL)
+	{
+		free(dir);
+		return MHK_EIO;
+	}
+	success = fwrite(header, MHK_HEADER_SIZE, 1, fp) == 1;
+	for (i = 0; success && i < archive->numFiles; i++)
+	{
+		if (archive->files[i].size != 0)
+			success = fwrite(archive->files[i].data,
+							 archive->files[i].size, 1, fp) == 1;
+	}
+	if (success)
+		success = fwrite(dir, dirSize, 1, fp) == 1;
+	if (fclose(fp) != 0)
+		success = false;
+	free(dir);
+	return success ? MHK_OK : MHK_EIO;
+}
+
+/* Frees the archive along with all of the resource data.  */
+void FreeMhkArchive(MhkArchive* archive)
+{
+	unsigned i;
+	if (archive == NULL)
+		return;
+	if (archive->files != NULL)
+	{
+		for (i = 0; i < archive->numFiles; i++)
+		{
+			if (archive->files[i].ownData)
+				free(archive->files[i].data);
+		}
+		free(archive->files);
+	}
+	if (archive->resources != NULL)
+	{
+		for (i = 0; i < archive->numResources; i++)
+			free(archive->resources[i].name);
+		free(archive->resources);
+	}
+	free(archive->image);
+	free(archive);
+}
+
+/* Returns the resource with the given type and ID, or NULL if there
+   is no such resource.  */
+MhkResource* FindMhkResource(MhkArchive* archive, unsigned long type,
+	unsigned short id)
+{
+	MhkResource key;
+	key.type = type;
+	key.id = id;
+	return (MhkResource*)bsearch(&key, archive->resources,
+		archive->numResources, sizeof(MhkResource), CompareResources);
+}
+
+MhkFile* GetMhkResourceFile(MhkArchive* archive, MhkResource* rsrc)
+{
+	return &archive->files[rsrc->file];
+}
+
+/* Replaces the data of a file table entry.  The file takes ownership
+   of "data", which must have been allocated with malloc().  Note that
+   this changes the data of every resource that shares the file.  */
+void ReplaceMhkFileData(MhkFile* file, unsigned char* data,
+	unsigned long size)
+{
+	if (file->ownData)
+		free(file->data);
+	file->data = data;
+	file->size = size;
+	file->ownData = true;
+}
+
+/* Sets the data of the resource with the given type and ID, adding
+   the resource if it does not exist yet.  Like ReplaceMhkFileData(),
+   this takes ownership of "data", also on failure.  Adding a resource
+   invalidates pointers into the resource list.  Returns an MhkError
+   code.  */
+int AddMhkResource(MhkArchive* archive, unsigned long type,
+	unsigned short id, unsigned char* data, unsigned long size)
+{
+	MhkResource* rsrc = FindMhkResource(archive, type, id);
+	MhkFile* files;
+	MhkResource* resources;
+
+	if (rsrc != NULL)
+	{
+		ReplaceMhkFileData(GetMhkResourceFile(archive, rsrc), data, size);
+		return MHK_OK;
+	}
+
+	/* The file table is 32 bits, but resource tables only have room
+	   for 16-bit file indices.  */
+	if (archive->numFiles >= 0xffff)
+	{
+		free(data);
+		return MHK_EUNSUPPORTED;
+	}
+	files = (MhkFile*)realloc(archive->files,
+		(archive->numFiles + 1) * sizeof(MhkFile));
+	if (files == NULL)
+	{
+		free(data);
+		return MHK_ENOMEM;
+	}
+	archive->files = files;
+	resources = (MhkResource*)realloc(archive->resources,
+		(archive->numResources + 1) * sizeof(MhkResource));
+	if (resources == NULL)
+	{
+		free(data);
+		return MHK_ENOMEM;
+	}
+	archive->resources = resources;
+
+	memset(&files[archive->numFiles], 0, sizeof(MhkFile));
+	ReplaceMhkFileData(&files[archive->numFiles], data, size);
+	rsrc = &resources[archive->numResources++];
+	rsrc->type = type;
+	rsrc->id = id;
+	rsrc->name = NULL;
+	rsrc->file = archive->numFiles++;
+	qsort(archive->resources, archive->numResources, sizeof(MhkResource),
+		  CompareResources);
+	return MHK_OK;
+}
+
+/* Converts a type tag to a printable string.  "str" must have room
+   for at least 5 characters.  */
+void MhkTagToString(unsigned long type, char* str)
+{
+	unsigned i;
+	for (i = 0; i < 4; i++)
+	{
+		char c = (char)(type >> (24 - i * 8));
+		str[i] = (c >= ' ' && c <= '~') ? c : '?';
+	}
+	str[4] = '\0';
+}
+
+const char* MhkErrorString(int error)
+{
+	switch (error)
+	{
+	case MHK_OK: return "Success";
+	case MHK_ENOMEM: return "Out of memory";
+	case MHK_EIO: return "Could not access the file";
+	case MHK_EFORMAT: return "The data is corrupt or of the wrong type";
+	case MHK_EUNSUPPORTED: return "The data uses an unsupported format";
+	}
+	return "Unknown error";
+}
+
+static int CompareResources(const void* a, const void* b)
+{
+	const MhkResource* ra = (const MhkResource*)a;
+	const MhkResource* rb = (const MhkResource*)b;
+	if (ra->type != rb->type)
+		return (ra->type < rb->type) ? -1 : 1;
+	if (ra->id != rb->id)
+		return (ra->id < rb->id) ? -1 : 1;
+	return 0;
+}
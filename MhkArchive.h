@@ -0,0 +1,97 @@
+/* Mohawk archive interface */
+/* This code is platform independent, but it does use the boolean
+   definitions: include "bool.h" before this header.  */
+
+#ifndef MHKARCHIVE_H
+#define MHKARCHIVE_H
+
+#include <stddef.h>
+
+/* Error codes shared by all of the Mohawk resource code.  */
+enum MhkError
+{
+	MHK_OK = 0,
+	MHK_ENOMEM, /* Out of memory */
+	MHK_EIO, /* Could not read or write a file */
+	MHK_EFORMAT, /* Data is corrupt or not of the expected type */
+	MHK_EUNSUPPORTED /* Valid data that we do not know how to handle */
+};
+
+/* Packs a four character type tag like 'tBMP' into a number.  */
+#define MHK_TAG(a, b, c, d) \
+	(((unsigned long)(unsigned char)(a) << 24) | \
+	 ((unsigned long)(unsigned char)(b) << 16) | \
+	 ((unsigned long)(unsigned char)(c) << 8) | \
+	 (unsigned long)(unsigned char)(d))
+
+#define MHK_TBMP MHK_TAG('t', 'B', 'M', 'P')
+#define MHK_TPAL MHK_TAG('t', 'P', 'A', 'L')
+#define MHK_TSPR MHK_TAG('t', 'S', 'P', 'R')
+#define MHK_TWAV MHK_TAG('t', 'W', 'A', 'V')
+
+typedef struct MhkFile_t MhkFile;
+typedef struct MhkResource_t MhkResource;
+typedef struct MhkArchive_t MhkArchive;
+
+/* An entry in the archive's file table.  More than one resource may
+   refer to the same file.  */
+struct MhkFile_t
+{
+	unsigned char* data;
+	unsigned long size;
+	unsigned char flags; /* Low 3 bits are consumed by the size */
+	unsigned short unknown;
+	bool ownData; /* Was "data" allocated separately from the image? */
+};
+
+struct MhkResource_t
+{
+	unsigned long type;
+	unsigned short id;
+	char* name; /* NULL if the resource does not have a name */
+	unsigned file; /* Zero-based index into the file table */
+};
+
+struct MhkArchive_t
+{
+	unsigned char* image; /* The archive file as it was loaded */
+	unsigned long imageSize;
+	unsigned short version;
+	unsigned short compaction;
+	unsigned numFiles;
+	MhkFile* files;
+	unsigned numResources; /* Sorted by type, then by ID */
+	MhkResource* resources;
+};
+
+MhkArchive* LoadMhkArchive(const char* filename, int* error);
+MhkArchive* ParseMhkArchive(unsigned char* image, unsigned long size,
+	int* error);
+int SaveMhkArchive(MhkArchive* archive, const char* filename);
+void FreeMhkArchive(MhkArchive* archive);
+
+MhkResource* FindMhkResource(MhkArchive* archive, unsigned long type,
+	unsigned short id);
+MhkFile* GetMhkResourceFile(MhkArchive* archive, MhkResource* rsrc);
+void ReplaceMhkFileData(MhkFile* file, unsigned char* data,
+	unsigned long size);
+int AddMhkResource(MhkArchive* archive, unsigned long type,
+	unsigned short id, unsigned char* data, unsigned long size);
+void MhkTagToString(unsigned long type, char* str);
+const char* MhkErrorString(int error);
+
+/* Big-endian access helpers used throughout the resource code.  */
+#define MHK_GET16(p) \
+	((unsigned)(((const unsigned char*)(p))[0] << 8) | \
+	 ((const unsigned char*)(p))[1])
+#define MHK_GET32(p) \
+	(((unsigned long)MHK_GET16(p) << 16) | \
+	 MHK_GET16((const unsigned char*)(p) + 2))
+#define MHK_PUT16(p, v) \
+	(((unsigned char*)(p))[0] = (unsigned char)((v) >> 8), \
+	 ((unsigned char*)(p))[1] = (unsigned char)(v))
+#define MHK_PUT32(p, v) \
+	(MHK_PUT16(p, (v) >> 16), \
+	 MHK_PUT16((unsigned char*)(p) + 2, (v) & 0xffff))
+
+#endif /* not MHKARCHIVE_H */
@@ -0,0 +1,730 @@
+/* Mohawk bitmap (tBMP) codec */
+
+/* A tBMP resource starts with four big-endian words: width, height,
+   bytes per row, and the format word (see BmpFormat).  An 8-bit
+   bitmap with the BMP_HAS_CLUT flag is then followed by an inline
+   palette: u16 table size, u8 RGB bits, u8 color count minus one,
+   and then blue, green, and red bytes for every color.  The rest of
+   the resource is the pixel data.
+
+   The pixel data is compressed in two layers.  The secondary
+   compression is applied to the rows first, then the primary
+   compression is applied to the result.  Without secondary
+   compression, every row is stored in "bytes per row" bytes.  With
+   RLE8, every row starts with a u16 count of the encoded bytes that
+   follow it, which is why rows can be decoded independently.  Inside
+   a row, a code byte with the high bit set repeats the following
+   byte (code & 0x7f) + 1 times, and a code byte without the high bit
+   is followed by code + 1 literal bytes.
+
+   With LZ primary compression, the data starts with u32 unpacked
+   size, u32 packed size, and u16 ring buffer size (always 1024),
+   followed by the stream described in MhkLz.c.
+
+   The "unknown" variants of both layers and the Riven compression are
+   recognized but not decoded.  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "MhkLz.h"
+
+typedef struct RowSource_t RowSource;
+typedef struct CopySink_t CopySink;
+
+/* The secondary layer's view of its input, which is either the
+   resource data itself or the output of the LZ layer.  */
+struct RowSource_t
+{
+	const unsigned char* data;
+	size_t size;
+	LzStream* lz; /* NULL if all of "data" is available */
+};
+
+struct CopySink_t
+{
+	unsigned char* pixels;
+	size_t stride;
+	size_t rowSize;
+};
+
+static size_t MaxUnpackedSize(const MhkBitmap* bmp);
+static bool RequireRowData(RowSource* source, size_t upTo);
+static int StreamRawRows(const MhkBitmap* bmp, const BmpRect* clip,
+	RowSource* source, BmpRowSink sink, void* ctx);
+static int StreamRle8Rows(const MhkBitmap* bmp, const BmpRect* clip,
+	RowSource* source, BmpRowSink sink, void* ctx);
+static void CopyRowSink(void* ctx, unsigned y, const unsigned char* row);
+static size_t EncodeRle8Row(const unsigned char* row, unsigned width,
+	unsigned char* dst);
+
+/* Parses the header and inline palette of a tBMP resource.  The
+   compressed pixel data is not touched, and "bmp->data" points inside
+   "rsrc" afterward.  Returns an MhkError code.  */
+int ParseBitmap(const unsigned char* rsrc, size_t size, MhkBitmap* bmp)
+{
+	size_t pos = BMP_HEADER_SIZE;
+
+	if (size < BMP_HEADER_SIZE)
+		return MHK_EFORMAT;
+	bmp->width = MHK_GET16(rsrc) & BMP_MAX_DIM;
+	bmp->height = MHK_GET16(rsrc + 2) & BMP_MAX_DIM;
+	bmp->bytesPerRow = MHK_GET16(rsrc + 4) & 0x3fe;
+	bmp->format = MHK_GET16(rsrc + 6);
+	bmp->bpp = BmpBitsPerPixel(bmp->format);
+	bmp->rgbBits = 8;
+	bmp->numColors = 0;
+	if (bmp->bpp == 0)
+		return MHK_EUNSUPPORTED;
+
+	if (bmp->bpp == 8 && (bmp->format & BMP_HAS_CLUT))
+	{
+		unsigned i;
+		if (size < pos + 4)
+			return MHK_EFORMAT;
+		bmp->rgbBits = rsrc[pos + 2];
+		bmp->numColors = rsrc[pos + 3] + 1;
+		pos += 4;
+		if (size < pos + bmp->numColors * 3)
+			return MHK_EFORMAT;
+		for (i = 0; i < bmp->numColors; i++, pos += 3)
+		{
+			bmp->palette[i] = ((unsigned long)rsrc[pos + 2] << 16) |
+				((unsigned long)rsrc[pos + 1] << 8) | rsrc[pos];
+		}
+	}
+
+	bmp->data = rsrc + pos;
+	bmp->dataSize = size - pos;
+	return MHK_OK;
+}
+
+/* Returns the number of bits per pixel for a format word, or zero if
+   the depth code is not valid.  */
+unsigned BmpBitsPerPixel(unsigned format)
+{
+	switch (format & BMP_BPP_MASK)
+	{
+	case BMP_BPP1: return 1;
+	case BMP_BPP4: return 4;
+	case BMP_BPP8: return 8;
+	case BMP_BPP16: return 16;
+	case BMP_BPP24: return 24;
+	}
+	return 0;
+}
+
+/* Returns the size of a decoded pixel row.  */
+size_t BmpRowSize(const MhkBitmap* bmp)
+{
+	return ((size_t)bmp->width * bmp->bpp + 7) / 8;
+}
+
+/* Is the combination of compression layers one we can decode?  */
+bool BmpCanDecode(unsigned format)
+{
+	unsigned primary = format & BMP_1ST_MASK;
+	unsigned secondary = format & BMP_2ND_MASK;
+	if (BmpBitsPerPixel(format) == 0)
+		return false;
+	if (primary != BMP_1ST_NONE && primary != BMP_1ST_LZ)
+		return false;
+	if (secondary == BMP_2ND_NONE)
+		return true;
+	return secondary == BMP_2ND_RLE8 && BmpBitsPerPixel(format) == 8;
+}
+
+bool BmpCanEncode(unsigned format)
+{
+	return BmpCanDecode(format);
+}
+
+/* Decodes the rows of a parsed bitmap that intersect "clip" and
+   passes them to "sink" from top to bottom.  If "clip" is NULL, the
+   whole bitmap is decoded.  Rows past the bottom of the clipping
+   rectangle are never decompressed, and without LZ compression, the
+   rows above it are skipped without being decoded either.  Returns an
+   MhkError code.  */
+int StreamBitmap(const MhkBitmap* bmp, const BmpRect* clip,
+	BmpRowSink sink, void* ctx)
+{
+	BmpRect rt;
+	RowSource source;
+	LzStream lz;
+	unsigned char* unpacked = NULL;
+	int result;
+
+	if (!BmpCanDecode(bmp->format))
+		return MHK_EUNSUPPORTED;
+	rt.left = 0;
+	rt.top = 0;
+	rt.right = bmp->width;
+	rt.bottom = bmp->height;
+	if (clip != NULL)
+	{
+		if (clip->left > rt.left) rt.left = clip->left;
+		if (clip->top > rt.top) rt.top = clip->top;
+		if (clip->right < rt.right) rt.right = clip->right;
+		if (clip->bottom < rt.bottom) rt.bottom = clip->bottom;
+	}
+	if (rt.left >= rt.right || rt.top >= rt.bottom)
+		return MHK_OK;
+
+	source.data = bmp->data;
+	source.size = bmp->dataSize;
+	source.lz = NULL;
+	if ((bmp->format & BMP_1ST_MASK) == BMP_1ST_LZ)
+	{
+		size_t unpackedSize;
+		if (bmp->dataSize < BMP_LZ_HEADER_SIZE)
+			return MHK_EFORMAT;
+		unpackedSize = MHK_GET32(bmp->data);
+		if (unpackedSize > MaxUnpackedSize(bmp))
+			return MHK_EFORMAT;
+		unpacked = (unsigned char*)malloc(unpackedSize + 1);
+		if (unpacked == NULL)
+			return MHK_ENOMEM;
+		LzStreamInit(&lz, bmp->data + BMP_LZ_HEADER_SIZE,
+			bmp->dataSize - BMP_LZ_HEADER_SIZE, unpacked, unpackedSize);
+		source.data = unpacked;
+		source.size = unpackedSize;
+		source.lz = &lz;
+	}
+
+	if ((bmp->format & BMP_2ND_MASK) == BMP_2ND_RLE8)
+		result = StreamRle8Rows(bmp, &rt, &source, sink, ctx);
+	else
+		result = StreamRawRows(bmp, &rt, &source, sink, ctx);
+	free(unpacked);
+	return result;
+}
+
+/* Rebuilds a tBMP resource with a new inline palette of "numColors"
+   colors.  The pixel data is copied as is, so nothing is re-encoded.
+   Only 8-bit bitmaps can have an inline palette; one without a palette
+   gets the BMP_HAS_CLUT flag.  The RGB bits field is kept.  The new
+   resource is allocated with malloc() and returned in "out".  Returns
+   an MhkError code.  */
+int ReplaceBitmapPalette(const unsigned char* rsrc, size_t size,
+	const unsigned long* palette, unsigned numColors,
+	unsigned char** out, size_t* outSize)
+{
+	MhkBitmap bmp;
+	unsigned char* res;
+	unsigned char* pal;
+	size_t palSize;
+	unsigned i;
+	int result;
+
+	result = ParseBitmap(rsrc, size, &bmp);
+	if (result != MHK_OK)
+		return result;
+	if (bmp.bpp != 8)
+		return MHK_EUNSUPPORTED;
+	if (numColors == 0 || numColors > 256)
+		return MHK_EFORMAT;
+	palSize = 4 + numColors * 3;
+	res = (unsigned char*)malloc(BMP_HEADER_SIZE + palSize + bmp.dataSize);
+	if (res == NULL)
+		return MHK_ENOMEM;
+	memcpy(res, rsrc, BMP_HEADER_SIZE);
+	MHK_PUT16(res + 6, bmp.format | BMP_HAS_CLUT);
+	pal = res + BMP_HEADER_SIZE;
+	MHK_PUT16(pal, palSize);
+	pal[2] = (unsigned char)bmp.rgbBits;
+	pal[3] = (unsigned char)(numColors - 1);
+	for (i = 0, pal += 4; i < numColors; i++, pal += 3)
+	{
+		pal[0] = (unsigned char)palette[i];
+		pal[1] = (unsigned char)(palette[i] >> 8);
+		pal[2] = (unsigned char)(palette[i] >> 16);
+	}
+	memcpy(pal, bmp.data, bmp.dataSize);
+	*out = res;
+	*outSize = BMP_HEADER_SIZE + palSize + bmp.dataSize;
+	return MHK_OK;
+}
+
+/* Reads a tPAL resource: u16 first index, u16 count, then red, green,
+   blue, and an unused byte for every color.  The colors are stored
+   from "palette[*start]" on; the other entries are not touched.
+   Returns an MhkError code.  */
+int ParsePaletteResource(const unsigned char* rsrc, size_t size,
+	unsigned long* palette, unsigned* start, unsigned* count)
+{
+	unsigned first, num, i;
+	if (size < 4)
+		return MHK_EFORMAT;
+	first = MHK_GET16(rsrc);
+	num = MHK_GET16(rsrc + 2);
+	if (first + num > 256 || 4 + num * 4 > size)
+		return MHK_EFORMAT;
+	for (i = 0, rsrc += 4; i < num; i++, rsrc += 4)
+	{
+		palette[first + i] = ((unsigned long)rsrc[0] << 16) |
+			((unsigned long)rsrc[1] << 8) | rsrc[2];
+	}
+	*start = first;
+	*count = num;
+	return MHK_OK;
+}
+
+/* Builds a tPAL resource holding "count" colors of "palette" starting
+   at index "start".  The resource is allocated with malloc() and
+   returned in "out".  Returns an MhkError code.  */
+int EncodePaletteResource(const unsigned long* palette, unsigned start,
+	unsigned count, unsigned char** out, size_t* outSize)
+{
+	unsigned char* res;
+	unsigned char* entry;
+	unsigned i;
+	if (start + count > 256)
+		return MHK_EFORMAT;
+	res = (unsigned char*)malloc(4 + count * 4);
+	if (res == NULL)
+		return MHK_ENOMEM;
+	MHK_PUT16(res, start);
+	MHK_PUT16(res + 2, count);
+	for (i = 0, entry = res + 4; i < count; i++, entry += 4)
+	{
+		unsigned long color = palette[start + i];
+		entry[0] = (unsigned char)(color >> 16);
+		entry[1] = (unsigned char)(color >> 8);
+		entry[2] = (unsigned char)color;
+		entry[3] = 0;
+	}
+	*out = res;
+	*outSize = 4 + count * 4;
+	return MHK_OK;
+}
+
+/* Undoes the LZ compression of a bitmap all at once.  The unpacked
+   rows are allocated with malloc() and returned in "out".  Returns an
+   MhkError code.  */
+int UnpackBitmapLz(const MhkBitmap* bmp, unsigned char** out,
+	size_t* outSize)
+{
+	unsigned char* unpacked;
+	size_t unpackedSize;
+
+	if (bmp->dataSize < BMP_LZ_HEADER_SIZE)
+		return MHK_EFORMAT;
+	unpackedSize = MHK_GET32(bmp->data);
+	if (unpackedSize > MaxUnpackedSize(bmp))
+		return MHK_EFORMAT;
+	unpacked = (unsigned char*)malloc(unpackedSize + 1);
+	if (unpacked == NULL)
+		return MHK_ENOMEM;
+	if (!LzUnpack(bmp->data + BMP_LZ_HEADER_SIZE,
+		bmp->dataSize - BMP_LZ_HEADER_SIZE, unpacked, unpackedSize, NULL))
+	{
+		free(unpacked);
+		return MHK_EFORMAT;
+	}
+	*out = unpacked;
+	*outSize = unpackedSize;
+	return MHK_OK;
+}
+
+/* Decodes the pixels of a parsed bitmap into "pixels", which holds
+   rows of at least BmpRowSize() bytes that are "stride" bytes apart.
+   Returns an MhkError code.  */
+int DecodeBitmap(const MhkBitmap* bmp, unsigned char* pixels, size_t stride)
+{
+	CopySink sink;
+	sink.pixels = pixels;
+	sink.stride = stride;
+	sink.rowSize = BmpRowSize(bmp);
+	return StreamBitmap(bmp, NULL, CopyRowSink, &sink);
+}
+
+/* Encodes decoded pixels into a complete tBMP resource using the
+   dimensions, palette, and format word in "bmp".  "bmp->bytesPerRow"
+   is recalculated.  "lzChain" is passed on to LzPack().  The new
+   resource is allocated with malloc() and returned in "out".  Returns
+   an MhkError code.  */
+int EncodeBitmap(const MhkBitmap* bmp, const unsigned char* pixels,
+	size_t stride, unsigned lzChain, unsigned char** out, size_t* outSize)
+{
+	unsigned bpp = BmpBitsPerPixel(bmp->format);
+	size_t rowSize = ((size_t)bmp->width * bpp + 7) / 8;
+	unsigned bytesPerRow = (unsigned)(((size_t)bmp->width * bpp + 15) / 16 * 2);
+	size_t headerSize = BMP_HEADER_SIZE;
+	unsigned char* rows;
+	size_t rowsSize = 0;
+	unsigned char* res;
+	size_t resSize;
+	unsigned y;
+
+	if (!BmpCanEncode(bmp->format))
+		return MHK_EUNSUPPORTED;
+	if (bmp->width > BMP_MAX_DIM || bmp->height > BMP_MAX_DIM)
+		return MHK_EUNSUPPORTED;
+	/* The header only has room for ten bits of the row size.  */
+	if (bytesPerRow > BMP_MAX_ROW_SIZE)
+		return MHK_EUNSUPPORTED;
+	if (bpp == 8 && (bmp->format & BMP_HAS_CLUT))
+	{
+		if (bmp->numColors == 0 || bmp->numColors > 256)
+			return MHK_EFORMAT;
+		headerSize += 4 + bmp->numColors * 3;
+	}
+
+	/* Apply the secondary compression.  */
+	if ((bmp->format & BMP_2ND_MASK) == BMP_2ND_RLE8)
+	{
+		rows = (unsigned char*)malloc(
+			(rowSize + rowSize / 128 + 3) * bmp->height + 1);
+		if (rows == NULL)
+			return MHK_ENOMEM;
+		for (y = 0; y < bmp->height; y++)
+			rowsSize += EncodeRle8Row(pixels + y * stride, bmp->width,
+									  rows + rowsSize);
+	}
+	else
+	{
+		rows = (unsigned char*)malloc((size_t)bytesPerRow * bmp->height + 1);
+		if (rows == NULL)
+			return MHK_ENOMEM;
+		for (y = 0; y < bmp->height; y++)
+		{
+			memcpy(rows + rowsSize, pixels + y * stride, rowSize);
+			memset(rows + rowsSize + rowSize, 0, bytesPerRow - rowSize);
+			rowsSize += bytesPerRow;
+		}
+	}
+
+	/* Apply the primary compression while writing out the
+	   resource.  */
+	if ((bmp->format & BMP_1ST_MASK) == BMP_1ST_LZ)
+	{
+		size_t packedSize;
+		res = (unsigned char*)malloc(headerSize + BMP_LZ_HEADER_SIZE +
+									 LZ_PACK_BOUND(rowsSize));
+		if (res == NULL)
+		{
+			free(rows);
+			return MHK_ENOMEM;
+		}
+		packedSize = LzPack(rows, rowsSize,
+			res + headerSize + BMP_LZ_HEADER_SIZE, lzChain);
+		if (packedSize == 0 && rowsSize != 0)
+		{
+			free(rows);
+			free(res);
+			return MHK_ENOMEM;
+		}
+		MHK_PUT32(res + headerSize, rowsSize);
+		MHK_PUT32(res + headerSize + 4, packedSize);
+		MHK_PUT16(res + headerSize + 8, LZ_RING_SIZE);
+		resSize = headerSize + BMP_LZ_HEADER_SIZE + packedSize;
+	}
+	else
+	{
+		res = (unsigned char*)malloc(headerSize + rowsSize);
+		if (res == NULL)
+		{
+			free(rows);
+			return MHK_ENOMEM;
+		}
+		memcpy(res + headerSize, rows, rowsSize);
+		resSize = headerSize + rowsSize;
+	}
+	free(rows);
+
+	MHK_PUT16(res, bmp->width);
+	MHK_PUT16(res + 2, bmp->height);
+	MHK_PUT16(res + 4, bytesPerRow);
+	MHK_PUT16(res + 6, bmp->format);
+	if (headerSize > BMP_HEADER_SIZE)
+	{
+		unsigned char* pal = res + BMP_HEADER_SIZE;
+		unsigned i;
+		MHK_PUT16(pal, headerSize - BMP_HEADER_SIZE);
+		pal[2] = (unsigned char)bmp->rgbBits;
+		pal[3] = (unsigned char)(bmp->numColors - 1);
+		for (i = 0, pal += 4; i < bmp->numColors; i++, pal += 3)
+		{
+			pal[0] = (unsigned char)bmp->palette[i];
+			pal[1] = (unsigned char)(bmp->palette[i] >> 8);
+			pal[2] = (unsigned char)(bmp->palette[i] >> 16);
+		}
+	}
+
+	*out = res;
+	*outSize = resSize;
+	return MHK_OK;
+}
+
+/* Re-encodes only the rows of a bitmap that are flagged in "dirty"
+   (one byte per row, nonzero if the row changed) and copies all other
+   rows from "rsrc" untouched.  "pixels" holds every decoded row,
+   "stride" bytes apart.  RLE8 rows carry their own byte counts, so a
+   row that changes size only moves the rows after it.  Bitmaps with
+   LZ compression can't be patched this way, since the rows are not
+   separate in the packed stream: MHK_EUNSUPPORTED is returned and
+   EncodeBitmap() has to be used instead.  The new resource is
+   allocated with malloc() and returned in "out".  Returns an MhkError
+   code.  */
+int SpliceBitmapRows(const unsigned char* rsrc, size_t size,
+	const unsigned char* pixels, size_t stride, const unsigned char* dirty,
+	unsigned char** out, size_t* outSize)
+{
+	MhkBitmap bmp;
+	size_t headerSize, rowSize;
+	size_t pos, spanStart, outPos;
+	unsigned numDirty = 0;
+	unsigned char* res;
+	unsigned y;
+	int result;
+
+	result = ParseBitmap(rsrc, size, &bmp);
+	if (result != MHK_OK)
+		return result;
+	if (!BmpCanEncode(bmp.format) ||
+		(bmp.format & BMP_1ST_MASK) != BMP_1ST_NONE)
+		return MHK_EUNSUPPORTED;
+	headerSize = bmp.data - rsrc;
+	rowSize = BmpRowSize(&bmp);
+
+	if ((bmp.format & BMP_2ND_MASK) == BMP_2ND_NONE)
+	{
+		/* Rows stay where they are.  */
+		if (bmp.bytesPerRow < rowSize ||
+			bmp.dataSize < (size_t)bmp.bytesPerRow * bmp.height)
+			return MHK_EFORMAT;
+		res = (unsigned char*)malloc(size);
+		if (res == NULL)
+			return MHK_ENOMEM;
+		memcpy(res, rsrc, size);
+		for (y = 0; y < bmp.height; y++)
+		{
+			if (dirty[y])
+				memcpy(res + headerSize + (size_t)y * bmp.bytesPerRow,
+					pixels + y * stride, rowSize);
+		}
+		*out = res;
+		*outSize = size;
+		return MHK_OK;
+	}
+
+	/* Check the row counts before copying anything.  */
+	for (y = 0, pos = 0; y < bmp.height; y++)
+	{
+		if (pos + 2 > bmp.dataSize ||
+			pos + 2 + MHK_GET16(bmp.data + pos) > bmp.dataSize)
+			return MHK_EFORMAT;
+		pos += 2 + MHK_GET16(bmp.data + pos);
+		if (dirty[y])
+			numDirty++;
+	}
+	res = (unsigned char*)malloc(headerSize + bmp.dataSize +
+		(rowSize + rowSize / 128 + 3) * numDirty + 1);
+	if (res == NULL)
+		return MHK_ENOMEM;
+	memcpy(res, rsrc, headerSize);
+	outPos = headerSize;
+	/* Clean rows are copied in runs.  */
+	for (y = 0, pos = 0, spanStart = 0; y < bmp.height; y++)
+	{
+		size_t rowEnd = pos + 2 + MHK_GET16(bmp.data + pos);
+		if (dirty[y])
+		{
+			memcpy(res + outPos, bmp.data + spanStart, pos - spanStart);
+			outPos += pos - spanStart;
+			outPos += EncodeRle8Row(pixels + y * stride, bmp.width,
+									res + outPos);
+			spanStart = rowEnd;
+		}
+		pos = rowEnd;
+	}
+	/* This includes anything after the last row.  */
+	memcpy(res + outPos, bmp.data + spanStart, bmp.dataSize - spanStart);
+	outPos += bmp.dataSize - spanStart;
+	*out = res;
+	*outSize = outPos;
+	return MHK_OK;
+}
+
+/* Neither compression layer can expand a row by more than this, so
+   any larger unpacked size is corrupt.  */
+static size_t MaxUnpackedSize(const MhkBitmap* bmp)
+{
+	return ((size_t)bmp->bytesPerRow + BmpRowSize(bmp) + 4) *
+		(bmp->height + 1) + 1024;
+}
+
+/* Makes sure that the first "upTo" bytes of the row data are
+   available.  */
+static bool RequireRowData(RowSource* source, size_t upTo)
+{
+	if (upTo > source->size)
+		return false;
+	if (source->lz != NULL && source->lz->outPos < upTo)
+		return LzStreamFill(source->lz, upTo);
+	return true;
+}
+
+static int StreamRawRows(const MhkBitmap* bmp, const BmpRect* clip,
+	RowSource* source, BmpRowSink sink, void* ctx)
+{
+	unsigned y;
+	if (bmp->bytesPerRow < BmpRowSize(bmp))
+		return MHK_EFORMAT;
+	/* Every row has the same size, so the rows above the clipping
+	   rectangle can be skipped directly.  */
+	for (y = clip->top; y < clip->bottom; y++)
+	{
+		size_t rowPos = (size_t)y * bmp->bytesPerRow;
+		if (!RequireRowData(source, rowPos + bmp->bytesPerRow))
+			return MHK_EFORMAT;
+		sink(ctx, y, source->data + rowPos);
+	}
+	return MHK_OK;
+}
+
+static int StreamRle8Rows(const MhkBitmap* bmp, const BmpRect* clip,
+	RowSource* source, BmpRowSink sink, void* ctx)
+{
+	unsigned char* row;
+	size_t pos = 0;
+	unsigned y;
+	int result = MHK_OK;
+
+	row = (unsigned char*)malloc(bmp->width + 1);
+	if (row == NULL)
+		return MHK_ENOMEM;
+
+	for (y = 0; y < clip->bottom; y++)
+	{
+		const unsigned char* src;
+		const unsigned char* rowEnd;
+		unsigned char* dst = row;
+		unsigned remaining = clip->right;
+		size_t rowLen;
+
+		if (!RequireRowData(source, pos + 2))
+		{
+			result = MHK_EFORMAT;
+			break;
+		}
+		rowLen = MHK_GET16(source->data + pos);
+		if (!RequireRowData(source, pos + 2 + rowLen))
+		{
+			result = MHK_EFORMAT;
+			break;
+		}
+		src = source->data + pos + 2;
+		rowEnd = src + rowLen;
+		pos += 2 + rowLen;
+		/* The row byte counts let us hop over rows that are above the
+		   clipping rectangle.  */
+		if (y < clip->top)
+			continue;
+
+		/* Only decode up to the right edge of the clipping
+		   rectangle.  */
+		while (remaining > 0)
+		{
+			unsigned code;
+			unsigned runLen;
+			if (src >= rowEnd)
+			{
+				result = MHK_EFORMAT;
+				break;
+			}
+			code = *src++;
+			runLen = (code & 0x7f) + 1;
+			if (runLen > remaining)
+				runLen = remaining;
+			if (code & 0x80)
+			{
+				if (src >= rowEnd)
+				{
+					result = MHK_EFORMAT;
+					break;
+				}
+				memset(dst, *src++, runLen);
+			}
+			else
+			{
+				if ((size_t)(rowEnd - src) < runLen)
+				{
+					result = MHK_EFORMAT;
+					break;
+				}
+				memcpy(dst, src, runLen);
+				src += (code & 0x7f) + 1;
+			}
+			dst += runLen;
+			remaining -= runLen;
+		}
+		if (result != MHK_OK)
+			break;
+		sink(ctx, y, row);
+	}
+
+	free(row);
+	return result;
+}
+
+static void CopyRowSink(void* ctx, unsigned y, const unsigned char* row)
+{
+	CopySink* sink = (CopySink*)ctx;
+	memcpy(sink->pixels + y * sink->stride, row, sink->rowSize);
+}
+
+/* Encodes one row with RLE8, including the leading byte count, and
+   returns the number of bytes written.  Runs shorter than three bytes
+   are folded into the surrounding literals, since they would not save
+   anything.  */
+static size_t EncodeRle8Row(const unsigned char* row, unsigned width,
+	unsigned char* dst)
+{
+	size_t outPos = 2;
+	unsigned litStart = 0;
+	unsigned x = 0;
+
+	while (x < width)
+	{
+		unsigned run = 1;
+		while (x + run < width && run < 128 && row[x + run] == row[x])
+			run++;
+		if (run >= 3)
+		{
+			/* Flush pending literals, then write the run.  */
+			while (litStart < x)
+			{
+				unsigned n = x - litStart;
+				if (n > 128)
+					n = 128;
+				dst[outPos++] = (unsigned char)(n - 1);
+				memcpy(dst + outPos, row + litStart, n);
+				outPos += n;
+				litStart += n;
+			}
+			dst[outPos++] = (unsigned char)(0x80 | (run - 1));
+			dst[outPos++] = row[x];
+			x += run;
+			litStart = x;
+		}
+		else
+			x += run;
+	}
+	while (litStart < width)
+	{
+		unsigned n = width - litStart;
+		if (n > 128)
+			n = 128;
+		dst[outPos++] = (unsigned char)(n - 1);
+		memcpy(dst + outPos, row + litStart, n);
+		outPos += n;
+		litStart += n;
+	}
+
+	MHK_PUT16(dst, outPos - 2);
+	return outPos;
+}
@@ -0,0 +1,96 @@
+/* Mohawk bitmap (tBMP) interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef MHKBITMAP_H
+#define MHKBITMAP_H
+
+#include <stddef.h>
+
+/* Bits of the format word in a tBMP header.  The names of the
+   compression bits follow the labels of the bitmap parameters
+   dialog.  */
+enum BmpFormat
+{
+	BMP_BPP_MASK	= 0x0007,
+	BMP_BPP1		= 0x0000,
+	BMP_BPP4		= 0x0001,
+	BMP_BPP8		= 0x0002,
+	BMP_BPP16		= 0x0003,
+	BMP_BPP24		= 0x0004,
+	BMP_HAS_CLUT	= 0x0008,
+	BMP_2ND_MASK	= 0x00f0, /* Secondary compression */
+	BMP_2ND_NONE	= 0x0000,
+	BMP_2ND_RLE8	= 0x0010,
+	BMP_2ND_RLEU	= 0x0030, /* Unknown RLE variant */
+	BMP_1ST_MASK	= 0x0f00, /* Primary compression */
+	BMP_1ST_NONE	= 0x0000,
+	BMP_1ST_LZ		= 0x0100,
+	BMP_1ST_LZU		= 0x0200, /* Unknown LZ variant */
+	BMP_1ST_RIVEN	= 0x0400
+};
+
+#define BMP_HEADER_SIZE	8
+#define BMP_LZ_HEADER_SIZE 10
+#define BMP_MAX_DIM		0x3ff /* Upper bits of the dimensions are flags */
+#define BMP_MAX_ROW_SIZE (BMP_MAX_DIM & ~1) /* Row sizes are even */
+
+typedef struct MhkBitmap_t MhkBitmap;
+typedef struct BmpRect_t BmpRect;
+
+/* Receives decoded rows from StreamBitmap().  "row" holds the packed
+   pixels of row "y" starting at column zero, but only the columns
+   inside the clipping rectangle are valid.  The row is only valid
+   during the call.  */
+typedef void (*BmpRowSink)(void* ctx, unsigned y, const unsigned char* row);
+
+/* A parsed tBMP resource.  Decoded pixels are stored as packed rows
+   at the bitmap's native depth, BmpRowSize() bytes per row, with the
+   leftmost pixel in the most significant bits.  */
+struct MhkBitmap_t
+{
+	unsigned width;
+	unsigned height;
+	unsigned bytesPerRow; /* Row size in uncompressed tBMP data */
+	unsigned format; /* See BmpFormat */
+	unsigned bpp;
+	unsigned rgbBits;
+	unsigned numColors; /* Zero unless there is an inline palette */
+	unsigned long palette[256]; /* 0x00RRGGBB */
+	const unsigned char* data; /* Compressed pixel data */
+	size_t dataSize;
+};
+
+/* A rectangle in bitmap coordinates; "right" and "bottom" are
+   exclusive.  */
+struct BmpRect_t
+{
+	unsigned left;
+	unsigned top;
+	unsigned right;
+	unsigned bottom;
+};
+
+int ParseBitmap(const unsigned char* rsrc, size_t size, MhkBitmap* bmp);
+unsigned BmpBitsPerPixel(unsigned format);
+size_t BmpRowSize(const MhkBitmap* bmp);
+bool BmpCanDecode(unsigned format);
+bool BmpCanEncode(unsigned format);
+int StreamBitmap(const MhkBitmap* bmp, const BmpRect* clip,
+	BmpRowSink sink, void* ctx);
+int ReplaceBitmapPalette(const unsigned char* rsrc, size_t size,
+	const unsigned long* palette, unsigned numColors,
+	unsigned char** out, size_t* outSize);
+int ParsePaletteResource(const unsigned char* rsrc, size_t size,
+	unsigned long* palette, unsigned* start, unsigned* count);
+int EncodePaletteResource(const unsigned long* palette, unsigned start,
+	unsigned count, unsigned char** out, size_t* outSize);
+int UnpackBitmapLz(const MhkBitmap* bmp, unsigned char** out,
+	size_t* outSize);
+int DecodeBitmap(const MhkBitmap* bmp, unsigned char* pixels, size_t stride);
+int EncodeBitmap(const MhkBitmap* bmp, const unsigned char* pixels,
+	size_t stride, unsigned lzChain, unsigned char** out, size_t* outSize);
+int SpliceBitmapRows(const unsigned char* rsrc, size_t size,
+	const unsigned char* pixels, size_t stride, const unsigned char* dirty,
+	unsigned char** out, size_t* outSize);
+
+#endif /* not MHKBITMAP_H */
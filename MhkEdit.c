@@ -22,8 +22,22 @@
 
 #include "bool.h"
 #include "Panel.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "WorkPool.h"
+#include "BmpOptimize.h"
+#include "PalExpand.h"
+#include "Quantize.h"
+#include "BmpImport.h"
+#include "BmpView.h"
+#include "PalEdit.h"
+#include "ImageFile.h"
+#include "ThumbView.h"
+#include "MhkSprite.h"
+#include "SpriteView.h"
+#include "TimelineView.h"
 /* #include "FileSysInterface.h" */
-/** #include "TextEdit.h" */
+#include "HexEdit.h"
 
 #ifndef __GNUC__
 #define __attribute__(params)
@@ -77,6 +91,14 @@ bool draggingDiv = false; /* This is up here for a strange reason (see
 						     "Message loop") */
 static HWND paramsDlg = NULL;
 int mhkGameMode = D_GM_ORLY;
+static MhkArchive* curArchive = NULL;
+static char curFileName[MAX_PATH] = "";
+/* Palette editing state.  The edited colors are only written to the
+   archive when editing ends.  */
+static int palRsrc = -1; /* Resource being edited, or -1 */
+static unsigned long editPal[256];
+static unsigned editPalCount;
+static bool palDirty = false;
 
 LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 	LPARAM lParam);
@@ -89,6 +111,20 @@ INT_PTR CALLBACK GameModeProc(HWND hDlg, UINT uMsg, WPARAM wParam,
 	LPARAM lParam);
 HWND CreateToolBar(HWND hWndParent);
 void ConstructParamsDlg(HWND hwnd, LPCTSTR rcIDs[], unsigned numAppend);
+BOOL PromptFileName(HWND hwnd, BOOL save);
+void FillResourceTree(void);
+void OptimizeBitmaps(HWND hwnd);
+void AutoCompressResource(HWND hwnd);
+void ImportResource(HWND hwnd);
+int SelectedTreeParam(void);
+int SelectedResource(void);
+void SelectTreeResource(int index);
+void ShowResource(int param);
+void ShowSpriteParams(const MhkSprite* spr);
+void UpdateSpriteParams(void);
+void BeginPaletteEdit(HWND hwnd);
+void EndPaletteEdit(HWND hwnd, bool commit);
+void LoadPalette(HWND hwnd);
 void HidePanelWin(HWND hwnd);
 void ShowPanelWin(HWND hwnd, HWND before1, HWND before2, HWND before3,
 	BOOL horzDiv, int subProps, unsigned oldMoveTo, long divPos);
@@ -127,12 +163,21 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInst,
 	if (!RegisterClassEx(&wcex))
 		return 0;
 
-	/* Register newer text edit window class */
-	/** wcex.lpfnWndProc = TextEditProc;
+	if (!RegisterBmpView(hInstance) || !RegisterPalEdit(hInstance) ||
+		!RegisterThumbView(hInstance) || !RegisterSpriteView(hInstance) ||
+		!RegisterTimelineView(hInstance))
+		return 0;
+
+	/* Register newer text edit window class, which shows resources
+	   that have no view of their own in hex.  */
+	wcex.lpfnWndProc = TextEditProc;
+	wcex.hCursor = LoadCursor(NULL, IDC_ARROW);
+	wcex.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
+	wcex.lpszMenuName = NULL;
 	wcex.lpszClassName = "CustomTextEdit";
 
 	if (!RegisterClassEx(&wcex))
-		return 0; */
+		return 0;
 
 	/* Load the accelerator table.  */
 	hAccel = LoadAccelerators(hInstance, (LPCTSTR)ACCTABLE);
@@ -216,6 +261,12 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInst,
 /* Window management variables */
 static Panel* mainFrame = NULL;
 static HWND dataWin;
+static HWND bmpWin; /* Takes the place of dataWin for bitmaps */
+static HWND thumbWin; /* And for a type with bitmaps */
+static HWND spriteWin; /* And for sprites */
+static HWND tmlnWin; /* And for sounds, and groups of sprites or sounds */
+static HWND hexWin; /* And for any other resource */
+static HWND palEditWin = NULL;
 static HWND treeWin;
 static HWND statusWin;
 static HWND toolBar;
@@ -251,6 +302,9 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 		unsigned statusHeight, toolBarHeight;
 		HTREEITEM hPrev;
 		TVINSERTSTRUCT tv;
+		char thumbCache[MAX_PATH];
+		char peakCache[MAX_PATH];
+		DWORD tempLen;
 
 		cs = (CREATESTRUCT*)lParam;
 
@@ -284,6 +338,44 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 		ReleaseDC(hwnd, hDC);
 		SendMessage(dataWin, WM_SETFONT, (WPARAM)hFont, (LPARAM)FALSE);
 		mainFrame->sub0->panWin = dataWin;
+		/* The bitmap view stays hidden until a bitmap is selected.  */
+		bmpWin = CreateWindowEx(WS_EX_CLIENTEDGE, BMPVIEW_CLASS, NULL,
+			WS_CHILD | WS_HSCROLL | WS_VSCROLL,
+			0, 0, 0, 0,
+			hwnd, (HMENU)BMP_WINDOW, cs->hInstance, NULL);
+		/* So does the thumbnail view, which keeps its cache in the
+		   temporary directory.  */
+		tempLen = GetTempPath(MAX_PATH, thumbCache);
+		if (tempLen == 0 || tempLen + 16 > MAX_PATH)
+			thumbCache[0] = '\0';
+		else
+		{
+			strcpy(peakCache, thumbCache);
+			strcat(thumbCache, "mhkedit.thumbs");
+			strcat(peakCache, "mhkedit.peaks");
+		}
+		thumbWin = CreateWindowEx(WS_EX_CLIENTEDGE, THUMBVIEW_CLASS, NULL,
+			WS_CHILD | WS_VSCROLL,
+			0, 0, 0, 0,
+			hwnd, (HMENU)THUMB_WINDOW, cs->hInstance,
+			thumbCache[0] != '\0' ? thumbCache : NULL);
+		spriteWin = CreateWindowEx(WS_EX_CLIENTEDGE, SPRITEVIEW_CLASS, NULL,
+			WS_CHILD,
+			0, 0, 0, 0,
+			hwnd, (HMENU)SPRITE_WINDOW, cs->hInstance, NULL);
+		/* The timeline keeps sound overviews next to the thumbnails.  */
+		tmlnWin = CreateWindowEx(WS_EX_CLIENTEDGE, TIMELINEVIEW_CLASS, NULL,
+			WS_CHILD | WS_HSCROLL | WS_VSCROLL,
+			0, 0, 0, 0,
+			hwnd, (HMENU)TMLN_WINDOW, cs->hInstance,
+			thumbCache[0] != '\0' ? peakCache : NULL);
+		/* Other resources are binary data, so show them in hex.  */
+		hexWin = CreateWindowEx(WS_EX_CLIENTEDGE, "CustomTextEdit", NULL,
+			WS_CHILD | WS_HSCROLL | WS_VSCROLL,
+			0, 0, 0, 0,
+			hwnd, (HMENU)HEX_WINDOW, cs->hInstance, NULL);
+		SendMessage(hexWin, WM_SETFONT, (WPARAM)hFont, (LPARAM)FALSE);
+		SendMessage(hexWin, EM_SETHEXMODE, (WPARAM)16, 0);
 		/* Receive notifications. */
 		/* SendMessage(dataWin, EM_SETEVENTMASK, (WPARAM)0,
 			(LPARAM)(ENM_SELCHANGE | ENM_MOUSEEVENTS)); */
@@ -372,13 +464,21 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 		break;
 	}
 	case WM_DESTROY:
+		EndPaletteEdit(hwnd, false);
 		ChangeClipboardChain(hwnd, nextClipViewer);
 		FreePanels(mainFrame);
 		DestroyWindow(paramsDlg);
 		DestroyWindow(treeWin);
 		DestroyWindow(dataWin);
+		DestroyWindow(bmpWin);
+		DestroyWindow(thumbWin);
+		DestroyWindow(spriteWin);
+		DestroyWindow(tmlnWin);
+		DestroyWindow(hexWin);
 		DeleteObject(hFont);
 		DestroyWindow(statusWin);
+		FreeMhkArchive(curArchive);
+		curArchive = NULL;
 		PostQuitMessage(0);
 		break;
 	case WM_PAINT:
@@ -442,10 +542,65 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 			MessageBox(hwnd, "HEY!", NULL, MB_OK);
 			break;
 		case M_OPEN:
+		{
+			MhkArchive* archive;
+			int error;
+			if (!PromptFileName(hwnd, FALSE))
+				break;
+			archive = LoadMhkArchive(curFileName, &error);
+			if (archive == NULL)
+			{
+				MessageBox(hwnd, MhkErrorString(error), NULL,
+						   MB_OK | MB_ICONERROR);
+				break;
+			}
+			EndPaletteEdit(hwnd, false);
+			FreeMhkArchive(curArchive);
+			curArchive = archive;
+			FillResourceTree();
 			break;
+		}
 		case M_SAVE:
-			break;
 		case M_SAVEAS:
+		{
+			int error;
+			if (curArchive == NULL)
+				break;
+			if ((LOWORD(wParam) == M_SAVEAS || curFileName[0] == '\0') &&
+				!PromptFileName(hwnd, TRUE))
+				break;
+			EndPaletteEdit(hwnd, true);
+			/* Note: The archive image stays loaded, so saving over
+			   the original file is safe.  */
+			error = SaveMhkArchive(curArchive, curFileName);
+			if (error != MHK_OK)
+				MessageBox(hwnd, MhkErrorString(error), NULL,
+						   MB_OK | MB_ICONERROR);
+			break;
+		}
+		case THUMB_WINDOW:
+			if (HIWORD(wParam) == THN_OPEN)
+				SelectTreeResource(GetThumbViewSelection(thumbWin));
+			break;
+		case TMLN_WINDOW:
+			if (HIWORD(wParam) == TLN_OPEN)
+				SelectTreeResource(GetTimelineSelection(tmlnWin));
+			break;
+		case SPRITE_WINDOW:
+			UpdateSpriteParams();
+			break;
+		case PALEDIT_WINDOW:
+			if (HIWORD(wParam) == PEN_CHANGE && palRsrc >= 0)
+			{
+				/* Only the palette expansion runs again, so redraw
+				   right away to keep up with the slider.  */
+				editPalCount = GetPalEditColors(palEditWin, editPal);
+				palDirty = true;
+				SetBmpViewPalette(bmpWin, editPal, editPalCount);
+				UpdateWindow(bmpWin);
+			}
+			else if (HIWORD(wParam) == PEN_CLOSE)
+				EndPaletteEdit(hwnd, true);
 			break;
 		case M_GAME_MODE:
 			DialogBox(g_hInstance, (LPCTSTR)GAME_MODE_DLG,
@@ -548,6 +703,12 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 				}
 				break;
 			}
+		case M_RSRC_IMPORT:
+			ImportResource(hwnd);
+			break;
+		case M_RSRC_OPTIMIZE:
+			OptimizeBitmaps(hwnd);
+			break;
 		case M_RSRC_PARAMS:
 			{
 				HMENU hMen;
@@ -645,6 +806,7 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 				DeleteObject(hFont);
 				hFont = CreateFontIndirect(cf.lpLogFont);
 				SendMessage(dataWin, WM_SETFONT, (WPARAM)hFont, (LPARAM)TRUE);
+				SendMessage(hexWin, WM_SETFONT, (WPARAM)hFont, (LPARAM)TRUE);
 			}
 			break;
 		}
@@ -687,6 +849,11 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 			pnmtv = (NMTREEVIEW*)lParam;
 			/* MessageBox(NULL, "BOO!", NULL, MB_OK); */
 			/* FSSOnChangeSelection(pnmtv->itemNew.pszText, dataWin); */
+			EndPaletteEdit(hwnd, true);
+			if (pnmtv->itemNew.hItem != NULL)
+				ShowResource((int)pnmtv->itemNew.lParam);
+			else
+				ShowResource(-1);
 		}
 		if (notHead->code == TTN_GETDISPINFO)
 		{
@@ -1177,8 +1344,49 @@ INT_PTR CALLBACK ParamsDlgProc(HWND hDlg, UINT uMsg, WPARAM wParam,
 			break;
 
 		/* Bitmap parameters */
+		case D_TBMP_AUTOCMP:
+		{
+			/* Automatic selection takes over both compression radio
+			   button groups, and is applied to the selected bitmap
+			   right away.  */
+			BOOL manual = !IsDlgButtonChecked(hDlg, D_TBMP_AUTOCMP);
+			unsigned id;
+			for (id = D_TBMP_2NDCMP_NONE; id <= D_TBMP_1STCMP_RIVEN; id++)
+				EnableWindow(GetDlgItem(hDlg, id), manual);
+			if (!manual)
+				AutoCompressResource(GetParent(hDlg));
+			break;
+		}
+
+		case D_TBMP_EDITPAL:
+			if (IsDlgButtonChecked(hDlg, D_TBMP_EDITPAL))
+				BeginPaletteEdit(GetParent(hDlg));
+			else
+				EndPaletteEdit(GetParent(hDlg), true);
+			break;
+		case D_TBMP_LOADPAL:
+			LoadPalette(GetParent(hDlg));
+			break;
 
 		/* Sprite parameters */
+		case D_TSPR_PREV:
+		case D_TSPR_NEXT:
+		{
+			unsigned frame = GetSpriteViewFrame(spriteWin);
+			unsigned numFrames =
+				GetDlgItemInt(hDlg, D_TSPR_NUMBMP, NULL, FALSE);
+			if (numFrames == 0)
+				break;
+			if (LOWORD(wParam) == D_TSPR_PREV)
+				frame = (frame + numFrames - 1) % numFrames;
+			else
+				frame = (frame + 1) % numFrames;
+			SetSpriteViewFrame(spriteWin, frame);
+			break;
+		}
+		case D_TSPR_PLAY:
+			PlaySpriteView(spriteWin, !IsSpriteViewPlaying(spriteWin));
+			break;
 
 		/* Palette parameters */
 		}
@@ -1446,6 +1654,557 @@ void ConstructParamsDlg(HWND hwnd, LPCTSTR rcIDs[], unsigned numAppend)
 	free(paramsDlgTmpl);
 }
 
+/* Asks the user for an archive file name, which is stored in
+   curFileName.  Returns FALSE if the user canceled.  */
+BOOL PromptFileName(HWND hwnd, BOOL save)
+{
+	OPENFILENAME ofn;
+	ZeroMemory(&ofn, sizeof(OPENFILENAME));
+	ofn.lStructSize = sizeof(OPENFILENAME);
+	ofn.hwndOwner = hwnd;
+	ofn.lpstrFilter = "Mohawk Archives (*.mhk)\0*.mhk\0All Files (*.*)\0*.*\0";
+	ofn.lpstrFile = curFileName;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.lpstrDefExt = "mhk";
+	if (save)
+	{
+		ofn.Flags = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST;
+		return GetSaveFileName(&ofn);
+	}
+	ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
+	return GetOpenFileName(&ofn);
+}
+
+/* Replaces the contents of the tree window with the resources of the
+   current archive, grouped by type.  The item parameter of a resource
+   is its index in the archive.  A type group has -2 minus the index of
+   its first resource, so that -1 can still mean no item.  */
+void FillResourceTree(void)
+{
+	TVINSERTSTRUCT tv;
+	HTREEITEM hType = NULL;
+	unsigned long lastType = 0;
+	char text[80];
+	unsigned i;
+
+	ShowResource(-1);
+	TreeView_DeleteAllItems(treeWin);
+	if (curArchive == NULL)
+		return;
+	tv.hInsertAfter = TVI_LAST;
+	tv.item.mask = TVIF_CHILDREN | TVIF_PARAM | TVIF_TEXT;
+	tv.item.pszText = text;
+	for (i = 0; i < curArchive->numResources; i++)
+	{
+		MhkResource* rsrc = &curArchive->resources[i];
+		if (hType == NULL || rsrc->type != lastType)
+		{
+			MhkTagToString(rsrc->type, text);
+			tv.hParent = NULL;
+			tv.item.cChildren = 1;
+			tv.item.lParam = -2 - (LPARAM)i;
+			hType = TreeView_InsertItem(treeWin, &tv);
+			lastType = rsrc->type;
+		}
+		if (rsrc->name != NULL)
+			wsprintf(text, "%u %.64s", rsrc->id, rsrc->name);
+		else
+			wsprintf(text, "%u", rsrc->id);
+		tv.hParent = hType;
+		tv.item.cChildren = 0;
+		tv.item.lParam = i;
+		TreeView_InsertItem(treeWin, &tv);
+	}
+}
+
+/* Runs the automatic compression selection over every bitmap in the
+   current archive and reports the savings.  */
+void OptimizeBitmaps(HWND hwnd)
+{
+	AutoCmpOptions opts;
+	RecompressReport report;
+	WorkPool* pool;
+	HCURSOR hOldCursor;
+	char text[2048];
+	int error;
+
+	if (curArchive == NULL)
+	{
+		MessageBeep(MB_OK);
+		return;
+	}
+	EndPaletteEdit(hwnd, true);
+	InitAutoCmpOptions(&opts);
+	hOldCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
+	pool = CreateWorkPool(0);
+	error = RecompressArchiveBitmaps(curArchive, &opts, pool, &report);
+	FreeWorkPool(pool);
+	SetCursor(hOldCursor);
+	/* The bitmap data may have moved.  */
+	ShowResource(SelectedTreeParam());
+	if (error != MHK_OK)
+	{
+		MessageBox(hwnd, MhkErrorString(error), NULL, MB_OK | MB_ICONERROR);
+		return;
+	}
+	FormatRecompressReport(&report, text, sizeof(text));
+	MessageBox(hwnd, text, "Bitmap Compression", MB_OK | MB_ICONINFORMATION);
+}
+
+/* Re-encodes the selected bitmap with the automatically chosen
+   compression.  The resource is left alone if no candidate beats its
+   current encoding.  */
+void AutoCompressResource(HWND hwnd)
+{
+	AutoCmpOptions opts;
+	AutoCmpResult result;
+	WorkPool* pool;
+	HCURSOR hOldCursor;
+	MhkBitmap bmp;
+	MhkFile* file;
+	unsigned char* pixels;
+	size_t rowSize;
+	int index = SelectedResource();
+	int best;
+	int error;
+
+	if (curArchive == NULL || index < 0 ||
+		curArchive->resources[index].type != MHK_TBMP)
+	{
+		MessageBeep(MB_OK);
+		return;
+	}
+	/* Committing the palette may replace the data, so do it first.  */
+	EndPaletteEdit(hwnd, true);
+	file = GetMhkResourceFile(curArchive, &curArchive->resources[index]);
+	error = ParseBitmap(file->data, file->size, &bmp);
+	if (error == MHK_OK && !BmpCanDecode(bmp.format))
+		error = MHK_EUNSUPPORTED;
+	if (error != MHK_OK)
+	{
+		MessageBox(hwnd, MhkErrorString(error), NULL, MB_OK | MB_ICONERROR);
+		return;
+	}
+
+	InitAutoCmpOptions(&opts);
+	ZeroMemory(&result, sizeof(AutoCmpResult));
+	rowSize = BmpRowSize(&bmp);
+	pixels = (unsigned char*)malloc(rowSize * bmp.height + 1);
+	if (pixels == NULL)
+	{
+		MessageBox(hwnd, MhkErrorString(MHK_ENOMEM), NULL,
+				   MB_OK | MB_ICONERROR);
+		return;
+	}
+	hOldCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
+	error = DecodeBitmap(&bmp, pixels, rowSize);
+	if (error == MHK_OK)
+	{
+		pool = CreateWorkPool(0);
+		error = AutoCompressBitmap(&bmp, pixels, rowSize, &opts, pool,
+								   &result);
+		FreeWorkPool(pool);
+	}
+	free(pixels);
+	SetCursor(hOldCursor);
+	if (error != MHK_OK)
+	{
+		FreeAutoCmpResult(&result);
+		MessageBox(hwnd, MhkErrorString(error), NULL, MB_OK | MB_ICONERROR);
+		return;
+	}
+
+	best = PickAutoCmpCandidate(&result, &opts, bmp.format, file->size);
+	if (best >= 0)
+	{
+		ReplaceMhkFileData(file, result.cands[best].data,
+						   result.cands[best].size);
+		result.cands[best].data = NULL;
+	}
+	FreeAutoCmpResult(&result);
+	ShowResource(index);
+}
+
+/* Returns the item parameter of the tree window selection (see
+   FillResourceTree()), or -1 if nothing is selected.  */
+int SelectedTreeParam(void)
+{
+	TVITEM item;
+	item.hItem = TreeView_GetSelection(treeWin);
+	if (item.hItem == NULL)
+		return -1;
+	item.mask = TVIF_PARAM;
+	if (!TreeView_GetItem(treeWin, &item))
+		return -1;
+	return (int)item.lParam;
+}
+
+/* Returns the archive index of the resource selected in the tree
+   window, or -1 if no resource is selected.  */
+int SelectedResource(void)
+{
+	int param = SelectedTreeParam();
+	return (param >= 0) ? param : -1;
+}
+
+/* Selects the tree item of a resource, which shows it.  */
+void SelectTreeResource(int index)
+{
+	HTREEITEM hType, hItem;
+	TVITEM item;
+
+	if (index < 0)
+		return;
+	item.mask = TVIF_PARAM;
+	for (hType = TreeView_GetRoot(treeWin); hType != NULL;
+		 hType = TreeView_GetNextSibling(treeWin, hType))
+	{
+		for (hItem = TreeView_GetChild(treeWin, hType); hItem != NULL;
+			 hItem = TreeView_GetNextSibling(treeWin, hItem))
+		{
+			item.hItem = hItem;
+			if (TreeView_GetItem(treeWin, &item) && item.lParam == index)
+			{
+				TreeView_EnsureVisible(treeWin, hItem);
+				TreeView_SelectItem(treeWin, hItem);
+				return;
+			}
+		}
+	}
+}
+
+/* Replaces the selected bitmap with a BMP file.  Full-color images are
+   quantized to 8 bits per pixel with a palette of their own, and the
+   compression is chosen automatically.  */
+void ImportResource(HWND hwnd)
+{
+	OPENFILENAME ofn;
+	char fileName[MAX_PATH] = "";
+	ImportOptions opts;
+	WorkPool* pool;
+	HCURSOR hOldCursor;
+	PalColor* pixels;
+	unsigned width, height;
+	unsigned char* data;
+	size_t size;
+	int index = SelectedResource();
+	MhkResource* rsrc;
+	int error;
+
+	if (curArchive == NULL || index < 0 ||
+		curArchive->resources[index].type != MHK_TBMP)
+	{
+		MessageBeep(MB_OK);
+		return;
+	}
+	rsrc = &curArchive->resources[index];
+
+	ZeroMemory(&ofn, sizeof(OPENFILENAME));
+	ofn.lStructSize = sizeof(OPENFILENAME);
+	ofn.hwndOwner = hwnd;
+	ofn.lpstrFilter = "Bitmaps (*.bmp)\0*.bmp\0All Files (*.*)\0*.*\0";
+	ofn.lpstrFile = fileName;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
+	if (!GetOpenFileName(&ofn))
+		return;
+
+	EndPaletteEdit(hwnd, false);
+	InitImportOptions(&opts);
+	hOldCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
+	error = LoadBmpFile(fileName, &pixels, &width, &height);
+	if (error == MHK_OK)
+	{
+		pool = CreateWorkPool(0);
+		error = ImportBitmap(pixels, width, height, width * sizeof(PalColor),
+							 &opts, pool, &data, &size);
+		FreeWorkPool(pool);
+		free(pixels);
+	}
+	SetCursor(hOldCursor);
+	if (error == MHK_EUNSUPPORTED)
+	{
+		MessageBox(hwnd, "The image is too large or uses a BMP format "
+			"that cannot be imported.", NULL, MB_OK | MB_ICONERROR);
+		return;
+	}
+	if (error != MHK_OK)
+	{
+		MessageBox(hwnd, MhkErrorString(error), NULL, MB_OK | MB_ICONERROR);
+		return;
+	}
+	ReplaceMhkFileData(GetMhkResourceFile(curArchive, rsrc), data, size);
+	ShowResource(index);
+}
+
+/* Shows a resource of the current archive in the data pane, given its
+   tree item parameter.  Bitmaps that can be decoded replace the data
+   window with the bitmap view, and a group of bitmaps with the
+   thumbnail view; sprites get the sprite view and sounds the
+   timeline, as do groups of either.  A "param" of -1 clears the
+   view.  */
+void ShowResource(int param)
+{
+	HWND showWin = dataWin;
+	HWND hideWin;
+	Panel* panel = NULL;
+	HWND paneWins[6];
+	MhkBitmap bmp;
+	MhkSprite spr;
+	bool isSprite = false;
+	char palStatus[32] = "None";
+	BOOL indexed = FALSE;
+	unsigned i;
+
+	if (curArchive != NULL && param >= 0 &&
+		(unsigned)param < curArchive->numResources)
+	{
+		MhkResource* rsrc = &curArchive->resources[param];
+		MhkFile* file = GetMhkResourceFile(curArchive, rsrc);
+		if (rsrc->type == MHK_TBMP &&
+			ParseBitmap(file->data, file->size, &bmp) == MHK_OK &&
+			BmpCanDecode(bmp.format))
+		{
+			SetBmpViewBitmap(bmpWin, &bmp);
+			showWin = bmpWin;
+			indexed = (bmp.bpp <= 8);
+			if (bmp.numColors > 0)
+				wsprintf(palStatus, "Inline, %u colors", bmp.numColors);
+		}
+		else if (rsrc->type == MHK_TSPR &&
+				 ParseSprite(file->data, file->size, &spr) == MHK_OK)
+		{
+			/* The view takes over the frame table, but the header
+			   fields are still read below.  */
+			SetSpriteViewSprite(spriteWin, &spr);
+			showWin = spriteWin;
+			isSprite = true;
+		}
+		else if (rsrc->type == MHK_TWAV &&
+				 SetTimelineSound(tmlnWin, file->data, file->size))
+			showWin = tmlnWin;
+		else if (hexWin != NULL)
+		{
+			/* The hex view reads the data in place.  */
+			SendMessage(hexWin, EM_SETHANDLE, (WPARAM)file->data,
+						(LPARAM)file->size);
+			showWin = hexWin;
+		}
+	}
+	else if (curArchive != NULL && param <= -2 &&
+			 (unsigned)(-2 - param) < curArchive->numResources)
+	{
+		unsigned first = (unsigned)(-2 - param);
+		unsigned long type = curArchive->resources[first].type;
+		unsigned end = first;
+		while (end < curArchive->numResources &&
+			   curArchive->resources[end].type == type)
+			end++;
+		if (type == MHK_TBMP)
+		{
+			SetThumbViewItems(thumbWin, curArchive, first, end - first);
+			showWin = thumbWin;
+		}
+		else if (type == MHK_TSPR || type == MHK_TWAV)
+		{
+			SetTimelineItems(tmlnWin, curArchive, first, end - first);
+			showWin = tmlnWin;
+		}
+	}
+	if (showWin != bmpWin)
+		SetBmpViewBitmap(bmpWin, NULL);
+	if (showWin != thumbWin)
+		SetThumbViewItems(thumbWin, NULL, 0, 0);
+	if (showWin != spriteWin)
+		SetSpriteViewSprite(spriteWin, NULL);
+	if (showWin != tmlnWin)
+		SetTimelineSound(tmlnWin, NULL, 0);
+	if (showWin != hexWin)
+		SendMessage(hexWin, EM_SETHANDLE, (WPARAM)"", 0);
+	ShowSpriteParams(isSprite ? &spr : NULL);
+	SetDlgItemText(paramsDlg, D_TBMP_PALSTAT, palStatus);
+	EnableWindow(GetDlgItem(paramsDlg, D_TBMP_EDITPAL), indexed);
+	EnableWindow(GetDlgItem(paramsDlg, D_TBMP_LOADPAL), indexed);
+
+	/* Swap the windows in the panel.  Note that ChangePanelHWND()
+	   can't be used here.  */
+	paneWins[0] = dataWin;
+	paneWins[1] = bmpWin;
+	paneWins[2] = thumbWin;
+	paneWins[3] = spriteWin;
+	paneWins[4] = tmlnWin;
+	paneWins[5] = hexWin;
+	for (i = 0; i < 6 && panel == NULL; i++)
+		panel = PanelFromHWND(mainFrame, paneWins[i]);
+	if (panel == NULL)
+		return;
+	hideWin = panel->panWin;
+	panel->panWin = showWin;
+	if (hideWin != showWin)
+		ShowWindow(hideWin, SW_HIDE);
+	ShowWindow(showWin, SW_SHOW);
+	SizePanelWindows(mainFrame);
+}
+
+/* Fills in the sprite parameters, or clears them if "spr" is NULL.  */
+void ShowSpriteParams(const MhkSprite* spr)
+{
+	static const int fieldIds[SPR_NUM_UNKNOWN] =
+	{
+		D_TSPR_UKN1, D_TSPR_UKN2, D_TSPR_UKN3, D_TSPR_UKN4, D_TSPR_UKN5,
+		D_TSPR_UKN6, D_TSPR_UKN7, D_TSPR_UKN8, D_TSPR_UKN9, D_TSPR_UKN10,
+		D_TSPR_UKN11, D_TSPR_UKN12, D_TSPR_UKN13, D_TSPR_UKN14
+	};
+	unsigned i;
+
+	SetDlgItemInt(paramsDlg, D_TSPR_NUMBMP,
+		spr != NULL ? spr->numFrames : 0, FALSE);
+	if (spr != NULL)
+		SetDlgItemInt(paramsDlg, D_TSPR_VER, spr->version, FALSE);
+	else
+		SetDlgItemText(paramsDlg, D_TSPR_VER, "");
+	for (i = 0; i < SPR_NUM_UNKNOWN; i++)
+	{
+		if (spr != NULL)
+			SetDlgItemInt(paramsDlg, fieldIds[i], spr->unknown[i], FALSE);
+		else
+			SetDlgItemText(paramsDlg, fieldIds[i], "");
+	}
+	EnableWindow(GetDlgItem(paramsDlg, D_TSPR_PLAY), spr != NULL);
+	EnableWindow(GetDlgItem(paramsDlg, D_TSPR_PREV), spr != NULL);
+	EnableWindow(GetDlgItem(paramsDlg, D_TSPR_NEXT), spr != NULL);
+	UpdateSpriteParams();
+}
+
+/* Shows the frame and playback state of the sprite view.  */
+void UpdateSpriteParams(void)
+{
+	char text[32];
+	if (GetDlgItemInt(paramsDlg, D_TSPR_NUMBMP, NULL, FALSE) > 0)
+		wsprintf(text, "Sprite #%u", GetSpriteViewFrame(spriteWin) + 1);
+	else
+		strcpy(text, "Sprite #n");
+	SetDlgItemText(paramsDlg, D_TSPR_SPRNUM, text);
+	SetDlgItemText(paramsDlg, D_TSPR_PLAY,
+		IsSpriteViewPlaying(spriteWin) ? "Stop" : "Play");
+}
+
+/* Starts editing the palette of the bitmap in the bitmap view.  The
+   decoded pixels stay in memory until editing ends, so that color
+   changes only need the palette expansion.  */
+void BeginPaletteEdit(HWND hwnd)
+{
+	if (palRsrc >= 0)
+		return;
+	editPalCount = GetBmpViewPalette(bmpWin, editPal);
+	if (editPalCount == 0 || !IsWindowVisible(bmpWin))
+	{
+		MessageBeep(MB_OK);
+		CheckDlgButton(paramsDlg, D_TBMP_EDITPAL, BST_UNCHECKED);
+		return;
+	}
+	if (!SetBmpViewResident(bmpWin, true))
+	{
+		MessageBox(hwnd, "The bitmap could not be decoded.", NULL,
+				   MB_OK | MB_ICONERROR);
+		CheckDlgButton(paramsDlg, D_TBMP_EDITPAL, BST_UNCHECKED);
+		return;
+	}
+	palRsrc = SelectedResource();
+	palDirty = false;
+	palEditWin = CreatePalEdit(hwnd, editPal, editPalCount);
+	CheckDlgButton(paramsDlg, D_TBMP_EDITPAL, BST_CHECKED);
+}
+
+/* Stops editing a palette.  If "commit" is set, changed colors are
+   written to the bitmap's inline palette; the pixel data is copied
+   without being re-encoded.  */
+void EndPaletteEdit(HWND hwnd, bool commit)
+{
+	int rsrcIndex = palRsrc;
+	if (rsrcIndex < 0)
+		return;
+	palRsrc = -1;
+	if (palEditWin != NULL)
+	{
+		DestroyWindow(palEditWin);
+		palEditWin = NULL;
+	}
+	CheckDlgButton(paramsDlg, D_TBMP_EDITPAL, BST_UNCHECKED);
+	SetBmpViewResident(bmpWin, false);
+	if (!palDirty)
+		return;
+	palDirty = false;
+
+	if (commit)
+	{
+		MhkFile* file = GetMhkResourceFile(curArchive,
+			&curArchive->resources[rsrcIndex]);
+		unsigned char* data;
+		size_t size;
+		int error = ReplaceBitmapPalette(file->data, file->size,
+			editPal, editPalCount, &data, &size);
+		if (error == MHK_OK)
+			ReplaceMhkFileData(file, data, size);
+		else if (error == MHK_EUNSUPPORTED)
+			MessageBox(hwnd, "Only 8-bit bitmaps can store a palette.  "
+				"The palette changes were discarded.", NULL,
+				MB_OK | MB_ICONWARNING);
+		else
+			MessageBox(hwnd, MhkErrorString(error), NULL,
+					   MB_OK | MB_ICONERROR);
+	}
+	/* Show the stored colors again, which also picks up the new
+	   resource data.  */
+	ShowResource(SelectedResource());
+}
+
+/* Replaces the colors of the bitmap in the bitmap view with the colors
+   from a palette file, starting palette editing if necessary.  */
+void LoadPalette(HWND hwnd)
+{
+	OPENFILENAME ofn;
+	char fileName[MAX_PATH] = "";
+	unsigned long palette[256];
+	unsigned numColors;
+	int error;
+
+	ZeroMemory(&ofn, sizeof(OPENFILENAME));
+	ofn.lStructSize = sizeof(OPENFILENAME);
+	ofn.hwndOwner = hwnd;
+	ofn.lpstrFilter = "Palettes (*.pal;*.act)\0*.pal;*.act\0"
+		"All Files (*.*)\0*.*\0";
+	ofn.lpstrFile = fileName;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
+	if (!GetOpenFileName(&ofn))
+		return;
+	error = LoadPaletteFile(fileName, palette, &numColors);
+	if (error != MHK_OK)
+	{
+		MessageBox(hwnd, MhkErrorString(error), NULL, MB_OK | MB_ICONERROR);
+		return;
+	}
+
+	BeginPaletteEdit(hwnd);
+	if (palRsrc < 0)
+		return;
+	/* The bitmap's depth limits how many colors it can use.  */
+	{
+		MhkFile* file = GetMhkResourceFile(curArchive,
+			&curArchive->resources[palRsrc]);
+		MhkBitmap bmp;
+		if (ParseBitmap(file->data, file->size, &bmp) == MHK_OK &&
+			bmp.bpp < 8 && numColors > (1U << bmp.bpp))
+			numColors = 1U << bmp.bpp;
+	}
+	memcpy(editPal, palette, numColors * sizeof(unsigned long));
+	editPalCount = numColors;
+	palDirty = true;
+	SetPalEditColors(palEditWin, editPal, editPalCount);
+	SetBmpViewPalette(bmpWin, editPal, editPalCount);
+}
+
 void HidePanelWin(HWND hwnd)
 {
 	Panel* panel; Panel* savePanel;
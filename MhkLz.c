@@ -0,0 +1,242 @@
+/* Mohawk LZ compression */
+
+/* The Mohawk LZ format is a classic LZSS variant with a 1024 byte
+   ring buffer.  A flag byte precedes every group of eight items,
+   least significant bit first.  A set bit means that a literal byte
+   follows.  A clear bit means that a big-endian 16-bit word follows:
+   the top 6 bits hold the match length minus 3, and the bottom 10
+   bits hold the ring buffer position of the match minus 66 (the
+   maximum match length).  The odd bias comes from the original LZSS
+   implementation, which started writing at position 1024 - 66 of the
+   ring buffer rather than at zero.
+
+   The ring buffer position of an output byte is simply its offset
+   modulo 1024, so the decoder works directly in the output buffer.
+   Matches that reach before the start of the output read zeros.  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkLz.h"
+
+#define LZ_RING_MASK (LZ_RING_SIZE - 1)
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_HASH(p) \
+	((((unsigned)(p)[0] << 8) ^ ((unsigned)(p)[1] << 4) ^ (p)[2]) & \
+	 (LZ_HASH_SIZE - 1))
+
+/* Prepares to unpack "srcSize" bytes of packed data into "dst",
+   which must have room for the "dstSize" bytes of unpacked data.  */
+void LzStreamInit(LzStream* stream, const unsigned char* src,
+	size_t srcSize, unsigned char* dst, size_t dstSize)
+{
+	stream->src = src;
+	stream->srcEnd = src + srcSize;
+	stream->dst = dst;
+	stream->dstSize = dstSize;
+	stream->outPos = 0;
+	stream->flags = 0;
+}
+
+/* Unpacks until at least "upTo" bytes of output are available, which
+   lets callers stop early when they only need the beginning of the
+   data.  The last match may run past "upTo".  Returns false if the
+   input ran out first.  */
+bool LzStreamFill(LzStream* stream, size_t upTo)
+{
+	const unsigned char* src = stream->src;
+	const unsigned char* srcEnd = stream->srcEnd;
+	unsigned char* dst = stream->dst;
+	size_t dstSize = stream->dstSize;
+	size_t outPos = stream->outPos;
+	unsigned flags = stream->flags;
+	bool success = true;
+
+	if (upTo > dstSize)
+		upTo = dstSize;
+	while (outPos < upTo)
+	{
+		flags >>= 1;
+		if (!(flags & 0x100))
+		{
+			if (src >= srcEnd)
+			{
+				success = false;
+				break;
+			}
+			flags = *src++ | 0xff00;
+		}
+		if (flags & 1)
+		{
+			if (src >= srcEnd)
+			{
+				success = false;
+				break;
+			}
+			dst[outPos++] = *src++;
+		}
+		else
+		{
+			unsigned offLen;
+			unsigned length;
+			unsigned ringPos;
+			unsigned insertPos = outPos & LZ_RING_MASK;
+			size_t distance;
+
+			if (srcEnd - src < 2)
+			{
+				success = false;
+				break;
+			}
+			offLen = (src[0] << 8) | src[1];
+			src += 2;
+			length = (offLen >> 10) + LZ_MIN_MATCH;
+			ringPos = (offLen + LZ_MAX_MATCH) & LZ_RING_MASK;
+			distance = ((insertPos - ringPos - 1) & LZ_RING_MASK) + 1;
+			if (length > dstSize - outPos)
+				length = dstSize - outPos;
+
+			/* Copy forward one byte at a time, since the match may
+			   overlap the bytes being written.  */
+			while (length > 0 && distance > outPos)
+			{
+				dst[outPos++] = 0;
+				length--;
+			}
+			while (length > 0)
+			{
+				dst[outPos] = dst[outPos - distance];
+				outPos++;
+				length--;
+			}
+		}
+	}
+
+	stream->src = src;
+	stream->outPos = outPos;
+	stream->flags = flags;
+	return success;
+}
+
+/* Unpacks exactly "dstSize" bytes into "dst".  If "srcUsed" is not
+   NULL, the number of input bytes consumed is stored there.  Returns
+   false if the input ran out first.  */
+bool LzUnpack(const unsigned char* src, size_t srcSize,
+	unsigned char* dst, size_t dstSize, size_t* srcUsed)
+{
+	LzStream stream;
+	LzStreamInit(&stream, src, srcSize, dst, dstSize);
+	if (!LzStreamFill(&stream, dstSize))
+		return false;
+	if (srcUsed != NULL)
+		*srcUsed = stream.src - src;
+	return true;
+}
+
+/* Packs "srcSize" bytes into "dst", which must have room for at least
+   LZ_PACK_BOUND(srcSize) bytes.  "maxChain" limits how many earlier
+   positions are tried for each match; larger values compress better
+   but more slowly.  Returns the packed size, or zero if memory could
+   not be allocated.  */
+size_t LzPack(const unsigned char* src, size_t srcSize,
+	unsigned char* dst, unsigned maxChain)
+{
+	/* Hash chains of earlier positions.  "prev" is indexed by ring
+	   position, so only positions inside the window are kept.  */
+	long* head;
+	long* prev;
+	size_t pos = 0;
+	size_t outPos = 0;
+	size_t flagPos = 0;
+	unsigned flagBit = 0x100;
+	unsigned i;
+
+	head = (long*)malloc(LZ_HASH_SIZE * sizeof(long));
+	prev = (long*)malloc(LZ_RING_SIZE * sizeof(long));
+	if (head == NULL || prev == NULL)
+	{
+		free(head);
+		free(prev);
+		return 0;
+	}
+	for (i = 0; i < LZ_HASH_SIZE; i++)
+		head[i] = -1;
+
+	while (pos < srcSize)
+	{
+		unsigned bestLen = 0;
+		size_t bestPos = 0;
+		size_t avail = srcSize - pos;
+		unsigned matchLen;
+
+		if (flagBit == 0x100)
+		{
+			flagPos = outPos++;
+			dst[flagPos] = 0;
+			flagBit = 1;
+		}
+
+		if (avail >= LZ_MIN_MATCH)
+		{
+			unsigned maxLen = (avail < LZ_MAX_MATCH) ? avail : LZ_MAX_MATCH;
+			long cand = head[LZ_HASH(src + pos)];
+			unsigned chain = maxChain;
+			while (cand >= 0 && pos - cand <= LZ_RING_SIZE && chain-- > 0)
+			{
+				const unsigned char* a = src + cand;
+				const unsigned char* b = src + pos;
+				unsigned len = 0;
+				long next;
+				while (len < maxLen && a[len] == b[len])
+					len++;
+				if (len > bestLen)
+				{
+					bestLen = len;
+					bestPos = cand;
+					if (len == maxLen)
+						break;
+				}
+				/* Chains must run backward; anything else means that
+				   the ring slot has been reused.  */
+				next = prev[cand & LZ_RING_MASK];
+				if (next >= cand)
+					break;
+				cand = next;
+			}
+		}
+
+		if (bestLen >= LZ_MIN_MATCH)
+		{
+			unsigned offLen = ((bestLen - LZ_MIN_MATCH) << 10) |
+				((bestPos - LZ_MAX_MATCH) & LZ_RING_MASK);
+			dst[outPos++] = (unsigned char)(offLen >> 8);
+			dst[outPos++] = (unsigned char)offLen;
+			matchLen = bestLen;
+		}
+		else
+		{
+			dst[flagPos] |= flagBit;
+			dst[outPos++] = src[pos];
+			matchLen = 1;
+		}
+		flagBit <<= 1;
+
+		/* Enter every consumed position into the hash chains.  */
+		while (matchLen-- > 0)
+		{
+			if (srcSize - pos >= LZ_MIN_MATCH)
+			{
+				unsigned hash = LZ_HASH(src + pos);
+				prev[pos & LZ_RING_MASK] = head[hash];
+				head[hash] = pos;
+			}
+			pos++;
+		}
+	}
+
+	free(head);
+	free(prev);
+	return outPos;
+}
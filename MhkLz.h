@@ -0,0 +1,38 @@
+/* Mohawk LZ compression interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef MHKLZ_H
+#define MHKLZ_H
+
+#include <stddef.h>
+
+#define LZ_RING_SIZE	1024 /* Size of the sliding window */
+#define LZ_MIN_MATCH	3
+#define LZ_MAX_MATCH	66
+/* Worst case size of a packed stream: one flag byte for every eight
+   literals.  */
+#define LZ_PACK_BOUND(n) ((n) + (n) / 8 + 2)
+
+typedef struct LzStream_t LzStream;
+
+/* State for unpacking a stream a piece at a time.  The output buffer
+   doubles as the sliding window, so it must hold the whole output.  */
+struct LzStream_t
+{
+	const unsigned char* src;
+	const unsigned char* srcEnd;
+	unsigned char* dst;
+	size_t dstSize;
+	size_t outPos; /* Bytes of "dst" unpacked so far */
+	unsigned flags;
+};
+
+void LzStreamInit(LzStream* stream, const unsigned char* src,
+	size_t srcSize, unsigned char* dst, size_t dstSize);
+bool LzStreamFill(LzStream* stream, size_t upTo);
+bool LzUnpack(const unsigned char* src, size_t srcSize,
+	unsigned char* dst, size_t dstSize, size_t* srcUsed);
+size_t LzPack(const unsigned char* src, size_t srcSize,
+	unsigned char* dst, unsigned maxChain);
+
+#endif /* not MHKLZ_H */
@@ -0,0 +1,415 @@
+/* Mohawk sound (tWAV) decoding */
+
+/* A tWAV resource is a small chunked file: "MHWK", a u32 size,
+   "WAVE", and then chunks that each start with a tag and a u32 size,
+   all big-endian.  Only the "Data" chunk matters for playback.  The
+   "ADPC" chunk holds decoder states for seeking, which are not needed.
+   The "Data" chunk starts with a 20-byte header:
+
+   u16 sample rate, u32 number of frames, u8 bits per sample,
+   u8 number of channels, u16 encoding (see SndEncoding), u16 loop
+   count, u32 loop start, u32 loop end.
+
+   The "Cue#" chunk holds markers for synchronizing animation: a u16
+   count, and for each marker a u32 frame and a name with a u8 length,
+   padded to an even size.
+
+   IMA ADPCM data has no block headers.  Every channel starts with a
+   predictor and step index of zero, and each byte holds two samples,
+   high nibble first.  In stereo those are the left and right samples
+   of one frame.
+
+   The ADPCM decoder looks up the whole step difference for a step
+   index and the three magnitude bits in one table, and applies the
+   sign and the clamping without branches, so that a sample costs a
+   handful of instructions and no calls.  The two channels of a stereo
+   byte depend on nothing but their own history, so they are decoded
+   side by side in one loop, and the processor works on both chains at
+   once.  DecodeImaAdpcmNaive() is the textbook version, kept to check
+   and measure the fast one against.  */
+
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkSound.h"
+
+#define SND_HEADER_SIZE 12
+#define SND_DATA_HEADER_SIZE 20
+#define IMA_MAX_INDEX 88
+
+/* Applies one nibble to a channel's predictor "pred" and step index
+   "idx", and stores the new sample in "out".  */
+#define IMA_STEP(pred, idx, nibble, out) \
+	do { \
+		int sign_ = -(int)((nibble) >> 3); \
+		(pred) += ((int)imaDiffs[idx][(nibble) & 7] ^ sign_) - sign_; \
+		(pred) = (pred) > 32767 ? 32767 : (pred); \
+		(pred) = (pred) < -32768 ? -32768 : (pred); \
+		(idx) += imaIndexAdjust[(nibble) & 7]; \
+		(idx) = (idx) < 0 ? 0 : (idx); \
+		(idx) = (idx) > IMA_MAX_INDEX ? IMA_MAX_INDEX : (idx); \
+		(out) = (short)(pred); \
+	} while (0)
+
+static const unsigned short imaStepSizes[IMA_MAX_INDEX + 1] =
+{
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
+	41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
+	190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+	724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894,
+	6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289,
+	16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int imaIndexAdjust[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+/* The difference that each step size and magnitude adds, computed
+   exactly as the naive decoder does, with the same truncation.  */
+static const unsigned short imaDiffs[IMA_MAX_INDEX + 1][8] =
+{
+	{ 0, 1, 3, 4, 7, 8, 10, 11 },
+	{ 1, 3, 5, 7, 9, 11, 13, 15 },
+	{ 1, 3, 5, 7, 10, 12, 14, 16 },
+	{ 1, 3, 6, 8, 11, 13, 16, 18 },
+	{ 1, 3, 6, 8, 12, 14, 17, 19 },
+	{ 1, 4, 7, 10, 13, 16, 19, 22 },
+	{ 1, 4, 7, 10, 14, 17, 20, 23 },
+	{ 1, 4, 8, 11, 15, 18, 22, 25 },
+	{ 2, 6, 10, 14, 18, 22, 26, 30 },
+	{ 2, 6, 10, 14, 19, 23, 27, 31 },
+	{ 2, 6, 11, 15, 21, 25, 30, 34 },
+	{ 2, 7, 12, 17, 23, 28, 33, 38 },
+	{ 2, 7, 13, 18, 25, 30, 36, 41 },
+	{ 3, 9, 15, 21, 28, 34, 40, 46 },
+	{ 3, 10, 17, 24, 31, 38, 45, 52 },
+	{ 3, 10, 18, 25, 34, 41, 49, 56 },
+	{ 4, 12, 21, 29, 38, 46, 55, 63 },
+	{ 4, 13, 22, 31, 41, 50, 59, 68 },
+	{ 5, 15, 25, 35, 46, 56, 66, 76 },
+	{ 5, 16, 27, 38, 50, 61, 72, 83 },
+	{ 6, 18, 31, 43, 56, 68, 81, 93 },
+	{ 6, 19, 33, 46, 61, 74, 88, 101 },
+	{ 7, 22, 37, 52, 67, 82, 97, 112 },
+	{ 8, 24, 41, 57, 74, 90, 107, 123 },
+	{ 9, 27, 45, 63, 82, 100, 118, 136 },
+	{ 10, 30, 50, 70, 90, 110, 130, 150 },
+	{ 11, 33, 55, 77, 99, 121, 143, 165 },
+	{ 12, 36, 60, 84, 109, 133, 157, 181 },
+	{ 13, 39, 66, 92, 120, 146, 173, 199 },
+	{ 14, 43, 73, 102, 132, 161, 191, 220 },
+	{ 16, 48, 81, 113, 146, 178, 211, 243 },
+	{ 17, 52, 88, 123, 160, 195, 231, 266 },
+	{ 19, 58, 97, 136, 176, 215, 254, 293 },
+	{ 21, 64, 107, 150, 194, 237, 280, 323 },
+	{ 23, 70, 118, 165, 213, 260, 308, 355 },
+	{ 26, 78, 130, 182, 235, 287, 339, 391 },
+	{ 28, 85, 143, 200, 258, 315, 373, 430 },
+	{ 31, 94, 157, 220, 284, 347, 410, 473 },
+	{ 34, 103, 173, 242, 313, 382, 452, 521 },
+	{ 38, 114, 191, 267, 345, 421, 498, 574 },
+	{ 42, 126, 210, 294, 379, 463, 547, 631 },
+	{ 46, 138, 231, 323, 417, 509, 602, 694 },
+	{ 51, 153, 255, 357, 459, 561, 663, 765 },
+	{ 56, 168, 280, 392, 505, 617, 729, 841 },
+	{ 61, 184, 308, 431, 555, 678, 802, 925 },
+	{ 68, 204, 340, 476, 612, 748, 884, 1020 },
+	{ 74, 223, 373, 522, 672, 821, 971, 1120 },
+	{ 82, 246, 411, 575, 740, 904, 1069, 1233 },
+	{ 90, 271, 452, 633, 814, 995, 1176, 1357 },
+	{ 99, 298, 497, 696, 895, 1094, 1293, 1492 },
+	{ 109, 328, 547, 766, 985, 1204, 1423, 1642 },
+	{ 120, 360, 601, 841, 1083, 1323, 1564, 1804 },
+	{ 132, 397, 662, 927, 1192, 1457, 1722, 1987 },
+	{ 145, 436, 728, 1019, 1311, 1602, 1894, 2185 },
+	{ 160, 480, 801, 1121, 1442, 1762, 2083, 2403 },
+	{ 176, 528, 881, 1233, 1587, 1939, 2292, 2644 },
+	{ 194, 582, 970, 1358, 1746, 2134, 2522, 2910 },
+	{ 213, 639, 1066, 1492, 1920, 2346, 2773, 3199 },
+	{ 234, 703, 1173, 1642, 2112, 2581, 3051, 3520 },
+	{ 258, 774, 1291, 1807, 2324, 2840, 3357, 3873 },
+	{ 284, 852, 1420, 1988, 2556, 3124, 3692, 4260 },
+	{ 312, 936, 1561, 2185, 2811, 3435, 4060, 4684 },
+	{ 343, 1030, 1717, 2404, 3092, 3779, 4466, 5153 },
+	{ 378, 1134, 1890, 2646, 3402, 4158, 4914, 5670 },
+	{ 415, 1246, 2078, 2909, 3742, 4573, 5405, 6236 },
+	{ 457, 1372, 2287, 3202, 4117, 5032, 5947, 6862 },
+	{ 503, 1509, 2516, 3522, 4529, 5535, 6542, 7548 },
+	{ 553, 1660, 2767, 3874, 4981, 6088, 7195, 8302 },
+	{ 608, 1825, 3043, 4260, 5479, 6696, 7914, 9131 },
+	{ 669, 2008, 3348, 4687, 6027, 7366, 8706, 10045 },
+	{ 736, 2209, 3683, 5156, 6630, 8103, 9577, 11050 },
+	{ 810, 2431, 4052, 5673, 7294, 8915, 10536, 12157 },
+	{ 891, 2674, 4457, 6240, 8023, 9806, 11589, 13372 },
+	{ 980, 2941, 4902, 6863, 8825, 10786, 12747, 14708 },
+	{ 1078, 3235, 5393, 7550, 9708, 11865, 14023, 16180 },
+	{ 1186, 3559, 5932, 8305, 10679, 13052, 15425, 17798 },
+	{ 1305, 3915, 6526, 9136, 11747, 14357, 16968, 19578 },
+	{ 1435, 4306, 7178, 10049, 12922, 15793, 18665, 21536 },
+	{ 1579, 4737, 7896, 11054, 14214, 17372, 20531, 23689 },
+	{ 1737, 5211, 8686, 12160, 15636, 19110, 22585, 26059 },
+	{ 1911, 5733, 9555, 13377, 17200, 21022, 24844, 28666 },
+	{ 2102, 6306, 10511, 14715, 18920, 23124, 27329, 31533 },
+	{ 2312, 6937, 11562, 16187, 20812, 25437, 30062, 34687 },
+	{ 2543, 7630, 12718, 17805, 22893, 27980, 33068, 38155 },
+	{ 2798, 8394, 13990, 19586, 25183, 30779, 36375, 41971 },
+	{ 3077, 9232, 15388, 21543, 27700, 33855, 40011, 46166 },
+	{ 3385, 10156, 16928, 23699, 30471, 37242, 44014, 50785 },
+	{ 3724, 11172, 18621, 26069, 33518, 40966, 48415, 55863 },
+	{ 4095, 12286, 20478, 28669, 36862, 45053, 53245, 61436 }
+
+};
+
+static const char* const encodingNames[] = { "PCM", "IMA ADPCM", "MPEG-2" };
+
+static int FindSoundChunk(const unsigned char* rsrc, size_t size,
+	unsigned long tag, const unsigned char** chunk, unsigned long* chunkSize);
+static int ImaDecodeNibble(ImaState* state, unsigned nibble);
+
+/* Finds the "Data" chunk of a tWAV resource and reads its header.
+   Returns an MhkError code.  */
+int ParseSound(const unsigned char* rsrc, size_t size, MhkSound* snd)
+{
+	const unsigned char* chunk;
+	unsigned long chunkSize;
+	unsigned long maxFrames;
+	int error;
+
+	error = FindSoundChunk(rsrc, size, MHK_TAG('D', 'a', 't', 'a'),
+		&chunk, &chunkSize);
+	if (error != MHK_OK)
+		return error;
+	if (chunkSize < SND_DATA_HEADER_SIZE)
+		return MHK_EFORMAT;
+	snd->sampleRate = MHK_GET16(chunk);
+	snd->numFrames = MHK_GET32(chunk + 2);
+	snd->bitsPerSample = chunk[6];
+	snd->numChannels = chunk[7];
+	snd->encoding = MHK_GET16(chunk + 8);
+	snd->loopCount = MHK_GET16(chunk + 10);
+	snd->loopStart = MHK_GET32(chunk + 12);
+	snd->loopEnd = MHK_GET32(chunk + 16);
+	snd->data = chunk + SND_DATA_HEADER_SIZE;
+	snd->dataSize = chunkSize - SND_DATA_HEADER_SIZE;
+	if (snd->numChannels == 0 || snd->numChannels > SND_MAX_CHANNELS ||
+		snd->sampleRate == 0)
+		return MHK_EFORMAT;
+
+	/* Trust the data over the frame count.  */
+	if (snd->encoding == SND_ADPCM)
+		maxFrames = (unsigned long)(snd->dataSize * 2 / snd->numChannels);
+	else if (snd->encoding == SND_RAW &&
+			 (snd->bitsPerSample == 8 || snd->bitsPerSample == 16))
+		maxFrames = (unsigned long)(snd->dataSize /
+			(snd->bitsPerSample / 8 * snd->numChannels));
+	else
+		return MHK_EUNSUPPORTED;
+	if (snd->numFrames > maxFrames)
+		snd->numFrames = maxFrames;
+	return MHK_OK;
+}
+
+/* Reads up to "maxCues" markers from the "Cue#" chunk of a tWAV
+   resource into "cues", in the order they are stored.  Returns the
+   number of markers in the chunk, which may be more than "maxCues", or
+   zero if there is no chunk or it is cut short.  */
+unsigned ReadSoundCues(const unsigned char* rsrc, size_t size,
+	SoundCue* cues, unsigned maxCues)
+{
+	const unsigned char* chunk;
+	unsigned long chunkSize;
+	size_t pos = 2;
+	unsigned count, i;
+
+	if (FindSoundChunk(rsrc, size, MHK_TAG('C', 'u', 'e', '#'),
+			&chunk, &chunkSize) != MHK_OK || chunkSize < 2)
+		return 0;
+	count = MHK_GET16(chunk);
+	for (i = 0; i < count && i < maxCues; i++)
+	{
+		unsigned nameLength;
+		if (chunkSize - pos < 5)
+			return 0;
+		nameLength = chunk[pos + 4];
+		if (chunkSize - pos - 5 < nameLength)
+			return 0;
+		cues[i].frame = MHK_GET32(chunk + pos);
+		memcpy(cues[i].name, chunk + pos + 5, nameLength);
+		cues[i].name[nameLength] = '\0';
+		pos += 5 + nameLength + (nameLength % 2 == 0);
+	}
+	return count;
+}
+
+void InitSoundDecoder(SoundDecoder* dec, const MhkSound* snd)
+{
+	memset(dec, 0, sizeof(SoundDecoder));
+	dec->snd = snd;
+}
+
+/* Decodes up to "maxFrames" frames into "dst" as interleaved 16-bit
+   samples.  Returns the number of frames, which is zero at the end of
+   the sound.  */
+size_t DecodeSound(SoundDecoder* dec, short* dst, size_t maxFrames)
+{
+	const MhkSound* snd = dec->snd;
+	unsigned long frame = dec->frame;
+	size_t count = snd->numFrames - frame;
+	size_t i;
+
+	if (count > maxFrames)
+		count = maxFrames;
+	if (count == 0)
+		return 0;
+	dec->frame += (unsigned long)count;
+
+	if (snd->encoding == SND_ADPCM && snd->numChannels == 2)
+		DecodeImaAdpcm(snd->data + frame, count, 2, dec->ima, dst);
+	else if (snd->encoding == SND_ADPCM)
+	{
+		size_t left = count;
+		/* A block that starts in the middle of a byte finishes it
+		   first.  */
+		if ((frame & 1) != 0)
+		{
+			IMA_STEP(dec->ima[0].predictor, dec->ima[0].index,
+				snd->data[frame / 2] & 0xfu, *dst);
+			dst++;
+			frame++;
+			left--;
+		}
+		DecodeImaAdpcm(snd->data + frame / 2, left, 1, dec->ima, dst);
+	}
+	else if (snd->bitsPerSample == 8)
+	{
+		const unsigned char* src = snd->data + frame * snd->numChannels;
+		for (i = 0; i < count * snd->numChannels; i++)
+			dst[i] = (short)((src[i] - 128) * 256);
+	}
+	else
+	{
+		const unsigned char* src = snd->data + frame * snd->numChannels * 2;
+		for (i = 0; i < count * snd->numChannels; i++)
+			dst[i] = (short)MHK_GET16(src + i * 2);
+	}
+	return count;
+}
+
+/* Decodes "numFrames" frames of IMA ADPCM from "src" into interleaved
+   16-bit samples, updating the state of every channel.  Mono data
+   must start at a byte boundary.  */
+void DecodeImaAdpcm(const unsigned char* src, size_t numFrames,
+	unsigned numChannels, ImaState* states, short* dst)
+{
+	int pred0 = states[0].predictor, idx0 = states[0].index;
+	size_t i;
+
+	if (numChannels == 2)
+	{
+		int pred1 = states[1].predictor, idx1 = states[1].index;
+		for (i = 0; i < numFrames; i++)
+		{
+			unsigned b = src[i];
+			IMA_STEP(pred0, idx0, b >> 4, dst[i * 2]);
+			IMA_STEP(pred1, idx1, b & 0xfu, dst[i * 2 + 1]);
+		}
+		states[1].predictor = pred1;
+		states[1].index = idx1;
+	}
+	else
+	{
+		for (i = 0; i + 1 < numFrames; i += 2)
+		{
+			unsigned b = src[i / 2];
+			IMA_STEP(pred0, idx0, b >> 4, dst[i]);
+			IMA_STEP(pred0, idx0, b & 0xfu, dst[i + 1]);
+		}
+		if (i < numFrames)
+			IMA_STEP(pred0, idx0, (unsigned)src[i / 2] >> 4, dst[i]);
+	}
+	states[0].predictor = pred0;
+	states[0].index = idx0;
+}
+
+/* Does the same as DecodeImaAdpcm(), one nibble at a time.  */
+void DecodeImaAdpcmNaive(const unsigned char* src, size_t numFrames,
+	unsigned numChannels, ImaState* states, short* dst)
+{
+	size_t numSamples = numFrames * numChannels;
+	size_t i;
+
+	for (i = 0; i < numSamples; i++)
+	{
+		unsigned nibble = (i & 1) ? src[i / 2] & 0xf : src[i / 2] >> 4;
+		dst[i] = (short)ImaDecodeNibble(&states[i % numChannels], nibble);
+	}
+}
+
+/* Returns whether a channel state is one that the decoder can reach,
+   and so is safe to decode from.  */
+bool ImaStateValid(const ImaState* state)
+{
+	return state->predictor >= -32768 && state->predictor <= 32767 &&
+		state->index >= 0 && state->index <= IMA_MAX_INDEX;
+}
+
+const char* SndEncodingName(unsigned encoding)
+{
+	if (encoding < sizeof(encodingNames) / sizeof(encodingNames[0]))
+		return encodingNames[encoding];
+	return "unknown";
+}
+
+/* Finds the first chunk with a tag in a tWAV resource.  Returns an
+   MhkError code.  */
+static int FindSoundChunk(const unsigned char* rsrc, size_t size,
+	unsigned long tag, const unsigned char** chunk, unsigned long* chunkSize)
+{
+	size_t pos = SND_HEADER_SIZE;
+
+	if (size < SND_HEADER_SIZE || memcmp(rsrc, "MHWK", 4) != 0 ||
+		memcmp(rsrc + 8, "WAVE", 4) != 0)
+		return MHK_EFORMAT;
+	while (size - pos >= 8)
+	{
+		unsigned long chunkTag = MHK_GET32(rsrc + pos);
+		*chunkSize = MHK_GET32(rsrc + pos + 4);
+		*chunk = rsrc + pos + 8;
+		pos += 8;
+		if (*chunkSize > size - pos)
+			return MHK_EFORMAT;
+		pos += *chunkSize;
+		if (chunkTag == tag)
+			return MHK_OK;
+	}
+	return MHK_EFORMAT;
+}
+
+static int ImaDecodeNibble(ImaState* state, unsigned nibble)
+{
+	int step = imaStepSizes[state->index];
+	int diff = step >> 3;
+
+	if (nibble & 4)
+		diff += step;
+	if (nibble & 2)
+		diff += step >> 1;
+	if (nibble & 1)
+		diff += step >> 2;
+	if (nibble & 8)
+		state->predictor -= diff;
+	else
+		state->predictor += diff;
+	if (state->predictor > 32767)
+		state->predictor = 32767;
+	else if (state->predictor < -32768)
+		state->predictor = -32768;
+
+	state->index += imaIndexAdjust[nibble & 7];
+	if (state->index < 0)
+		state->index = 0;
+	else if (state->index > IMA_MAX_INDEX)
+		state->index = IMA_MAX_INDEX;
+	return state->predictor;
+}
@@ -0,0 +1,77 @@
+/* Mohawk sound (tWAV) interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef MHKSOUND_H
+#define MHKSOUND_H
+
+#include <stddef.h>
+
+/* Encodings of the samples in the "Data" chunk */
+enum SndEncoding
+{
+	SND_RAW, /* 8-bit unsigned or 16-bit big-endian signed PCM */
+	SND_ADPCM, /* IMA ADPCM, 4 bits per sample */
+	SND_MPEG2 /* MPEG-2 layer II, not decoded */
+};
+
+#define SND_MAX_CHANNELS 2
+#define SND_LOOP_FOREVER 0xffff
+#define SND_MAX_CUE_NAME 255
+
+typedef struct MhkSound_t MhkSound;
+typedef struct SoundCue_t SoundCue;
+typedef struct ImaState_t ImaState;
+typedef struct SoundDecoder_t SoundDecoder;
+
+/* A parsed tWAV resource.  "data" points into the resource, which must
+   stay valid while the sound is in use.  */
+struct MhkSound_t
+{
+	unsigned sampleRate;
+	unsigned long numFrames; /* Samples per channel */
+	unsigned bitsPerSample;
+	unsigned numChannels;
+	unsigned encoding; /* See SndEncoding */
+	unsigned loopCount;
+	unsigned long loopStart;
+	unsigned long loopEnd;
+	const unsigned char* data;
+	size_t dataSize;
+};
+
+/* A marker from the "Cue#" chunk */
+struct SoundCue_t
+{
+	unsigned long frame;
+	char name[SND_MAX_CUE_NAME + 1];
+};
+
+/* The running state of one IMA ADPCM channel.  Both start at zero.  */
+struct ImaState_t
+{
+	int predictor;
+	int index;
+};
+
+/* Decodes a sound a block at a time.  Prepare it with
+   InitSoundDecoder().  */
+struct SoundDecoder_t
+{
+	const MhkSound* snd;
+	unsigned long frame; /* Next frame to decode */
+	ImaState ima[SND_MAX_CHANNELS];
+};
+
+int ParseSound(const unsigned char* rsrc, size_t size, MhkSound* snd);
+unsigned ReadSoundCues(const unsigned char* rsrc, size_t size,
+	SoundCue* cues, unsigned maxCues);
+void InitSoundDecoder(SoundDecoder* dec, const MhkSound* snd);
+size_t DecodeSound(SoundDecoder* dec, short* dst, size_t maxFrames);
+void DecodeImaAdpcm(const unsigned char* src, size_t numFrames,
+	unsigned numChannels, ImaState* states, short* dst);
+void DecodeImaAdpcmNaive(const unsigned char* src, size_t numFrames,
+	unsigned numChannels, ImaState* states, short* dst);
+bool ImaStateValid(const ImaState* state);
+const char* SndEncodingName(unsigned encoding);
+
+#endif /* not MHKSOUND_H */
@@ -0,0 +1,140 @@
+/* Mohawk sprite (tSPR) parsing */
+
+/* A tSPR resource is a set of frames for an animation.  Its layout
+   follows the fields of the sprite parameters dialog: a header of two
+   big-endian u16 words, the number of frames and the version, then
+   fourteen u16 words whose meaning is unknown (SPR_NUM_UNKNOWN), then
+   a table with a u32 offset from the start of the resource for every
+   frame.  Each frame is a complete tBMP resource (see MhkBitmap.c)
+   that ends at the next higher frame offset or at the end of the
+   resource.  The frames need not be in order, so ParseSprite() sorts
+   the offsets once to find where every frame ends.  */
+
+#include <stdlib.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "MhkSprite.h"
+
+static int CompareOffsets(const void* a, const void* b);
+
+/* Parses the header and frame table of a tSPR resource.  "spr->rsrc"
+   points to "rsrc" afterward, which must stay valid while the sprite
+   is in use.  Returns an MhkError code.  FreeSprite() may be called
+   on "spr" either way.  */
+int ParseSprite(const unsigned char* rsrc, size_t size, MhkSprite* spr)
+{
+	const unsigned char* table = rsrc + SPR_HEADER_SIZE;
+	size_t* sorted;
+	unsigned i;
+
+	spr->frameEnds = NULL;
+	if (size < SPR_HEADER_SIZE)
+		return MHK_EFORMAT;
+	spr->numFrames = MHK_GET16(rsrc);
+	spr->version = MHK_GET16(rsrc + 2);
+	for (i = 0; i < SPR_NUM_UNKNOWN; i++)
+		spr->unknown[i] = MHK_GET16(rsrc + 4 + i * 2);
+	if ((size - SPR_HEADER_SIZE) / 4 < spr->numFrames)
+		return MHK_EFORMAT;
+	spr->rsrc = rsrc;
+	spr->size = size;
+	if (spr->numFrames == 0)
+		return MHK_OK;
+
+	/* Each frame ends at the closest frame that starts after it.  */
+	spr->frameEnds = (size_t*)malloc(spr->numFrames * sizeof(size_t));
+	sorted = (size_t*)malloc(spr->numFrames * sizeof(size_t));
+	if (spr->frameEnds == NULL || sorted == NULL)
+	{
+		free(sorted);
+		FreeSprite(spr);
+		return MHK_ENOMEM;
+	}
+	for (i = 0; i < spr->numFrames; i++)
+		sorted[i] = MHK_GET32(table + i * 4);
+	qsort(sorted, spr->numFrames, sizeof(size_t), CompareOffsets);
+	for (i = 0; i < spr->numFrames; i++)
+	{
+		size_t start = MHK_GET32(table + i * 4);
+		unsigned lo = 0, hi = spr->numFrames;
+		/* Find the first offset past "start".  */
+		while (lo < hi)
+		{
+			unsigned mid = lo + (hi - lo) / 2;
+			if (sorted[mid] <= start)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		spr->frameEnds[i] = (lo < spr->numFrames && sorted[lo] < size) ?
+			sorted[lo] : size;
+	}
+	free(sorted);
+	return MHK_OK;
+}
+
+void FreeSprite(MhkSprite* spr)
+{
+	free(spr->frameEnds);
+	spr->frameEnds = NULL;
+}
+
+/* Locates the tBMP resource of frame "index" inside the sprite.
+   Returns an MhkError code.  */
+int GetSpriteFrameData(const MhkSprite* spr, unsigned index,
+	const unsigned char** data, size_t* size)
+{
+	size_t tableEnd = SPR_HEADER_SIZE + (size_t)spr->numFrames * 4;
+	size_t start;
+
+	if (index >= spr->numFrames)
+		return MHK_EFORMAT;
+	start = MHK_GET32(spr->rsrc + SPR_HEADER_SIZE + index * 4);
+	if (start < tableEnd || start >= spr->size)
+		return MHK_EFORMAT;
+	*data = spr->rsrc + start;
+	*size = spr->frameEnds[index] - start;
+	return MHK_OK;
+}
+
+/* Parses the tBMP header of frame "index".  Returns an MhkError
+   code.  */
+int GetSpriteFrame(const MhkSprite* spr, unsigned index, MhkBitmap* bmp)
+{
+	const unsigned char* data;
+	size_t size;
+	int error = GetSpriteFrameData(spr, index, &data, &size);
+	if (error != MHK_OK)
+		return error;
+	return ParseBitmap(data, size, bmp);
+}
+
+/* Finds the size of the smallest rectangle that holds every frame.
+   Frames that cannot be parsed are left out.  */
+void GetSpriteBounds(const MhkSprite* spr, unsigned* width,
+	unsigned* height)
+{
+	MhkBitmap bmp;
+	unsigned i;
+
+	*width = 0;
+	*height = 0;
+	for (i = 0; i < spr->numFrames; i++)
+	{
+		if (GetSpriteFrame(spr, i, &bmp) != MHK_OK)
+			continue;
+		if (*width < bmp.width)
+			*width = bmp.width;
+		if (*height < bmp.height)
+			*height = bmp.height;
+	}
+}
+
+static int CompareOffsets(const void* a, const void* b)
+{
+	size_t sa = *(const size_t*)a;
+	size_t sb = *(const size_t*)b;
+	return sa < sb ? -1 : (sa > sb);
+}
@@ -0,0 +1,33 @@
+/* Mohawk sprite (tSPR) interface */
+/* Include "bool.h" and "MhkBitmap.h" before this header.  */
+
+#ifndef MHKSPRITE_H
+#define MHKSPRITE_H
+
+#include <stddef.h>
+
+#define SPR_NUM_UNKNOWN	14
+#define SPR_HEADER_SIZE	(4 + SPR_NUM_UNKNOWN * 2)
+
+typedef struct MhkSprite_t MhkSprite;
+
+/* A parsed tSPR resource.  Free it with FreeSprite().  */
+struct MhkSprite_t
+{
+	unsigned numFrames;
+	unsigned version;
+	unsigned unknown[SPR_NUM_UNKNOWN];
+	const unsigned char* rsrc; /* The whole resource */
+	size_t size;
+	size_t* frameEnds; /* Where each frame ends, NULL if no frames */
+};
+
+int ParseSprite(const unsigned char* rsrc, size_t size, MhkSprite* spr);
+void FreeSprite(MhkSprite* spr);
+int GetSpriteFrameData(const MhkSprite* spr, unsigned index,
+	const unsigned char** data, size_t* size);
+int GetSpriteFrame(const MhkSprite* spr, unsigned index, MhkBitmap* bmp);
+void GetSpriteBounds(const MhkSprite* spr, unsigned* width,
+	unsigned* height);
+
+#endif /* not MHKSPRITE_H */
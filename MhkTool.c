@@ -0,0 +1,1781 @@
+/* Command line front end for batch operations on Mohawk archives */
+/* The GUI is fine for looking at one resource at a time, but batch
+   operations over whole archives (or whole games) are more convenient
+   to script from a console.  Each command is a function that gets the
+   arguments following the command name.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "WorkPool.h"
+#include "BmpOptimize.h"
+#include "PalExpand.h"
+#include "BmpDecode.h"
+#include "Quantize.h"
+#include "BmpImport.h"
+#include "ImageFile.h"
+#include "BmpEdit.h"
+#include "BmpSurvey.h"
+#include "MhkSprite.h"
+#include "SpriteAtlas.h"
+#include "SpriteStats.h"
+#include "MhkSound.h"
+#include "SoundFile.h"
+#include "SoundPlayer.h"
+#include "UndoJournal.h"
+
+/* Sizes for BenchJournal() */
+#define JOURNAL_TEXT_SIZE 4096
+#define JOURNAL_NUM_CHARS 1000000
+#define JOURNAL_MAX_BYTES 0x4000000
+#define JOURNAL_MAX_RESIDENT 0x40000 /* Small enough to spill */
+
+typedef struct ToolCommand_t ToolCommand;
+typedef struct WavJob_t WavJob;
+
+/* Types of the journal entries made by BenchJournal() */
+enum JournalEntryType
+{
+	JE_TYPED, /* Undone by taking the text out */
+	JE_DELETED /* Undone by putting the text back */
+};
+
+struct ToolCommand_t
+{
+	const char* name;
+	int (*func)(int argc, char* argv[]);
+	const char* usage;
+};
+
+/* One sound to export with CmdWav() */
+struct WavJob_t
+{
+	const MhkFile* file;
+	unsigned short id;
+	const char* dir;
+	int error;
+	unsigned long numFrames;
+	unsigned sampleRate;
+};
+
+typedef void (*ImaDecodeFunc)(const unsigned char* src, size_t numFrames,
+	unsigned numChannels, ImaState* states, short* dst);
+typedef void (*ExpandRowFunc)(const PalExpander* pe,
+	const unsigned char* row, unsigned left, unsigned count, PalColor* dst);
+typedef int (*DecodeRgbFunc)(const MhkBitmap* bmp, const PalExpander* pe,
+	PalColor* dst, size_t stride);
+typedef unsigned (*NearestFunc)(const ColorMap* map, PalColor color);
+
+static int CmdRecompress(int argc, char* argv[]);
+static int CmdImport(int argc, char* argv[]);
+static int CmdPaste(int argc, char* argv[]);
+static bool PasteImage(BmpEdit* edit, const PalColor* pixels,
+	unsigned width, unsigned height, unsigned left, unsigned top);
+static int CmdSurvey(int argc, char* argv[]);
+static int CmdAtlas(int argc, char* argv[]);
+static bool WriteAtlasTable(const char* filename,
+	const SpriteAtlas* atlases, unsigned numAtlases);
+static int CmdSprStats(int argc, char* argv[]);
+static bool WriteSpriteRecords(const char* filename,
+	const SpriteRecord* records, unsigned numRecords);
+static bool WriteFieldStats(const char* filename, const FieldStats* stats);
+static bool WriteFieldValues(const char* filename, const FieldStats* stats);
+static void WriteCsvString(FILE* fp, const char* str);
+static int CmdWav(int argc, char* argv[]);
+static void WavJobFunc(void* arg);
+static int CmdPlay(int argc, char* argv[]);
+static int CmdBench(int argc, char* argv[]);
+static int BenchPalette(unsigned width, unsigned height);
+static int BenchDecode(unsigned width, unsigned height);
+static int BenchRemap(unsigned width, unsigned height);
+static int BenchAdpcm(unsigned seconds);
+static int BenchJournal(void);
+static bool SpliceEntry(char* text, size_t* length, const UndoEntry* entry,
+	bool remove);
+static double TimeExpandRows(ExpandRowFunc func, const PalExpander* pe,
+	const unsigned char* rows, size_t rowSize, unsigned width,
+	unsigned height, PalColor* dst);
+static double TimeDecodeRgb(DecodeRgbFunc func, const MhkBitmap* bmp,
+	const PalExpander* pe, PalColor* dst);
+static double TimeNearest(NearestFunc func, const ColorMap* map,
+	const PalColor* pixels, size_t count, unsigned char* dst);
+static double TimeRemap(const ColorMap* map, const PalColor* pixels,
+	unsigned width, unsigned height, int dither, unsigned char* dst);
+static double TimeImaDecode(ImaDecodeFunc func, const unsigned char* src,
+	size_t numFrames, unsigned numChannels, short* dst);
+static bool ParseDither(const char* str, int* dither);
+static bool ParseUnsigned(const char* str, unsigned* value);
+
+static const ToolCommand commands[] =
+{
+	{ "recompress", CmdRecompress,
+	  "recompress [-fast PERCENT] [-chain N] [-threads N] IN OUT\n"
+	  "\tPick the best compression for every bitmap.  With -fast, keep\n"
+	  "\tthe fastest to decode within PERCENT of the smallest size." },
+	{ "import", CmdImport,
+	  "import [-colors N] [-dither none|ordered|diffuse] [-shared ID]\n"
+	  "\t[-threads N] IN OUT ID FILE [ID FILE...]\n"
+	  "\tReplace or add the bitmaps with the given IDs from BMP files,\n"
+	  "\tquantized to 8 bits per pixel.  With -shared, all of them use\n"
+	  "\tone palette, which is stored as the tPAL with that ID." },
+	{ "paste", CmdPaste,
+	  "paste IN OUT ID FILE X Y\n"
+	  "\tCopy a BMP file into a bitmap with its top left corner at X, Y.\n"
+	  "\t8-bit bitmaps keep their palette.  Only the changed rows are\n"
+	  "\tencoded again unless the bitmap uses LZ compression." },
+	{ "survey", CmdSurvey,
+	  "survey [-threads N] FILE [FILE...]\n"
+	  "\tGather statistics on the bitmaps with unknown RLE or LZ\n"
+	  "\tcompression and try candidate decoders on them." },
+	{ "atlas", CmdAtlas,
+	  "atlas [-width N] [-padding N] [-threads N] IN DIR\n"
+	  "\tPack the frames of every sprite into one image, written to\n"
+	  "\tDIR as ID.bmp, and list where each frame went in\n"
+	  "\tDIR/atlas.csv.  The sprites are packed in parallel." },
+	{ "sprstats", CmdSprStats,
+	  "sprstats [-threads N] [-csv PREFIX] FILE [FILE...]\n"
+	  "\tSummarize the unknown header fields of every sprite and how\n"
+	  "\tthey relate to the frame count, frame size, and version.\n"
+	  "\tWith -csv, write PREFIX-sprites.csv, PREFIX-fields.csv, and\n"
+	  "\tPREFIX-values.csv." },
+	{ "wav", CmdWav,
+	  "wav [-threads N] IN DIR\n"
+	  "\tDecode every sound to a 16-bit WAV file, written to DIR as\n"
+	  "\tID.wav.  The sounds are decoded in parallel." },
+	{ "play", CmdPlay,
+	  "play [-null | -file OUT] IN ID\n"
+	  "\tPlay a sound while it is decoded, and report how long the first\n"
+	  "\tsamples took and how often the output ran out.  With -null or\n"
+	  "\t-file, play it at the same pace to nowhere or to a WAV file." },
+	{ "bench", CmdBench,
+	  "bench palette|decode|remap [-width N] [-height N]\n"
+	  "bench adpcm [-seconds N]\n"
+	  "bench journal\n"
+	  "\tMeasure palette expansion, full bitmap decoding, or color\n"
+	  "\tremapping speed in megapixels per second, IMA ADPCM decoding\n"
+	  "\tspeed in megasamples per second, or how long random edits take\n"
+	  "\tto record, undo, and redo in the text editor's undo journal." }
+};
+#define NUM_COMMANDS (sizeof(commands) / sizeof(ToolCommand))
+
+int main(int argc, char* argv[])
+{
+	unsigned i;
+	if (argc >= 2)
+	{
+		for (i = 0; i < NUM_COMMANDS; i++)
+		{
+			if (strcmp(argv[1], commands[i].name) == 0)
+				return commands[i].func(argc - 2, argv + 2);
+		}
+	}
+
+	fputs("Usage: mhktool COMMAND [ARGS...]\n\nCommands:\n", stderr);
+	for (i = 0; i < NUM_COMMANDS; i++)
+		fprintf(stderr, "  %s\n", commands[i].usage);
+	return 2;
+}
+
+static int CmdRecompress(int argc, char* argv[])
+{
+	AutoCmpOptions opts;
+	RecompressReport report;
+	MhkArchive* archive;
+	WorkPool* pool;
+	unsigned numThreads = 0;
+	char text[2048];
+	int error;
+	int i;
+
+	InitAutoCmpOptions(&opts);
+	for (i = 0; i < argc && argv[i][0] == '-'; i += 2)
+	{
+		bool valid = i + 1 < argc;
+		if (valid && strcmp(argv[i], "-fast") == 0)
+		{
+			opts.policy = AUTOCMP_FASTEST;
+			valid = ParseUnsigned(argv[i+1], &opts.tolerance);
+		}
+		else if (valid && strcmp(argv[i], "-chain") == 0)
+			valid = ParseUnsigned(argv[i+1], &opts.lzChain);
+		else if (valid && strcmp(argv[i], "-threads") == 0)
+			valid = ParseUnsigned(argv[i+1], &numThreads);
+		else
+			valid = false;
+		if (!valid)
+		{
+			fprintf(stderr, "recompress: bad option \"%s\"\n", argv[i]);
+			return 2;
+		}
+	}
+	if (argc - i != 2)
+	{
+		fputs("recompress: expected an input and an output file\n", stderr);
+		return 2;
+	}
+
+	archive = LoadMhkArchive(argv[i], &error);
+	if (archive == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", argv[i], MhkErrorString(error));
+		return 1;
+	}
+	pool = CreateWorkPool(numThreads);
+	error = RecompressArchiveBitmaps(archive, &opts, pool, &report);
+	FreeWorkPool(pool);
+	if (error == MHK_OK)
+	{
+		FormatRecompressReport(&report, text, sizeof(text));
+		fputs(text, stdout);
+		error = SaveMhkArchive(archive, argv[i+1]);
+		if (error != MHK_OK)
+			fprintf(stderr, "%s: %s\n", argv[i+1], MhkErrorString(error));
+	}
+	else
+		fprintf(stderr, "recompress: %s\n", MhkErrorString(error));
+	FreeMhkArchive(archive);
+	return error == MHK_OK ? 0 : 1;
+}
+
+static int CmdImport(int argc, char* argv[])
+{
+	ImportOptions opts;
+	ImportFile* files;
+	unsigned short* ids;
+	unsigned long palette[256];
+	unsigned numFiles, numColors;
+	unsigned palId = 0;
+	MhkArchive* archive;
+	WorkPool* pool;
+	unsigned numThreads = 0;
+	int error = MHK_OK;
+	int i;
+	unsigned j;
+
+	InitImportOptions(&opts);
+	for (i = 0; i < argc && argv[i][0] == '-'; i += 2)
+	{
+		bool valid = i + 1 < argc;
+		if (valid && strcmp(argv[i], "-colors") == 0)
+			valid = ParseUnsigned(argv[i+1], &opts.quant.maxColors) &&
+				opts.quant.maxColors >= 1 && opts.quant.maxColors <= 256;
+		else if (valid && strcmp(argv[i], "-dither") == 0)
+			valid = ParseDither(argv[i+1], &opts.quant.dither);
+		else if (valid && strcmp(argv[i], "-shared") == 0)
+		{
+			opts.sharedPalette = true;
+			valid = ParseUnsigned(argv[i+1], &palId) && palId <= 0xffff;
+		}
+		else if (valid && strcmp(argv[i], "-threads") == 0)
+			valid = ParseUnsigned(argv[i+1], &numThreads);
+		else
+			valid = false;
+		if (!valid)
+		{
+			fprintf(stderr, "import: bad option \"%s\"\n", argv[i]);
+			return 2;
+		}
+	}
+	if (argc - i < 4 || (argc - i) % 2 != 0)
+	{
+		fputs("import: expected an input and an output file, then pairs "
+			"of IDs and BMP files\n", stderr);
+		return 2;
+	}
+
+	numFiles = (argc - i - 2) / 2;
+	files = (ImportFile*)calloc(numFiles, sizeof(ImportFile));
+	ids = (unsigned short*)calloc(numFiles, sizeof(unsigned short));
+	if (files == NULL || ids == NULL)
+	{
+		free(files);
+		free(ids);
+		fputs("import: out of memory\n", stderr);
+		return 1;
+	}
+	for (j = 0; j < numFiles; j++)
+	{
+		unsigned id;
+		if (!ParseUnsigned(argv[i+2+j*2], &id) || id > 0xffff)
+		{
+			fprintf(stderr, "import: bad ID \"%s\"\n", argv[i+2+j*2]);
+			free(files);
+			free(ids);
+			return 2;
+		}
+		ids[j] = (unsigned short)id;
+		files[j].fileName = argv[i+3+j*2];
+	}
+
+	archive = LoadMhkArchive(argv[i], &error);
+	if (archive == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", argv[i], MhkErrorString(error));
+		free(files);
+		free(ids);
+		return 1;
+	}
+	pool = CreateWorkPool(numThreads);
+	error = ImportBitmapFiles(files, numFiles, &opts, pool, palette,
+							  &numColors);
+	FreeWorkPool(pool);
+
+	/* Bitmaps that don't exist yet are added.  */
+	for (j = 0; j < numFiles; j++)
+	{
+		if (files[j].error != MHK_OK)
+		{
+			fprintf(stderr, "%s: %s\n", files[j].fileName,
+				MhkErrorString(files[j].error));
+			continue;
+		}
+		if (error != MHK_OK)
+			continue;
+		error = AddMhkResource(archive, MHK_TBMP, ids[j], files[j].data,
+							   files[j].size);
+		files[j].data = NULL;
+		printf("%u: %ux%u, %lu bytes\n", ids[j], files[j].width,
+			files[j].height, (unsigned long)files[j].size);
+	}
+	if (error == MHK_OK && opts.sharedPalette)
+	{
+		unsigned char* data;
+		size_t size;
+		error = EncodePaletteResource(palette, 0, numColors, &data, &size);
+		if (error == MHK_OK)
+			error = AddMhkResource(archive, MHK_TPAL, (unsigned short)palId,
+								   data, size);
+		printf("palette %u: %u colors\n", palId, numColors);
+	}
+	if (error == MHK_OK)
+	{
+		error = SaveMhkArchive(archive, argv[i+1]);
+		if (error != MHK_OK)
+			fprintf(stderr, "%s: %s\n", argv[i+1], MhkErrorString(error));
+	}
+	else
+		fprintf(stderr, "import: %s\n", MhkErrorString(error));
+
+	for (j = 0; j < numFiles; j++)
+		free(files[j].data);
+	free(files);
+	free(ids);
+	FreeMhkArchive(archive);
+	return error == MHK_OK ? 0 : 1;
+}
+
+static int CmdPaste(int argc, char* argv[])
+{
+	MhkArchive* archive;
+	MhkResource* rsrc;
+	MhkFile* file;
+	BmpEdit* edit;
+	PalColor* pixels;
+	unsigned width, height;
+	unsigned id, left, top;
+	unsigned char* data;
+	size_t size;
+	unsigned rowsEncoded;
+	AutoCmpOptions cmpOpts;
+	clock_t start;
+	double seconds;
+	int error;
+
+	if (argc != 6 || !ParseUnsigned(argv[2], &id) || id > 0xffff ||
+		!ParseUnsigned(argv[4], &left) || !ParseUnsigned(argv[5], &top))
+	{
+		fputs("paste: expected IN OUT ID FILE X Y\n", stderr);
+		return 2;
+	}
+	archive = LoadMhkArchive(argv[0], &error);
+	if (archive == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", argv[0], MhkErrorString(error));
+		return 1;
+	}
+	rsrc = FindMhkResource(archive, MHK_TBMP, (unsigned short)id);
+	if (rsrc == NULL)
+	{
+		fprintf(stderr, "paste: no tBMP %u\n", id);
+		FreeMhkArchive(archive);
+		return 1;
+	}
+	file = GetMhkResourceFile(archive, rsrc);
+	error = OpenBmpEdit(file->data, file->size, &edit);
+	if (error != MHK_OK)
+	{
+		fprintf(stderr, "paste: tBMP %u: %s\n", id, MhkErrorString(error));
+		FreeMhkArchive(archive);
+		return 1;
+	}
+	error = LoadBmpFile(argv[3], &pixels, &width, &height);
+	if (error != MHK_OK)
+	{
+		fprintf(stderr, "%s: %s\n", argv[3], MhkErrorString(error));
+		FreeBmpEdit(edit);
+		FreeMhkArchive(archive);
+		return 1;
+	}
+	if (!PasteImage(edit, pixels, width, height, left, top))
+	{
+		fputs("paste: only 8-bit bitmaps with an inline palette and 16 or "
+			"24-bit bitmaps can be pasted into\n", stderr);
+		free(pixels);
+		FreeBmpEdit(edit);
+		FreeMhkArchive(archive);
+		return 1;
+	}
+	free(pixels);
+
+	/* The LZ effort only matters if the bitmap is encoded in full.  */
+	InitAutoCmpOptions(&cmpOpts);
+	start = clock();
+	error = SaveBmpEdit(edit, cmpOpts.lzChain, &data, &size, &rowsEncoded);
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (error == MHK_OK)
+	{
+		printf("%u: %u of %u rows encoded, %lu -> %lu bytes, %.3f ms\n",
+			id, rowsEncoded, GetBmpEditBitmap(edit)->height,
+			(unsigned long)file->size, (unsigned long)size, seconds * 1000);
+		ReplaceMhkFileData(file, data, size);
+		error = SaveMhkArchive(archive, argv[1]);
+		if (error != MHK_OK)
+			fprintf(stderr, "%s: %s\n", argv[1], MhkErrorString(error));
+	}
+	else
+		fprintf(stderr, "paste: %s\n", MhkErrorString(error));
+	FreeBmpEdit(edit);
+	FreeMhkArchive(archive);
+	return error == MHK_OK ? 0 : 1;
+}
+
+/* Writes the part of an image that falls inside the bitmap.  8-bit
+   pixels get the nearest palette color.  Returns false if the bitmap's
+   format can't be written to.  */
+static bool PasteImage(BmpEdit* edit, const PalColor* pixels,
+	unsigned width, unsigned height, unsigned left, unsigned top)
+{
+	const MhkBitmap* bmp = GetBmpEditBitmap(edit);
+	ColorMap map;
+	unsigned x, y;
+
+	if (bmp->bpp == 8 &&
+		(bmp->numColors == 0 ||
+		 !InitColorMap(&map, bmp->palette, bmp->numColors)))
+		return false;
+	if (bmp->bpp != 8 && bmp->bpp != 16 && bmp->bpp != 24)
+		return false;
+	for (y = 0; y < height && top + y < bmp->height; y++)
+	{
+		const PalColor* src = pixels + (size_t)y * width;
+		unsigned char* row;
+		if (left >= bmp->width)
+			break;
+		row = EditBmpRow(edit, top + y);
+		for (x = 0; x < width && left + x < bmp->width; x++)
+		{
+			PalColor c = src[x];
+			unsigned char* p;
+			switch (bmp->bpp)
+			{
+			case 8:
+				row[left + x] = (unsigned char)NearestColor(&map, c);
+				break;
+			case 16:
+			{
+				unsigned v = (unsigned)(((c >> 19) & 0x1f) << 10 |
+					((c >> 11) & 0x1f) << 5 | ((c >> 3) & 0x1f));
+				p = row + (left + x) * 2;
+				p[0] = (unsigned char)(v >> 8);
+				p[1] = (unsigned char)v;
+				break;
+			}
+			case 24:
+				p = row + (left + x) * 3;
+				p[0] = (unsigned char)c;
+				p[1] = (unsigned char)(c >> 8);
+				p[2] = (unsigned char)(c >> 16);
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+static int CmdSurvey(int argc, char* argv[])
+{
+	SurveyStats stats[SURVEY_NUM_KINDS];
+	MhkArchive** archives;
+	const char** names;
+	WorkPool* pool;
+	unsigned numThreads = 0;
+	unsigned numArchives = 0;
+	unsigned total = 0;
+	char text[8192];
+	clock_t start;
+	int error = MHK_OK;
+	int result = 0;
+	int i, k;
+
+	for (i = 0; i < argc && argv[i][0] == '-'; i += 2)
+	{
+		bool valid = i + 1 < argc;
+		if (valid && strcmp(argv[i], "-threads") == 0)
+			valid = ParseUnsigned(argv[i+1], &numThreads);
+		else
+			valid = false;
+		if (!valid)
+		{
+			fprintf(stderr, "survey: bad option \"%s\"\n", argv[i]);
+			return 2;
+		}
+	}
+	if (i >= argc)
+	{
+		fputs("survey: expected at least one archive\n", stderr);
+		return 2;
+	}
+
+	/* An archive that does not load is reported and left out, so that
+	   one bad file does not spoil the survey of a whole game.  */
+	archives = (MhkArchive**)malloc((argc - i) * sizeof(MhkArchive*));
+	names = (const char**)malloc((argc - i) * sizeof(const char*));
+	if (archives == NULL || names == NULL)
+	{
+		free(archives);
+		free(names);
+		fputs("survey: out of memory\n", stderr);
+		return 1;
+	}
+	for (; i < argc; i++)
+	{
+		archives[numArchives] = LoadMhkArchive(argv[i], &error);
+		if (archives[numArchives] == NULL)
+		{
+			fprintf(stderr, "%s: %s\n", argv[i], MhkErrorString(error));
+			result = 1;
+			continue;
+		}
+		names[numArchives++] = argv[i];
+	}
+
+	start = clock();
+	pool = CreateWorkPool(numThreads);
+	error = SurveyArchives(archives, names, numArchives,
+		pool, stats);
+	FreeWorkPool(pool);
+	if (error == MHK_OK)
+	{
+		for (k = 0; k < SURVEY_NUM_KINDS; k++)
+		{
+			if (stats[k].numBitmaps == 0)
+				continue;
+			FormatSurveyReport(&stats[k], text, sizeof(text));
+			fputs(text, stdout);
+			putchar('\n');
+			total += stats[k].numBitmaps;
+		}
+		printf("%u bitmaps with unknown compression in %u archives, "
+			"%.0f ms\n", total, numArchives,
+			(double)(clock() - start) * 1000 / CLOCKS_PER_SEC);
+	}
+	else
+	{
+		fprintf(stderr, "survey: %s\n", MhkErrorString(error));
+		result = 1;
+	}
+
+	while (numArchives > 0)
+		FreeMhkArchive(archives[--numArchives]);
+	free(archives);
+	free(names);
+	return result;
+}
+
+static int CmdAtlas(int argc, char* argv[])
+{
+	MhkArchive* archive;
+	SpriteAtlas* atlases;
+	WorkPool* pool;
+	unsigned maxWidth = 0;
+	unsigned padding = 1;
+	unsigned numThreads = 0;
+	unsigned numAtlases = 0;
+	unsigned long numFrames = 0, numFailed = 0;
+	double megapixels = 0;
+	char path[1024];
+	clock_t start;
+	int error;
+	int result = 0;
+	int i;
+	unsigned j;
+
+	for (i = 0; i < argc && argv[i][0] == '-'; i += 2)
+	{
+		bool valid = i + 1 < argc;
+		if (valid && strcmp(argv[i], "-width") == 0)
+			valid = ParseUnsigned(argv[i+1], &maxWidth);
+		else if (valid && strcmp(argv[i], "-padding") == 0)
+			valid = ParseUnsigned(argv[i+1], &padding) && padding <= 64;
+		else if (valid && strcmp(argv[i], "-threads") == 0)
+			valid = ParseUnsigned(argv[i+1], &numThreads);
+		else
+			valid = false;
+		if (!valid)
+		{
+			fprintf(stderr, "atlas: bad option \"%s\"\n", argv[i]);
+			return 2;
+		}
+	}
+	if (argc - i != 2 || strlen(argv[i+1]) > sizeof(path) - 16)
+	{
+		fputs("atlas: expected an archive and a directory\n", stderr);
+		return 2;
+	}
+
+	archive = LoadMhkArchive(argv[i], &error);
+	if (archive == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", argv[i], MhkErrorString(error));
+		return 1;
+	}
+	start = clock();
+	pool = CreateWorkPool(numThreads);
+	error = PackArchiveAtlases(archive, maxWidth, padding, pool,
+		&atlases, &numAtlases);
+	FreeWorkPool(pool);
+	if (error != MHK_OK)
+	{
+		fprintf(stderr, "atlas: %s\n", MhkErrorString(error));
+		FreeMhkArchive(archive);
+		return 1;
+	}
+
+	for (j = 0; j < numAtlases; j++)
+	{
+		SpriteAtlas* atlas = &atlases[j];
+		if (atlas->error == MHK_OK && atlas->width > 0)
+		{
+			sprintf(path, "%s/%u.bmp", argv[i+1], atlas->id);
+			atlas->error = SaveBmpFile(path, atlas->pixels, atlas->width,
+				atlas->height, (size_t)atlas->width * sizeof(PalColor));
+		}
+		if (atlas->error != MHK_OK)
+		{
+			fprintf(stderr, "tSPR %u: %s\n", atlas->id,
+				MhkErrorString(atlas->error));
+			result = 1;
+			continue;
+		}
+		numFrames += atlas->numFrames;
+		numFailed += atlas->numFailed;
+		megapixels += (double)atlas->width * atlas->height / 1e6;
+	}
+	sprintf(path, "%s/atlas.csv", argv[i+1]);
+	if (!WriteAtlasTable(path, atlases, numAtlases))
+	{
+		fprintf(stderr, "%s: %s\n", path, MhkErrorString(MHK_EIO));
+		result = 1;
+	}
+	printf("%u sprites, %lu frames (%lu failed), %.1f megapixels, "
+		"%.0f ms\n", numAtlases, numFrames, numFailed, megapixels,
+		(double)(clock() - start) * 1000 / CLOCKS_PER_SEC);
+
+	for (j = 0; j < numAtlases; j++)
+		FreeSpriteAtlas(&atlases[j]);
+	free(atlases);
+	FreeMhkArchive(archive);
+	return result;
+}
+
+/* Writes one line for every frame of the atlases that were saved:
+   the sprite ID, the frame index, and the frame's rectangle in the
+   sprite's atlas.  */
+static bool WriteAtlasTable(const char* filename,
+	const SpriteAtlas* atlases, unsigned numAtlases)
+{
+	FILE* fp = fopen(filename, "w");
+	unsigned i, j;
+	bool ok;
+
+	if (fp == NULL)
+		return false;
+	fputs("sprite,frame,x,y,width,height\n", fp);
+	for (i = 0; i < numAtlases; i++)
+	{
+		const SpriteAtlas* atlas = &atlases[i];
+		if (atlas->error != MHK_OK)
+			continue;
+		for (j = 0; j < atlas->numFrames; j++)
+		{
+			const AtlasRect* rect = &atlas->rects[j];
+			fprintf(fp, "%u,%u,%u,%u,%u,%u\n", atlas->id, j, rect->x,
+				rect->y, rect->width, rect->height);
+		}
+	}
+	ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+	return ok;
+}
+
+static int CmdSprStats(int argc, char* argv[])
+{
+	FieldStats stats[SPR_NUM_UNKNOWN];
+	MhkArchive** archives;
+	const char** names;
+	SpriteRecord* records = NULL;
+	WorkPool* pool;
+	const char* prefix = NULL;
+	unsigned numThreads = 0;
+	unsigned numArchives = 0;
+	unsigned numRecords = 0;
+	unsigned numCorrupt = 0;
+	char path[1024];
+	clock_t start;
+	int error = MHK_OK;
+	int result = 0;
+	int i;
+	unsigned f, j;
+
+	for (i = 0; i < argc && argv[i][0] == '-'; i += 2)
+	{
+		bool valid = i + 1 < argc;
+		if (valid && strcmp(argv[i], "-threads") == 0)
+			valid = ParseUnsigned(argv[i+1], &numThreads);
+		else if (valid && strcmp(argv[i], "-csv") == 0)
+		{
+			prefix = argv[i+1];
+			valid = strlen(prefix) < sizeof(path) - 16;
+		}
+		else
+			valid = false;
+		if (!valid)
+		{
+			fprintf(stderr, "sprstats: bad option \"%s\"\n", argv[i]);
+			return 2;
+		}
+	}
+	if (i >= argc)
+	{
+		fputs("sprstats: expected at least one archive\n", stderr);
+		return 2;
+	}
+
+	archives = (MhkArchive**)malloc((argc - i) * sizeof(MhkArchive*));
+	names = (const char**)malloc((argc - i) * sizeof(const char*));
+	if (archives == NULL || names == NULL)
+	{
+		free(archives);
+		free(names);
+		fputs("sprstats: out of memory\n", stderr);
+		return 1;
+	}
+	for (; i < argc; i++)
+	{
+		archives[numArchives] = LoadMhkArchive(argv[i], &error);
+		if (archives[numArchives] == NULL)
+		{
+			fprintf(stderr, "%s: %s\n", argv[i], MhkErrorString(error));
+			result = 1;
+			continue;
+		}
+		names[numArchives++] = argv[i];
+	}
+
+	start = clock();
+	pool = CreateWorkPool(numThreads);
+	error = CollectSpriteRecords(archives, names, numArchives, pool,
+		&records, &numRecords);
+	FreeWorkPool(pool);
+	for (f = 0; f < SPR_NUM_UNKNOWN && error == MHK_OK; f++)
+	{
+		error = ComputeFieldStats(records, numRecords, f, &stats[f]);
+		if (error != MHK_OK)
+		{
+			while (f > 0)
+				FreeFieldStats(&stats[--f]);
+		}
+	}
+	if (error != MHK_OK)
+	{
+		fprintf(stderr, "sprstats: %s\n", MhkErrorString(error));
+		free(records);
+		while (numArchives > 0)
+			FreeMhkArchive(archives[--numArchives]);
+		free(archives);
+		free(names);
+		return 1;
+	}
+
+	for (j = 0; j < numRecords; j++)
+	{
+		if (records[j].error != MHK_OK)
+		{
+			fprintf(stderr, "%s: tSPR %u: %s\n", records[j].archive,
+				records[j].id, MhkErrorString(records[j].error));
+			numCorrupt++;
+		}
+	}
+	puts("Field    Distinct      Min      Max      Mean  r(frames) "
+		"r(width) r(height) r(version)  Most common");
+	for (f = 0; f < SPR_NUM_UNKNOWN; f++)
+	{
+		const FieldStats* st = &stats[f];
+		printf("Unk %-4u %8u %8u %8u %9.1f %10.3f %8.3f %9.3f %10.3f ",
+			f + 1, st->numValues, st->minValue, st->maxValue, st->mean,
+			st->corrFrames, st->corrWidth, st->corrHeight, st->corrVersion);
+		for (j = 0; j < st->numValues && j < 3; j++)
+			printf(" %u (%u)", st->values[j].value, st->values[j].count);
+		putchar('\n');
+	}
+	printf("%u sprites (%u corrupt) in %u archives, %.0f ms\n",
+		numRecords, numCorrupt, numArchives,
+		(double)(clock() - start) * 1000 / CLOCKS_PER_SEC);
+
+	if (prefix != NULL)
+	{
+		sprintf(path, "%s-sprites.csv", prefix);
+		if (!WriteSpriteRecords(path, records, numRecords))
+		{
+			fprintf(stderr, "%s: %s\n", path, MhkErrorString(MHK_EIO));
+			result = 1;
+		}
+		sprintf(path, "%s-fields.csv", prefix);
+		if (!WriteFieldStats(path, stats))
+		{
+			fprintf(stderr, "%s: %s\n", path, MhkErrorString(MHK_EIO));
+			result = 1;
+		}
+		sprintf(path, "%s-values.csv", prefix);
+		if (!WriteFieldValues(path, stats))
+		{
+			fprintf(stderr, "%s: %s\n", path, MhkErrorString(MHK_EIO));
+			result = 1;
+		}
+	}
+
+	for (f = 0; f < SPR_NUM_UNKNOWN; f++)
+		FreeFieldStats(&stats[f]);
+	free(records);
+	while (numArchives > 0)
+		FreeMhkArchive(archives[--numArchives]);
+	free(archives);
+	free(names);
+	return result;
+}
+
+/* Writes one line for every sprite that could be read, with all of
+   its header fields.  */
+static bool WriteSpriteRecords(const char* filename,
+	const SpriteRecord* records, unsigned numRecords)
+{
+	FILE* fp = fopen(filename, "w");
+	unsigned i, f;
+	bool ok;
+
+	if (fp == NULL)
+		return false;
+	fputs("archive,sprite,frames,version,width,height", fp);
+	for (f = 0; f < SPR_NUM_UNKNOWN; f++)
+		fprintf(fp, ",unknown%u", f + 1);
+	fputc('\n', fp);
+	for (i = 0; i < numRecords; i++)
+	{
+		const SpriteRecord* rec = &records[i];
+		if (rec->error != MHK_OK)
+			continue;
+		WriteCsvString(fp, rec->archive);
+		fprintf(fp, ",%u,%u,%u,%u,%u", rec->id, rec->numFrames,
+			rec->version, rec->width, rec->height);
+		for (f = 0; f < SPR_NUM_UNKNOWN; f++)
+			fprintf(fp, ",%u", rec->unknown[f]);
+		fputc('\n', fp);
+	}
+	ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+	return ok;
+}
+
+/* Writes one line of statistics for every unknown field.  */
+static bool WriteFieldStats(const char* filename, const FieldStats* stats)
+{
+	FILE* fp = fopen(filename, "w");
+	unsigned f;
+	bool ok;
+
+	if (fp == NULL)
+		return false;
+	fputs("field,sprites,distinct,min,max,mean,corr_frames,corr_width,"
+		"corr_height,corr_version,eq_frames,eq_width,eq_height\n", fp);
+	for (f = 0; f < SPR_NUM_UNKNOWN; f++)
+	{
+		const FieldStats* st = &stats[f];
+		fprintf(fp, "%u,%u,%u,%u,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%u,%u,%u\n",
+			st->field + 1, st->numSprites, st->numValues, st->minValue,
+			st->maxValue, st->mean, st->corrFrames, st->corrWidth,
+			st->corrHeight, st->corrVersion, st->eqFrames, st->eqWidth,
+			st->eqHeight);
+	}
+	ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+	return ok;
+}
+
+/* Writes the histogram of every unknown field, most frequent values
+   first.  */
+static bool WriteFieldValues(const char* filename, const FieldStats* stats)
+{
+	FILE* fp = fopen(filename, "w");
+	unsigned f, j;
+	bool ok;
+
+	if (fp == NULL)
+		return false;
+	fputs("field,value,count\n", fp);
+	for (f = 0; f < SPR_NUM_UNKNOWN; f++)
+	{
+		for (j = 0; j < stats[f].numValues; j++)
+			fprintf(fp, "%u,%u,%u\n", f + 1, stats[f].values[j].value,
+				stats[f].values[j].count);
+	}
+	ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+	return ok;
+}
+
+/* Writes "str" as a quoted CSV field, doubling any quotes in it.  */
+static void WriteCsvString(FILE* fp, const char* str)
+{
+	fputc('"', fp);
+	for (; *str != '\0'; str++)
+	{
+		if (*str == '"')
+			fputc('"', fp);
+		fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+static int CmdWav(int argc, char* argv[])
+{
+	MhkArchive* archive;
+	WavJob* jobs;
+	WorkPool* pool;
+	unsigned numThreads = 0;
+	unsigned numJobs = 0;
+	double seconds = 0;
+	clock_t start;
+	double elapsed;
+	int error;
+	int result = 0;
+	int i;
+	unsigned j;
+
+	for (i = 0; i < argc && argv[i][0] == '-'; i += 2)
+	{
+		bool valid = i + 1 < argc;
+		if (valid && strcmp(argv[i], "-threads") == 0)
+			valid = ParseUnsigned(argv[i+1], &numThreads);
+		else
+			valid = false;
+		if (!valid)
+		{
+			fprintf(stderr, "wav: bad option \"%s\"\n", argv[i]);
+			return 2;
+		}
+	}
+	if (argc - i != 2 || strlen(argv[i+1]) > 1000)
+	{
+		fputs("wav: expected an archive and a directory\n", stderr);
+		return 2;
+	}
+
+	archive = LoadMhkArchive(argv[i], &error);
+	if (archive == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", argv[i], MhkErrorString(error));
+		return 1;
+	}
+	jobs = (WavJob*)malloc((archive->numResources + 1) * sizeof(WavJob));
+	if (jobs == NULL)
+	{
+		fputs("wav: out of memory\n", stderr);
+		FreeMhkArchive(archive);
+		return 1;
+	}
+	for (j = 0; j < archive->numResources; j++)
+	{
+		MhkResource* rsrc = &archive->resources[j];
+		if (rsrc->type != MHK_TWAV)
+			continue;
+		jobs[numJobs].file = &archive->files[rsrc->file];
+		jobs[numJobs].id = rsrc->id;
+		jobs[numJobs].dir = argv[i+1];
+		jobs[numJobs].numFrames = 0;
+		jobs[numJobs].sampleRate = 0;
+		numJobs++;
+	}
+
+	start = clock();
+	pool = CreateWorkPool(numThreads);
+	for (j = 0; j < numJobs; j++)
+		SubmitWork(pool, WavJobFunc, &jobs[j]);
+	WaitWorkPool(pool);
+	FreeWorkPool(pool);
+	elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	for (j = 0; j < numJobs; j++)
+	{
+		if (jobs[j].error != MHK_OK)
+		{
+			fprintf(stderr, "tWAV %u: %s\n", jobs[j].id,
+				MhkErrorString(jobs[j].error));
+			result = 1;
+			continue;
+		}
+		seconds += (double)jobs[j].numFrames / jobs[j].sampleRate;
+	}
+	printf("%u sounds, %.1f seconds of audio, %.0f ms\n", numJobs,
+		seconds, elapsed * 1000);
+	free(jobs);
+	FreeMhkArchive(archive);
+	return result;
+}
+
+/* Runs on a worker thread.  */
+static void WavJobFunc(void* arg)
+{
+	WavJob* job = (WavJob*)arg;
+	MhkSound snd;
+	char path[1024];
+
+	job->error = ParseSound(job->file->data, job->file->size, &snd);
+	if (job->error != MHK_OK)
+		return;
+	sprintf(path, "%s/%u.wav", job->dir, job->id);
+	job->error = ExportSoundWav(&snd, path);
+	job->numFrames = snd.numFrames;
+	job->sampleRate = snd.sampleRate;
+}
+
+static int CmdPlay(int argc, char* argv[])
+{
+	MhkArchive* archive;
+	MhkResource* rsrc;
+	MhkFile* file;
+	MhkSound snd;
+	SoundPlayer* player = NULL;
+	SoundPlayStats stats;
+	int output = SNDOUT_DEVICE;
+	const char* filename = NULL;
+	unsigned id;
+	int error;
+	int result = 0;
+	int i;
+
+	for (i = 0; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "-null") == 0)
+			output = SNDOUT_NULL;
+		else if (strcmp(argv[i], "-file") == 0 && i + 1 < argc)
+		{
+			output = SNDOUT_FILE;
+			filename = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "play: bad option \"%s\"\n", argv[i]);
+			return 2;
+		}
+	}
+	if (argc - i != 2 || !ParseUnsigned(argv[i+1], &id) || id > 0xffff)
+	{
+		fputs("play: expected an archive and a tWAV ID\n", stderr);
+		return 2;
+	}
+
+	archive = LoadMhkArchive(argv[i], &error);
+	if (archive == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", argv[i], MhkErrorString(error));
+		return 1;
+	}
+	rsrc = FindMhkResource(archive, MHK_TWAV, (unsigned short)id);
+	if (rsrc == NULL)
+	{
+		fprintf(stderr, "play: no tWAV %u\n", id);
+		FreeMhkArchive(archive);
+		return 1;
+	}
+	file = GetMhkResourceFile(archive, rsrc);
+	error = ParseSound(file->data, file->size, &snd);
+	if (error == MHK_OK)
+		player = CreateSoundPlayer(&snd, output, filename, &error);
+	if (error != MHK_OK)
+	{
+		fprintf(stderr, "play: tWAV %u: %s\n", id, MhkErrorString(error));
+		FreeMhkArchive(archive);
+		return 1;
+	}
+	printf("tWAV %u: %s, %u Hz, %u channels, %.1f seconds\n", id,
+		SndEncodingName(snd.encoding), snd.sampleRate, snd.numChannels,
+		(double)snd.numFrames / snd.sampleRate);
+	while (!WaitSoundPlayer(player, 1000))
+		;
+	GetSoundPlayStats(player, &stats);
+	FreeSoundPlayer(player);
+
+	if (stats.error != MHK_OK)
+	{
+		fprintf(stderr, "play: %s\n", MhkErrorString(stats.error));
+		result = 1;
+	}
+	printf("first sample after %.1f ms, %lu underruns (%lu frames of "
+		"silence)\n", stats.firstSampleMs, stats.underruns,
+		stats.underrunFrames);
+	printf("%lu frames decoded in %.1f ms, %lu played\n", stats.decoded,
+		stats.decodeMs, stats.played);
+	FreeMhkArchive(archive);
+	return result;
+}
+
+static int CmdBench(int argc, char* argv[])
+{
+	unsigned width = 320, height = 240;
+	unsigned seconds = 60;
+	int i;
+
+	for (i = 1; i < argc; i += 2)
+	{
+		bool valid = i + 1 < argc;
+		if (valid && strcmp(argv[i], "-width") == 0)
+			valid = ParseUnsigned(argv[i+1], &width) && width > 0;
+		else if (valid && strcmp(argv[i], "-height") == 0)
+			valid = ParseUnsigned(argv[i+1], &height) && height > 0;
+		else if (valid && strcmp(argv[i], "-seconds") == 0)
+			valid = ParseUnsigned(argv[i+1], &seconds) && seconds > 0 &&
+				seconds <= 3600;
+		else
+			valid = false;
+		if (!valid)
+		{
+			fprintf(stderr, "bench: bad option \"%s\"\n", argv[i]);
+			return 2;
+		}
+	}
+	if (argc >= 1 && strcmp(argv[0], "palette") == 0)
+		return BenchPalette(width, height);
+	if (argc >= 1 && strcmp(argv[0], "decode") == 0)
+		return BenchDecode(width, height);
+	if (argc >= 1 && strcmp(argv[0], "remap") == 0)
+		return BenchRemap(width, height);
+	if (argc >= 1 && strcmp(argv[0], "adpcm") == 0)
+		return BenchAdpcm(seconds);
+	if (argc >= 1 && strcmp(argv[0], "journal") == 0)
+		return BenchJournal();
+	fputs("bench: expected \"palette\", \"decode\", \"remap\", "
+		"\"adpcm\", or \"journal\"\n", stderr);
+	return 2;
+}
+
+/* Compares the naive per-pixel loop against PalExpandRow() at every
+   supported instruction set level, and checks that they agree.  */
+static int BenchPalette(unsigned width, unsigned height)
+{
+	static const unsigned depths[] = { 1, 2, 4, 8, 8 };
+	static const unsigned colors[] = { 2, 4, 16, 16, 256 };
+	unsigned maxLevel = GetPalExpandLevel();
+	PalColor lut[256];
+	PalExpander pe;
+	unsigned char* rows;
+	PalColor* ref;
+	PalColor* dst;
+	size_t rowSize = width; /* Enough for 8 bits per pixel */
+	unsigned test, level;
+	size_t i;
+	int result = 0;
+
+	rows = (unsigned char*)malloc(rowSize * height);
+	ref = (PalColor*)malloc(width * sizeof(PalColor));
+	dst = (PalColor*)malloc(width * sizeof(PalColor));
+	if (rows == NULL || ref == NULL || dst == NULL)
+	{
+		free(rows); free(ref); free(dst);
+		fputs("bench: out of memory\n", stderr);
+		return 1;
+	}
+	srand(1);
+	for (i = 0; i < 256; i++)
+		lut[i] = ((PalColor)rand() << 12) ^ (PalColor)rand();
+
+	printf("%ux%u pixels, Mpixels/s\n%-4s %-7s %8s", width, height,
+		"bpp", "colors", "naive");
+	for (level = 0; level <= maxLevel; level++)
+		printf(" %8s", PalExpandLevelName(level));
+	putchar('\n');
+
+	for (test = 0; test < sizeof(depths) / sizeof(unsigned); test++)
+	{
+		unsigned mask = colors[test] - 1;
+		for (i = 0; i < rowSize * height; i++)
+		{
+			/* Keep every index inside the palette.  */
+			unsigned b = rand() & 0xff;
+			if (depths[test] == 8)
+				b &= mask;
+			rows[i] = (unsigned char)b;
+		}
+		SetPalExpandLevel(PALEXP_SCALAR);
+		InitPalExpander(&pe, depths[test], lut, colors[test]);
+		printf("%-4u %-7u %8.1f", depths[test], colors[test],
+			TimeExpandRows(PalExpandRowNaive, &pe, rows, rowSize,
+				width, height, ref));
+		PalExpandRowNaive(&pe, rows, 0, width, ref);
+
+		for (level = 0; level <= maxLevel; level++)
+		{
+			SetPalExpandLevel(level);
+			InitPalExpander(&pe, depths[test], lut, colors[test]);
+			printf(" %8.1f", TimeExpandRows(PalExpandRow, &pe, rows,
+				rowSize, width, height, dst));
+			/* Also check an unaligned start.  */
+			PalExpandRow(&pe, rows, 0, width, dst);
+			if (memcmp(dst, ref, width * sizeof(PalColor)) != 0)
+				result = 1;
+			PalExpandRow(&pe, rows, 3, width - 3, dst);
+			PalExpandRowNaive(&pe, rows, 3, width - 3, ref);
+			if (memcmp(dst, ref, (width - 3) * sizeof(PalColor)) != 0)
+				result = 1;
+			PalExpandRowNaive(&pe, rows, 0, width, ref);
+		}
+		putchar('\n');
+	}
+	SetPalExpandLevel(maxLevel);
+
+	if (result != 0)
+		fputs("bench: kernel output does not match the naive loop\n",
+			stderr);
+	free(rows);
+	free(ref);
+	free(dst);
+	return result;
+}
+
+/* Compares the generic per-pixel decoder against the specialized one
+   for every combination of depth and compression, and checks that
+   they agree.  */
+static int BenchDecode(unsigned width, unsigned height)
+{
+	static const unsigned depths[] =
+		{ BMP_BPP1, BMP_BPP4, BMP_BPP8, BMP_BPP16, BMP_BPP24 };
+	static const unsigned primaries[] = { BMP_1ST_NONE, BMP_1ST_LZ };
+	static const unsigned secondaries[] = { BMP_2ND_NONE, BMP_2ND_RLE8 };
+	size_t stride = ((size_t)width * 24 + 7) / 8;
+	unsigned char* pixels;
+	PalColor* ref;
+	PalColor* dst;
+	MhkBitmap bmp;
+	unsigned d, p, s;
+	size_t i;
+	int result = 0;
+
+	if (width > BMP_MAX_DIM || height > BMP_MAX_DIM)
+	{
+		fprintf(stderr, "bench: bitmaps are at most %ux%u\n",
+			BMP_MAX_DIM, BMP_MAX_DIM);
+		return 2;
+	}
+	pixels = (unsigned char*)malloc(stride * height);
+	ref = (PalColor*)malloc((size_t)width * height * sizeof(PalColor));
+	dst = (PalColor*)malloc((size_t)width * height * sizeof(PalColor));
+	if (pixels == NULL || ref == NULL || dst == NULL)
+	{
+		free(pixels); free(ref); free(dst);
+		fputs("bench: out of memory\n", stderr);
+		return 1;
+	}
+	/* Runs of a few bytes with some noise, so that every compression
+	   has something to do.  */
+	srand(1);
+	for (i = 0; i < stride * height; )
+	{
+		size_t run = 1 + rand() % 12;
+		unsigned char value = (unsigned char)rand();
+		for (; run > 0 && i < stride * height; run--, i++)
+			pixels[i] = value;
+	}
+
+	memset(&bmp, 0, sizeof(MhkBitmap));
+	bmp.width = width;
+	bmp.height = height;
+	bmp.rgbBits = 8;
+	bmp.numColors = 256;
+	for (i = 0; i < 256; i++)
+		bmp.palette[i] = ((unsigned long)rand() << 12) ^ rand();
+
+	printf("%ux%u pixels, Mpixels/s\n%-22s %8s %8s %8s\n", width, height,
+		"format", "generic", "special", "speedup");
+	for (d = 0; d < sizeof(depths) / sizeof(unsigned); d++)
+	for (p = 0; p < 2; p++)
+	for (s = 0; s < 2; s++)
+	{
+		unsigned format = depths[d] | primaries[p] | secondaries[s];
+		unsigned char* rsrc;
+		size_t rsrcSize;
+		MhkBitmap parsed;
+		PalExpander pe;
+		double generic, special;
+		char name[32];
+
+		if (depths[d] == BMP_BPP8)
+			format |= BMP_HAS_CLUT;
+		bmp.format = format;
+		bmp.bpp = BmpBitsPerPixel(format);
+		sprintf(name, "%ubpp %s", bmp.bpp, BmpCmpName(format));
+		if (!BmpCanEncode(format))
+			continue;
+		if (EncodeBitmap(&bmp, pixels, stride, 64, &rsrc, &rsrcSize) != MHK_OK)
+		{
+			printf("%-22s (too wide for this depth)\n", name);
+			continue;
+		}
+		if (ParseBitmap(rsrc, rsrcSize, &parsed) != MHK_OK)
+		{
+			free(rsrc);
+			result = 1;
+			continue;
+		}
+		/* Depths without a palette get the gray ramp.  */
+		InitBmpPalExpander(&parsed, &pe);
+		generic = TimeDecodeRgb(DecodeBitmapRgbGeneric, &parsed, &pe, ref);
+		special = TimeDecodeRgb(GetBmpRgbDecoder(format), &parsed, &pe, dst);
+		if (generic == 0 || special == 0 ||
+			memcmp(ref, dst, (size_t)width * height * sizeof(PalColor)) != 0)
+			result = 1;
+		printf("%-22s %8.1f %8.1f %7.2fx\n", name, generic, special,
+			special / generic);
+		free(rsrc);
+	}
+
+	if (result != 0)
+		fputs("bench: specialized output does not match the generic "
+			"decoder\n", stderr);
+	free(pixels);
+	free(ref);
+	free(dst);
+	return result;
+}
+
+/* Compares a search over the whole palette against the k-d tree for
+   the nearest color of every pixel, and times remapping a whole image
+   with each dithering mode.  */
+static int BenchRemap(unsigned width, unsigned height)
+{
+	static const char* ditherNames[3] = { "none", "ordered", "diffuse" };
+	size_t count = (size_t)width * height;
+	QuantOptions opts;
+	unsigned long palette[256];
+	unsigned numColors;
+	ColorMap map;
+	PalColor* pixels;
+	unsigned char* ref;
+	unsigned char* dst;
+	unsigned x, y;
+	int dither;
+	int result = 0;
+	int error;
+
+	pixels = (PalColor*)malloc(count * sizeof(PalColor));
+	ref = (unsigned char*)malloc(count);
+	dst = (unsigned char*)malloc(count);
+	if (pixels == NULL || ref == NULL || dst == NULL)
+	{
+		free(pixels); free(ref); free(dst);
+		fputs("bench: out of memory\n", stderr);
+		return 1;
+	}
+	/* Smooth gradients with a little noise, like painted artwork.  */
+	srand(1);
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			unsigned r = x * 255 / width, g = y * 255 / height;
+			unsigned b = (x + y) * 127 / (width + height) + rand() % 8;
+			pixels[(size_t)y * width + x] = (r << 16) | (g << 8) | b;
+		}
+	}
+	InitQuantOptions(&opts);
+	opts.dither = QUANT_DITHER_NONE;
+	error = QuantizeImage(pixels, width, height, width * sizeof(PalColor),
+		&opts, palette, &numColors, ref, width);
+	if (error != MHK_OK)
+	{
+		free(pixels); free(ref); free(dst);
+		fprintf(stderr, "bench: %s\n", MhkErrorString(error));
+		return 1;
+	}
+	InitColorMap(&map, palette, numColors);
+
+	printf("%ux%u pixels, %u colors, Mpixels/s\n", width, height,
+		numColors);
+	printf("%-20s %8.1f\n", "naive search",
+		TimeNearest(NearestColorNaive, &map, pixels, count, ref));
+	printf("%-20s %8.1f\n", "k-d tree",
+		TimeNearest(NearestColor, &map, pixels, count, dst));
+	if (memcmp(ref, dst, count) != 0)
+		result = 1;
+	for (dither = QUANT_DITHER_NONE; dither <= QUANT_DITHER_DIFFUSE; dither++)
+	{
+		char name[32];
+		sprintf(name, "remap, dither %s", ditherNames[dither]);
+		printf("%-20s %8.1f\n", name,
+			TimeRemap(&map, pixels, width, height, dither, dst));
+		if (dither == QUANT_DITHER_NONE && memcmp(ref, dst, count) != 0)
+			result = 1;
+	}
+
+	if (result != 0)
+		fputs("bench: the searches do not agree with the naive search\n",
+			stderr);
+	free(pixels);
+	free(ref);
+	free(dst);
+	return result;
+}
+
+/* Expands the rows over and over for a quarter second, and returns
+   the speed in megapixels per second.  */
+static double TimeExpandRows(ExpandRowFunc func, const PalExpander* pe,
+	const unsigned char* rows, size_t rowSize, unsigned width,
+	unsigned height, PalColor* dst)
+{
+	clock_t start = clock();
+	clock_t elapsed;
+	double pixels = 0;
+	do
+	{
+		unsigned y;
+		for (y = 0; y < height; y++)
+			func(pe, rows + y * rowSize, 0, width, dst);
+		pixels += (double)width * height;
+		elapsed = clock() - start;
+	} while (elapsed < CLOCKS_PER_SEC / 4);
+	return pixels / ((double)elapsed / CLOCKS_PER_SEC) / 1e6;
+}
+
+/* Like TimeExpandRows(), for whole bitmap decoders.  The output of the
+   last run is left in "dst".  Returns zero if decoding fails.  */
+/* Compares the naive IMA ADPCM decoder against the fast one on
+   random data, in mono and stereo, and checks that they agree.  */
+static int BenchAdpcm(unsigned seconds)
+{
+	size_t numBytes = (size_t)seconds * 22050;
+	unsigned char* src;
+	short* ref;
+	short* dst;
+	unsigned channels;
+	size_t i;
+	int result = 0;
+
+	src = (unsigned char*)malloc(numBytes);
+	ref = (short*)malloc(numBytes * 2 * sizeof(short));
+	dst = (short*)malloc(numBytes * 2 * sizeof(short));
+	if (src == NULL || ref == NULL || dst == NULL)
+	{
+		free(src); free(ref); free(dst);
+		fputs("bench: out of memory\n", stderr);
+		return 1;
+	}
+	/* Any nibbles are valid ADPCM, and random ones clamp often.  */
+	srand(1);
+	for (i = 0; i < numBytes; i++)
+		src[i] = (unsigned char)rand();
+
+	printf("%u seconds of stereo at 22050 Hz, Msamples/s\n"
+		"%-8s %8s %8s %8s\n", seconds, "channels", "naive", "fast",
+		"speedup");
+	for (channels = 1; channels <= 2; channels++)
+	{
+		/* Mono has two frames in every byte.  An odd count also
+		   checks the lone last nibble.  */
+		size_t frames = channels == 1 ? numBytes * 2 - 1 : numBytes;
+		double naive = TimeImaDecode(DecodeImaAdpcmNaive, src, frames,
+			channels, ref);
+		double fast = TimeImaDecode(DecodeImaAdpcm, src, frames,
+			channels, dst);
+		if (naive == 0 || fast == 0 ||
+			memcmp(ref, dst, frames * channels * sizeof(short)) != 0)
+			result = 1;
+		printf("%-8u %8.1f %8.1f %7.2fx\n", channels, naive, fast,
+			fast / naive);
+	}
+
+	if (result != 0)
+		fputs("bench: fast decoder output does not match the naive one\n",
+			stderr);
+	free(src);
+	free(ref);
+	free(dst);
+	return result;
+}
+
+/* Returns how many megasamples per second an IMA ADPCM decoder
+   manages, starting over from a fresh state every time.  */
+static double TimeImaDecode(ImaDecodeFunc func, const unsigned char* src,
+	size_t numFrames, unsigned numChannels, short* dst)
+{
+	clock_t start = clock();
+	clock_t elapsed;
+	double samples = 0;
+	do
+	{
+		ImaState states[SND_MAX_CHANNELS];
+		memset(states, 0, sizeof(states));
+		func(src, numFrames, numChannels, states, dst);
+		samples += (double)numFrames * numChannels;
+		elapsed = clock() - start;
+	} while (elapsed < CLOCKS_PER_SEC / 4);
+	return samples / ((double)elapsed / CLOCKS_PER_SEC) / 1e6;
+}
+
+/* Makes random runs of typing and deleting in a small text, keeping an
+   undo journal with so little memory that it spills, then undoes and
+   redoes all of it and checks that the text comes back both times.
+   Some deleting runs start from an empty entry and change direction,
+   which must start a new entry rather than extend the old one.  */
+static int BenchJournal(void)
+{
+	UndoJournal* journal;
+	char* text;
+	char* first;
+	char* last;
+	size_t length = JOURNAL_TEXT_SIZE;
+	unsigned long numChars = 0, numEntries = 0;
+	const UndoEntry* entry;
+	clock_t start;
+	double editMs, undoMs, redoMs;
+	size_t i;
+	int result = 0;
+
+	journal = CreateUndoJournal(JOURNAL_MAX_BYTES, JOURNAL_MAX_RESIDENT);
+	text = (char*)malloc(JOURNAL_TEXT_SIZE * 2 + 16);
+	first = (char*)malloc(JOURNAL_TEXT_SIZE * 2 + 16);
+	last = (char*)malloc(JOURNAL_TEXT_SIZE * 2 + 16);
+	if (journal == NULL || text == NULL || first == NULL || last == NULL)
+	{
+		FreeUndoJournal(journal);
+		free(text); free(first); free(last);
+		fputs("bench: out of memory\n", stderr);
+		return 1;
+	}
+	srand(1);
+	for (i = 0; i < length; i++)
+		text[i] = (char)('a' + rand() % 26);
+	memcpy(first, text, length);
+
+	start = clock();
+	while (numChars < JOURNAL_NUM_CHARS && result == 0)
+	{
+		size_t caret = (size_t)rand() % (length + 1);
+		unsigned runLength = 1 + rand() % 16;
+		unsigned k;
+		/* Type more while the text is short, delete more while it is
+		   long.  */
+		if ((size_t)rand() % (JOURNAL_TEXT_SIZE * 2) >= length)
+		{
+			for (k = 0; k < runLength; k++, caret++, numChars++)
+			{
+				char c = (char)('A' + rand() % 26);
+				memmove(text + caret + 1, text + caret, length - caret);
+				text[caret] = c;
+				length++;
+				if (k > 0 && ExtendUndoEntry(journal, caret, c))
+					continue;
+				entry = AddUndoEntry(journal, JE_TYPED, caret, 1, 0);
+				if (entry == NULL)
+					result = 1;
+				else
+					entry->data[0] = c;
+				numEntries++;
+			}
+			continue;
+		}
+		k = 0;
+		if (rand() % 4 == 0)
+		{
+			/* Like deleting an empty selection */
+			if (AddUndoEntry(journal, JE_DELETED, caret, 0, 0) == NULL)
+				result = 1;
+			numEntries++;
+			k = 1;
+		}
+		for (; k < runLength && length > 0; k++, numChars++)
+		{
+			size_t pos;
+			char c;
+			/* Backspace or delete, whichever is possible */
+			if (caret == length || (caret > 0 && rand() % 2 == 0))
+				caret--;
+			pos = caret;
+			c = text[pos];
+			memmove(text + pos, text + pos + 1, length - pos - 1);
+			length--;
+			if (k > 0 && ExtendUndoEntry(journal, pos, c))
+				continue;
+			entry = AddUndoEntry(journal, JE_DELETED, pos, 1, 0);
+			if (entry == NULL)
+				result = 1;
+			else
+				entry->data[0] = c;
+			numEntries++;
+		}
+	}
+	editMs = (double)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+	memcpy(last, text, length);
+	i = length;
+
+	start = clock();
+	while (result == 0 && (entry = StepUndo(journal)) != NULL)
+	{
+		if (!SpliceEntry(text, &length, entry, entry->type == JE_TYPED))
+			result = 1;
+	}
+	undoMs = (double)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+	if (CanStepUndo(journal) || length != JOURNAL_TEXT_SIZE ||
+		memcmp(text, first, length) != 0)
+		result = 1;
+
+	start = clock();
+	while (result == 0 && (entry = StepRedo(journal)) != NULL)
+	{
+		if (!SpliceEntry(text, &length, entry, entry->type == JE_DELETED))
+			result = 1;
+	}
+	redoMs = (double)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+	if (CanStepRedo(journal) || length != i ||
+		memcmp(text, last, length) != 0)
+		result = 1;
+
+	printf("%lu characters typed or deleted in %lu entries\n"
+		"%-8s %8s %8s %8s\n%-8s %8.0f %8.0f %8.0f\n", numChars,
+		numEntries, "", "edit", "undo", "redo", "ms", editMs, undoMs,
+		redoMs);
+	if (result != 0)
+		fputs("bench: undoing or redoing did not bring the text back\n",
+			stderr);
+	FreeUndoJournal(journal);
+	free(text);
+	free(first);
+	free(last);
+	return result;
+}
+
+/* Takes the text of a journal entry out of "text", checking that it
+   is there, or puts it back in.  */
+static bool SpliceEntry(char* text, size_t* length, const UndoEntry* entry,
+	bool remove)
+{
+	char* at = text + entry->opPos;
+	size_t after = *length - entry->opPos;
+	if (remove)
+	{
+		if (entry->length > after ||
+			memcmp(at, entry->data, entry->length) != 0)
+			return false;
+		memmove(at, at + entry->length, after - entry->length);
+		*length -= entry->length;
+	}
+	else
+	{
+		memmove(at + entry->length, at, after);
+		memcpy(at, entry->data, entry->length);
+		*length += entry->length;
+	}
+	return true;
+}
+
+static double TimeDecodeRgb(DecodeRgbFunc func, const MhkBitmap* bmp,
+	const PalExpander* pe, PalColor* dst)
+{
+	clock_t start = clock();
+	clock_t elapsed;
+	double pixels = 0;
+	do
+	{
+		if (func(bmp, pe, dst, bmp->width * sizeof(PalColor)) != MHK_OK)
+			return 0;
+		pixels += (double)bmp->width * bmp->height;
+		elapsed = clock() - start;
+	} while (elapsed < CLOCKS_PER_SEC / 4);
+	return pixels / ((double)elapsed / CLOCKS_PER_SEC) / 1e6;
+}
+
+/* Like TimeExpandRows(), for nearest color searches over a list of
+   pixels.  */
+static double TimeNearest(NearestFunc func, const ColorMap* map,
+	const PalColor* pixels, size_t count, unsigned char* dst)
+{
+	clock_t start = clock();
+	clock_t elapsed;
+	double done = 0;
+	do
+	{
+		size_t i;
+		for (i = 0; i < count; i++)
+			dst[i] = (unsigned char)func(map, pixels[i]);
+		done += (double)count;
+		elapsed = clock() - start;
+	} while (elapsed < CLOCKS_PER_SEC / 4);
+	return done / ((double)elapsed / CLOCKS_PER_SEC) / 1e6;
+}
+
+/* Like TimeExpandRows(), for RemapImage().  */
+static double TimeRemap(const ColorMap* map, const PalColor* pixels,
+	unsigned width, unsigned height, int dither, unsigned char* dst)
+{
+	clock_t start = clock();
+	clock_t elapsed;
+	double done = 0;
+	do
+	{
+		if (RemapImage(map, pixels, width, height, width * sizeof(PalColor),
+					   dither, dst, width) != MHK_OK)
+			return 0;
+		done += (double)width * height;
+		elapsed = clock() - start;
+	} while (elapsed < CLOCKS_PER_SEC / 4);
+	return done / ((double)elapsed / CLOCKS_PER_SEC) / 1e6;
+}
+
+static bool ParseDither(const char* str, int* dither)
+{
+	if (strcmp(str, "none") == 0)
+		*dither = QUANT_DITHER_NONE;
+	else if (strcmp(str, "ordered") == 0)
+		*dither = QUANT_DITHER_ORDERED;
+	else if (strcmp(str, "diffuse") == 0)
+		*dither = QUANT_DITHER_DIFFUSE;
+	else
+		return false;
+	return true;
+}
+
+static bool ParseUnsigned(const char* str, unsigned* value)
+{
+	char* end;
+	unsigned long result = strtoul(str, &end, 10);
+	if (*str == '\0' || *end != '\0')
+		return false;
+	*value = (unsigned)result;
+	return true;
+}
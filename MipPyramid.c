@@ -0,0 +1,372 @@
+/* Tiled image pyramid */
+/* Keeps an image at full size and at every power-of-two reduction, cut
+   into square tiles, so that a zoomed out view only has to touch as
+   many pixels as it shows.  Nothing is made until it is asked for: a
+   full-size tile is filled from the source, and a reduced tile is
+   averaged from the four tiles of the level below, which are made in
+   turn if needed.  The source is always asked for whole bands of
+   rows, since compressed bitmaps can only be decoded from the top.
+
+   Tiles stay until TrimMipPyramid() drops the ones that have gone
+   unused the longest.  Pointers returned by GetMipTile() are valid
+   until then.  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "PalExpand.h"
+#include "MipPyramid.h"
+
+#define MAX_LEVELS 32
+
+typedef struct MipLevel_t MipLevel;
+typedef struct TileRef_t TileRef;
+
+struct MipLevel_t
+{
+	unsigned width, height;
+	unsigned tilesX, tilesY;
+	PalColor** tiles; /* Row by row, NULL for tiles not made yet */
+	unsigned long* lastUse;
+};
+
+struct MipPyramid_t
+{
+	MipSourceFunc source;
+	void* ctx;
+	unsigned numLevels;
+	MipLevel levels[MAX_LEVELS];
+	unsigned long clock; /* Counts tile uses */
+	size_t bytes; /* Of all tiles */
+};
+
+/* Used to sort tiles by age when trimming.  */
+struct TileRef_t
+{
+	unsigned long lastUse;
+	unsigned level;
+	unsigned index;
+};
+
+static bool FillBaseBand(MipPyramid* pyr, unsigned ty);
+static bool BuildTile(MipPyramid* pyr, unsigned level, unsigned tx,
+	unsigned ty);
+static void ReduceQuadrant(const PalColor* src, unsigned srcWidth,
+	unsigned srcHeight, PalColor* dst, unsigned dstStride);
+static void FreeTile(MipPyramid* pyr, unsigned level, unsigned index);
+static int CompareTileAge(const void* a, const void* b);
+
+/* Creates an empty pyramid for an image of the given size.  "source"
+   is called to get full-size pixels as they are needed.  */
+MipPyramid* CreateMipPyramid(unsigned width, unsigned height,
+	MipSourceFunc source, void* ctx)
+{
+	MipPyramid* pyr;
+	unsigned i;
+
+	if (width == 0 || height == 0)
+		return NULL;
+	pyr = (MipPyramid*)calloc(1, sizeof(MipPyramid));
+	if (pyr == NULL)
+		return NULL;
+	pyr->source = source;
+	pyr->ctx = ctx;
+	for (i = 0; i < MAX_LEVELS; i++)
+	{
+		MipLevel* lvl = &pyr->levels[i];
+		size_t numTiles;
+		lvl->width = width;
+		lvl->height = height;
+		lvl->tilesX = (width + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+		lvl->tilesY = (height + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+		numTiles = (size_t)lvl->tilesX * lvl->tilesY;
+		lvl->tiles = (PalColor**)calloc(numTiles, sizeof(PalColor*));
+		lvl->lastUse = (unsigned long*)calloc(numTiles,
+											  sizeof(unsigned long));
+		pyr->numLevels++;
+		if (lvl->tiles == NULL || lvl->lastUse == NULL)
+		{
+			FreeMipPyramid(pyr);
+			return NULL;
+		}
+		/* The last level fits in a single tile.  */
+		if (width <= MIP_TILE_SIZE && height <= MIP_TILE_SIZE)
+			break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+	return pyr;
+}
+
+/* Returns the number of levels.  Level 0 is full size, and each level
+   is half the size of the one before, rounded up.  */
+unsigned MipLevelCount(const MipPyramid* pyr)
+{
+	return pyr->numLevels;
+}
+
+void GetMipLevelSize(const MipPyramid* pyr, unsigned level,
+	unsigned* width, unsigned* height)
+{
+	*width = pyr->levels[level].width;
+	*height = pyr->levels[level].height;
+}
+
+/* Returns tile ("tx", "ty") of a level, making it if needed.  Tiles
+   are MIP_TILE_SIZE pixels square except at the right and bottom
+   edges; the actual size is stored in "width" and "height", which is
+   also the stride in pixels.  Returns NULL if the tile does not exist
+   or memory runs out.  */
+const PalColor* GetMipTile(MipPyramid* pyr, unsigned level, unsigned tx,
+	unsigned ty, unsigned* width, unsigned* height)
+{
+	MipLevel* lvl;
+	unsigned index;
+
+	if (level >= pyr->numLevels)
+		return NULL;
+	lvl = &pyr->levels[level];
+	if (tx >= lvl->tilesX || ty >= lvl->tilesY)
+		return NULL;
+	index = ty * lvl->tilesX + tx;
+	if (lvl->tiles[index] == NULL)
+	{
+		bool made = (level == 0) ? FillBaseBand(pyr, ty) :
+			BuildTile(pyr, level, tx, ty);
+		if (!made || lvl->tiles[index] == NULL)
+			return NULL;
+	}
+	lvl->lastUse[index] = ++pyr->clock;
+	*width = lvl->width - tx * MIP_TILE_SIZE;
+	if (*width > MIP_TILE_SIZE)
+		*width = MIP_TILE_SIZE;
+	*height = lvl->height - ty * MIP_TILE_SIZE;
+	if (*height > MIP_TILE_SIZE)
+		*height = MIP_TILE_SIZE;
+	return lvl->tiles[index];
+}
+
+/* Frees the least recently used tiles until the pyramid takes at most
+   "maxBytes".  */
+void TrimMipPyramid(MipPyramid* pyr, size_t maxBytes)
+{
+	TileRef* refs;
+	size_t numRefs = 0, i;
+	unsigned level;
+
+	if (pyr->bytes <= maxBytes)
+		return;
+	for (level = 0; level < pyr->numLevels; level++)
+	{
+		MipLevel* lvl = &pyr->levels[level];
+		numRefs += (size_t)lvl->tilesX * lvl->tilesY;
+	}
+	refs = (TileRef*)malloc(numRefs * sizeof(TileRef));
+	if (refs == NULL)
+	{
+		/* Dropping everything still bounds the memory.  */
+		ClearMipPyramid(pyr);
+		return;
+	}
+	numRefs = 0;
+	for (level = 0; level < pyr->numLevels; level++)
+	{
+		MipLevel* lvl = &pyr->levels[level];
+		unsigned n = lvl->tilesX * lvl->tilesY;
+		unsigned j;
+		for (j = 0; j < n; j++)
+		{
+			if (lvl->tiles[j] == NULL)
+				continue;
+			refs[numRefs].lastUse = lvl->lastUse[j];
+			refs[numRefs].level = level;
+			refs[numRefs].index = j;
+			numRefs++;
+		}
+	}
+	qsort(refs, numRefs, sizeof(TileRef), CompareTileAge);
+	for (i = 0; i < numRefs && pyr->bytes > maxBytes; i++)
+		FreeTile(pyr, refs[i].level, refs[i].index);
+	free(refs);
+}
+
+/* Frees every tile, for when the source pixels change.  */
+void ClearMipPyramid(MipPyramid* pyr)
+{
+	unsigned level;
+	for (level = 0; level < pyr->numLevels; level++)
+	{
+		MipLevel* lvl = &pyr->levels[level];
+		unsigned n = lvl->tilesX * lvl->tilesY;
+		unsigned j;
+		for (j = 0; j < n; j++)
+			FreeTile(pyr, level, j);
+	}
+}
+
+void FreeMipPyramid(MipPyramid* pyr)
+{
+	unsigned level;
+	if (pyr == NULL)
+		return;
+	for (level = 0; level < pyr->numLevels; level++)
+	{
+		MipLevel* lvl = &pyr->levels[level];
+		if (lvl->tiles != NULL)
+		{
+			unsigned n = lvl->tilesX * lvl->tilesY;
+			unsigned j;
+			for (j = 0; j < n; j++)
+				free(lvl->tiles[j]);
+		}
+		free(lvl->tiles);
+		free(lvl->lastUse);
+	}
+	free(pyr);
+}
+
+/* Makes every missing full-size tile in tile row "ty" from a single
+   band of source rows.  */
+static bool FillBaseBand(MipPyramid* pyr, unsigned ty)
+{
+	MipLevel* lvl = &pyr->levels[0];
+	unsigned top = ty * MIP_TILE_SIZE;
+	unsigned height = lvl->height - top;
+	PalColor* band;
+	unsigned tx;
+
+	if (height > MIP_TILE_SIZE)
+		height = MIP_TILE_SIZE;
+	band = (PalColor*)malloc((size_t)lvl->width * height * sizeof(PalColor));
+	if (band == NULL)
+		return false;
+	pyr->source(pyr->ctx, top, height, band, lvl->width * sizeof(PalColor));
+	for (tx = 0; tx < lvl->tilesX; tx++)
+	{
+		unsigned index = ty * lvl->tilesX + tx;
+		unsigned left = tx * MIP_TILE_SIZE;
+		unsigned width = lvl->width - left;
+		PalColor* tile;
+		unsigned y;
+		if (lvl->tiles[index] != NULL)
+			continue;
+		if (width > MIP_TILE_SIZE)
+			width = MIP_TILE_SIZE;
+		tile = (PalColor*)malloc((size_t)width * height * sizeof(PalColor));
+		if (tile == NULL)
+			continue;
+		for (y = 0; y < height; y++)
+			memcpy(tile + y * width, band + (size_t)y * lvl->width + left,
+				width * sizeof(PalColor));
+		lvl->tiles[index] = tile;
+		lvl->lastUse[index] = pyr->clock;
+		pyr->bytes += (size_t)width * height * sizeof(PalColor);
+	}
+	free(band);
+	return true;
+}
+
+/* Makes a reduced tile from the (up to) four tiles below it.  */
+static bool BuildTile(MipPyramid* pyr, unsigned level, unsigned tx,
+	unsigned ty)
+{
+	MipLevel* lvl = &pyr->levels[level];
+	unsigned index = ty * lvl->tilesX + tx;
+	unsigned width = lvl->width - tx * MIP_TILE_SIZE;
+	unsigned height = lvl->height - ty * MIP_TILE_SIZE;
+	PalColor* tile;
+	unsigned q;
+
+	if (width > MIP_TILE_SIZE)
+		width = MIP_TILE_SIZE;
+	if (height > MIP_TILE_SIZE)
+		height = MIP_TILE_SIZE;
+	tile = (PalColor*)malloc((size_t)width * height * sizeof(PalColor));
+	if (tile == NULL)
+		return false;
+	for (q = 0; q < 4; q++)
+	{
+		unsigned cx = q & 1, cy = q >> 1;
+		unsigned childWidth, childHeight;
+		const PalColor* child;
+		if (cx * MIP_TILE_SIZE / 2 >= width ||
+			cy * MIP_TILE_SIZE / 2 >= height)
+			continue;
+		child = GetMipTile(pyr, level - 1, tx * 2 + cx, ty * 2 + cy,
+			&childWidth, &childHeight);
+		if (child == NULL)
+		{
+			free(tile);
+			return false;
+		}
+		ReduceQuadrant(child, childWidth, childHeight,
+			tile + (cy * MIP_TILE_SIZE / 2) * width + cx * MIP_TILE_SIZE / 2,
+			width);
+	}
+	lvl->tiles[index] = tile;
+	pyr->bytes += (size_t)width * height * sizeof(PalColor);
+	return true;
+}
+
+/* Halves a tile in both directions.  Each pixel is the average of a
+   2 by 2 block, or of what is left of one at an odd edge.  */
+static void ReduceQuadrant(const PalColor* src, unsigned srcWidth,
+	unsigned srcHeight, PalColor* dst, unsigned dstStride)
+{
+	unsigned dstHeight = (srcHeight + 1) / 2;
+	unsigned x, y;
+
+	for (y = 0; y < dstHeight; y++)
+	{
+		const PalColor* row0 = src + (y * 2) * srcWidth;
+		const PalColor* row1 = (y * 2 + 1 < srcHeight) ?
+			row0 + srcWidth : row0;
+		PalColor* out = dst + y * dstStride;
+		for (x = 0; x < srcWidth / 2; x++)
+		{
+			/* Red and blue are summed in one word, and green in
+			   another, without the fields running into each
+			   other.  */
+			PalColor a = row0[x*2], b = row0[x*2+1];
+			PalColor c = row1[x*2], d = row1[x*2+1];
+			PalColor rb = (a & 0xff00ff) + (b & 0xff00ff) +
+				(c & 0xff00ff) + (d & 0xff00ff) + 0x020002;
+			PalColor g = (a & 0xff00) + (b & 0xff00) +
+				(c & 0xff00) + (d & 0xff00) + 0x200;
+			out[x] = ((rb >> 2) & 0xff00ff) | ((g >> 2) & 0xff00);
+		}
+		if (srcWidth & 1)
+		{
+			PalColor a = row0[srcWidth - 1], c = row1[srcWidth - 1];
+			PalColor rb = (a & 0xff00ff) + (c & 0xff00ff) + 0x010001;
+			PalColor g = (a & 0xff00) + (c & 0xff00) + 0x100;
+			out[x] = ((rb >> 1) & 0xff00ff) | ((g >> 1) & 0xff00);
+		}
+	}
+}
+
+static void FreeTile(MipPyramid* pyr, unsigned level, unsigned index)
+{
+	MipLevel* lvl = &pyr->levels[level];
+	unsigned tx = index % lvl->tilesX, ty = index / lvl->tilesX;
+	unsigned width = lvl->width - tx * MIP_TILE_SIZE;
+	unsigned height = lvl->height - ty * MIP_TILE_SIZE;
+
+	if (lvl->tiles[index] == NULL)
+		return;
+	if (width > MIP_TILE_SIZE)
+		width = MIP_TILE_SIZE;
+	if (height > MIP_TILE_SIZE)
+		height = MIP_TILE_SIZE;
+	free(lvl->tiles[index]);
+	lvl->tiles[index] = NULL;
+	pyr->bytes -= (size_t)width * height * sizeof(PalColor);
+}
+
+static int CompareTileAge(const void* a, const void* b)
+{
+	unsigned long ua = ((const TileRef*)a)->lastUse;
+	unsigned long ub = ((const TileRef*)b)->lastUse;
+	return (ua > ub) - (ua < ub);
+}
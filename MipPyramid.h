@@ -0,0 +1,29 @@
+/* Tiled image pyramid interface */
+/* Include "bool.h" and "PalExpand.h" before this header.  */
+
+#ifndef MIPPYRAMID_H
+#define MIPPYRAMID_H
+
+#include <stddef.h>
+
+#define MIP_TILE_SIZE 128
+
+typedef struct MipPyramid_t MipPyramid;
+
+/* Supplies full-resolution pixels: rows "top" through "top" +
+   "height" - 1, full width, "stride" bytes apart.  */
+typedef void (*MipSourceFunc)(void* ctx, unsigned top, unsigned height,
+	PalColor* dst, size_t stride);
+
+MipPyramid* CreateMipPyramid(unsigned width, unsigned height,
+	MipSourceFunc source, void* ctx);
+unsigned MipLevelCount(const MipPyramid* pyr);
+void GetMipLevelSize(const MipPyramid* pyr, unsigned level,
+	unsigned* width, unsigned* height);
+const PalColor* GetMipTile(MipPyramid* pyr, unsigned level, unsigned tx,
+	unsigned ty, unsigned* width, unsigned* height);
+void TrimMipPyramid(MipPyramid* pyr, size_t maxBytes);
+void ClearMipPyramid(MipPyramid* pyr);
+void FreeMipPyramid(MipPyramid* pyr);
+
+#endif /* not MIPPYRAMID_H */
@@ -0,0 +1,270 @@
+/* Palette editor window */
+/* A small tool window with a 16 by 16 grid of color swatches and a
+   red, green, and blue slider for the selected color.  The owner gets
+   a PEN_CHANGE notification for every slider movement, so it can
+   redraw whatever uses the palette while the slider is dragged.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <commctrl.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "resource.h"
+#include "PalEdit.h"
+
+#define CELL_SIZE	12
+#define MARGIN		8
+#define GRID_SIZE	(CELL_SIZE * 16)
+#define SLIDER_TOP	(MARGIN * 2 + GRID_SIZE)
+#define SLIDER_HEIGHT 24
+#define CLIENT_WIDTH (MARGIN * 2 + GRID_SIZE + 4)
+#define CLIENT_HEIGHT (SLIDER_TOP + SLIDER_HEIGHT * 3 + MARGIN)
+
+/* Child control IDs.  Color component "i" uses ID_SLIDER + i and
+   ID_VALUE + i, in the order red, green, blue.  */
+enum
+{
+	ID_SLIDER = 100,
+	ID_VALUE = 110
+};
+
+typedef struct PalEdit_t PalEdit;
+
+struct PalEdit_t
+{
+	unsigned long palette[256]; /* 0x00RRGGBB */
+	unsigned numColors;
+	unsigned selected;
+	HWND sliders[3];
+	HWND values[3];
+};
+
+LRESULT CALLBACK PalEditProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam);
+static void CreateSliders(HWND hwnd, PalEdit* pe);
+static void UpdateSliders(PalEdit* pe);
+static void GetCellRect(unsigned index, RECT* rt);
+static void NotifyOwner(HWND hwnd, unsigned code);
+
+BOOL RegisterPalEdit(HINSTANCE hInstance)
+{
+	WNDCLASSEX wcex;
+	wcex.cbSize = sizeof(WNDCLASSEX);
+	wcex.style = 0;
+	wcex.lpfnWndProc = PalEditProc;
+	wcex.cbClsExtra = 0;
+	wcex.cbWndExtra = 0;
+	wcex.hInstance = hInstance;
+	wcex.hIcon = NULL;
+	wcex.hCursor = LoadCursor(NULL, IDC_ARROW);
+	wcex.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+	wcex.lpszMenuName = NULL;
+	wcex.lpszClassName = PALEDIT_CLASS;
+	wcex.hIconSm = NULL;
+	return RegisterClassEx(&wcex) != 0;
+}
+
+/* Creates a palette editor owned by "owner", which receives the
+   notifications.  */
+HWND CreatePalEdit(HWND owner, const unsigned long* palette,
+	unsigned numColors)
+{
+	RECT rt = { 0, 0, CLIENT_WIDTH, CLIENT_HEIGHT };
+	DWORD style = WS_POPUP | WS_CAPTION | WS_SYSMENU;
+	HWND hwnd;
+
+	AdjustWindowRectEx(&rt, style, FALSE, WS_EX_TOOLWINDOW);
+	hwnd = CreateWindowEx(WS_EX_TOOLWINDOW, PALEDIT_CLASS, "Palette",
+		style, CW_USEDEFAULT, CW_USEDEFAULT,
+		rt.right - rt.left, rt.bottom - rt.top, owner, NULL,
+		(HINSTANCE)GetWindowLongPtr(owner, GWLP_HINSTANCE), NULL);
+	if (hwnd == NULL)
+		return NULL;
+	SetPalEditColors(hwnd, palette, numColors);
+	ShowWindow(hwnd, SW_SHOWNA);
+	return hwnd;
+}
+
+void SetPalEditColors(HWND hwnd, const unsigned long* palette,
+	unsigned numColors)
+{
+	PalEdit* pe = (PalEdit*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (pe == NULL)
+		return;
+	if (numColors > 256)
+		numColors = 256;
+	memcpy(pe->palette, palette, numColors * sizeof(unsigned long));
+	pe->numColors = numColors;
+	if (pe->selected >= numColors)
+		pe->selected = 0;
+	UpdateSliders(pe);
+	InvalidateRect(hwnd, NULL, TRUE);
+}
+
+/* Copies the edited colors.  Returns the number of colors.  */
+unsigned GetPalEditColors(HWND hwnd, unsigned long* palette)
+{
+	PalEdit* pe = (PalEdit*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (pe == NULL)
+		return 0;
+	memcpy(palette, pe->palette, pe->numColors * sizeof(unsigned long));
+	return pe->numColors;
+}
+
+LRESULT CALLBACK PalEditProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam)
+{
+	PalEdit* pe = (PalEdit*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	switch (uMsg)
+	{
+	case WM_CREATE:
+		pe = (PalEdit*)malloc(sizeof(PalEdit));
+		if (pe == NULL)
+			return -1;
+		memset(pe, 0, sizeof(PalEdit));
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)pe);
+		CreateSliders(hwnd, pe);
+		return 0;
+	case WM_DESTROY:
+		free(pe);
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+		return 0;
+	case WM_CLOSE:
+		/* The owner decides what to do with the edits.  */
+		NotifyOwner(hwnd, PEN_CLOSE);
+		return 0;
+	case WM_PAINT:
+	{
+		PAINTSTRUCT ps;
+		RECT rt;
+		unsigned i;
+		BeginPaint(hwnd, &ps);
+		for (i = 0; i < 256; i++)
+		{
+			unsigned long color = pe->palette[i];
+			HBRUSH hBrush;
+			GetCellRect(i, &rt);
+			if (i >= pe->numColors)
+			{
+				/* Unused entries */
+				FrameRect(ps.hdc, &rt, GetSysColorBrush(COLOR_BTNSHADOW));
+				continue;
+			}
+			hBrush = CreateSolidBrush(RGB((color >> 16) & 0xff,
+				(color >> 8) & 0xff, color & 0xff));
+			FillRect(ps.hdc, &rt, hBrush);
+			DeleteObject(hBrush);
+			if (i == pe->selected)
+			{
+				FrameRect(ps.hdc, &rt, (HBRUSH)GetStockObject(BLACK_BRUSH));
+				InflateRect(&rt, -1, -1);
+				FrameRect(ps.hdc, &rt, (HBRUSH)GetStockObject(WHITE_BRUSH));
+			}
+		}
+		EndPaint(hwnd, &ps);
+		return 0;
+	}
+	case WM_LBUTTONDOWN:
+	{
+		int x = (short)LOWORD(lParam) - MARGIN;
+		int y = (short)HIWORD(lParam) - MARGIN;
+		unsigned index;
+		RECT rt;
+		if (x < 0 || y < 0 || x >= GRID_SIZE || y >= GRID_SIZE)
+			return 0;
+		index = (y / CELL_SIZE) * 16 + x / CELL_SIZE;
+		if (index >= pe->numColors || index == pe->selected)
+			return 0;
+		GetCellRect(pe->selected, &rt);
+		InvalidateRect(hwnd, &rt, TRUE);
+		pe->selected = index;
+		GetCellRect(index, &rt);
+		InvalidateRect(hwnd, &rt, TRUE);
+		UpdateSliders(pe);
+		return 0;
+	}
+	case WM_HSCROLL:
+	{
+		int comp = GetDlgCtrlID((HWND)lParam) - ID_SLIDER;
+		unsigned shift;
+		unsigned long value;
+		unsigned long* color;
+		char text[8];
+		RECT rt;
+		if (comp < 0 || comp > 2 || pe->numColors == 0)
+			break;
+		shift = 16 - comp * 8;
+		value = (unsigned long)SendMessage(pe->sliders[comp], TBM_GETPOS, 0, 0);
+		color = &pe->palette[pe->selected];
+		if (((*color >> shift) & 0xff) == value)
+			return 0;
+		*color = (*color & ~(0xffUL << shift)) | (value << shift);
+		wsprintf(text, "%u", (unsigned)value);
+		SetWindowText(pe->values[comp], text);
+		GetCellRect(pe->selected, &rt);
+		InvalidateRect(hwnd, &rt, FALSE);
+		NotifyOwner(hwnd, PEN_CHANGE);
+		return 0;
+	}
+	}
+	return DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
+
+static void CreateSliders(HWND hwnd, PalEdit* pe)
+{
+	static const char* labels[3] = { "R", "G", "B" };
+	HINSTANCE hInst = (HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE);
+	HFONT hFont = (HFONT)GetStockObject(DEFAULT_GUI_FONT);
+	unsigned i;
+	for (i = 0; i < 3; i++)
+	{
+		int y = SLIDER_TOP + i * SLIDER_HEIGHT;
+		HWND hLabel = CreateWindowEx(0, "STATIC", labels[i],
+			WS_CHILD | WS_VISIBLE, MARGIN, y + 4, 12, 16,
+			hwnd, NULL, hInst, NULL);
+		pe->sliders[i] = CreateWindowEx(0, TRACKBAR_CLASS, NULL,
+			WS_CHILD | WS_VISIBLE | WS_TABSTOP | TBS_HORZ | TBS_NOTICKS,
+			MARGIN + 14, y, GRID_SIZE - 44, SLIDER_HEIGHT,
+			hwnd, (HMENU)(ID_SLIDER + i), hInst, NULL);
+		pe->values[i] = CreateWindowEx(0, "STATIC", "0",
+			WS_CHILD | WS_VISIBLE | SS_RIGHT,
+			MARGIN + GRID_SIZE - 28, y + 4, 28, 16,
+			hwnd, (HMENU)(ID_VALUE + i), hInst, NULL);
+		SendMessage(pe->sliders[i], TBM_SETRANGE, FALSE, MAKELPARAM(0, 255));
+		SendMessage(hLabel, WM_SETFONT, (WPARAM)hFont, FALSE);
+		SendMessage(pe->values[i], WM_SETFONT, (WPARAM)hFont, FALSE);
+	}
+}
+
+/* Moves the sliders to the selected color.  */
+static void UpdateSliders(PalEdit* pe)
+{
+	unsigned long color = pe->palette[pe->selected];
+	unsigned i;
+	for (i = 0; i < 3; i++)
+	{
+		unsigned value = (unsigned)(color >> (16 - i * 8)) & 0xff;
+		char text[8];
+		SendMessage(pe->sliders[i], TBM_SETPOS, TRUE, value);
+		wsprintf(text, "%u", value);
+		SetWindowText(pe->values[i], text);
+		EnableWindow(pe->sliders[i], pe->numColors > 0);
+	}
+}
+
+static void GetCellRect(unsigned index, RECT* rt)
+{
+	rt->left = MARGIN + (index % 16) * CELL_SIZE;
+	rt->top = MARGIN + (index / 16) * CELL_SIZE;
+	rt->right = rt->left + CELL_SIZE;
+	rt->bottom = rt->top + CELL_SIZE;
+}
+
+static void NotifyOwner(HWND hwnd, unsigned code)
+{
+	SendMessage(GetWindow(hwnd, GW_OWNER), WM_COMMAND,
+		MAKEWPARAM(PALEDIT_WINDOW, code), (LPARAM)hwnd);
+}
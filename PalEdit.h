@@ -0,0 +1,25 @@
+/* Palette editor window interface */
+/* This is platform dependent code: include windows.h and "bool.h"
+   before this header.  */
+
+#ifndef PALEDIT_H
+#define PALEDIT_H
+
+#define PALEDIT_CLASS "MhkPalEdit"
+
+/* Notification codes sent to the owner window in WM_COMMAND, with the
+   PALEDIT_WINDOW control ID.  */
+enum PalEditNotify
+{
+	PEN_CHANGE = 1, /* A color was changed */
+	PEN_CLOSE /* The user closed the window */
+};
+
+BOOL RegisterPalEdit(HINSTANCE hInstance);
+HWND CreatePalEdit(HWND owner, const unsigned long* palette,
+	unsigned numColors);
+void SetPalEditColors(HWND hwnd, const unsigned long* palette,
+	unsigned numColors);
+unsigned GetPalEditColors(HWND hwnd, unsigned long* palette);
+
+#endif /* not PALEDIT_H */
@@ -0,0 +1,343 @@
+/* Palette expansion */
+/* Converts rows of 1, 2, 4, or 8-bit palette indices to 32-bit DIB
+   colors.  Sub-byte depths are first unpacked to one index per byte
+   in small chunks, so every kernel only has to deal with byte
+   indices.  There are three kernels:
+
+   - Scalar: a plain table lookup, unrolled.
+   - SSSE3: the palette is split into groups of 16 colors, and every
+     group into blue, green, and red byte tables.  The low nibble of an
+     index selects a byte with PSHUFB, and the high nibble selects the
+     group with a compare mask.  The cost grows with the number of
+     groups, so this is only used for small palettes.
+   - AVX2: eight table lookups at a time with a gather.  Gathers are
+     about as fast as the shuffles for a single group and faster for
+     anything larger, so they are used whenever they are available.
+
+   The kernel is picked once per palette by InitPalExpander() from the
+   instruction sets that the CPU supports.  */
+
+#include <string.h>
+
+#include "bool.h"
+#include "PalExpand.h"
+
+#if !defined(PALEXP_NO_SIMD) && (defined(__i386__) || \
+	defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64))
+#define PALEXP_X86
+#include <immintrin.h>
+#ifdef __GNUC__
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#include <intrin.h>
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+#endif
+
+/* Indices are unpacked in chunks of this many pixels.  It must be a
+   multiple of eight so that every chunk after the first starts on a
+   byte boundary.  */
+#define UNPACK_CHUNK 256
+/* Use the split-nibble kernel for palettes of up to this many groups
+   of 16 colors.  Past that, the scalar kernel is faster.  */
+#define SPLIT_MAX_GROUPS 2
+
+static int maxLevel = -1; /* Not detected yet */
+static unsigned curLevel;
+/* The indices packed in every possible byte */
+static unsigned char unpack1[256][8];
+static unsigned char unpack2[256][4];
+static unsigned char unpack4[256][2];
+
+static void DetectPalExpandLevel(void);
+static void UnpackIndices(const unsigned char* row, unsigned bpp,
+	unsigned left, unsigned count, unsigned char* indices);
+static void ScalarKernel(const PalExpander* pe, const unsigned char* indices,
+	unsigned count, PalColor* dst);
+#ifdef PALEXP_X86
+TARGET_SSSE3 static void Ssse3Kernel(const PalExpander* pe,
+	const unsigned char* indices, unsigned count, PalColor* dst);
+TARGET_AVX2 static void Avx2Kernel(const PalExpander* pe,
+	const unsigned char* indices, unsigned count, PalColor* dst);
+#endif
+
+/* Returns the highest PalExpandLevel that new expanders will use.  */
+unsigned GetPalExpandLevel(void)
+{
+	if (maxLevel < 0)
+		DetectPalExpandLevel();
+	return curLevel;
+}
+
+/* Limits the kernels of new expanders to "level" or lower, for
+   benchmarks and for ruling out a misbehaving kernel.  Returns the
+   level that is actually in effect.  */
+unsigned SetPalExpandLevel(unsigned level)
+{
+	if (maxLevel < 0)
+		DetectPalExpandLevel();
+	curLevel = (level < (unsigned)maxLevel) ? level : (unsigned)maxLevel;
+	return curLevel;
+}
+
+const char* PalExpandLevelName(unsigned level)
+{
+	switch (level)
+	{
+	case PALEXP_SCALAR: return "scalar";
+	case PALEXP_SSSE3: return "SSSE3";
+	case PALEXP_AVX2: return "AVX2";
+	}
+	return "unknown";
+}
+
+/* Prepares to expand "bpp"-bit indices with the first "numColors"
+   entries of "lut".  The remaining colors are black.  The top byte of
+   the colors is ignored.  Returns false if the depth is not
+   supported.  */
+bool InitPalExpander(PalExpander* pe, unsigned bpp, const PalColor* lut,
+	unsigned numColors)
+{
+	unsigned level = GetPalExpandLevel();
+	unsigned i;
+
+	if (bpp != 1 && bpp != 2 && bpp != 4 && bpp != 8)
+		return false;
+	if (numColors > (1U << bpp))
+		numColors = 1 << bpp;
+	pe->bpp = bpp;
+	memset(pe->lut, 0, sizeof(pe->lut));
+	for (i = 0; i < numColors; i++)
+		pe->lut[i] = lut[i] & 0xffffff;
+	pe->numGroups = (numColors + 15) / 16;
+	if (pe->numGroups == 0)
+		pe->numGroups = 1;
+	for (i = 0; i < pe->numGroups * 16; i++)
+	{
+		pe->split[i>>4][0][i&15] = (unsigned char)pe->lut[i];
+		pe->split[i>>4][1][i&15] = (unsigned char)(pe->lut[i] >> 8);
+		pe->split[i>>4][2][i&15] = (unsigned char)(pe->lut[i] >> 16);
+	}
+
+	pe->kernel = ScalarKernel;
+#ifdef PALEXP_X86
+	if (level >= PALEXP_AVX2)
+		pe->kernel = Avx2Kernel;
+	else if (level >= PALEXP_SSSE3 && pe->numGroups <= SPLIT_MAX_GROUPS)
+		pe->kernel = Ssse3Kernel;
+#else
+	(void)level;
+#endif
+	return true;
+}
+
+/* Expands "count" pixels of a packed row starting at pixel "left"
+   into "dst".  */
+void PalExpandRow(const PalExpander* pe, const unsigned char* row,
+	unsigned left, unsigned count, PalColor* dst)
+{
+	unsigned char indices[UNPACK_CHUNK];
+	if (pe->bpp == 8)
+	{
+		pe->kernel(pe, row + left, count, dst);
+		return;
+	}
+	while (count > 0)
+	{
+		unsigned chunk = (count < UNPACK_CHUNK) ? count : UNPACK_CHUNK;
+		UnpackIndices(row, pe->bpp, left, chunk, indices);
+		pe->kernel(pe, indices, chunk, dst);
+		left += chunk;
+		count -= chunk;
+		dst += chunk;
+	}
+}
+
+/* The straightforward per-pixel loop that PalExpandRow() replaces.
+   It is kept as a reference for benchmarks.  */
+void PalExpandRowNaive(const PalExpander* pe, const unsigned char* row,
+	unsigned left, unsigned count, PalColor* dst)
+{
+	unsigned mask = (1 << pe->bpp) - 1;
+	unsigned x;
+	for (x = left; x < left + count; x++)
+	{
+		unsigned long bit = (unsigned long)x * pe->bpp;
+		unsigned shift = 8 - pe->bpp - (unsigned)(bit & 7);
+		*dst++ = pe->lut[(row[bit>>3] >> shift) & mask];
+	}
+}
+
+static void DetectPalExpandLevel(void)
+{
+	int level = PALEXP_SCALAR;
+	unsigned b;
+#if defined(PALEXP_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3"))
+		level = PALEXP_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+		level = PALEXP_AVX2;
+#elif defined(PALEXP_X86)
+	int info[4];
+	int maxLeaf;
+	__cpuid(info, 0);
+	maxLeaf = info[0];
+	if (maxLeaf >= 1)
+	{
+		bool osAvx;
+		__cpuid(info, 1);
+		if (info[2] & (1 << 9))
+			level = PALEXP_SSSE3;
+		/* AVX needs both the CPU and the OS to save the YMM
+		   registers.  */
+		osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+			(_xgetbv(0) & 6) == 6;
+		if (osAvx && maxLeaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5))
+				level = PALEXP_AVX2;
+		}
+	}
+#endif
+	/* This only runs once, so it is a good time to fill the unpacking
+	   tables too.  */
+	for (b = 0; b < 256; b++)
+	{
+		unsigned i;
+		for (i = 0; i < 8; i++)
+			unpack1[b][i] = (b >> (7 - i)) & 1;
+		for (i = 0; i < 4; i++)
+			unpack2[b][i] = (b >> (6 - 2 * i)) & 3;
+		unpack4[b][0] = b >> 4;
+		unpack4[b][1] = b & 0xf;
+	}
+	maxLevel = level;
+	curLevel = level;
+}
+
+/* Unpacks "count" indices starting at pixel "left" into one byte
+   each.  */
+static void UnpackIndices(const unsigned char* row, unsigned bpp,
+	unsigned left, unsigned count, unsigned char* indices)
+{
+	unsigned perByte = 8 / bpp;
+	unsigned mask = (1 << bpp) - 1;
+	const unsigned char* src = row + left / perByte;
+	unsigned sub = left % perByte;
+
+	/* Leading pixels in the middle of a byte */
+	while (sub != 0 && count > 0)
+	{
+		*indices++ = (*src >> (8 - bpp * (sub + 1))) & mask;
+		count--;
+		if (++sub == perByte)
+		{
+			sub = 0;
+			src++;
+		}
+	}
+
+	switch (bpp)
+	{
+	case 4:
+		for (; count >= 2; count -= 2, indices += 2)
+			memcpy(indices, unpack4[*src++], 2);
+		break;
+	case 2:
+		for (; count >= 4; count -= 4, indices += 4)
+			memcpy(indices, unpack2[*src++], 4);
+		break;
+	case 1:
+		for (; count >= 8; count -= 8, indices += 8)
+			memcpy(indices, unpack1[*src++], 8);
+		break;
+	}
+
+	/* Trailing pixels */
+	for (sub = 0; sub < count; sub++)
+		*indices++ = (*src >> (8 - bpp * (sub + 1))) & mask;
+}
+
+static void ScalarKernel(const PalExpander* pe, const unsigned char* indices,
+	unsigned count, PalColor* dst)
+{
+	const PalColor* lut = pe->lut;
+	unsigned i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		dst[i] = lut[indices[i]];
+		dst[i+1] = lut[indices[i+1]];
+		dst[i+2] = lut[indices[i+2]];
+		dst[i+3] = lut[indices[i+3]];
+	}
+	for (; i < count; i++)
+		dst[i] = lut[indices[i]];
+}
+
+#ifdef PALEXP_X86
+
+TARGET_SSSE3 static void Ssse3Kernel(const PalExpander* pe,
+	const unsigned char* indices, unsigned count, PalColor* dst)
+{
+	const __m128i nibMask = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(indices + i));
+		__m128i lo = _mm_and_si128(v, nibMask);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibMask);
+		__m128i b = zero, g = zero, r = zero;
+		__m128i bgLo, bgHi, r0Lo, r0Hi;
+		unsigned grp;
+		for (grp = 0; grp < pe->numGroups; grp++)
+		{
+			__m128i sel = _mm_cmpeq_epi8(hi, _mm_set1_epi8((char)grp));
+			const __m128i* split = (const __m128i*)pe->split[grp];
+			b = _mm_or_si128(b, _mm_and_si128(sel,
+				_mm_shuffle_epi8(_mm_loadu_si128(split), lo)));
+			g = _mm_or_si128(g, _mm_and_si128(sel,
+				_mm_shuffle_epi8(_mm_loadu_si128(split + 1), lo)));
+			r = _mm_or_si128(r, _mm_and_si128(sel,
+				_mm_shuffle_epi8(_mm_loadu_si128(split + 2), lo)));
+		}
+		/* Interleave the byte planes into B, G, R, 0 pixels.  */
+		bgLo = _mm_unpacklo_epi8(b, g);
+		bgHi = _mm_unpackhi_epi8(b, g);
+		r0Lo = _mm_unpacklo_epi8(r, zero);
+		r0Hi = _mm_unpackhi_epi8(r, zero);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(bgLo, r0Lo));
+		_mm_storeu_si128((__m128i*)(dst + i + 4),
+			_mm_unpackhi_epi16(bgLo, r0Lo));
+		_mm_storeu_si128((__m128i*)(dst + i + 8),
+			_mm_unpacklo_epi16(bgHi, r0Hi));
+		_mm_storeu_si128((__m128i*)(dst + i + 12),
+			_mm_unpackhi_epi16(bgHi, r0Hi));
+	}
+	ScalarKernel(pe, indices + i, count - i, dst + i);
+}
+
+TARGET_AVX2 static void Avx2Kernel(const PalExpander* pe,
+	const unsigned char* indices, unsigned count, PalColor* dst)
+{
+	const int* lut = (const int*)pe->lut;
+	unsigned i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i i0 = _mm256_cvtepu8_epi32(
+			_mm_loadl_epi64((const __m128i*)(indices + i)));
+		__m256i i1 = _mm256_cvtepu8_epi32(
+			_mm_loadl_epi64((const __m128i*)(indices + i + 8)));
+		_mm256_storeu_si256((__m256i*)(dst + i),
+			_mm256_i32gather_epi32(lut, i0, 4));
+		_mm256_storeu_si256((__m256i*)(dst + i + 8),
+			_mm256_i32gather_epi32(lut, i1, 4));
+	}
+	ScalarKernel(pe, indices + i, count - i, dst + i);
+}
+
+#endif /* PALEXP_X86 */
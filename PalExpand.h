@@ -0,0 +1,50 @@
+/* Palette expansion interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef PALEXPAND_H
+#define PALEXPAND_H
+
+/* A 32-bit color in the same layout as a 32-bit DIB pixel,
+   0x00RRGGBB.  (unsigned long would be 64 bits wide on some
+   compilers.)  */
+typedef unsigned int PalColor;
+
+/* Instruction set levels of the expansion kernels, in order of
+   preference.  */
+enum PalExpandLevel
+{
+	PALEXP_SCALAR,
+	PALEXP_SSSE3, /* Split-nibble shuffle table lookups */
+	PALEXP_AVX2 /* Gathers */
+};
+
+#define PALEXP_NUM_LEVELS 3
+
+typedef struct PalExpander_t PalExpander;
+typedef void (*PalKernel)(const PalExpander* pe, const unsigned char* indices,
+	unsigned count, PalColor* dst);
+
+/* Everything that is needed to expand rows with one palette.  Prepare
+   it with InitPalExpander() whenever the palette changes.  */
+struct PalExpander_t
+{
+	unsigned bpp; /* 1, 2, 4, or 8 */
+	unsigned numGroups; /* Number of 16-color groups in use */
+	PalKernel kernel;
+	PalColor lut[256];
+	/* The blue, green, and red bytes of every group of 16 colors, as
+	   lookup tables for byte shuffles.  */
+	unsigned char split[16][3][16];
+};
+
+unsigned GetPalExpandLevel(void);
+unsigned SetPalExpandLevel(unsigned level);
+const char* PalExpandLevelName(unsigned level);
+bool InitPalExpander(PalExpander* pe, unsigned bpp, const PalColor* lut,
+	unsigned numColors);
+void PalExpandRow(const PalExpander* pe, const unsigned char* row,
+	unsigned left, unsigned count, PalColor* dst);
+void PalExpandRowNaive(const PalExpander* pe, const unsigned char* row,
+	unsigned left, unsigned count, PalColor* dst);
+
+#endif /* not PALEXPAND_H */
@@ -0,0 +1,377 @@
+/* Piece table */
+/* Edits a text without moving it around.  The text is a list of
+   pieces, each a run of bytes in one of two places: the original text,
+   which is never written to and so can be a mapped file, or an add
+   buffer that only grows.  Inserting appends the new bytes to the add
+   buffer and splits the piece they land in; deleting trims or drops
+   pieces.  Either way the work depends on the number of pieces, not
+   the size of the text, and typing at one spot keeps extending the same
+   piece instead of making new ones.
+
+   The add buffer is a chain of blocks that are never reallocated, so a
+   pointer into the text stays valid until the table is freed, although
+   the range it points at may no longer be part of the text.  Each piece
+   records its text position, so finding one is a binary search, and
+   the last piece found is tried first, which makes reading in order
+   cheap in either direction.  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "PieceTable.h"
+
+#define ADD_BLOCK_SIZE 65536 /* Usual size of an add buffer block */
+
+typedef struct Piece_t Piece;
+
+struct Piece_t
+{
+	const char* data;
+	size_t pos; /* Text position of the first byte */
+	size_t length;
+};
+
+struct PieceTable_t
+{
+	size_t size; /* Length of the text */
+	Piece* pieces; /* In text order, none of them empty */
+	size_t numPieces;
+	size_t maxPieces;
+	char** blocks; /* The add buffer */
+	size_t numBlocks;
+	size_t blockSize; /* Size of the last block */
+	size_t blockUsed; /* Bytes used in the last block */
+	size_t lastPiece; /* Piece last found */
+};
+
+static size_t FindPiece(PieceTable* table, size_t pos);
+static size_t SearchPiece(const PieceTable* table, size_t pos);
+static bool ReservePieces(PieceTable* table, size_t extra);
+static const char* AddText(PieceTable* table, const char* text,
+	size_t length);
+
+/* Starts a table over "size" bytes at "original", which are not
+   copied and must stay valid until the table is freed.  Returns NULL
+   if out of memory.  */
+PieceTable* CreatePieceTable(const char* original, size_t size)
+{
+	PieceTable* table;
+	table = (PieceTable*)calloc(1, sizeof(PieceTable));
+	if (table == NULL)
+		return NULL;
+	if (size == 0)
+		return table;
+	if (!ReservePieces(table, 1))
+	{
+		FreePieceTable(table);
+		return NULL;
+	}
+	table->pieces[0].data = original;
+	table->pieces[0].pos = 0;
+	table->pieces[0].length = size;
+	table->numPieces = 1;
+	table->size = size;
+	return table;
+}
+
+size_t PieceTableSize(const PieceTable* table)
+{
+	return table->size;
+}
+
+/* Inserts "length" bytes of "text" before position "pos".  Returns
+   false if out of memory or "pos" is past the end, leaving the text
+   unchanged.  */
+bool InsertPieceText(PieceTable* table, size_t pos, const char* text,
+	size_t length)
+{
+	size_t i, j;
+	bool split;
+	const char* data;
+	Piece* pieces;
+
+	if (pos > table->size)
+		return false;
+	if (length == 0)
+		return true;
+	i = FindPiece(table, pos);
+	split = (i < table->numPieces && table->pieces[i].pos < pos);
+
+	/* Text added right after the previous insertion extends its
+	   piece.  */
+	if (!split && i > 0 && table->numBlocks > 0 &&
+		table->blockSize - table->blockUsed >= length)
+	{
+		Piece* prev = &table->pieces[i - 1];
+		char* end = table->blocks[table->numBlocks - 1] + table->blockUsed;
+		if (prev->data + prev->length == end)
+		{
+			memcpy(end, text, length);
+			table->blockUsed += length;
+			prev->length += length;
+			for (j = i; j < table->numPieces; j++)
+				table->pieces[j].pos += length;
+			table->size += length;
+			table->lastPiece = i - 1;
+			return true;
+		}
+	}
+
+	if (!ReservePieces(table, split ? 2 : 1))
+		return false;
+	data = AddText(table, text, length);
+	if (data == NULL)
+		return false;
+	pieces = table->pieces;
+	if (split)
+	{
+		size_t head = pos - pieces[i].pos;
+		memmove(&pieces[i + 3], &pieces[i + 1],
+			(table->numPieces - i - 1) * sizeof(Piece));
+		pieces[i + 2].data = pieces[i].data + head;
+		pieces[i + 2].pos = pos;
+		pieces[i + 2].length = pieces[i].length - head;
+		pieces[i].length = head;
+		i++;
+		table->numPieces += 2;
+	}
+	else
+	{
+		memmove(&pieces[i + 1], &pieces[i],
+			(table->numPieces - i) * sizeof(Piece));
+		table->numPieces++;
+	}
+	pieces[i].data = data;
+	pieces[i].pos = pos;
+	pieces[i].length = length;
+	for (j = i + 1; j < table->numPieces; j++)
+		pieces[j].pos += length;
+	table->size += length;
+	table->lastPiece = i;
+	return true;
+}
+
+/* Deletes "length" bytes from position "pos".  Returns false if out of
+   memory or the range is past the end, leaving the text unchanged.  */
+bool DeletePieceText(PieceTable* table, size_t pos, size_t length)
+{
+	size_t first, last, end;
+	size_t numKept, j;
+	Piece kept[2];
+	Piece* pieces;
+
+	if (pos > table->size || length > table->size - pos)
+		return false;
+	if (length == 0)
+		return true;
+	end = pos + length;
+	first = FindPiece(table, pos);
+	last = FindPiece(table, end - 1);
+
+	/* The parts of the first and last pieces outside the range stay.  */
+	pieces = table->pieces;
+	numKept = 0;
+	if (pieces[first].pos < pos)
+	{
+		kept[numKept].data = pieces[first].data;
+		kept[numKept].pos = pieces[first].pos;
+		kept[numKept].length = pos - pieces[first].pos;
+		numKept++;
+	}
+	if (pieces[last].pos + pieces[last].length > end)
+	{
+		size_t skip = end - pieces[last].pos;
+		kept[numKept].data = pieces[last].data + skip;
+		kept[numKept].pos = pos;
+		kept[numKept].length = pieces[last].length - skip;
+		numKept++;
+	}
+	if (numKept > last - first + 1 && !ReservePieces(table, 1))
+		return false;
+
+	pieces = table->pieces;
+	memmove(&pieces[first + numKept], &pieces[last + 1],
+		(table->numPieces - last - 1) * sizeof(Piece));
+	memcpy(&pieces[first], kept, numKept * sizeof(Piece));
+	table->numPieces = table->numPieces - (last - first + 1) + numKept;
+	for (j = first + numKept; j < table->numPieces; j++)
+		pieces[j].pos -= length;
+	table->size -= length;
+	table->lastPiece = first;
+	return true;
+}
+
+/* Returns the byte at "pos", or zero past the end.  */
+char GetPieceChar(PieceTable* table, size_t pos)
+{
+	const Piece* piece;
+	if (pos >= table->size)
+		return '\0';
+	piece = &table->pieces[FindPiece(table, pos)];
+	return piece->data[pos - piece->pos];
+}
+
+/* Copies up to "length" bytes from "pos" to "dest", stopping at the
+   end of the text.  Returns the number copied.  */
+size_t CopyPieceText(const PieceTable* table, size_t pos, size_t length,
+	char* dest)
+{
+	PieceIter iter;
+	size_t copied = 0;
+	bool more;
+	for (more = BeginPieceIter(table, pos, &iter); more && copied < length;
+		 more = NextPieceIter(&iter))
+	{
+		size_t n = iter.length;
+		if (n > length - copied)
+			n = length - copied;
+		memcpy(dest + copied, iter.data, n);
+		copied += n;
+	}
+	return copied;
+}
+
+/* Returns the "length" bytes from "pos" in one run.  They are read in
+   place if they lie in one piece, and otherwise copied to "scratch",
+   which must have room for them.  */
+const char* GetPieceSpan(PieceTable* table, size_t pos, size_t length,
+	char* scratch)
+{
+	const Piece* piece;
+	if (pos >= table->size || length == 0)
+		return scratch;
+	piece = &table->pieces[FindPiece(table, pos)];
+	if (length <= piece->pos + piece->length - pos)
+		return piece->data + (pos - piece->pos);
+	CopyPieceText(table, pos, length, scratch);
+	return scratch;
+}
+
+/* Points "iter" at the run of text that starts at "pos".  Returns
+   false if "pos" is at or past the end.  */
+bool BeginPieceIter(const PieceTable* table, size_t pos, PieceIter* iter)
+{
+	const Piece* piece;
+	iter->table = table;
+	iter->pos = pos;
+	iter->data = NULL;
+	iter->length = 0;
+	if (pos >= table->size)
+		return false;
+	iter->piece = SearchPiece(table, pos);
+	piece = &table->pieces[iter->piece];
+	iter->data = piece->data + (pos - piece->pos);
+	iter->length = piece->length - (pos - piece->pos);
+	return true;
+}
+
+/* Moves "iter" to the next run.  Returns false at the end of the
+   text.  */
+bool NextPieceIter(PieceIter* iter)
+{
+	const Piece* piece;
+	iter->pos += iter->length;
+	iter->data = NULL;
+	iter->length = 0;
+	if (iter->pos >= iter->table->size)
+		return false;
+	iter->piece++;
+	piece = &iter->table->pieces[iter->piece];
+	iter->data = piece->data;
+	iter->length = piece->length;
+	return true;
+}
+
+void FreePieceTable(PieceTable* table)
+{
+	size_t i;
+	if (table == NULL)
+		return;
+	for (i = 0; i < table->numBlocks; i++)
+		free(table->blocks[i]);
+	free(table->blocks);
+	free(table->pieces);
+	free(table);
+}
+
+/* Returns the index of the piece that holds "pos", or the number of
+   pieces if "pos" is at or past the end.  */
+static size_t FindPiece(PieceTable* table, size_t pos)
+{
+	size_t i = table->lastPiece;
+	if (pos >= table->size)
+		return table->numPieces;
+	if (i < table->numPieces && pos >= table->pieces[i].pos)
+	{
+		if (pos - table->pieces[i].pos < table->pieces[i].length)
+			return i;
+		if (i + 1 < table->numPieces &&
+			pos - table->pieces[i + 1].pos < table->pieces[i + 1].length)
+			return ++table->lastPiece;
+	}
+	else if (i > 0 && i <= table->numPieces &&
+		pos >= table->pieces[i - 1].pos)
+		return --table->lastPiece;
+	table->lastPiece = SearchPiece(table, pos);
+	return table->lastPiece;
+}
+
+static size_t SearchPiece(const PieceTable* table, size_t pos)
+{
+	size_t begin = 0, end = table->numPieces;
+	while (begin < end)
+	{
+		size_t mid = begin + (end - begin) / 2;
+		const Piece* piece = &table->pieces[mid];
+		if (piece->pos + piece->length <= pos)
+			begin = mid + 1;
+		else
+			end = mid;
+	}
+	return begin;
+}
+
+/* Makes room for "extra" more pieces.  */
+static bool ReservePieces(PieceTable* table, size_t extra)
+{
+	Piece* pieces;
+	size_t maxPieces;
+	if (table->numPieces + extra <= table->maxPieces)
+		return true;
+	maxPieces = table->maxPieces * 2 + extra + 15;
+	pieces = (Piece*)realloc(table->pieces, maxPieces * sizeof(Piece));
+	if (pieces == NULL)
+		return false;
+	table->pieces = pieces;
+	table->maxPieces = maxPieces;
+	return true;
+}
+
+/* Copies "length" bytes to the end of the add buffer.  Returns where
+   they went, or NULL if out of memory.  */
+static const char* AddText(PieceTable* table, const char* text,
+	size_t length)
+{
+	char* dest;
+	if (table->numBlocks == 0 || table->blockSize - table->blockUsed < length)
+	{
+		char** blocks;
+		size_t size = length > ADD_BLOCK_SIZE ? length : ADD_BLOCK_SIZE;
+		blocks = (char**)realloc(table->blocks,
+			(table->numBlocks + 1) * sizeof(char*));
+		if (blocks == NULL)
+			return NULL;
+		table->blocks = blocks;
+		dest = (char*)malloc(size);
+		if (dest == NULL)
+			return NULL;
+		blocks[table->numBlocks++] = dest;
+		table->blockSize = size;
+		table->blockUsed = 0;
+	}
+	dest = table->blocks[table->numBlocks - 1] + table->blockUsed;
+	memcpy(dest, text, length);
+	table->blockUsed += length;
+	return dest;
+}
@@ -0,0 +1,37 @@
+/* Piece table interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <stddef.h>
+
+typedef struct PieceTable_t PieceTable;
+typedef struct PieceIter_t PieceIter;
+
+/* A run of "length" bytes at "data" that starts at text position
+   "pos".  Any edit to the table invalidates the iterator.  */
+struct PieceIter_t
+{
+	const PieceTable* table;
+	size_t piece;
+	size_t pos;
+	const char* data;
+	size_t length;
+};
+
+PieceTable* CreatePieceTable(const char* original, size_t size);
+size_t PieceTableSize(const PieceTable* table);
+bool InsertPieceText(PieceTable* table, size_t pos, const char* text,
+	size_t length);
+bool DeletePieceText(PieceTable* table, size_t pos, size_t length);
+char GetPieceChar(PieceTable* table, size_t pos);
+size_t CopyPieceText(const PieceTable* table, size_t pos, size_t length,
+	char* dest);
+const char* GetPieceSpan(PieceTable* table, size_t pos, size_t length,
+	char* scratch);
+bool BeginPieceIter(const PieceTable* table, size_t pos, PieceIter* iter);
+bool NextPieceIter(PieceIter* iter);
+void FreePieceTable(PieceTable* table);
+
+#endif /* not PIECETABLE_H */
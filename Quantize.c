@@ -0,0 +1,770 @@
+/* Color quantization */
+/* Reduces full-color artwork to a palette of at most 256 colors and
+   maps every pixel to a palette index.  This is done in three steps,
+   so that several images can share one palette:
+
+   - A histogram counts the pixels of one or more images.  Colors are
+     binned at 6 bits per channel, but each bin also sums the two bits
+     that were dropped, so the mean color of a bin is exact.
+     Histograms of different images (or different threads) can be
+     merged by adding them.
+   - Median cut builds the palette from the histogram.  The box with
+     the largest squared error is split along its widest channel, at
+     the cut that leaves the least squared error in the two halves,
+     until there are enough boxes.  Every box becomes the mean color
+     of its pixels.
+   - Remapping finds the nearest palette entry of every pixel.  The
+     color cube is divided into a 16x16x16 grid, and the first color
+     that falls into a cell lists the few palette entries that can be
+     nearest to anything in the cell, so later pixels only compare
+     against those.  Artwork repeats the same colors over and over, so
+     the results are also memoized in a small direct-mapped cache.
+     Optional ordered or error diffusion dithering is applied while
+     remapping.  Single colors are looked up with a k-d tree over the
+     palette instead, which needs no per-image state.  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "PalExpand.h"
+#include "Quantize.h"
+
+#define HIST_BITS	6
+#define HIST_SHIFT	(8 - HIST_BITS)
+#define HIST_SIZE	(1L << (HIST_BITS * 3))
+#define HIST_INDEX(c) \
+	((((c) >> (16 + HIST_SHIFT)) & 0x3f) << 12 | \
+	 (((c) >> (8 + HIST_SHIFT)) & 0x3f) << 6 | \
+	 (((c) >> HIST_SHIFT) & 0x3f))
+
+/* Size of the nearest color cache, a power of two.  */
+#define CACHE_BITS	12
+#define CACHE_SIZE	(1 << CACHE_BITS)
+#define CACHE_EMPTY	0xffffffffUL
+
+/* The lookup grid has 16 cells per channel.  */
+#define GRID_BITS	4
+#define GRID_SHIFT	(8 - GRID_BITS)
+#define GRID_CELLS	(1 << (GRID_BITS * 3))
+
+typedef struct HistBin_t HistBin;
+typedef struct HistEntry_t HistEntry;
+typedef struct QuantBox_t QuantBox;
+typedef struct ColorCache_t ColorCache;
+
+struct HistBin_t
+{
+	unsigned long count;
+	unsigned long low[3]; /* Sums of the dropped bits of red, green,
+							 and blue */
+};
+
+struct ColorHist_t
+{
+	HistBin* bins;
+	unsigned long total;
+};
+
+/* A populated histogram bin, as used by median cut.  */
+struct HistEntry_t
+{
+	unsigned char pos[3]; /* Bin coordinates */
+	double count;
+	double mean[3];
+};
+
+struct QuantBox_t
+{
+	unsigned start, end; /* Range of entries */
+	double count;
+	double sum[3];
+	double sumSq[3];
+	double error; /* Sum of squared distances from the mean */
+};
+
+/* Per-image lookup state.  Each grid cell lists the palette entries
+   that can be nearest to some color inside the cell, and is filled in
+   the first time a color falls into it.  */
+struct ColorCache_t
+{
+	unsigned long keys[CACHE_SIZE];
+	unsigned char values[CACHE_SIZE];
+	long cellStart[GRID_CELLS]; /* Into "lists", or -1 if not filled */
+	unsigned short cellCount[GRID_CELLS];
+	unsigned char lists[GRID_CELLS * 256];
+	long listsUsed;
+};
+
+static void MeasureBox(QuantBox* box, const HistEntry* entries);
+static bool SplitBox(QuantBox* box, QuantBox* newBox, HistEntry* entries,
+	HistEntry* temp);
+static int BuildKdTree(ColorMap* map, unsigned char* order, unsigned count,
+	unsigned* numNodes);
+static void SearchKdTree(const ColorMap* map, int node, const int* color,
+	unsigned* best, long* bestDist);
+static unsigned CachedNearest(const ColorMap* map, ColorCache* cache,
+	int r, int g, int b);
+static void FillGridCell(const ColorMap* map, ColorCache* cache,
+	unsigned cell);
+
+/* Threshold matrix for ordered dithering, values from 0 to 63.  */
+static const unsigned char bayer8[8][8] =
+{
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+void InitQuantOptions(QuantOptions* opts)
+{
+	opts->maxColors = 256;
+	opts->dither = QUANT_DITHER_DIFFUSE;
+}
+
+/* Creates an empty histogram.  Returns NULL if out of memory.  */
+ColorHist* CreateColorHist(void)
+{
+	ColorHist* hist = (ColorHist*)malloc(sizeof(ColorHist));
+	if (hist == NULL)
+		return NULL;
+	hist->bins = (HistBin*)calloc(HIST_SIZE, sizeof(HistBin));
+	if (hist->bins == NULL)
+	{
+		free(hist);
+		return NULL;
+	}
+	hist->total = 0;
+	return hist;
+}
+
+/* Counts the pixels of an image.  "stride" is in bytes.  */
+void AddColorHist(ColorHist* hist, const PalColor* pixels, unsigned width,
+	unsigned height, size_t stride)
+{
+	unsigned x, y;
+	for (y = 0; y < height; y++)
+	{
+		const PalColor* row = (const PalColor*)
+			((const unsigned char*)pixels + y * stride);
+		for (x = 0; x < width; x++)
+		{
+			PalColor c = row[x];
+			HistBin* bin = &hist->bins[HIST_INDEX(c)];
+			bin->count++;
+			bin->low[0] += (c >> 16) & 3;
+			bin->low[1] += (c >> 8) & 3;
+			bin->low[2] += c & 3;
+		}
+	}
+	hist->total += (unsigned long)width * height;
+}
+
+/* Adds the counts of "src" to "dest".  */
+void MergeColorHist(ColorHist* dest, const ColorHist* src)
+{
+	long i;
+	for (i = 0; i < HIST_SIZE; i++)
+	{
+		const HistBin* s = &src->bins[i];
+		HistBin* d;
+		if (s->count == 0)
+			continue;
+		d = &dest->bins[i];
+		d->count += s->count;
+		d->low[0] += s->low[0];
+		d->low[1] += s->low[1];
+		d->low[2] += s->low[2];
+	}
+	dest->total += src->total;
+}
+
+/* Returns the number of pixels counted.  */
+unsigned long ColorHistTotal(const ColorHist* hist)
+{
+	return hist->total;
+}
+
+/* Builds a palette of at most "maxColors" colors for the pixels of the
+   histogram with median cut.  An empty histogram gives a single black
+   entry.  Returns an MhkError code.  */
+int BuildHistPalette(const ColorHist* hist, unsigned maxColors,
+	unsigned long* palette, unsigned* numColors)
+{
+	HistEntry* entries;
+	HistEntry* temp;
+	QuantBox boxes[256];
+	unsigned numEntries = 0;
+	unsigned numBoxes;
+	unsigned i;
+	long b;
+
+	if (maxColors == 0 || maxColors > 256)
+		maxColors = 256;
+	for (b = 0; b < HIST_SIZE; b++)
+	{
+		if (hist->bins[b].count != 0)
+			numEntries++;
+	}
+	if (numEntries == 0)
+	{
+		palette[0] = 0;
+		*numColors = 1;
+		return MHK_OK;
+	}
+
+	entries = (HistEntry*)malloc(numEntries * sizeof(HistEntry));
+	temp = (HistEntry*)malloc(numEntries * sizeof(HistEntry));
+	if (entries == NULL || temp == NULL)
+	{
+		free(entries);
+		free(temp);
+		return MHK_ENOMEM;
+	}
+	for (b = 0, i = 0; b < HIST_SIZE; b++)
+	{
+		const HistBin* bin = &hist->bins[b];
+		HistEntry* e;
+		unsigned c;
+		if (bin->count == 0)
+			continue;
+		e = &entries[i++];
+		e->pos[0] = (unsigned char)(b >> 12);
+		e->pos[1] = (unsigned char)((b >> 6) & 0x3f);
+		e->pos[2] = (unsigned char)(b & 0x3f);
+		e->count = (double)bin->count;
+		for (c = 0; c < 3; c++)
+			e->mean[c] = (e->pos[c] << HIST_SHIFT) +
+				(double)bin->low[c] / e->count;
+	}
+
+	boxes[0].start = 0;
+	boxes[0].end = numEntries;
+	MeasureBox(&boxes[0], entries);
+	numBoxes = 1;
+	while (numBoxes < maxColors)
+	{
+		/* Split the box with the largest error.  */
+		int worst = -1;
+		for (i = 0; i < numBoxes; i++)
+		{
+			if (boxes[i].end - boxes[i].start > 1 && boxes[i].error > 0 &&
+				(worst < 0 || boxes[i].error > boxes[worst].error))
+				worst = i;
+		}
+		if (worst < 0)
+			break;
+		if (SplitBox(&boxes[worst], &boxes[numBoxes], entries, temp))
+			numBoxes++;
+		else
+			boxes[worst].error = 0; /* Don't try it again */
+	}
+
+	for (i = 0; i < numBoxes; i++)
+	{
+		unsigned long color = 0;
+		unsigned c;
+		for (c = 0; c < 3; c++)
+		{
+			unsigned value = (unsigned)(boxes[i].sum[c] / boxes[i].count + 0.5);
+			if (value > 255)
+				value = 255;
+			color = (color << 8) | value;
+		}
+		palette[i] = color;
+	}
+	*numColors = numBoxes;
+	free(entries);
+	free(temp);
+	return MHK_OK;
+}
+
+void FreeColorHist(ColorHist* hist)
+{
+	if (hist == NULL)
+		return;
+	free(hist->bins);
+	free(hist);
+}
+
+/* Computes the totals of a box from its entries.  */
+static void MeasureBox(QuantBox* box, const HistEntry* entries)
+{
+	unsigned i, c;
+	box->count = 0;
+	for (c = 0; c < 3; c++)
+		box->sum[c] = box->sumSq[c] = 0;
+	for (i = box->start; i < box->end; i++)
+	{
+		const HistEntry* e = &entries[i];
+		box->count += e->count;
+		for (c = 0; c < 3; c++)
+		{
+			box->sum[c] += e->count * e->mean[c];
+			box->sumSq[c] += e->count * e->mean[c] * e->mean[c];
+		}
+	}
+	box->error = 0;
+	for (c = 0; c < 3; c++)
+		box->error += box->sumSq[c] - box->sum[c] * box->sum[c] / box->count;
+}
+
+/* Splits "box" in two along the channel with the largest variance.
+   The entries are sorted along that channel with a counting sort,
+   and the cut that minimizes the error of the two halves is chosen.
+   Returns false if the box cannot be split.  */
+static bool SplitBox(QuantBox* box, QuantBox* newBox, HistEntry* entries,
+	HistEntry* temp)
+{
+	unsigned starts[64 + 1];
+	unsigned axis = 0;
+	double bestVar = -1;
+	double left[3], leftCount = 0;
+	double bestScore = -1;
+	unsigned bestCut = 0;
+	unsigned i, c, v;
+
+	for (c = 0; c < 3; c++)
+	{
+		double var = box->sumSq[c] - box->sum[c] * box->sum[c] / box->count;
+		if (var > bestVar)
+		{
+			bestVar = var;
+			axis = c;
+		}
+	}
+
+	/* Counting sort on the bin coordinate.  */
+	memset(starts, 0, sizeof(starts));
+	for (i = box->start; i < box->end; i++)
+		starts[entries[i].pos[axis] + 1]++;
+	for (v = 1; v <= 64; v++)
+		starts[v] += starts[v-1];
+	for (i = box->start; i < box->end; i++)
+		temp[box->start + starts[entries[i].pos[axis]]++] = entries[i];
+	memcpy(entries + box->start, temp + box->start,
+		   (box->end - box->start) * sizeof(HistEntry));
+
+	/* Try every cut between two different coordinates.  Minimizing
+	   the error of the halves is the same as maximizing the sum of
+	   sum^2 / count over both halves.  */
+	left[0] = left[1] = left[2] = 0;
+	for (i = box->start; i < box->end - 1; i++)
+	{
+		const HistEntry* e = &entries[i];
+		double score = 0;
+		double rightCount;
+		leftCount += e->count;
+		for (c = 0; c < 3; c++)
+			left[c] += e->count * e->mean[c];
+		if (e->pos[axis] == entries[i+1].pos[axis])
+			continue;
+		rightCount = box->count - leftCount;
+		for (c = 0; c < 3; c++)
+		{
+			double right = box->sum[c] - left[c];
+			score += left[c] * left[c] / leftCount +
+				right * right / rightCount;
+		}
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestCut = i + 1;
+		}
+	}
+	if (bestCut == 0)
+		return false; /* All entries have the same coordinate */
+
+	newBox->start = bestCut;
+	newBox->end = box->end;
+	box->end = bestCut;
+	MeasureBox(box, entries);
+	MeasureBox(newBox, entries);
+	return true;
+}
+
+/* Prepares a color map for a palette.  Returns false if the palette
+   is empty.  */
+bool InitColorMap(ColorMap* map, const unsigned long* palette,
+	unsigned numColors)
+{
+	unsigned char order[256];
+	unsigned numNodes = 0;
+	unsigned i;
+
+	if (numColors == 0)
+		return false;
+	if (numColors > 256)
+		numColors = 256;
+	map->numColors = numColors;
+	for (i = 0; i < numColors; i++)
+	{
+		map->comps[i][0] = (unsigned char)(palette[i] >> 16);
+		map->comps[i][1] = (unsigned char)(palette[i] >> 8);
+		map->comps[i][2] = (unsigned char)palette[i];
+		order[i] = (unsigned char)i;
+	}
+	map->root = BuildKdTree(map, order, numColors, &numNodes);
+	return true;
+}
+
+/* Returns the index of the palette entry closest to "color" by
+   squared distance.  */
+unsigned NearestColor(const ColorMap* map, PalColor color)
+{
+	int comps[3];
+	unsigned best = 0;
+	long bestDist = 0x7fffffffL;
+	comps[0] = (color >> 16) & 0xff;
+	comps[1] = (color >> 8) & 0xff;
+	comps[2] = color & 0xff;
+	SearchKdTree(map, map->root, comps, &best, &bestDist);
+	return best;
+}
+
+/* A plain search over every palette entry, for comparison.  */
+unsigned NearestColorNaive(const ColorMap* map, PalColor color)
+{
+	int r = (color >> 16) & 0xff;
+	int g = (color >> 8) & 0xff;
+	int b = color & 0xff;
+	unsigned best = 0;
+	long bestDist = 0x7fffffffL;
+	unsigned i;
+	for (i = 0; i < map->numColors; i++)
+	{
+		long dr = r - map->comps[i][0];
+		long dg = g - map->comps[i][1];
+		long db = b - map->comps[i][2];
+		long dist = dr * dr + dg * dg + db * db;
+		if (dist < bestDist)
+		{
+			bestDist = dist;
+			best = i;
+		}
+	}
+	return best;
+}
+
+/* Maps an image to palette indices, with the given QuantDither mode.
+   "stride" is in bytes.  Returns an MhkError code.  */
+int RemapImage(const ColorMap* map, const PalColor* pixels, unsigned width,
+	unsigned height, size_t stride, int dither, unsigned char* indices,
+	size_t indexStride)
+{
+	ColorCache* cache;
+	int* errors = NULL; /* Two rows of red, green, blue errors */
+	int spread = 0;
+	unsigned x, y;
+
+	cache = (ColorCache*)malloc(sizeof(ColorCache));
+	if (cache == NULL)
+		return MHK_ENOMEM;
+	for (x = 0; x < CACHE_SIZE; x++)
+		cache->keys[x] = CACHE_EMPTY;
+	for (x = 0; x < GRID_CELLS; x++)
+		cache->cellStart[x] = -1;
+	cache->listsUsed = 0;
+
+	if (dither == QUANT_DITHER_DIFFUSE)
+	{
+		/* One extra pixel on both ends saves the edge checks.  */
+		errors = (int*)calloc((width + 2) * 3 * 2, sizeof(int));
+		if (errors == NULL)
+		{
+			free(cache);
+			return MHK_ENOMEM;
+		}
+	}
+	else if (dither == QUANT_DITHER_ORDERED)
+	{
+		/* Scale the threshold to the spacing that the palette would
+		   have if it was spread evenly over the color cube.  */
+		unsigned n = 1;
+		while ((n + 1) * (n + 1) * (n + 1) <= map->numColors)
+			n++;
+		spread = 256 / n;
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		const PalColor* row = (const PalColor*)
+			((const unsigned char*)pixels + y * stride);
+		unsigned char* out = indices + y * indexStride;
+
+		if (dither == QUANT_DITHER_DIFFUSE)
+		{
+			/* Serpentine scan: every other row goes right to left, so
+			   the error does not pile up on one side.  */
+			int* cur = errors + ((y & 1) ? (width + 2) * 3 : 0);
+			int* next = errors + ((y & 1) ? 0 : (width + 2) * 3);
+			int dir = (y & 1) ? -1 : 1;
+			unsigned i;
+			memset(next, 0, (width + 2) * 3 * sizeof(int));
+			for (i = 0; i < width; i++)
+			{
+				unsigned px = (dir > 0) ? i : width - 1 - i;
+				int* e = cur + (px + 1) * 3;
+				int* n = next + (px + 1) * 3;
+				int comps[3];
+				unsigned index;
+				int c;
+				comps[0] = (int)((row[px] >> 16) & 0xff);
+				comps[1] = (int)((row[px] >> 8) & 0xff);
+				comps[2] = (int)(row[px] & 0xff);
+				for (c = 0; c < 3; c++)
+				{
+					/* Errors are kept in sixteenths.  */
+					comps[c] += (e[c] + 8) >> 4;
+					if (comps[c] < 0)
+						comps[c] = 0;
+					else if (comps[c] > 255)
+						comps[c] = 255;
+				}
+				index = CachedNearest(map, cache, comps[0], comps[1],
+									  comps[2]);
+				out[px] = (unsigned char)index;
+				for (c = 0; c < 3; c++)
+				{
+					int err = comps[c] - map->comps[index][c];
+					e[dir * 3 + c] += err * 7;
+					n[-dir * 3 + c] += err * 3;
+					n[c] += err * 5;
+					n[dir * 3 + c] += err;
+				}
+			}
+			continue;
+		}
+
+		for (x = 0; x < width; x++)
+		{
+			int r = (int)((row[x] >> 16) & 0xff);
+			int g = (int)((row[x] >> 8) & 0xff);
+			int b = (int)(row[x] & 0xff);
+			if (dither == QUANT_DITHER_ORDERED)
+			{
+				int offset = (2 * bayer8[y & 7][x & 7] - 63) * spread / 128;
+				r += offset;
+				g += offset;
+				b += offset;
+				r = (r < 0) ? 0 : (r > 255) ? 255 : r;
+				g = (g < 0) ? 0 : (g > 255) ? 255 : g;
+				b = (b < 0) ? 0 : (b > 255) ? 255 : b;
+			}
+			out[x] = (unsigned char)CachedNearest(map, cache, r, g, b);
+		}
+	}
+
+	free(errors);
+	free(cache);
+	return MHK_OK;
+}
+
+/* Quantizes a single image to its own palette.  Returns an MhkError
+   code.  */
+int QuantizeImage(const PalColor* pixels, unsigned width, unsigned height,
+	size_t stride, const QuantOptions* opts, unsigned long* palette,
+	unsigned* numColors, unsigned char* indices, size_t indexStride)
+{
+	ColorHist* hist;
+	ColorMap map;
+	int error;
+
+	hist = CreateColorHist();
+	if (hist == NULL)
+		return MHK_ENOMEM;
+	AddColorHist(hist, pixels, width, height, stride);
+	error = BuildHistPalette(hist, opts->maxColors, palette, numColors);
+	FreeColorHist(hist);
+	if (error != MHK_OK)
+		return error;
+	InitColorMap(&map, palette, *numColors);
+	return RemapImage(&map, pixels, width, height, stride, opts->dither,
+					  indices, indexStride);
+}
+
+/* Builds the subtree over the palette entries in "order" and returns
+   its node, or -1 if "count" is zero.  Each node splits its entries
+   at the median of the channel with the widest range.  */
+static int BuildKdTree(ColorMap* map, unsigned char* order, unsigned count,
+	unsigned* numNodes)
+{
+	unsigned char lo[3] = { 255, 255, 255 };
+	unsigned char hi[3] = { 0, 0, 0 };
+	unsigned axis = 0;
+	unsigned mid;
+	unsigned i, j, c;
+	int node;
+
+	if (count == 0)
+		return -1;
+	for (i = 0; i < count; i++)
+	{
+		for (c = 0; c < 3; c++)
+		{
+			unsigned char v = map->comps[order[i]][c];
+			if (v < lo[c])
+				lo[c] = v;
+			if (v > hi[c])
+				hi[c] = v;
+		}
+	}
+	for (c = 1; c < 3; c++)
+	{
+		if (hi[c] - lo[c] > hi[axis] - lo[axis])
+			axis = c;
+	}
+	/* Insertion sort is fine for at most 256 entries.  */
+	for (i = 1; i < count; i++)
+	{
+		unsigned char entry = order[i];
+		unsigned char v = map->comps[entry][axis];
+		for (j = i; j > 0 && map->comps[order[j-1]][axis] > v; j--)
+			order[j] = order[j-1];
+		order[j] = entry;
+	}
+
+	mid = count / 2;
+	node = (*numNodes)++;
+	map->nodes[node].index = order[mid];
+	map->nodes[node].axis = (unsigned char)axis;
+	map->nodes[node].left = (short)BuildKdTree(map, order, mid, numNodes);
+	map->nodes[node].right = (short)BuildKdTree(map, order + mid + 1,
+		count - mid - 1, numNodes);
+	return node;
+}
+
+static void SearchKdTree(const ColorMap* map, int node, const int* color,
+	unsigned* best, long* bestDist)
+{
+	while (node >= 0)
+	{
+		const ColorMapNode* n = &map->nodes[node];
+		const unsigned char* comps = map->comps[n->index];
+		long dr = color[0] - comps[0];
+		long dg = color[1] - comps[1];
+		long db = color[2] - comps[2];
+		long dist = dr * dr + dg * dg + db * db;
+		long diff = color[n->axis] - comps[n->axis];
+		int near, far;
+
+		if (dist < *bestDist ||
+			(dist == *bestDist && n->index < *best))
+		{
+			*bestDist = dist;
+			*best = n->index;
+		}
+		if (diff < 0)
+		{
+			near = n->left;
+			far = n->right;
+		}
+		else
+		{
+			near = n->right;
+			far = n->left;
+		}
+		SearchKdTree(map, near, color, best, bestDist);
+		/* Only visit the far side if it could hold something as
+		   close.  */
+		if (diff * diff > *bestDist)
+			break;
+		node = far;
+	}
+}
+
+static unsigned CachedNearest(const ColorMap* map, ColorCache* cache,
+	int r, int g, int b)
+{
+	unsigned long key = ((unsigned long)r << 16) | (g << 8) | b;
+	unsigned slot = (unsigned)((key * 2654435761UL) & 0xffffffffUL) >>
+		(32 - CACHE_BITS);
+	unsigned cell = ((unsigned)r >> GRID_SHIFT) << (GRID_BITS * 2) |
+		((unsigned)g >> GRID_SHIFT) << GRID_BITS | ((unsigned)b >> GRID_SHIFT);
+	const unsigned char* list;
+	unsigned count;
+	unsigned best = 0;
+	long bestDist = 0x7fffffffL;
+	unsigned i;
+
+	if (cache->keys[slot] == key)
+		return cache->values[slot];
+	if (cache->cellStart[cell] < 0)
+		FillGridCell(map, cache, cell);
+	list = cache->lists + cache->cellStart[cell];
+	count = cache->cellCount[cell];
+	/* The list is in palette order, so ties go to the lowest index
+	   like in the other searches.  */
+	for (i = 0; i < count; i++)
+	{
+		const unsigned char* comps = map->comps[list[i]];
+		long dr = r - comps[0];
+		long dg = g - comps[1];
+		long db = b - comps[2];
+		long dist = dr * dr + dg * dg + db * db;
+		if (dist < bestDist)
+		{
+			bestDist = dist;
+			best = list[i];
+		}
+	}
+	cache->keys[slot] = key;
+	cache->values[slot] = (unsigned char)best;
+	return best;
+}
+
+/* Lists the palette entries that may be nearest to some color of a
+   grid cell: those whose smallest distance to the cell is no larger
+   than the smallest of the largest distances of all entries.  */
+static void FillGridCell(const ColorMap* map, ColorCache* cache,
+	unsigned cell)
+{
+	int lo[3], hi[3];
+	long minDist[256];
+	long limit = 0x7fffffffL;
+	unsigned char* list = cache->lists + cache->listsUsed;
+	unsigned count = 0;
+	unsigned i, c;
+
+	lo[0] = (int)(cell >> (GRID_BITS * 2)) << GRID_SHIFT;
+	lo[1] = (int)((cell >> GRID_BITS) & ((1 << GRID_BITS) - 1)) << GRID_SHIFT;
+	lo[2] = (int)(cell & ((1 << GRID_BITS) - 1)) << GRID_SHIFT;
+	for (c = 0; c < 3; c++)
+		hi[c] = lo[c] + (1 << GRID_SHIFT) - 1;
+
+	for (i = 0; i < map->numColors; i++)
+	{
+		long nearDist = 0, farDist = 0;
+		for (c = 0; c < 3; c++)
+		{
+			int v = map->comps[i][c];
+			long d;
+			if (v < lo[c])
+				d = lo[c] - v;
+			else if (v > hi[c])
+				d = v - hi[c];
+			else
+				d = 0;
+			nearDist += d * d;
+			d = (v - lo[c] > hi[c] - v) ? v - lo[c] : hi[c] - v;
+			farDist += d * d;
+		}
+		minDist[i] = nearDist;
+		if (farDist < limit)
+			limit = farDist;
+	}
+	for (i = 0; i < map->numColors; i++)
+	{
+		if (minDist[i] <= limit)
+			list[count++] = (unsigned char)i;
+	}
+	cache->cellStart[cell] = cache->listsUsed;
+	cache->cellCount[cell] = (unsigned short)count;
+	cache->listsUsed += count;
+}
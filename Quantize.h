@@ -0,0 +1,68 @@
+/* Color quantization interface */
+/* Include "bool.h" and "PalExpand.h" before this header.  */
+
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stddef.h>
+
+enum QuantDither
+{
+	QUANT_DITHER_NONE,
+	QUANT_DITHER_ORDERED, /* 8x8 Bayer matrix */
+	QUANT_DITHER_DIFFUSE /* Floyd-Steinberg error diffusion */
+};
+
+typedef struct ColorHist_t ColorHist;
+typedef struct ColorMapNode_t ColorMapNode;
+typedef struct ColorMap_t ColorMap;
+typedef struct QuantOptions_t QuantOptions;
+
+/* A node of the k-d tree over the palette.  */
+struct ColorMapNode_t
+{
+	unsigned char index; /* Palette entry at this node */
+	unsigned char axis; /* 0 = red, 1 = green, 2 = blue */
+	short left, right; /* Child nodes, or -1 */
+};
+
+/* Finds the nearest palette entry of a color.  A color map does not
+   change after InitColorMap(), so several threads may share one.  */
+struct ColorMap_t
+{
+	unsigned numColors;
+	unsigned char comps[256][3]; /* Red, green, and blue of each entry */
+	ColorMapNode nodes[256];
+	int root;
+};
+
+struct QuantOptions_t
+{
+	unsigned maxColors; /* At most 256 */
+	int dither; /* See QuantDither */
+};
+
+void InitQuantOptions(QuantOptions* opts);
+
+ColorHist* CreateColorHist(void);
+void AddColorHist(ColorHist* hist, const PalColor* pixels, unsigned width,
+	unsigned height, size_t stride);
+void MergeColorHist(ColorHist* dest, const ColorHist* src);
+unsigned long ColorHistTotal(const ColorHist* hist);
+int BuildHistPalette(const ColorHist* hist, unsigned maxColors,
+	unsigned long* palette, unsigned* numColors);
+void FreeColorHist(ColorHist* hist);
+
+bool InitColorMap(ColorMap* map, const unsigned long* palette,
+	unsigned numColors);
+unsigned NearestColor(const ColorMap* map, PalColor color);
+unsigned NearestColorNaive(const ColorMap* map, PalColor color);
+int RemapImage(const ColorMap* map, const PalColor* pixels, unsigned width,
+	unsigned height, size_t stride, int dither, unsigned char* indices,
+	size_t indexStride);
+
+int QuantizeImage(const PalColor* pixels, unsigned width, unsigned height,
+	size_t stride, const QuantOptions* opts, unsigned long* palette,
+	unsigned* numColors, unsigned char* indices, size_t indexStride);
+
+#endif /* not QUANTIZE_H */
@@ -0,0 +1,329 @@
+/* Keyed record cache files */
+/* Keeps records that are expensive to compute from resource data,
+   such as thumbnails and sound peaks, in a file so that they survive
+   from one run to the next.  Records are keyed by a hash of the
+   resource data rather than by type and ID.  Changed resources simply
+   get a new key, and the same data in several archives (or several
+   copies of one archive) is only worked on once.
+
+   File layout, all big-endian:
+
+   0	8-byte magic, u16 version, u16 parameter
+   12	Records: u32 data size, u32 FNV-1a hash, u32 Adler-32 hash,
+		the rest of the header as the user of the file defines it,
+		then the data, whose size follows from the header
+
+   Records are only ever appended.  The whole file is scanned when it
+   is opened to build an index in memory; the data is read back when
+   it is asked for.  A damaged tail (say, from a crash while writing)
+   is ignored and overwritten by the next record.  If part of the tail
+   is left past that record, an all-zero record header follows it so
+   that the next scan stops there.  A file with another magic, version,
+   or parameter is started over.
+
+   The cache is not thread-safe.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "RecordCache.h"
+
+#define CACHE_HEADER_SIZE 12
+#define KEY_SIZE 12
+
+typedef struct CacheEntry_t CacheEntry;
+
+struct CacheEntry_t
+{
+	CacheKey key;
+	long offset; /* Of the data, or -1 for an empty slot */
+	unsigned char extra[CACHE_MAX_EXTRA];
+};
+
+struct RecordCache_t
+{
+	FILE* fp;
+	size_t extraSize;
+	CacheDataSizeFunc dataSize;
+	void* sizeParam;
+	long endPos; /* Where the next record goes */
+	long fileEnd; /* Past "endPos" if the file has a stale tail */
+	CacheEntry* entries; /* Open addressing hash table */
+	unsigned tableSize; /* A power of two */
+	unsigned count;
+};
+
+static CacheEntry* FindCacheEntry(const RecordCache* cache,
+	const CacheKey* key);
+static bool AddCacheEntry(RecordCache* cache, const CacheKey* key,
+	long offset, const unsigned char* extra);
+static bool ScanRecordCache(RecordCache* cache, const char* magic,
+	unsigned version, unsigned param);
+
+/* Computes the content key of resource data.  */
+void HashCacheKey(const unsigned char* data, size_t size, CacheKey* key)
+{
+	unsigned long fnv = 2166136261UL;
+	unsigned long a = 1, b = 0;
+	size_t i;
+	for (i = 0; i < size; )
+	{
+		/* Adler-32 sums can go this far before they must be
+		   reduced.  */
+		size_t end = i + 5552;
+		if (end > size)
+			end = size;
+		for (; i < end; i++)
+		{
+			fnv = ((fnv ^ data[i]) * 16777619UL) & 0xffffffffUL;
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	key->size = (unsigned long)size;
+	key->hash1 = fnv;
+	key->hash2 = (b << 16) | a;
+}
+
+/* Opens a cache file, creating it if needed.  "magic" is the 8-byte
+   file signature, and "version" and "param" must match the file for
+   its records to be used.  Record headers have "extraSize" bytes after
+   the key, which "dataSize" is called with, along with "sizeParam", to
+   get the size of the data.  Returns NULL on failure, with an MhkError
+   code in "error" if it is not NULL.  */
+RecordCache* OpenRecordCache(const char* filename, const char* magic,
+	unsigned version, unsigned param, size_t extraSize,
+	CacheDataSizeFunc dataSize, void* sizeParam, int* error)
+{
+	RecordCache* cache = NULL;
+	int result = MHK_EUNSUPPORTED;
+
+	if (extraSize > CACHE_MAX_EXTRA)
+		goto fail;
+	result = MHK_ENOMEM;
+	cache = (RecordCache*)calloc(1, sizeof(RecordCache));
+	if (cache == NULL)
+		goto fail;
+	cache->extraSize = extraSize;
+	cache->dataSize = dataSize;
+	cache->sizeParam = sizeParam;
+	cache->tableSize = 64;
+	cache->entries = (CacheEntry*)malloc(cache->tableSize *
+										 sizeof(CacheEntry));
+	if (cache->entries == NULL)
+		goto fail;
+	memset(cache->entries, 0xff, cache->tableSize * sizeof(CacheEntry));
+
+	result = MHK_EIO;
+	cache->fp = fopen(filename, "r+b");
+	if (cache->fp == NULL || !ScanRecordCache(cache, magic, version, param))
+	{
+		/* Start over with an empty file.  */
+		unsigned char header[CACHE_HEADER_SIZE];
+		if (cache->fp != NULL)
+			fclose(cache->fp);
+		cache->fp = fopen(filename, "w+b");
+		if (cache->fp == NULL)
+			goto fail;
+		memcpy(header, magic, 8);
+		MHK_PUT16(header + 8, version);
+		MHK_PUT16(header + 10, param);
+		if (fwrite(header, CACHE_HEADER_SIZE, 1, cache->fp) != 1 ||
+			fflush(cache->fp) != 0)
+			goto fail;
+		cache->endPos = CACHE_HEADER_SIZE;
+		cache->fileEnd = CACHE_HEADER_SIZE;
+	}
+	if (error != NULL)
+		*error = MHK_OK;
+	return cache;
+
+fail:
+	CloseRecordCache(cache);
+	if (error != NULL)
+		*error = result;
+	return NULL;
+}
+
+/* Returns the header bytes after the key of the record for "key", or
+   NULL if there is none.  */
+const unsigned char* FindCacheRecord(const RecordCache* cache,
+	const CacheKey* key)
+{
+	const CacheEntry* entry = FindCacheEntry(cache, key);
+	if (entry->offset < 0)
+		return NULL;
+	return entry->extra;
+}
+
+/* Reads "size" bytes from "offset" in the data of the record for
+   "key".  Returns false if there is no such record or it cannot be
+   read.  */
+bool ReadCacheData(RecordCache* cache, const CacheKey* key, long offset,
+	void* dst, size_t size)
+{
+	const CacheEntry* entry = FindCacheEntry(cache, key);
+	if (entry->offset < 0 ||
+		fseek(cache->fp, entry->offset + offset, SEEK_SET) != 0)
+		return false;
+	return size == 0 || fread(dst, size, 1, cache->fp) == 1;
+}
+
+/* Appends a record to the cache file, unless there is one for "key"
+   already.  "extra" is the rest of the record header, which the
+   cache's data size function must agree has "size" bytes of data.
+   Returns an MhkError code.  */
+int AppendCacheRecord(RecordCache* cache, const CacheKey* key,
+	const unsigned char* extra, const void* data, size_t size)
+{
+	unsigned char header[KEY_SIZE + CACHE_MAX_EXTRA];
+	long headerSize = KEY_SIZE + (long)cache->extraSize;
+	long newEnd;
+	bool added;
+
+	if (FindCacheEntry(cache, key)->offset >= 0)
+		return MHK_OK;
+	if (size > (size_t)(LONG_MAX - cache->endPos - headerSize))
+		return MHK_EUNSUPPORTED;
+	MHK_PUT32(header, key->size);
+	MHK_PUT32(header + 4, key->hash1);
+	MHK_PUT32(header + 8, key->hash2);
+	memcpy(header + KEY_SIZE, extra, cache->extraSize);
+	if (fseek(cache->fp, cache->endPos, SEEK_SET) != 0 ||
+		fwrite(header, headerSize, 1, cache->fp) != 1 ||
+		(size > 0 && fwrite(data, size, 1, cache->fp) != 1))
+		return MHK_EIO;
+	/* Stdio cannot truncate the file, so end the records with an
+	   invalid header if a stale tail follows.  A shorter tail is too
+	   short to be read as a record anyway.  */
+	newEnd = cache->endPos + headerSize + (long)size;
+	if (cache->fileEnd - newEnd >= headerSize)
+	{
+		memset(header, 0, sizeof(header));
+		if (fwrite(header, headerSize, 1, cache->fp) != 1)
+			return MHK_EIO;
+	}
+	else if (newEnd > cache->fileEnd)
+		cache->fileEnd = newEnd;
+	if (fflush(cache->fp) != 0)
+		return MHK_EIO;
+	/* The record is in the file whether or not it can be indexed.  */
+	added = AddCacheEntry(cache, key, cache->endPos + headerSize, extra);
+	cache->endPos = newEnd;
+	return added ? MHK_OK : MHK_ENOMEM;
+}
+
+/* Returns the number of records in the cache.  */
+unsigned CacheRecordCount(const RecordCache* cache)
+{
+	return cache->count;
+}
+
+void CloseRecordCache(RecordCache* cache)
+{
+	if (cache == NULL)
+		return;
+	if (cache->fp != NULL)
+		fclose(cache->fp);
+	free(cache->entries);
+	free(cache);
+}
+
+/* Returns the slot of "key", or the empty slot where it would go.  */
+static CacheEntry* FindCacheEntry(const RecordCache* cache,
+	const CacheKey* key)
+{
+	unsigned mask = cache->tableSize - 1;
+	unsigned i = (unsigned)(key->hash1 ^ (key->hash2 * 31)) & mask;
+	for (;;)
+	{
+		CacheEntry* entry = &cache->entries[i];
+		if (entry->offset < 0 ||
+			(entry->key.size == key->size &&
+			 entry->key.hash1 == key->hash1 &&
+			 entry->key.hash2 == key->hash2))
+			return entry;
+		i = (i + 1) & mask;
+	}
+}
+
+static bool AddCacheEntry(RecordCache* cache, const CacheKey* key,
+	long offset, const unsigned char* extra)
+{
+	CacheEntry* entry;
+	/* Keep the table at most half full.  */
+	if ((cache->count + 1) * 2 > cache->tableSize)
+	{
+		CacheEntry* oldEntries = cache->entries;
+		unsigned oldSize = cache->tableSize;
+		unsigned i;
+		cache->entries = (CacheEntry*)malloc(oldSize * 2 *
+											 sizeof(CacheEntry));
+		if (cache->entries == NULL)
+		{
+			cache->entries = oldEntries;
+			return false;
+		}
+		cache->tableSize = oldSize * 2;
+		memset(cache->entries, 0xff, cache->tableSize * sizeof(CacheEntry));
+		for (i = 0; i < oldSize; i++)
+		{
+			if (oldEntries[i].offset >= 0)
+				*FindCacheEntry(cache, &oldEntries[i].key) = oldEntries[i];
+		}
+		free(oldEntries);
+	}
+	entry = FindCacheEntry(cache, key);
+	if (entry->offset < 0)
+		cache->count++;
+	entry->key = *key;
+	entry->offset = offset;
+	memcpy(entry->extra, extra, cache->extraSize);
+	return true;
+}
+
+/* Reads the index of an existing cache file.  Returns false if the
+   file does not have the right magic, version, and parameter.  */
+static bool ScanRecordCache(RecordCache* cache, const char* magic,
+	unsigned version, unsigned param)
+{
+	unsigned char buf[KEY_SIZE + CACHE_MAX_EXTRA];
+	long headerSize = KEY_SIZE + (long)cache->extraSize;
+	long fileSize;
+	long pos;
+
+	if (fread(buf, CACHE_HEADER_SIZE, 1, cache->fp) != 1 ||
+		memcmp(buf, magic, 8) != 0 || MHK_GET16(buf + 8) != version ||
+		MHK_GET16(buf + 10) != param || fseek(cache->fp, 0, SEEK_END) != 0)
+		return false;
+	fileSize = ftell(cache->fp);
+	pos = CACHE_HEADER_SIZE;
+	while (pos + headerSize <= fileSize)
+	{
+		CacheKey key;
+		long dataSize;
+		if (fseek(cache->fp, pos, SEEK_SET) != 0 ||
+			fread(buf, headerSize, 1, cache->fp) != 1)
+			break;
+		key.size = MHK_GET32(buf);
+		key.hash1 = MHK_GET32(buf + 4);
+		key.hash2 = MHK_GET32(buf + 8);
+		dataSize = cache->dataSize(buf + KEY_SIZE, cache->sizeParam);
+		if (dataSize < 0 || dataSize > fileSize - pos - headerSize)
+			break;
+		/* A record that cannot be indexed for lack of memory is just
+		   missed, but it still has to be stepped over so that the
+		   next record goes after it.  */
+		AddCacheEntry(cache, &key, pos + headerSize, buf + KEY_SIZE);
+		pos += headerSize + dataSize;
+	}
+	cache->endPos = pos;
+	cache->fileEnd = fileSize;
+	return true;
+}
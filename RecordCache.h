@@ -0,0 +1,43 @@
+/* Keyed record cache file interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef RECORDCACHE_H
+#define RECORDCACHE_H
+
+#include <stddef.h>
+
+#define CACHE_MAX_EXTRA 8 /* Most bytes of a record header after the key */
+
+typedef struct CacheKey_t CacheKey;
+typedef struct RecordCache_t RecordCache;
+
+/* Identifies resource data by content, so that a cached record stays
+   valid when the resource is renamed, renumbered, or moved to another
+   archive.  */
+struct CacheKey_t
+{
+	unsigned long size;
+	unsigned long hash1; /* FNV-1a */
+	unsigned long hash2; /* Adler-32 */
+};
+
+/* Returns the size of the data that follows a record header, given
+   the header bytes after the key, or -1 if they are not valid.  An
+   all-zero header must not be valid.  */
+typedef long (*CacheDataSizeFunc)(const unsigned char* extra, void* param);
+
+void HashCacheKey(const unsigned char* data, size_t size, CacheKey* key);
+
+RecordCache* OpenRecordCache(const char* filename, const char* magic,
+	unsigned version, unsigned param, size_t extraSize,
+	CacheDataSizeFunc dataSize, void* sizeParam, int* error);
+const unsigned char* FindCacheRecord(const RecordCache* cache,
+	const CacheKey* key);
+bool ReadCacheData(RecordCache* cache, const CacheKey* key, long offset,
+	void* dst, size_t size);
+int AppendCacheRecord(RecordCache* cache, const CacheKey* key,
+	const unsigned char* extra, const void* data, size_t size);
+unsigned CacheRecordCount(const RecordCache* cache);
+void CloseRecordCache(RecordCache* cache);
+
+#endif /* not RECORDCACHE_H */
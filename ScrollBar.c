@@ -0,0 +1,31 @@
+/* Scroll bar helper */
+/* Shared by the views that scroll their contents themselves.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "ScrollBar.h"
+
+/* Translates a scroll bar request into a new (unclamped) position.
+   "line" is how far one arrow click moves.  The SB_LEFT and SB_RIGHT
+   families have the same values as SB_TOP and SB_BOTTOM, so this works
+   for either bar.  */
+int ScrollBarPos(HWND hwnd, int bar, int request, int line)
+{
+	SCROLLINFO si;
+	si.cbSize = sizeof(SCROLLINFO);
+	si.fMask = SIF_ALL;
+	GetScrollInfo(hwnd, bar, &si);
+	switch (request)
+	{
+	case SB_TOP: return si.nMin;
+	case SB_BOTTOM: return si.nMax;
+	case SB_LINEUP: return si.nPos - line;
+	case SB_LINEDOWN: return si.nPos + line;
+	case SB_PAGEUP: return si.nPos - (int)si.nPage;
+	case SB_PAGEDOWN: return si.nPos + (int)si.nPage;
+	case SB_THUMBTRACK:
+	case SB_THUMBPOSITION: return si.nTrackPos;
+	}
+	return si.nPos;
+}
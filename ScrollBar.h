@@ -0,0 +1,9 @@
+/* Scroll bar helper interface */
+/* Include windows.h before this header.  */
+
+#ifndef SCROLLBAR_H
+#define SCROLLBAR_H
+
+int ScrollBarPos(HWND hwnd, int bar, int request, int line);
+
+#endif /* not SCROLLBAR_H */
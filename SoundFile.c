@@ -0,0 +1,150 @@
+/* Sound files */
+/* Writes 16-bit PCM WAV files: a RIFF header with a "fmt " chunk and
+   a "data" chunk, all little-endian.  The samples are written as they
+   come, and the sizes in the header are filled in when the file is
+   closed, so a sound never has to be decoded in one piece.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkSound.h"
+#include "SoundFile.h"
+
+#define WAV_HEADER_SIZE 44
+#define WAV_BLOCK_FRAMES 16384 /* Frames decoded and written at a time */
+
+#define PUT16LE(p, v) ((p)[0] = (unsigned char)(v), \
+	(p)[1] = (unsigned char)((v) >> 8))
+#define PUT32LE(p, v) (PUT16LE(p, (v) & 0xffff), PUT16LE((p) + 2, (v) >> 16))
+
+struct WavWriter_t
+{
+	FILE* fp;
+	unsigned numChannels;
+	unsigned sampleRate;
+	unsigned long dataSize;
+	bool failed;
+	unsigned char buf[WAV_BLOCK_FRAMES * 2];
+};
+
+static void FillWavHeader(const WavWriter* wav, unsigned char* header);
+
+/* Creates a WAV file for "numChannels" channels of 16-bit samples.
+   Returns NULL and sets "*error" on failure.  */
+WavWriter* CreateWavFile(const char* filename, unsigned numChannels,
+	unsigned sampleRate, int* error)
+{
+	unsigned char header[WAV_HEADER_SIZE];
+	WavWriter* wav = (WavWriter*)malloc(sizeof(WavWriter));
+
+	if (wav == NULL)
+	{
+		*error = MHK_ENOMEM;
+		return NULL;
+	}
+	wav->numChannels = numChannels;
+	wav->sampleRate = sampleRate;
+	wav->dataSize = 0;
+	wav->failed = false;
+	wav->fp = fopen(filename, "wb");
+	if (wav->fp == NULL)
+	{
+		free(wav);
+		*error = MHK_EIO;
+		return NULL;
+	}
+	/* Written again with the real sizes on closing.  */
+	FillWavHeader(wav, header);
+	if (fwrite(header, 1, WAV_HEADER_SIZE, wav->fp) != WAV_HEADER_SIZE)
+		wav->failed = true;
+	return wav;
+}
+
+/* Appends interleaved samples.  Returns an MhkError code.  */
+int WriteWavSamples(WavWriter* wav, const short* samples, size_t numFrames)
+{
+	size_t numSamples = numFrames * wav->numChannels;
+
+	while (numSamples > 0 && !wav->failed)
+	{
+		size_t count = sizeof(wav->buf) / 2;
+		size_t i;
+		if (count > numSamples)
+			count = numSamples;
+		for (i = 0; i < count; i++)
+			PUT16LE(wav->buf + i * 2, (unsigned)samples[i] & 0xffff);
+		if (fwrite(wav->buf, 2, count, wav->fp) != count)
+			wav->failed = true;
+		wav->dataSize += (unsigned long)count * 2;
+		samples += count;
+		numSamples -= count;
+	}
+	return wav->failed ? MHK_EIO : MHK_OK;
+}
+
+/* Finishes the header and closes the file.  Returns an MhkError code
+   for the file as a whole.  */
+int CloseWavFile(WavWriter* wav)
+{
+	unsigned char header[WAV_HEADER_SIZE];
+	bool ok = !wav->failed;
+
+	FillWavHeader(wav, header);
+	if (ok && (fseek(wav->fp, 0, SEEK_SET) != 0 ||
+		fwrite(header, 1, WAV_HEADER_SIZE, wav->fp) != WAV_HEADER_SIZE))
+		ok = false;
+	if (fclose(wav->fp) != 0)
+		ok = false;
+	free(wav);
+	return ok ? MHK_OK : MHK_EIO;
+}
+
+/* Decodes a whole sound into a WAV file, a block at a time.  Returns
+   an MhkError code.  */
+int ExportSoundWav(const MhkSound* snd, const char* filename)
+{
+	SoundDecoder dec;
+	WavWriter* wav;
+	short* block;
+	size_t count;
+	int error = MHK_OK;
+
+	block = (short*)malloc(WAV_BLOCK_FRAMES * SND_MAX_CHANNELS *
+		sizeof(short));
+	if (block == NULL)
+		return MHK_ENOMEM;
+	wav = CreateWavFile(filename, snd->numChannels, snd->sampleRate, &error);
+	if (wav == NULL)
+	{
+		free(block);
+		return error;
+	}
+	InitSoundDecoder(&dec, snd);
+	while (error == MHK_OK &&
+		   (count = DecodeSound(&dec, block, WAV_BLOCK_FRAMES)) > 0)
+		error = WriteWavSamples(wav, block, count);
+	if (CloseWavFile(wav) != MHK_OK && error == MHK_OK)
+		error = MHK_EIO;
+	free(block);
+	return error;
+}
+
+static void FillWavHeader(const WavWriter* wav, unsigned char* header)
+{
+	unsigned blockAlign = wav->numChannels * 2;
+	header[0] = 'R'; header[1] = 'I'; header[2] = 'F'; header[3] = 'F';
+	PUT32LE(header + 4, WAV_HEADER_SIZE - 8 + wav->dataSize);
+	header[8] = 'W'; header[9] = 'A'; header[10] = 'V'; header[11] = 'E';
+	header[12] = 'f'; header[13] = 'm'; header[14] = 't'; header[15] = ' ';
+	PUT32LE(header + 16, 16);
+	PUT16LE(header + 20, 1); /* WAVE_FORMAT_PCM */
+	PUT16LE(header + 22, wav->numChannels);
+	PUT32LE(header + 24, wav->sampleRate);
+	PUT32LE(header + 28, (unsigned long)wav->sampleRate * blockAlign);
+	PUT16LE(header + 32, blockAlign);
+	PUT16LE(header + 34, 16);
+	header[36] = 'd'; header[37] = 'a'; header[38] = 't'; header[39] = 'a';
+	PUT32LE(header + 40, wav->dataSize);
+}
@@ -0,0 +1,17 @@
+/* Sound file interface */
+/* Include "bool.h" and "MhkSound.h" before this header.  */
+
+#ifndef SOUNDFILE_H
+#define SOUNDFILE_H
+
+#include <stddef.h>
+
+typedef struct WavWriter_t WavWriter;
+
+WavWriter* CreateWavFile(const char* filename, unsigned numChannels,
+	unsigned sampleRate, int* error);
+int WriteWavSamples(WavWriter* wav, const short* samples, size_t numFrames);
+int CloseWavFile(WavWriter* wav);
+int ExportSoundWav(const MhkSound* snd, const char* filename);
+
+#endif /* not SOUNDFILE_H */
@@ -0,0 +1,456 @@
+/* Sound peak pyramid */
+/* Keeps the lowest and highest sample of every bucket of frames, at
+   every power-of-two bucket size, so that a waveform can be drawn at
+   any zoom by reading one bucket per pixel column.  Level 0 buckets
+   cover 2^PEAK_BASE_SHIFT frames, and each level above merges pairs of
+   buckets from the one below.  Closer in than level 0, the samples
+   themselves are decoded again.  Since ADPCM can only be decoded from
+   the start, the decoder state is saved every PEAK_SEEK_FRAMES frames
+   as the pyramid is built, and reading samples starts from the
+   nearest saved state.
+
+   The pyramid is built a piece at a time by BuildSoundPeaks(), which
+   fills every level as far as the frames decoded so far allow.  It can
+   run on a worker thread while another thread draws what is done, as
+   long as the reader only looks at frames that BuildSoundPeaks() has
+   already returned as done and learns of them through some
+   synchronizing call.
+
+   Finished pyramids are kept in a record cache file (see
+   RecordCache.c) next to the thumbnail cache, keyed the same way by
+   the resource contents.  The file has the magic "MHKPEAKS" and
+   PEAK_BASE_SHIFT as its parameter.  The rest of a record header is
+   u32 number of frames, u16 number of channels, and u16 zero.  The
+   data is the decoder states (per channel an s16 predictor and a u16
+   step index), then the buckets of every level from level 0 up (per
+   channel an s16 minimum and an s16 maximum), all big-endian.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "RecordCache.h"
+#include "MhkSound.h"
+#include "SoundPeaks.h"
+
+#define MAX_LEVELS 32
+#define BASE_FRAMES (1UL << PEAK_BASE_SHIFT)
+#define SKIP_FRAMES 512 /* Frames decoded at a time when seeking */
+
+#define CACHE_MAGIC "MHKPEAKS"
+#define CACHE_VERSION 1
+#define EXTRA_SIZE 8 /* Frame count, channel count, and padding */
+
+struct SoundPeaks_t
+{
+	MhkSound snd;
+	unsigned long framesDone;
+	unsigned numLevels;
+	unsigned long counts[MAX_LEVELS]; /* Buckets in each level */
+	unsigned long levelDone[MAX_LEVELS]; /* Buckets filled in */
+	SoundPeak* levels[MAX_LEVELS]; /* Per bucket, one peak per channel */
+	SoundPeak* block; /* Holds all levels */
+	size_t numPeaks;
+	SoundDecoder dec;
+	SoundDecoder* seeks; /* The decoder at every PEAK_SEEK_FRAMES */
+	unsigned long numSeeks;
+	short* chunk; /* PEAK_SEEK_FRAMES frames */
+};
+
+struct PeakCache_t
+{
+	RecordCache* records;
+};
+
+static void ScanChunk(SoundPeaks* peaks, const short* samples,
+	unsigned long numFrames);
+static void MergeLevels(SoundPeaks* peaks);
+static long PeakDataSize(unsigned long numFrames, unsigned numChannels);
+static long PeakRecordSize(const unsigned char* extra, void* param);
+
+/* Creates an empty pyramid for a sound, which must stay in memory
+   until the pyramid is freed.  Returns NULL if the sound is empty or
+   memory runs out.  */
+SoundPeaks* CreateSoundPeaks(const MhkSound* snd)
+{
+	SoundPeaks* peaks;
+	unsigned long count;
+	size_t offset = 0;
+	unsigned i;
+
+	if (snd->numFrames == 0 || snd->numChannels == 0 ||
+		snd->numChannels > SND_MAX_CHANNELS)
+		return NULL;
+	peaks = (SoundPeaks*)calloc(1, sizeof(SoundPeaks));
+	if (peaks == NULL)
+		return NULL;
+	peaks->snd = *snd;
+	InitSoundDecoder(&peaks->dec, &peaks->snd);
+
+	/* The top level is a single bucket.  */
+	count = (snd->numFrames + BASE_FRAMES - 1) >> PEAK_BASE_SHIFT;
+	for (;;)
+	{
+		peaks->counts[peaks->numLevels++] = count;
+		peaks->numPeaks += (size_t)count * snd->numChannels;
+		if (count == 1 || peaks->numLevels == MAX_LEVELS)
+			break;
+		count = (count + 1) / 2;
+	}
+	peaks->numSeeks = (snd->numFrames + PEAK_SEEK_FRAMES - 1) /
+		PEAK_SEEK_FRAMES;
+	peaks->block = (SoundPeak*)malloc(peaks->numPeaks * sizeof(SoundPeak));
+	peaks->seeks = (SoundDecoder*)malloc(peaks->numSeeks *
+										 sizeof(SoundDecoder));
+	peaks->chunk = (short*)malloc((size_t)PEAK_SEEK_FRAMES *
+								  snd->numChannels * sizeof(short));
+	if (peaks->block == NULL || peaks->seeks == NULL || peaks->chunk == NULL)
+	{
+		FreeSoundPeaks(peaks);
+		return NULL;
+	}
+	for (i = 0; i < peaks->numLevels; i++)
+	{
+		peaks->levels[i] = peaks->block + offset;
+		offset += (size_t)peaks->counts[i] * snd->numChannels;
+	}
+	return peaks;
+}
+
+/* Decodes about "maxFrames" more frames, at least one checkpoint's
+   worth, and fills in the buckets that they complete at every level.
+   Frames that cannot be decoded count as silence.  Returns the number
+   of frames done so far, which is the sound's frame count once the
+   pyramid is complete.  */
+unsigned long BuildSoundPeaks(SoundPeaks* peaks, unsigned long maxFrames)
+{
+	unsigned channels = peaks->snd.numChannels;
+	unsigned long end = peaks->framesDone + maxFrames;
+
+	if (end > peaks->snd.numFrames || end < peaks->framesDone)
+		end = peaks->snd.numFrames;
+	do
+	{
+		unsigned long count = peaks->snd.numFrames - peaks->framesDone;
+		size_t got;
+		if (count == 0)
+			break;
+		if (count > PEAK_SEEK_FRAMES)
+			count = PEAK_SEEK_FRAMES;
+		/* Chunks start on checkpoints, so no bucket spans two.  */
+		peaks->seeks[peaks->framesDone / PEAK_SEEK_FRAMES] = peaks->dec;
+		got = DecodeSound(&peaks->dec, peaks->chunk, count);
+		memset(peaks->chunk + got * channels, 0,
+			(count - got) * channels * sizeof(short));
+		ScanChunk(peaks, peaks->chunk, count);
+		peaks->framesDone += count;
+		MergeLevels(peaks);
+	} while (peaks->framesDone < end);
+	return peaks->framesDone;
+}
+
+unsigned PeakLevelCount(const SoundPeaks* peaks)
+{
+	return peaks->numLevels;
+}
+
+/* Returns the buckets of a level, each covering 2^(PEAK_BASE_SHIFT +
+   "level") frames, with one peak per channel.  "*count" gets how many
+   are filled in when "framesDone" frames are done.  */
+const SoundPeak* GetPeakLevel(const SoundPeaks* peaks, unsigned level,
+	unsigned long framesDone, unsigned long* count)
+{
+	if (level >= peaks->numLevels)
+	{
+		*count = 0;
+		return NULL;
+	}
+	if (framesDone >= peaks->snd.numFrames)
+		*count = peaks->counts[level];
+	else
+		*count = framesDone >> (PEAK_BASE_SHIFT + level);
+	return peaks->levels[level];
+}
+
+/* Decodes "numFrames" frames starting at "first" into "dst", starting
+   from the nearest checkpoint.  The frames must be done.  Returns the
+   number of frames decoded.  */
+size_t ReadPeakSamples(const SoundPeaks* peaks, unsigned long first,
+	size_t numFrames, short* dst)
+{
+	short skip[SKIP_FRAMES * SND_MAX_CHANNELS];
+	SoundDecoder dec;
+	unsigned long pos;
+
+	if (first >= peaks->snd.numFrames)
+		return 0;
+	if (numFrames > peaks->snd.numFrames - first)
+		numFrames = peaks->snd.numFrames - first;
+	dec = peaks->seeks[first / PEAK_SEEK_FRAMES];
+	for (pos = dec.frame; pos < first; )
+	{
+		unsigned long count = first - pos;
+		if (count > SKIP_FRAMES)
+			count = SKIP_FRAMES;
+		if (DecodeSound(&dec, skip, count) != count)
+			return 0;
+		pos += count;
+	}
+	return DecodeSound(&dec, dst, numFrames);
+}
+
+void FreeSoundPeaks(SoundPeaks* peaks)
+{
+	if (peaks == NULL)
+		return;
+	free(peaks->block);
+	free(peaks->seeks);
+	free(peaks->chunk);
+	free(peaks);
+}
+
+/* Opens a cache file for peak pyramids, creating it if needed.
+   Returns NULL on failure, with an MhkError code in "error" if it is
+   not NULL.  */
+PeakCache* OpenPeakCache(const char* filename, int* error)
+{
+	PeakCache* cache;
+
+	cache = (PeakCache*)malloc(sizeof(PeakCache));
+	if (cache == NULL)
+	{
+		if (error != NULL)
+			*error = MHK_ENOMEM;
+		return NULL;
+	}
+	cache->records = OpenRecordCache(filename, CACHE_MAGIC, CACHE_VERSION,
+		PEAK_BASE_SHIFT, EXTRA_SIZE, PeakRecordSize, NULL, error);
+	if (cache->records == NULL)
+	{
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+/* Reads the cached pyramid of a sound, which is complete.  Returns
+   NULL if there is none.  */
+SoundPeaks* LookupPeaks(PeakCache* cache, const CacheKey* key,
+	const MhkSound* snd)
+{
+	const unsigned char* extra = FindCacheRecord(cache->records, key);
+	SoundPeaks* peaks;
+	unsigned char* data;
+	const unsigned char* p;
+	long size;
+	size_t i;
+	unsigned c;
+
+	if (extra == NULL || MHK_GET32(extra) != snd->numFrames ||
+		MHK_GET16(extra + 4) != snd->numChannels)
+		return NULL;
+	peaks = CreateSoundPeaks(snd);
+	if (peaks == NULL)
+		return NULL;
+	size = PeakDataSize(snd->numFrames, snd->numChannels);
+	data = (unsigned char*)malloc(size);
+	if (data == NULL ||
+		!ReadCacheData(cache->records, key, 0, data, (size_t)size))
+	{
+		free(data);
+		FreeSoundPeaks(peaks);
+		return NULL;
+	}
+	p = data;
+	for (i = 0; i < peaks->numSeeks; i++)
+	{
+		SoundDecoder* dec = &peaks->seeks[i];
+		*dec = peaks->dec;
+		dec->frame = (unsigned long)i * PEAK_SEEK_FRAMES;
+		for (c = 0; c < snd->numChannels; c++, p += 4)
+		{
+			dec->ima[c].predictor = (short)MHK_GET16(p);
+			dec->ima[c].index = MHK_GET16(p + 2);
+			/* A damaged record is a miss, rather than a step table
+			   lookup out of bounds later.  */
+			if (!ImaStateValid(&dec->ima[c]))
+			{
+				free(data);
+				FreeSoundPeaks(peaks);
+				return NULL;
+			}
+		}
+	}
+	for (i = 0; i < peaks->numPeaks; i++, p += 4)
+	{
+		peaks->block[i].min = (short)MHK_GET16(p);
+		peaks->block[i].max = (short)MHK_GET16(p + 2);
+	}
+	free(data);
+	peaks->framesDone = snd->numFrames;
+	for (i = 0; i < peaks->numLevels; i++)
+		peaks->levelDone[i] = peaks->counts[i];
+	return peaks;
+}
+
+/* Appends a complete pyramid to the cache file.  Returns an MhkError
+   code.  */
+int StorePeaks(PeakCache* cache, const CacheKey* key,
+	const SoundPeaks* peaks)
+{
+	unsigned char extra[EXTRA_SIZE];
+	unsigned char* data;
+	unsigned char* p;
+	long size = PeakDataSize(peaks->snd.numFrames, peaks->snd.numChannels);
+	unsigned channels = peaks->snd.numChannels;
+	size_t i;
+	unsigned c;
+	int error;
+
+	if (peaks->framesDone < peaks->snd.numFrames)
+		return MHK_EUNSUPPORTED;
+	if (FindCacheRecord(cache->records, key) != NULL)
+		return MHK_OK;
+	data = (unsigned char*)malloc(size);
+	if (data == NULL)
+		return MHK_ENOMEM;
+	p = data;
+	for (i = 0; i < peaks->numSeeks; i++)
+	{
+		const SoundDecoder* dec = &peaks->seeks[i];
+		for (c = 0; c < channels; c++, p += 4)
+		{
+			MHK_PUT16(p, (unsigned)dec->ima[c].predictor & 0xffff);
+			MHK_PUT16(p + 2, (unsigned)dec->ima[c].index);
+		}
+	}
+	for (i = 0; i < peaks->numPeaks; i++, p += 4)
+	{
+		MHK_PUT16(p, (unsigned)peaks->block[i].min & 0xffff);
+		MHK_PUT16(p + 2, (unsigned)peaks->block[i].max & 0xffff);
+	}
+
+	MHK_PUT32(extra, peaks->snd.numFrames);
+	MHK_PUT16(extra + 4, channels);
+	MHK_PUT16(extra + 6, 0);
+	error = AppendCacheRecord(cache->records, key, extra, data,
+		(size_t)size);
+	free(data);
+	return error;
+}
+
+void ClosePeakCache(PeakCache* cache)
+{
+	if (cache == NULL)
+		return;
+	CloseRecordCache(cache->records);
+	free(cache);
+}
+
+/* Fills in the level 0 buckets of a chunk that starts on a bucket
+   boundary.  */
+static void ScanChunk(SoundPeaks* peaks, const short* samples,
+	unsigned long numFrames)
+{
+	unsigned channels = peaks->snd.numChannels;
+	SoundPeak* dst = peaks->levels[0] + (size_t)peaks->levelDone[0] *
+		channels;
+	unsigned long start;
+
+	for (start = 0; start < numFrames; start += BASE_FRAMES)
+	{
+		unsigned long end = start + BASE_FRAMES;
+		unsigned c;
+		if (end > numFrames)
+			end = numFrames;
+		for (c = 0; c < channels; c++, dst++)
+		{
+			const short* src = samples + start * channels + c;
+			int lo = *src, hi = *src;
+			unsigned long i;
+			for (i = start + 1; i < end; i++)
+			{
+				src += channels;
+				if (*src < lo)
+					lo = *src;
+				if (*src > hi)
+					hi = *src;
+			}
+			dst->min = (short)lo;
+			dst->max = (short)hi;
+		}
+		peaks->levelDone[0]++;
+	}
+}
+
+/* Fills in the buckets of the upper levels whose halves are both
+   done, or that are the last of their level once everything is.  */
+static void MergeLevels(SoundPeaks* peaks)
+{
+	unsigned channels = peaks->snd.numChannels;
+	bool finished = (peaks->framesDone >= peaks->snd.numFrames);
+	unsigned level;
+
+	for (level = 1; level < peaks->numLevels; level++)
+	{
+		const SoundPeak* below = peaks->levels[level - 1];
+		unsigned long belowCount = peaks->counts[level - 1];
+		unsigned long end = finished ? peaks->counts[level] :
+			peaks->levelDone[level - 1] / 2;
+		unsigned long i;
+		for (i = peaks->levelDone[level]; i < end; i++)
+		{
+			SoundPeak* dst = peaks->levels[level] + (size_t)i * channels;
+			const SoundPeak* a = below + (size_t)i * 2 * channels;
+			unsigned c;
+			for (c = 0; c < channels; c++)
+			{
+				dst[c] = a[c];
+				/* The last bucket may have only one half.  */
+				if (i * 2 + 1 < belowCount)
+				{
+					const SoundPeak* b = a + channels;
+					if (b[c].min < dst[c].min)
+						dst[c].min = b[c].min;
+					if (b[c].max > dst[c].max)
+						dst[c].max = b[c].max;
+				}
+			}
+		}
+		peaks->levelDone[level] = end;
+	}
+}
+
+/* Returns the size of the record data in the cache file for a sound
+   of "numFrames" frames, which is not zero.  */
+static long PeakDataSize(unsigned long numFrames, unsigned numChannels)
+{
+	unsigned long count = (numFrames + BASE_FRAMES - 1) >> PEAK_BASE_SHIFT;
+	unsigned long units = (numFrames + PEAK_SEEK_FRAMES - 1) /
+		PEAK_SEEK_FRAMES;
+	unsigned numLevels = 1;
+	/* The same levels as CreateSoundPeaks() */
+	units += count;
+	while (count > 1 && numLevels < MAX_LEVELS)
+	{
+		count = (count + 1) / 2;
+		units += count;
+		numLevels++;
+	}
+	return (long)(units * numChannels * 4);
+}
+
+/* Returns the data size of a record with the given frame and channel
+   counts, or -1 if they are not valid.  */
+static long PeakRecordSize(const unsigned char* extra, void* param)
+{
+	unsigned long numFrames = MHK_GET32(extra);
+	unsigned numChannels = MHK_GET16(extra + 4);
+	(void)param;
+	if (numFrames == 0 || numChannels == 0 ||
+		numChannels > SND_MAX_CHANNELS)
+		return -1;
+	return PeakDataSize(numFrames, numChannels);
+}
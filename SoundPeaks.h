@@ -0,0 +1,40 @@
+/* Sound peak pyramid interface */
+/* Include "bool.h", "RecordCache.h", and "MhkSound.h" before this
+   header.  */
+
+#ifndef SOUNDPEAKS_H
+#define SOUNDPEAKS_H
+
+#include <stddef.h>
+
+#define PEAK_BASE_SHIFT 6 /* Level 0 buckets cover 64 frames */
+#define PEAK_SEEK_FRAMES 4096 /* Frames between decoder checkpoints */
+
+typedef struct SoundPeak_t SoundPeak;
+typedef struct SoundPeaks_t SoundPeaks;
+typedef struct PeakCache_t PeakCache;
+
+/* The lowest and highest sample in a bucket of frames */
+struct SoundPeak_t
+{
+	short min;
+	short max;
+};
+
+SoundPeaks* CreateSoundPeaks(const MhkSound* snd);
+unsigned long BuildSoundPeaks(SoundPeaks* peaks, unsigned long maxFrames);
+unsigned PeakLevelCount(const SoundPeaks* peaks);
+const SoundPeak* GetPeakLevel(const SoundPeaks* peaks, unsigned level,
+	unsigned long framesDone, unsigned long* count);
+size_t ReadPeakSamples(const SoundPeaks* peaks, unsigned long first,
+	size_t numFrames, short* dst);
+void FreeSoundPeaks(SoundPeaks* peaks);
+
+PeakCache* OpenPeakCache(const char* filename, int* error);
+SoundPeaks* LookupPeaks(PeakCache* cache, const CacheKey* key,
+	const MhkSound* snd);
+int StorePeaks(PeakCache* cache, const CacheKey* key,
+	const SoundPeaks* peaks);
+void ClosePeakCache(PeakCache* cache);
+
+#endif /* not SOUNDPEAKS_H */
@@ -0,0 +1,464 @@
+/* Streaming sound playback */
+
+/* Sounds are decoded while they play, so that a long sound starts as
+   soon as its first block is ready.  A decoder thread fills a ring of
+   RING_FRAMES frames, and an output thread takes a period of frames at
+   a time from it and hands them to the output: the wave device, a WAV
+   file, or nothing.  The file and null outputs keep the pace of a
+   device with the performance counter, so they behave the same as the
+   real thing without any sound hardware.
+
+   The ring has exactly one writer and one reader, so it needs no lock.
+   The decoder only ever moves "writePos" and the output only ever
+   moves "readPos".  Each side fills or empties its part of the ring
+   before it publishes the new position with an interlocked store, and
+   reads the other side's position with an interlocked load, so the
+   samples are always visible before the position that covers them.
+   The positions count frames from the start and wrap at 2^32, and the
+   ring index is the position modulo RING_FRAMES.
+
+   When the output wants a period and the ring has less than that, the
+   rest is played as silence and counted as an underrun, unless the
+   sound is over.  Playback begins once the first period (a device's
+   worth of periods for the wave device) has been decoded, and the time
+   from creation to then is the first-sample latency.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <mmsystem.h>
+#include <process.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkSound.h"
+#include "SoundFile.h"
+#include "SoundPlayer.h"
+
+#define RING_FRAMES 16384 /* Must be a power of two */
+#define PERIOD_FRAMES 1024 /* Frames the output takes at a time */
+#define DECODE_FRAMES 4096 /* Frames the decoder adds at a time */
+#define NUM_WAVE_BUFFERS 4
+#define POS_MASK 0xffffffffUL
+
+struct SoundPlayer_t
+{
+	MhkSound snd;
+	SoundDecoder dec;
+	int output;
+	WavWriter* wav; /* SNDOUT_FILE only */
+	HWAVEOUT waveOut; /* SNDOUT_DEVICE only */
+	WAVEHDR headers[NUM_WAVE_BUFFERS];
+	short* periods; /* NUM_WAVE_BUFFERS periods of samples */
+	HANDLE decodeThread;
+	HANDLE outputThread;
+	HANDLE spaceEvent; /* Signaled when the output took frames */
+	HANDLE dataEvent; /* Signaled when the decoder added frames or ended */
+	HANDLE waveEvent; /* Signaled by the device when a buffer is done */
+	HANDLE doneEvent; /* Stays signaled once the output is finished */
+	volatile LONG quit;
+	LARGE_INTEGER freq;
+	LARGE_INTEGER createTime;
+
+	/* The ring */
+	short* ring;
+	volatile LONG writePos;
+	volatile LONG readPos;
+	volatile LONG ended; /* Has the decoder reached the end? */
+
+	/* Protected by "lock" */
+	CRITICAL_SECTION lock;
+	SoundPlayStats stats;
+	LONGLONG decodeTicks;
+};
+
+static unsigned __stdcall DecoderThread(void* param);
+static unsigned __stdcall OutputThread(void* param);
+static void PlayToSink(SoundPlayer* player);
+static void PlayToDevice(SoundPlayer* player);
+static unsigned long PullFrames(SoundPlayer* player, short* dst,
+	unsigned long count, bool* finished);
+static unsigned long LoadPos(volatile LONG* pos);
+static void StorePos(volatile LONG* pos, unsigned long value);
+
+/* Starts playing a sound, which must stay in memory until the player
+   is freed.  "filename" is the WAV file to write for SNDOUT_FILE.
+   Returns NULL and sets "*error" on failure.  */
+SoundPlayer* CreateSoundPlayer(const MhkSound* snd, int output,
+	const char* filename, int* error)
+{
+	SoundPlayer* player;
+	size_t periodSize = (size_t)PERIOD_FRAMES * snd->numChannels;
+	unsigned i;
+
+	player = (SoundPlayer*)calloc(1, sizeof(SoundPlayer));
+	if (player == NULL)
+	{
+		*error = MHK_ENOMEM;
+		return NULL;
+	}
+	QueryPerformanceFrequency(&player->freq);
+	QueryPerformanceCounter(&player->createTime);
+	player->snd = *snd;
+	InitSoundDecoder(&player->dec, &player->snd);
+	player->output = output;
+	InitializeCriticalSection(&player->lock);
+	player->ring = (short*)malloc(
+		(size_t)RING_FRAMES * snd->numChannels * sizeof(short));
+	player->periods = (short*)malloc(
+		NUM_WAVE_BUFFERS * periodSize * sizeof(short));
+	player->spaceEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	player->dataEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	player->waveEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	player->doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	*error = MHK_ENOMEM;
+	if (player->ring == NULL || player->periods == NULL ||
+		player->spaceEvent == NULL || player->dataEvent == NULL ||
+		player->waveEvent == NULL || player->doneEvent == NULL)
+	{
+		FreeSoundPlayer(player);
+		return NULL;
+	}
+
+	if (output == SNDOUT_FILE)
+	{
+		player->wav = CreateWavFile(filename, snd->numChannels,
+			snd->sampleRate, error);
+		if (player->wav == NULL)
+		{
+			FreeSoundPlayer(player);
+			return NULL;
+		}
+	}
+	else if (output == SNDOUT_DEVICE)
+	{
+		WAVEFORMATEX wfx;
+		wfx.wFormatTag = WAVE_FORMAT_PCM;
+		wfx.nChannels = (WORD)snd->numChannels;
+		wfx.nSamplesPerSec = snd->sampleRate;
+		wfx.wBitsPerSample = 16;
+		wfx.nBlockAlign = (WORD)(snd->numChannels * 2);
+		wfx.nAvgBytesPerSec = snd->sampleRate * wfx.nBlockAlign;
+		wfx.cbSize = 0;
+		if (waveOutOpen(&player->waveOut, WAVE_MAPPER, &wfx,
+			(DWORD_PTR)player->waveEvent, 0, CALLBACK_EVENT) !=
+			MMSYSERR_NOERROR)
+		{
+			player->waveOut = NULL;
+			*error = MHK_EIO;
+			FreeSoundPlayer(player);
+			return NULL;
+		}
+		for (i = 0; i < NUM_WAVE_BUFFERS; i++)
+		{
+			player->headers[i].lpData =
+				(LPSTR)(player->periods + i * periodSize);
+			player->headers[i].dwBufferLength =
+				(DWORD)(periodSize * sizeof(short));
+			waveOutPrepareHeader(player->waveOut, &player->headers[i],
+				sizeof(WAVEHDR));
+		}
+	}
+
+	*error = MHK_ENOMEM;
+	player->decodeThread = (HANDLE)_beginthreadex(NULL, 0, DecoderThread,
+												  player, 0, NULL);
+	if (player->decodeThread == NULL)
+	{
+		FreeSoundPlayer(player);
+		return NULL;
+	}
+	player->outputThread = (HANDLE)_beginthreadex(NULL, 0, OutputThread,
+												  player, 0, NULL);
+	if (player->outputThread == NULL)
+	{
+		FreeSoundPlayer(player);
+		return NULL;
+	}
+	*error = MHK_OK;
+	return player;
+}
+
+/* Waits up to "timeoutMs" milliseconds for the sound to finish.
+   Returns true if it has.  */
+bool WaitSoundPlayer(SoundPlayer* player, unsigned long timeoutMs)
+{
+	return WaitForSingleObject(player->doneEvent, timeoutMs) ==
+		WAIT_OBJECT_0;
+}
+
+void GetSoundPlayStats(SoundPlayer* player, SoundPlayStats* stats)
+{
+	EnterCriticalSection(&player->lock);
+	*stats = player->stats;
+	stats->decodeMs = (double)player->decodeTicks * 1000 /
+		(double)player->freq.QuadPart;
+	LeaveCriticalSection(&player->lock);
+}
+
+/* Stops playback, if it is still going, and frees the player.  */
+void FreeSoundPlayer(SoundPlayer* player)
+{
+	unsigned i;
+	if (player == NULL)
+		return;
+
+	/* The threads stop first, so that the output thread cannot queue
+	   another buffer after the device is reset.  */
+	InterlockedExchange(&player->quit, 1);
+	if (player->decodeThread != NULL)
+	{
+		SetEvent(player->spaceEvent);
+		WaitForSingleObject(player->decodeThread, INFINITE);
+		CloseHandle(player->decodeThread);
+	}
+	if (player->outputThread != NULL)
+	{
+		SetEvent(player->dataEvent);
+		SetEvent(player->waveEvent);
+		WaitForSingleObject(player->outputThread, INFINITE);
+		CloseHandle(player->outputThread);
+	}
+	if (player->waveOut != NULL)
+	{
+		waveOutReset(player->waveOut);
+		for (i = 0; i < NUM_WAVE_BUFFERS; i++)
+			waveOutUnprepareHeader(player->waveOut, &player->headers[i],
+				sizeof(WAVEHDR));
+		waveOutClose(player->waveOut);
+	}
+	if (player->wav != NULL)
+		CloseWavFile(player->wav);
+	if (player->spaceEvent != NULL)
+		CloseHandle(player->spaceEvent);
+	if (player->dataEvent != NULL)
+		CloseHandle(player->dataEvent);
+	if (player->waveEvent != NULL)
+		CloseHandle(player->waveEvent);
+	if (player->doneEvent != NULL)
+		CloseHandle(player->doneEvent);
+	DeleteCriticalSection(&player->lock);
+	free(player->ring);
+	free(player->periods);
+	free(player);
+}
+
+/* The producer side of the ring */
+static unsigned __stdcall DecoderThread(void* param)
+{
+	SoundPlayer* player = (SoundPlayer*)param;
+	unsigned channels = player->snd.numChannels;
+	unsigned long want = PERIOD_FRAMES; /* Small at first, to start soon */
+	unsigned long writePos = 0;
+
+	while (!player->quit)
+	{
+		unsigned long readPos = LoadPos(&player->readPos);
+		unsigned long space = RING_FRAMES -
+			((writePos - readPos) & POS_MASK);
+		unsigned long index = writePos & (RING_FRAMES - 1);
+		LARGE_INTEGER t0, t1;
+		size_t count;
+
+		if (space < want)
+		{
+			/* The timeout covers a wakeup that came between the load
+			   and the wait.  */
+			WaitForSingleObject(player->spaceEvent, 20);
+			continue;
+		}
+		/* Stop at the end of the ring, and do the rest next time.  */
+		if (want > RING_FRAMES - index)
+			want = RING_FRAMES - index;
+		QueryPerformanceCounter(&t0);
+		count = DecodeSound(&player->dec, player->ring + index * channels,
+			want);
+		QueryPerformanceCounter(&t1);
+
+		EnterCriticalSection(&player->lock);
+		player->stats.decoded += (unsigned long)count;
+		player->decodeTicks += t1.QuadPart - t0.QuadPart;
+		LeaveCriticalSection(&player->lock);
+		if (count == 0)
+		{
+			InterlockedExchange(&player->ended, 1);
+			SetEvent(player->dataEvent);
+			break;
+		}
+		writePos = (writePos + (unsigned long)count) & POS_MASK;
+		StorePos(&player->writePos, writePos);
+		SetEvent(player->dataEvent);
+		want = DECODE_FRAMES;
+	}
+	return 0;
+}
+
+static unsigned __stdcall OutputThread(void* param)
+{
+	SoundPlayer* player = (SoundPlayer*)param;
+	unsigned long prefill = PERIOD_FRAMES;
+	int error = MHK_OK;
+
+	/* Wait for the first frames, so that the start of decoding is not
+	   counted as an underrun.  */
+	if (player->output == SNDOUT_DEVICE)
+		prefill = PERIOD_FRAMES * NUM_WAVE_BUFFERS;
+	while (!player->quit && !player->ended &&
+		   LoadPos(&player->writePos) < prefill)
+		WaitForSingleObject(player->dataEvent, 20);
+
+	timeBeginPeriod(1);
+	if (player->output == SNDOUT_DEVICE)
+		PlayToDevice(player);
+	else
+		PlayToSink(player);
+	timeEndPeriod(1);
+
+	if (player->wav != NULL)
+	{
+		error = CloseWavFile(player->wav);
+		player->wav = NULL;
+	}
+	EnterCriticalSection(&player->lock);
+	player->stats.done = !player->quit;
+	if (player->stats.error == MHK_OK)
+		player->stats.error = error;
+	LeaveCriticalSection(&player->lock);
+	SetEvent(player->doneEvent);
+	return 0;
+}
+
+/* Plays to a WAV file or to nothing, one period per period of time.
+   The deadlines are absolute, so that late wakeups do not add up.  */
+static void PlayToSink(SoundPlayer* player)
+{
+	LONGLONG period = player->freq.QuadPart * PERIOD_FRAMES /
+		player->snd.sampleRate;
+	LARGE_INTEGER next, now;
+
+	QueryPerformanceCounter(&next);
+	while (!player->quit)
+	{
+		bool finished;
+		unsigned long count = PullFrames(player, player->periods,
+			PERIOD_FRAMES, &finished);
+		if (player->wav != NULL && WriteWavSamples(player->wav,
+			player->periods, finished ? count : PERIOD_FRAMES) != MHK_OK)
+		{
+			EnterCriticalSection(&player->lock);
+			player->stats.error = MHK_EIO;
+			LeaveCriticalSection(&player->lock);
+			break;
+		}
+		if (finished)
+			break;
+		next.QuadPart += period;
+		QueryPerformanceCounter(&now);
+		if (next.QuadPart > now.QuadPart)
+			Sleep((DWORD)((next.QuadPart - now.QuadPart) * 1000 /
+						  player->freq.QuadPart));
+	}
+}
+
+/* Keeps every wave buffer that the device is not playing filled and
+   queued, until the sound is over and the device has played it all.  */
+static void PlayToDevice(SoundPlayer* player)
+{
+	size_t periodSize = (size_t)PERIOD_FRAMES * player->snd.numChannels;
+	bool queued[NUM_WAVE_BUFFERS];
+	bool finished = false;
+	unsigned i;
+
+	for (i = 0; i < NUM_WAVE_BUFFERS; i++)
+		queued[i] = false;
+	while (!player->quit)
+	{
+		bool busy = false;
+		for (i = 0; i < NUM_WAVE_BUFFERS; i++)
+		{
+			WAVEHDR* hdr = &player->headers[i];
+			if (queued[i] && (hdr->dwFlags & WHDR_DONE) != 0)
+				queued[i] = false;
+			if (!queued[i] && !finished)
+			{
+				unsigned long count = PullFrames(player,
+					player->periods + i * periodSize, PERIOD_FRAMES,
+					&finished);
+				if (finished)
+					periodSize = (size_t)count * player->snd.numChannels;
+				hdr->dwBufferLength = (DWORD)(periodSize * sizeof(short));
+				if (periodSize > 0 && waveOutWrite(player->waveOut, hdr,
+					sizeof(WAVEHDR)) == MMSYSERR_NOERROR)
+					queued[i] = true;
+			}
+			busy = busy || queued[i];
+		}
+		if (!busy)
+			break;
+		WaitForSingleObject(player->waveEvent, 100);
+	}
+}
+
+/* The output callback, the consumer side of the ring.  Copies up to
+   "count" frames to "dst" and fills the rest with silence.  Sets
+   "*finished" once the last frame of the sound has been taken.
+   Returns the number of frames taken from the ring.  */
+static unsigned long PullFrames(SoundPlayer* player, short* dst,
+	unsigned long count, bool* finished)
+{
+	unsigned channels = player->snd.numChannels;
+	/* Check for the end first, so that the write position is final if
+	   the sound has ended.  */
+	bool ended = LoadPos(&player->ended) != 0;
+	unsigned long readPos = LoadPos(&player->readPos);
+	unsigned long avail = (LoadPos(&player->writePos) - readPos) & POS_MASK;
+	unsigned long take = avail < count ? avail : count;
+	unsigned long index = readPos & (RING_FRAMES - 1);
+	unsigned long first = take < RING_FRAMES - index ?
+		take : RING_FRAMES - index;
+	LARGE_INTEGER now;
+
+	memcpy(dst, player->ring + index * channels,
+		first * channels * sizeof(short));
+	memcpy(dst + first * channels, player->ring,
+		(take - first) * channels * sizeof(short));
+	memset(dst + take * channels, 0,
+		(count - take) * channels * sizeof(short));
+	if (take > 0)
+	{
+		StorePos(&player->readPos, (readPos + take) & POS_MASK);
+		SetEvent(player->spaceEvent);
+	}
+	*finished = ended && take == avail;
+
+	EnterCriticalSection(&player->lock);
+	if (player->stats.played == 0 && take > 0)
+	{
+		QueryPerformanceCounter(&now);
+		player->stats.firstSampleMs = (double)(now.QuadPart -
+			player->createTime.QuadPart) * 1000 /
+			(double)player->freq.QuadPart;
+	}
+	player->stats.played += take;
+	if (take < count && !ended)
+	{
+		player->stats.underruns++;
+		player->stats.underrunFrames += count - take;
+	}
+	LeaveCriticalSection(&player->lock);
+	return take;
+}
+
+/* Reads a ring position with a full barrier.  */
+static unsigned long LoadPos(volatile LONG* pos)
+{
+	return (unsigned long)InterlockedCompareExchange(pos, 0, 0) & POS_MASK;
+}
+
+/* Publishes a ring position after everything written before it.  */
+static void StorePos(volatile LONG* pos, unsigned long value)
+{
+	InterlockedExchange(pos, (LONG)value);
+}
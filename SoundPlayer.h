@@ -0,0 +1,36 @@
+/* Streaming sound playback interface */
+/* Include "bool.h" and "MhkSound.h" before this header.  */
+
+#ifndef SOUNDPLAYER_H
+#define SOUNDPLAYER_H
+
+/* Where the samples go */
+enum SoundOutput
+{
+	SNDOUT_DEVICE, /* The default wave output device */
+	SNDOUT_NULL, /* Nowhere, at the pace of a device */
+	SNDOUT_FILE /* A WAV file, at the pace of a device */
+};
+
+typedef struct SoundPlayer_t SoundPlayer;
+typedef struct SoundPlayStats_t SoundPlayStats;
+
+struct SoundPlayStats_t
+{
+	double firstSampleMs; /* From creation to the first samples output */
+	unsigned long decoded; /* Frames */
+	unsigned long played; /* Frames, not counting silence */
+	unsigned long underruns; /* Times the output found the ring empty */
+	unsigned long underrunFrames; /* Silence put in their place */
+	double decodeMs; /* Time spent decoding */
+	bool done; /* Has everything been played? */
+	int error; /* MhkError code of the output */
+};
+
+SoundPlayer* CreateSoundPlayer(const MhkSound* snd, int output,
+	const char* filename, int* error);
+bool WaitSoundPlayer(SoundPlayer* player, unsigned long timeoutMs);
+void GetSoundPlayStats(SoundPlayer* player, SoundPlayStats* stats);
+void FreeSoundPlayer(SoundPlayer* player);
+
+#endif /* not SOUNDPLAYER_H */
@@ -0,0 +1,395 @@
+/* Sprite atlas packing */
+/* Packs all the frames of a tSPR resource into one image, for
+   previews and for tools that want a sprite as a single texture.
+
+   The frames are placed with a skyline packer: the top edge of what
+   has been placed so far is kept as a list of horizontal segments, and
+   each frame, tallest first, goes where its top edge ends up lowest.
+   That is nearly as tight as the maximal rectangles method for the
+   similar sizes that the frames of one animation have, and it takes
+   time proportional to the number of frames times the number of
+   segments.  A few atlas widths around the square root of the total
+   area are tried, and the smallest one that is not too far from square
+   wins.
+
+   Only the frame headers are read for packing.  Each frame is then
+   decoded straight into its place in the atlas, using the atlas width
+   as the row stride, so no frame is ever copied.  */
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "PalExpand.h"
+#include "BmpDecode.h"
+#include "WorkPool.h"
+#include "MhkSprite.h"
+#include "SpriteAtlas.h"
+
+#define ATLAS_MAX_SIZE 16384 /* Largest atlas width or height */
+#define NUM_WIDTH_STEPS 6
+
+typedef struct SkyNode_t SkyNode;
+typedef struct PackItem_t PackItem;
+typedef struct AtlasJob_t AtlasJob;
+
+/* A segment of the skyline.  Everything below "y" from "x" to "x" +
+   "width" is taken.  */
+struct SkyNode_t
+{
+	unsigned x, y;
+	unsigned width;
+};
+
+struct PackItem_t
+{
+	unsigned frame;
+	unsigned width, height; /* Including the padding */
+};
+
+struct AtlasJob_t
+{
+	const MhkFile* file;
+	unsigned maxWidth;
+	unsigned padding;
+	SpriteAtlas* atlas;
+};
+
+/* Atlas widths to try, relative to the square root of the area.  */
+static const double widthSteps[NUM_WIDTH_STEPS] =
+	{ 1.0, 1.1, 1.25, 1.5, 2.0, 3.0 };
+
+static double AtlasCost(unsigned width, unsigned height);
+static int CompareItems(const void* a, const void* b);
+static unsigned PackSkyline(const PackItem* items, unsigned numItems,
+	unsigned binWidth, SkyNode* nodes, AtlasRect* rects);
+static bool SkylineFits(const SkyNode* nodes, unsigned numNodes,
+	unsigned index, unsigned width, unsigned binWidth, unsigned* y);
+static unsigned PlaceOnSkyline(SkyNode* nodes, unsigned numNodes,
+	unsigned index, unsigned width, unsigned top);
+static void AtlasJobFunc(void* arg);
+
+/* Packs and decodes all the frames of a sprite.  "maxWidth" limits
+   the width of the atlas unless it is zero or narrower than the widest
+   frame, and "padding" pixels are left free to the right of and below
+   every frame.  Frames that cannot be read are left out and counted in
+   "atlas->numFailed".  Free the atlas with FreeSpriteAtlas() even if
+   this fails.  Returns an MhkError code.  */
+int PackSpriteAtlas(const MhkSprite* spr, unsigned maxWidth,
+	unsigned padding, SpriteAtlas* atlas)
+{
+	PackItem* items;
+	SkyNode* nodes;
+	unsigned numItems = 0;
+	unsigned widest = 0;
+	unsigned bestWidth = 0, bestHeight = 0;
+	double area = 0;
+	unsigned i;
+
+	atlas->numFrames = spr->numFrames;
+	atlas->numFailed = 0;
+	atlas->width = 0;
+	atlas->height = 0;
+	atlas->pixels = NULL;
+	atlas->rects = (AtlasRect*)calloc(spr->numFrames + 1, sizeof(AtlasRect));
+	items = (PackItem*)malloc((spr->numFrames + 1) * sizeof(PackItem));
+	nodes = (SkyNode*)malloc((spr->numFrames + 2) * sizeof(SkyNode));
+	if (atlas->rects == NULL || items == NULL || nodes == NULL)
+	{
+		free(items);
+		free(nodes);
+		return MHK_ENOMEM;
+	}
+
+	for (i = 0; i < spr->numFrames; i++)
+	{
+		MhkBitmap bmp;
+		if (GetSpriteFrame(spr, i, &bmp) != MHK_OK)
+		{
+			atlas->numFailed++;
+			continue;
+		}
+		if (bmp.width == 0 || bmp.height == 0)
+			continue;
+		items[numItems].frame = i;
+		items[numItems].width = bmp.width + padding;
+		items[numItems].height = bmp.height + padding;
+		area += (double)items[numItems].width * items[numItems].height;
+		if (widest < items[numItems].width)
+			widest = items[numItems].width;
+		numItems++;
+	}
+	qsort(items, numItems, sizeof(PackItem), CompareItems);
+
+	/* The bins are "padding" wider than the atlas, so that the frames
+	   along the right edge need no padding.  */
+	if (maxWidth != 0 && maxWidth + padding < widest)
+		maxWidth = 0;
+	for (i = 0; i < NUM_WIDTH_STEPS && numItems > 0; i++)
+	{
+		unsigned width = (unsigned)(sqrt(area) * widthSteps[i]);
+		unsigned height;
+		if (width < widest)
+			width = widest;
+		if (maxWidth != 0 && width > maxWidth + padding)
+			width = maxWidth + padding;
+		if (width == bestWidth)
+			continue;
+		height = PackSkyline(items, numItems, width, nodes, atlas->rects);
+		if (bestWidth == 0 || AtlasCost(width, height) <
+			AtlasCost(bestWidth, bestHeight))
+		{
+			bestWidth = width;
+			bestHeight = height;
+		}
+	}
+	if (numItems > 0)
+	{
+		PackSkyline(items, numItems, bestWidth, nodes, atlas->rects);
+		for (i = 0; i < numItems; i++)
+		{
+			atlas->rects[items[i].frame].width -= padding;
+			atlas->rects[items[i].frame].height -= padding;
+		}
+		atlas->width = bestWidth - padding;
+		atlas->height = bestHeight - padding;
+	}
+	free(items);
+	free(nodes);
+	if (atlas->width > ATLAS_MAX_SIZE || atlas->height > ATLAS_MAX_SIZE)
+		return MHK_EUNSUPPORTED;
+
+	atlas->pixels = (PalColor*)calloc(
+		(size_t)atlas->width * atlas->height + 1, sizeof(PalColor));
+	if (atlas->pixels == NULL)
+		return MHK_ENOMEM;
+	for (i = 0; i < spr->numFrames; i++)
+	{
+		AtlasRect* rect = &atlas->rects[i];
+		MhkBitmap bmp;
+		if (rect->width == 0)
+			continue;
+		if (GetSpriteFrame(spr, i, &bmp) != MHK_OK ||
+			DecodeBitmapRgb(&bmp, atlas->pixels +
+				(size_t)rect->y * atlas->width + rect->x,
+				(size_t)atlas->width * sizeof(PalColor)) != MHK_OK)
+		{
+			memset(rect, 0, sizeof(AtlasRect));
+			atlas->numFailed++;
+		}
+	}
+	return MHK_OK;
+}
+
+/* Packs every tSPR resource of an archive into its own atlas, one
+   sprite per job.  "*atlases" gets an array of "*numAtlases" atlases
+   in resource order, each with its own error code, which the caller
+   frees with FreeSpriteAtlas() and free().  Returns an MhkError code
+   for the archive as a whole.  */
+int PackArchiveAtlases(MhkArchive* archive, unsigned maxWidth,
+	unsigned padding, WorkPool* pool, SpriteAtlas** atlases,
+	unsigned* numAtlases)
+{
+	AtlasJob* jobs;
+	unsigned numJobs = 0;
+	unsigned i;
+
+	*atlases = NULL;
+	*numAtlases = 0;
+	jobs = (AtlasJob*)malloc((archive->numResources + 1) * sizeof(AtlasJob));
+	*atlases = (SpriteAtlas*)calloc(archive->numResources + 1,
+									sizeof(SpriteAtlas));
+	if (jobs == NULL || *atlases == NULL)
+	{
+		free(jobs);
+		free(*atlases);
+		*atlases = NULL;
+		return MHK_ENOMEM;
+	}
+	for (i = 0; i < archive->numResources; i++)
+	{
+		MhkResource* rsrc = &archive->resources[i];
+		if (rsrc->type != MHK_TSPR)
+			continue;
+		(*atlases)[numJobs].id = rsrc->id;
+		jobs[numJobs].file = &archive->files[rsrc->file];
+		jobs[numJobs].maxWidth = maxWidth;
+		jobs[numJobs].padding = padding;
+		jobs[numJobs].atlas = &(*atlases)[numJobs];
+		numJobs++;
+	}
+	for (i = 0; i < numJobs; i++)
+		SubmitWork(pool, AtlasJobFunc, &jobs[i]);
+	WaitWorkPool(pool);
+	free(jobs);
+	*numAtlases = numJobs;
+	return MHK_OK;
+}
+
+void FreeSpriteAtlas(SpriteAtlas* atlas)
+{
+	free(atlas->rects);
+	free(atlas->pixels);
+	atlas->rects = NULL;
+	atlas->pixels = NULL;
+}
+
+/* Rates an atlas size by its area, with long thin atlases counted as
+   the square that the longer side would need, since textures are
+   limited by their longer side.  Lower is better.  */
+static double AtlasCost(unsigned width, unsigned height)
+{
+	double area = (double)width * height;
+	double side = width > height ? width : height;
+	return area + side * side / 4;
+}
+
+/* Sorts tallest first, then widest first.  */
+static int CompareItems(const void* a, const void* b)
+{
+	const PackItem* ia = (const PackItem*)a;
+	const PackItem* ib = (const PackItem*)b;
+	if (ia->height != ib->height)
+		return ia->height > ib->height ? -1 : 1;
+	if (ia->width != ib->width)
+		return ia->width > ib->width ? -1 : 1;
+	return ia->frame < ib->frame ? -1 : (ia->frame > ib->frame);
+}
+
+/* Places the items in a bin "binWidth" wide, which must be at least
+   as wide as every item, and stores their places in "rects", padding
+   included.
+   "nodes" must have room for one more node than there are items.
+   Returns the height of the bin.  */
+static unsigned PackSkyline(const PackItem* items, unsigned numItems,
+	unsigned binWidth, SkyNode* nodes, AtlasRect* rects)
+{
+	unsigned numNodes = 1;
+	unsigned height = 0;
+	unsigned i, n;
+
+	nodes[0].x = 0;
+	nodes[0].y = 0;
+	nodes[0].width = binWidth;
+	for (i = 0; i < numItems; i++)
+	{
+		const PackItem* item = &items[i];
+		AtlasRect* rect = &rects[item->frame];
+		unsigned best = 0;
+		unsigned bestTop = UINT_MAX;
+		unsigned bestWaste = UINT_MAX;
+
+		/* Lowest top edge first, then the narrowest segment, which
+		   leaves the wide segments for the wide frames.  */
+		for (n = 0; n < numNodes; n++)
+		{
+			unsigned y;
+			if (!SkylineFits(nodes, numNodes, n, item->width, binWidth, &y))
+				continue;
+			if (y + item->height < bestTop ||
+				(y + item->height == bestTop && nodes[n].width < bestWaste))
+			{
+				best = n;
+				bestTop = y + item->height;
+				bestWaste = nodes[n].width;
+			}
+		}
+		rect->x = nodes[best].x;
+		rect->y = bestTop - item->height;
+		rect->width = item->width;
+		rect->height = item->height;
+		numNodes = PlaceOnSkyline(nodes, numNodes, best, item->width,
+			bestTop);
+		if (height < bestTop)
+			height = bestTop;
+	}
+
+	return height;
+}
+
+/* Finds how low an item "width" wide can sit with its left edge at
+   the start of segment "index".  Returns false if it would stick out
+   of the bin.  */
+static bool SkylineFits(const SkyNode* nodes, unsigned numNodes,
+	unsigned index, unsigned width, unsigned binWidth, unsigned* y)
+{
+	unsigned left = width;
+	unsigned n = index;
+
+	if (nodes[index].x + width > binWidth)
+		return false;
+	*y = 0;
+	while (n < numNodes)
+	{
+		if (*y < nodes[n].y)
+			*y = nodes[n].y;
+		if (left <= nodes[n].width)
+			break;
+		left -= nodes[n].width;
+		n++;
+	}
+	return true;
+}
+
+/* Raises the skyline to "top" over an item placed at the start of
+   segment "index".  Returns the new number of segments.  */
+static unsigned PlaceOnSkyline(SkyNode* nodes, unsigned numNodes,
+	unsigned index, unsigned width, unsigned top)
+{
+	unsigned right = nodes[index].x + width;
+	unsigned n;
+
+	memmove(&nodes[index + 1], &nodes[index],
+		(numNodes - index) * sizeof(SkyNode));
+	nodes[index].y = top;
+	nodes[index].width = width;
+	numNodes++;
+
+	/* Cut the segments that are now under the item.  */
+	n = index + 1;
+	while (n < numNodes && nodes[n].x < right)
+	{
+		unsigned cut = right - nodes[n].x;
+		if (cut < nodes[n].width)
+		{
+			nodes[n].x += cut;
+			nodes[n].width -= cut;
+			break;
+		}
+		memmove(&nodes[n], &nodes[n + 1],
+			(numNodes - n - 1) * sizeof(SkyNode));
+		numNodes--;
+	}
+
+	/* Join neighbors at the same height.  */
+	for (n = index > 0 ? index - 1 : 0; n + 1 < numNodes && n <= index + 1;)
+	{
+		if (nodes[n].y == nodes[n + 1].y)
+		{
+			nodes[n].width += nodes[n + 1].width;
+			memmove(&nodes[n + 1], &nodes[n + 2],
+				(numNodes - n - 2) * sizeof(SkyNode));
+			numNodes--;
+		}
+		else
+			n++;
+	}
+	return numNodes;
+}
+
+/* Runs on a worker thread.  */
+static void AtlasJobFunc(void* arg)
+{
+	AtlasJob* job = (AtlasJob*)arg;
+	MhkSprite spr;
+
+	job->atlas->error = ParseSprite(job->file->data, job->file->size, &spr);
+	if (job->atlas->error == MHK_OK)
+		job->atlas->error = PackSpriteAtlas(&spr, job->maxWidth,
+			job->padding, job->atlas);
+	FreeSprite(&spr);
+}
@@ -0,0 +1,38 @@
+/* Sprite atlas interface */
+/* Include "bool.h", "MhkArchive.h", "MhkBitmap.h", "PalExpand.h",
+   "WorkPool.h", and "MhkSprite.h" before this header.  */
+
+#ifndef SPRITEATLAS_H
+#define SPRITEATLAS_H
+
+typedef struct AtlasRect_t AtlasRect;
+typedef struct SpriteAtlas_t SpriteAtlas;
+
+/* Where one frame went in the atlas.  Frames that could not be read
+   or are empty get a zero-sized rectangle at 0, 0.  */
+struct AtlasRect_t
+{
+	unsigned x, y;
+	unsigned width, height;
+};
+
+/* All the frames of one sprite packed into one image.  */
+struct SpriteAtlas_t
+{
+	unsigned short id; /* Of the tSPR resource */
+	int error; /* MhkError code of the whole sprite */
+	unsigned numFrames;
+	unsigned numFailed; /* Frames that could not be decoded */
+	AtlasRect* rects; /* One for every frame */
+	unsigned width, height;
+	PalColor* pixels; /* Top-down, "width" pixels a row, zero if unused */
+};
+
+int PackSpriteAtlas(const MhkSprite* spr, unsigned maxWidth,
+	unsigned padding, SpriteAtlas* atlas);
+int PackArchiveAtlases(MhkArchive* archive, unsigned maxWidth,
+	unsigned padding, WorkPool* pool, SpriteAtlas** atlases,
+	unsigned* numAtlases);
+void FreeSpriteAtlas(SpriteAtlas* atlas);
+
+#endif /* not SPRITEATLAS_H */
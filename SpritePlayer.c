@@ -0,0 +1,342 @@
+/* Sprite playback */
+
+/* Decoding a frame can take longer than a frame lasts, and a window
+   timer is far too coarse for 60 frames per second, so playback is
+   split in two.  A decoder thread runs ahead of the display and fills
+   a ring of SPRITE_RING_SIZE frame buffers.  A multimedia timer ticks
+   twice per frame and posts a message to the window, which then shows
+   the newest decoded frame that is due according to the performance
+   counter.  That way a slow frame delays only itself, and a late
+   timer tick never puts the animation behind.
+
+   The ring holds the frames from "tail" to "tail" + "filled" - 1.
+   The frame at "tail" is the one on screen, so the decoder never
+   touches it, and it only leaves the ring once a newer frame is due.
+   The clock starts when the ring is full for the first time, so that
+   the slow first frames are not counted as dropped.
+
+   The player reads the sprite from the caller's memory, which must
+   not change until the player is freed.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <mmsystem.h>
+#include <process.h>
+
+#include <stdlib.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "PalExpand.h"
+#include "BmpDecode.h"
+#include "MhkSprite.h"
+#include "SpritePlayer.h"
+
+typedef struct FrameSlot_t FrameSlot;
+
+struct FrameSlot_t
+{
+	unsigned long seq; /* Position in the playback, counting from zero */
+	unsigned frame;
+	unsigned width; /* Zero if the frame could not be decoded */
+	unsigned height;
+	PalColor* pixels;
+};
+
+struct SpritePlayer_t
+{
+	MhkSprite sprite;
+	unsigned firstFrame;
+	unsigned fps;
+	unsigned width; /* Size of every frame buffer */
+	unsigned height;
+	HWND hwnd;
+	UINT tickMsg;
+	UINT timerId;
+	HANDLE thread;
+	HANDLE spaceEvent; /* Signaled when a slot is freed */
+	volatile LONG tickPending; /* Is a tick message in the queue? */
+	LARGE_INTEGER freq;
+
+	/* Shared with the decoder thread, protected by "lock" */
+	CRITICAL_SECTION lock;
+	FrameSlot slots[SPRITE_RING_SIZE];
+	unsigned tail;
+	unsigned filled;
+	LONGLONG startTime; /* Zero until the ring is first full */
+	LONGLONG decodeTicks;
+	LONGLONG decodeMaxTicks;
+	unsigned long decoded;
+	bool quit;
+
+	/* Only used by the window's thread */
+	bool showing; /* Is the frame at "tail" on screen? */
+	unsigned long lastSeq;
+	unsigned long shown;
+	unsigned long dropped;
+};
+
+static unsigned __stdcall DecoderThread(void* param);
+static void CALLBACK TimerTick(UINT id, UINT msg, DWORD_PTR user,
+	DWORD_PTR dw1, DWORD_PTR dw2);
+static unsigned long DueFrame(SpritePlayer* player, LONGLONG startTime);
+
+/* Starts playing a sprite at "fps" frames per second, beginning with
+   "firstFrame" and looping forever.  "tickMsg" is posted to "hwnd"
+   whenever AdvanceSpritePlayer() should be called.  Returns NULL on
+   failure.  */
+SpritePlayer* CreateSpritePlayer(const MhkSprite* spr, unsigned firstFrame,
+	unsigned fps, HWND hwnd, UINT tickMsg)
+{
+	SpritePlayer* player;
+	size_t frameBytes;
+	unsigned i;
+
+	if (spr->numFrames == 0 || fps == 0)
+		return NULL;
+	player = (SpritePlayer*)calloc(1, sizeof(SpritePlayer));
+	if (player == NULL)
+		return NULL;
+	player->sprite = *spr;
+	player->firstFrame = firstFrame % spr->numFrames;
+	player->fps = fps;
+	player->hwnd = hwnd;
+	player->tickMsg = tickMsg;
+	QueryPerformanceFrequency(&player->freq);
+	InitializeCriticalSection(&player->lock);
+	GetSpriteBounds(spr, &player->width, &player->height);
+
+	frameBytes = (size_t)player->width * player->height * sizeof(PalColor);
+	for (i = 0; i < SPRITE_RING_SIZE; i++)
+	{
+		player->slots[i].pixels = (PalColor*)malloc(frameBytes + 1);
+		if (player->slots[i].pixels == NULL)
+		{
+			FreeSpritePlayer(player);
+			return NULL;
+		}
+	}
+	player->spaceEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (player->spaceEvent == NULL)
+	{
+		FreeSpritePlayer(player);
+		return NULL;
+	}
+	player->thread = (HANDLE)_beginthreadex(NULL, 0, DecoderThread,
+											player, 0, NULL);
+	if (player->thread == NULL)
+	{
+		FreeSpritePlayer(player);
+		return NULL;
+	}
+
+	/* Tick twice per frame, so that timer jitter cannot make a frame
+	   wait for the tick after the next.  */
+	timeBeginPeriod(1);
+	player->timerId = timeSetEvent(500 / fps > 0 ? 500 / fps : 1, 1,
+		TimerTick, (DWORD_PTR)player, TIME_PERIODIC | TIME_CALLBACK_FUNCTION);
+	if (player->timerId == 0)
+	{
+		timeEndPeriod(1);
+		FreeSpritePlayer(player);
+		return NULL;
+	}
+	return player;
+}
+
+/* Moves on to the newest decoded frame that is due, dropping any
+   older ones.  Call this when the tick message arrives.  Returns true
+   if a different frame should be shown.  */
+bool AdvanceSpritePlayer(SpritePlayer* player)
+{
+	unsigned long due;
+	bool freed = false;
+	bool changed = false;
+	FrameSlot* slot;
+
+	InterlockedExchange(&player->tickPending, 0);
+	EnterCriticalSection(&player->lock);
+	if (player->startTime == 0)
+	{
+		LeaveCriticalSection(&player->lock);
+		return false;
+	}
+	due = DueFrame(player, player->startTime);
+	while (player->filled > 1 &&
+		   player->slots[(player->tail + 1) % SPRITE_RING_SIZE].seq <= due)
+	{
+		player->tail = (player->tail + 1) % SPRITE_RING_SIZE;
+		player->filled--;
+		player->showing = false;
+		freed = true;
+	}
+	slot = &player->slots[player->tail];
+	if (!player->showing && player->filled > 0 && slot->seq <= due)
+	{
+		if (player->shown > 0 && slot->seq > player->lastSeq + 1)
+			player->dropped += slot->seq - player->lastSeq - 1;
+		player->lastSeq = slot->seq;
+		player->shown++;
+		player->showing = true;
+		changed = true;
+	}
+	LeaveCriticalSection(&player->lock);
+	if (freed)
+		SetEvent(player->spaceEvent);
+	return changed;
+}
+
+/* Returns the pixels of the frame on screen, or NULL before the first
+   frame is due.  The rows are "stride" bytes apart, and the pixels
+   stay valid until the next call to AdvanceSpritePlayer().  Only call
+   this from the thread that calls AdvanceSpritePlayer().  */
+const PalColor* GetSpritePlayerFrame(const SpritePlayer* player,
+	unsigned* index, unsigned* width, unsigned* height, size_t* stride)
+{
+	const FrameSlot* slot = &player->slots[player->tail];
+	if (!player->showing)
+		return NULL;
+	*index = slot->frame;
+	*width = slot->width;
+	*height = slot->height;
+	*stride = (size_t)player->width * sizeof(PalColor);
+	return slot->pixels;
+}
+
+void GetSpritePlayStats(SpritePlayer* player, SpritePlayStats* stats)
+{
+	double msPerTick = 1000.0 / (double)player->freq.QuadPart;
+	LARGE_INTEGER now;
+
+	QueryPerformanceCounter(&now);
+	EnterCriticalSection(&player->lock);
+	stats->shown = player->shown;
+	stats->dropped = player->dropped;
+	stats->decoded = player->decoded;
+	stats->decodeAvgMs = player->decoded == 0 ? 0 :
+		player->decodeTicks * msPerTick / player->decoded;
+	stats->decodeMaxMs = player->decodeMaxTicks * msPerTick;
+	stats->fps = 0;
+	if (player->startTime != 0 && now.QuadPart > player->startTime)
+		stats->fps = player->shown * 1000.0 /
+			((now.QuadPart - player->startTime) * msPerTick);
+	LeaveCriticalSection(&player->lock);
+}
+
+/* Stops playback and frees the player.  A tick message may still be
+   in the window's queue afterward.  */
+void FreeSpritePlayer(SpritePlayer* player)
+{
+	unsigned i;
+	if (player == NULL)
+		return;
+
+	if (player->timerId != 0)
+	{
+		timeKillEvent(player->timerId);
+		timeEndPeriod(1);
+	}
+	if (player->thread != NULL)
+	{
+		EnterCriticalSection(&player->lock);
+		player->quit = true;
+		LeaveCriticalSection(&player->lock);
+		SetEvent(player->spaceEvent);
+		WaitForSingleObject(player->thread, INFINITE);
+		CloseHandle(player->thread);
+	}
+	if (player->spaceEvent != NULL)
+		CloseHandle(player->spaceEvent);
+	for (i = 0; i < SPRITE_RING_SIZE; i++)
+		free(player->slots[i].pixels);
+	DeleteCriticalSection(&player->lock);
+	free(player);
+}
+
+static unsigned __stdcall DecoderThread(void* param)
+{
+	SpritePlayer* player = (SpritePlayer*)param;
+	size_t stride = (size_t)player->width * sizeof(PalColor);
+	unsigned long seq = 0;
+
+	for (;;)
+	{
+		LARGE_INTEGER t0, t1;
+		LONGLONG startTime;
+		FrameSlot* slot;
+		MhkBitmap bmp;
+
+		EnterCriticalSection(&player->lock);
+		while (player->filled == SPRITE_RING_SIZE && !player->quit)
+		{
+			LeaveCriticalSection(&player->lock);
+			WaitForSingleObject(player->spaceEvent, INFINITE);
+			EnterCriticalSection(&player->lock);
+		}
+		if (player->quit)
+		{
+			LeaveCriticalSection(&player->lock);
+			break;
+		}
+		slot = &player->slots[(player->tail + player->filled) %
+							  SPRITE_RING_SIZE];
+		startTime = player->startTime;
+		LeaveCriticalSection(&player->lock);
+
+		/* If the display has passed us by, skip to the frame it needs
+		   rather than decode frames that would be dropped anyway.  */
+		if (startTime != 0 && seq < DueFrame(player, startTime))
+			seq = DueFrame(player, startTime);
+		slot->seq = seq;
+		slot->frame = (unsigned)((player->firstFrame + seq) %
+								 player->sprite.numFrames);
+		QueryPerformanceCounter(&t0);
+		if (GetSpriteFrame(&player->sprite, slot->frame, &bmp) == MHK_OK &&
+			DecodeBitmapRgb(&bmp, slot->pixels, stride) == MHK_OK)
+		{
+			slot->width = bmp.width;
+			slot->height = bmp.height;
+		}
+		else
+		{
+			slot->width = 0;
+			slot->height = 0;
+		}
+		QueryPerformanceCounter(&t1);
+		seq++;
+
+		EnterCriticalSection(&player->lock);
+		player->filled++;
+		player->decoded++;
+		player->decodeTicks += t1.QuadPart - t0.QuadPart;
+		if (player->decodeMaxTicks < t1.QuadPart - t0.QuadPart)
+			player->decodeMaxTicks = t1.QuadPart - t0.QuadPart;
+		if (player->startTime == 0 && player->filled == SPRITE_RING_SIZE)
+			player->startTime = t1.QuadPart;
+		LeaveCriticalSection(&player->lock);
+	}
+	return 0;
+}
+
+/* Runs on the multimedia timer's thread, so it only posts a message,
+   and only if the last one was handled.  */
+static void CALLBACK TimerTick(UINT id, UINT msg, DWORD_PTR user,
+	DWORD_PTR dw1, DWORD_PTR dw2)
+{
+	SpritePlayer* player = (SpritePlayer*)user;
+	if (InterlockedExchange(&player->tickPending, 1) == 0)
+		PostMessage(player->hwnd, player->tickMsg, 0, 0);
+}
+
+/* Returns the position in the playback of the frame that is due
+   now.  */
+static unsigned long DueFrame(SpritePlayer* player, LONGLONG startTime)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	if (now.QuadPart <= startTime)
+		return 0;
+	return (unsigned long)((now.QuadPart - startTime) * player->fps /
+						   player->freq.QuadPart);
+}
@@ -0,0 +1,34 @@
+/* Sprite playback interface */
+/* This is platform dependent code: include windows.h, "bool.h",
+   "MhkBitmap.h", "PalExpand.h", and "MhkSprite.h" before this
+   header.  */
+
+#ifndef SPRITEPLAYER_H
+#define SPRITEPLAYER_H
+
+#include <stddef.h>
+
+#define SPRITE_RING_SIZE 8 /* Decoded frames kept ahead of the display */
+
+typedef struct SpritePlayer_t SpritePlayer;
+typedef struct SpritePlayStats_t SpritePlayStats;
+
+struct SpritePlayStats_t
+{
+	unsigned long shown; /* Frames put on the screen */
+	unsigned long dropped; /* Frames that were not ready in time */
+	unsigned long decoded;
+	double decodeAvgMs;
+	double decodeMaxMs;
+	double fps; /* Frames shown per second since playback started */
+};
+
+SpritePlayer* CreateSpritePlayer(const MhkSprite* spr, unsigned firstFrame,
+	unsigned fps, HWND hwnd, UINT tickMsg);
+bool AdvanceSpritePlayer(SpritePlayer* player);
+const PalColor* GetSpritePlayerFrame(const SpritePlayer* player,
+	unsigned* index, unsigned* width, unsigned* height, size_t* stride);
+void GetSpritePlayStats(SpritePlayer* player, SpritePlayStats* stats);
+void FreeSpritePlayer(SpritePlayer* player);
+
+#endif /* not SPRITEPLAYER_H */
@@ -0,0 +1,262 @@
+/* Sprite header statistics */
+
+/* The sprite parameters dialog shows fourteen header words of every
+   tSPR resource as "Unknown 1" through "Unknown 14".  To find out what
+   they mean, this collects the header of every sprite in a set of
+   archives, together with what a field might plausibly describe: the
+   number of frames, the version, and the size of the largest frame.
+   For every field it then counts the distinct values, ranks them by
+   frequency, and measures how closely the field follows each of those
+   properties.
+
+   Reading the frame sizes means parsing every frame header, which is
+   most of the work, so every sprite is a separate job for the work
+   pool.  The statistics themselves are computed afterward from the
+   collected records, which take a few dozen bytes per sprite.  */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "WorkPool.h"
+#include "MhkSprite.h"
+#include "SpriteStats.h"
+
+typedef struct RecordJob_t RecordJob;
+
+struct RecordJob_t
+{
+	const MhkFile* file;
+	SpriteRecord* record;
+};
+
+static void RecordJobFunc(void* arg);
+static double Correlate(const SpriteRecord* records, unsigned numRecords,
+	unsigned field, size_t offset);
+static int CompareUnsigned(const void* a, const void* b);
+static int CompareValueCounts(const void* a, const void* b);
+
+/* Reads the header and frame sizes of every tSPR resource in the
+   archives.  Resources that share a file are only counted once.
+   "*records" gets an array of "*numRecords" records, which the caller
+   frees.  Sprites that cannot be read get a record with an error code,
+   so that they can be reported.  Returns an MhkError code.  */
+int CollectSpriteRecords(MhkArchive* const* archives,
+	const char* const* names, unsigned numArchives, WorkPool* pool,
+	SpriteRecord** records, unsigned* numRecords)
+{
+	RecordJob* jobs;
+	bool* seen;
+	size_t maxJobs = 0, maxFiles = 0;
+	unsigned numJobs = 0;
+	unsigned a, i;
+
+	*records = NULL;
+	*numRecords = 0;
+	for (a = 0; a < numArchives; a++)
+	{
+		maxJobs += archives[a]->numResources;
+		if (maxFiles < archives[a]->numFiles)
+			maxFiles = archives[a]->numFiles;
+	}
+	jobs = (RecordJob*)malloc((maxJobs + 1) * sizeof(RecordJob));
+	seen = (bool*)malloc((maxFiles + 1) * sizeof(bool));
+	*records = (SpriteRecord*)calloc(maxJobs + 1, sizeof(SpriteRecord));
+	if (jobs == NULL || seen == NULL || *records == NULL)
+	{
+		free(jobs);
+		free(seen);
+		free(*records);
+		*records = NULL;
+		return MHK_ENOMEM;
+	}
+
+	for (a = 0; a < numArchives; a++)
+	{
+		MhkArchive* archive = archives[a];
+		memset(seen, 0, (maxFiles + 1) * sizeof(bool));
+		for (i = 0; i < archive->numResources; i++)
+		{
+			MhkResource* rsrc = &archive->resources[i];
+			if (rsrc->type != MHK_TSPR || seen[rsrc->file])
+				continue;
+			seen[rsrc->file] = true;
+			(*records)[numJobs].archive = names[a];
+			(*records)[numJobs].id = rsrc->id;
+			jobs[numJobs].file = &archive->files[rsrc->file];
+			jobs[numJobs].record = &(*records)[numJobs];
+			numJobs++;
+		}
+	}
+	for (i = 0; i < numJobs; i++)
+		SubmitWork(pool, RecordJobFunc, &jobs[i]);
+	WaitWorkPool(pool);
+
+	free(jobs);
+	free(seen);
+	*numRecords = numJobs;
+	return MHK_OK;
+}
+
+/* Computes the statistics of unknown field "field" over the records
+   without errors.  Free them with FreeFieldStats() unless this fails.
+   Returns an MhkError code.  */
+int ComputeFieldStats(const SpriteRecord* records, unsigned numRecords,
+	unsigned field, FieldStats* stats)
+{
+	unsigned* sorted;
+	double sum = 0;
+	unsigned n = 0;
+	unsigned i;
+
+	memset(stats, 0, sizeof(FieldStats));
+	stats->field = field;
+	sorted = (unsigned*)malloc((numRecords + 1) * sizeof(unsigned));
+	if (sorted == NULL)
+		return MHK_ENOMEM;
+	for (i = 0; i < numRecords; i++)
+	{
+		const SpriteRecord* rec = &records[i];
+		unsigned value = rec->unknown[field];
+		if (rec->error != MHK_OK)
+			continue;
+		sorted[n++] = value;
+		sum += value;
+		if (value == rec->numFrames)
+			stats->eqFrames++;
+		if (value == rec->width)
+			stats->eqWidth++;
+		if (value == rec->height)
+			stats->eqHeight++;
+	}
+	stats->numSprites = n;
+	if (n == 0)
+	{
+		free(sorted);
+		return MHK_OK;
+	}
+	stats->mean = sum / n;
+
+	/* Sorting brings equal values together, so they can be counted in
+	   one pass.  */
+	qsort(sorted, n, sizeof(unsigned), CompareUnsigned);
+	stats->minValue = sorted[0];
+	stats->maxValue = sorted[n - 1];
+	stats->values = (FieldValue*)malloc(n * sizeof(FieldValue));
+	if (stats->values == NULL)
+	{
+		free(sorted);
+		return MHK_ENOMEM;
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (stats->numValues > 0 &&
+			stats->values[stats->numValues - 1].value == sorted[i])
+			stats->values[stats->numValues - 1].count++;
+		else
+		{
+			stats->values[stats->numValues].value = sorted[i];
+			stats->values[stats->numValues].count = 1;
+			stats->numValues++;
+		}
+	}
+	free(sorted);
+	qsort(stats->values, stats->numValues, sizeof(FieldValue),
+		CompareValueCounts);
+
+	stats->corrFrames = Correlate(records, numRecords, field,
+		offsetof(SpriteRecord, numFrames));
+	stats->corrWidth = Correlate(records, numRecords, field,
+		offsetof(SpriteRecord, width));
+	stats->corrHeight = Correlate(records, numRecords, field,
+		offsetof(SpriteRecord, height));
+	stats->corrVersion = Correlate(records, numRecords, field,
+		offsetof(SpriteRecord, version));
+	return MHK_OK;
+}
+
+void FreeFieldStats(FieldStats* stats)
+{
+	free(stats->values);
+	stats->values = NULL;
+}
+
+/* Runs on a worker thread.  */
+static void RecordJobFunc(void* arg)
+{
+	RecordJob* job = (RecordJob*)arg;
+	SpriteRecord* rec = job->record;
+	MhkSprite spr;
+	unsigned i;
+
+	rec->error = ParseSprite(job->file->data, job->file->size, &spr);
+	if (rec->error != MHK_OK)
+		return;
+	rec->numFrames = spr.numFrames;
+	rec->version = spr.version;
+	for (i = 0; i < SPR_NUM_UNKNOWN; i++)
+		rec->unknown[i] = spr.unknown[i];
+	GetSpriteBounds(&spr, &rec->width, &rec->height);
+	FreeSprite(&spr);
+}
+
+/* Returns the Pearson correlation between unknown field "field" and
+   the unsigned member at "offset" of the records without errors.  The
+   means are taken first, so that the sums of squares stay small.  */
+static double Correlate(const SpriteRecord* records, unsigned numRecords,
+	unsigned field, size_t offset)
+{
+	double meanX = 0, meanY = 0;
+	double sxy = 0, sxx = 0, syy = 0;
+	unsigned n = 0;
+	unsigned i;
+
+	for (i = 0; i < numRecords; i++)
+	{
+		if (records[i].error != MHK_OK)
+			continue;
+		meanX += records[i].unknown[field];
+		meanY += *(const unsigned*)((const char*)&records[i] + offset);
+		n++;
+	}
+	if (n < 2)
+		return 0;
+	meanX /= n;
+	meanY /= n;
+	for (i = 0; i < numRecords; i++)
+	{
+		double dx, dy;
+		if (records[i].error != MHK_OK)
+			continue;
+		dx = records[i].unknown[field] - meanX;
+		dy = *(const unsigned*)((const char*)&records[i] + offset) - meanY;
+		sxy += dx * dy;
+		sxx += dx * dx;
+		syy += dy * dy;
+	}
+	if (sxx == 0 || syy == 0)
+		return 0;
+	return sxy / sqrt(sxx * syy);
+}
+
+static int CompareUnsigned(const void* a, const void* b)
+{
+	unsigned ua = *(const unsigned*)a;
+	unsigned ub = *(const unsigned*)b;
+	return ua < ub ? -1 : (ua > ub);
+}
+
+/* Sorts the most frequent values first, and equally frequent values
+   in increasing order.  */
+static int CompareValueCounts(const void* a, const void* b)
+{
+	const FieldValue* va = (const FieldValue*)a;
+	const FieldValue* vb = (const FieldValue*)b;
+	if (va->count != vb->count)
+		return va->count > vb->count ? -1 : 1;
+	return va->value < vb->value ? -1 : (va->value > vb->value);
+}
@@ -0,0 +1,59 @@
+/* Sprite header statistics interface */
+/* Include "bool.h", "MhkArchive.h", "MhkBitmap.h", "WorkPool.h", and
+   "MhkSprite.h" before this header.  */
+
+#ifndef SPRITESTATS_H
+#define SPRITESTATS_H
+
+typedef struct SpriteRecord_t SpriteRecord;
+typedef struct FieldValue_t FieldValue;
+typedef struct FieldStats_t FieldStats;
+
+/* The header of one tSPR resource and what it is compared with.  */
+struct SpriteRecord_t
+{
+	const char* archive;
+	unsigned short id;
+	int error; /* MhkError code, the rest is only valid if MHK_OK */
+	unsigned numFrames;
+	unsigned version;
+	unsigned width; /* Of the largest frame */
+	unsigned height;
+	unsigned unknown[SPR_NUM_UNKNOWN];
+};
+
+struct FieldValue_t
+{
+	unsigned value;
+	unsigned count;
+};
+
+/* Statistics of one unknown header field over all the sprites that
+   could be read.  The correlations are Pearson coefficients, and zero
+   where either side never changes.  */
+struct FieldStats_t
+{
+	unsigned field; /* Zero-based, "Unknown 1" is zero */
+	unsigned numSprites;
+	unsigned minValue, maxValue;
+	double mean;
+	double corrFrames;
+	double corrWidth;
+	double corrHeight;
+	double corrVersion;
+	/* Sprites where the field equals the frame count or dimension */
+	unsigned eqFrames;
+	unsigned eqWidth;
+	unsigned eqHeight;
+	unsigned numValues; /* Distinct values */
+	FieldValue* values; /* Most frequent first */
+};
+
+int CollectSpriteRecords(MhkArchive* const* archives,
+	const char* const* names, unsigned numArchives, WorkPool* pool,
+	SpriteRecord** records, unsigned* numRecords);
+int ComputeFieldStats(const SpriteRecord* records, unsigned numRecords,
+	unsigned field, FieldStats* stats);
+void FreeFieldStats(FieldStats* stats);
+
+#endif /* not SPRITESTATS_H */
@@ -0,0 +1,629 @@
+/* Sprite view window */
+/* Shows one frame of a sprite at a time, centered in the window.
+   While stopped, the frames are stepped through with the arrow keys
+   or the buttons of the sprite parameters dialog.  Space starts
+   playback at SPRITEVIEW_FPS frames per second from the current frame (see
+   SpritePlayer.c).  The playback counters are drawn in the top left
+   corner, and stay there after playback stops so that they can be
+   read.
+
+   Frames are decoded only when they are needed.  Opening a sprite
+   decodes the first frame, and every step decodes the new frame right
+   away unless it is cached.  A frame that is already queued is not
+   decoded twice; the background shows until its job is done.  After
+   that, the frames up to
+   PREFETCH_RANGE steps away in either direction are decoded on worker
+   threads, so that the next steps are instant.  The decoded frames
+   are kept until they take up more than CACHE_BYTES, and then the
+   least recently shown frames outside the prefetch range are freed,
+   so memory stays flat however many frames the sprite has.
+
+   As in the thumbnail view, each job works on a copy of its frame's
+   data, and jobs for frames that leave the prefetch range are
+   canceled.  The cache itself belongs to the window thread.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "PalExpand.h"
+#include "BmpDecode.h"
+#include "WorkPool.h"
+#include "MhkSprite.h"
+#include "SpritePlayer.h"
+#include "SpriteView.h"
+
+#define PREFETCH_RANGE 2
+#define CACHE_BYTES (24L << 20) /* Decoded frames kept per sprite */
+#define MAX_JOBS 16 /* Including canceled jobs that have not returned */
+
+/* Posted by the player's timer.  */
+#define WM_SPRITETICK WM_APP
+/* Posted by a worker when a job is done, with the job in lParam.  */
+#define WM_FRAMEDONE (WM_APP + 1)
+
+enum FrameState
+{
+	FS_NONE, /* Not decoded and no job */
+	FS_QUEUED,
+	FS_DONE,
+	FS_FAILED /* Not a frame that can be decoded */
+};
+
+typedef struct CachedFrame_t CachedFrame;
+typedef struct FrameJob_t FrameJob;
+typedef struct SpriteView_t SpriteView;
+
+struct CachedFrame_t
+{
+	PalColor* pixels; /* Top-down, "width" pixels a row, or NULL */
+	unsigned short width, height;
+	unsigned char state;
+	unsigned long lastUse;
+};
+
+struct FrameJob_t
+{
+	HWND hwnd;
+	unsigned frame;
+	unsigned char* data; /* Copy of the frame's tBMP resource */
+	size_t size;
+	volatile LONG canceled;
+	int error;
+	unsigned width, height;
+	PalColor* pixels;
+};
+
+struct SpriteView_t
+{
+	MhkSprite sprite;
+	bool hasSprite;
+	unsigned frame;
+	CachedFrame* frames; /* One for every frame of the sprite */
+	unsigned long cacheBytes;
+	unsigned numCached;
+	unsigned long useClock;
+	WorkPool* pool;
+	FrameJob* jobs[MAX_JOBS]; /* Submitted and not yet returned */
+	unsigned numJobs;
+	SpritePlayer* player; /* NULL while stopped */
+	SpritePlayStats stats; /* Of the last playback */
+	bool haveStats;
+};
+
+LRESULT CALLBACK SpriteViewProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam);
+static void PaintSpriteView(HWND hwnd, SpriteView* view);
+static CachedFrame* ShowFrame(HWND hwnd, SpriteView* view, unsigned index);
+static void DecodeFrame(SpriteView* view, unsigned index);
+static void PrefetchFrames(HWND hwnd, SpriteView* view);
+static void StartFrameJob(HWND hwnd, SpriteView* view, unsigned index);
+static void FrameWork(void* arg);
+static void FinishFrameJob(HWND hwnd, SpriteView* view, FrameJob* job);
+static void StoreFrame(SpriteView* view, unsigned index, PalColor* pixels,
+	unsigned width, unsigned height);
+static void TrimFrameCache(SpriteView* view);
+static unsigned FrameDistance(const SpriteView* view, unsigned a,
+	unsigned b);
+static void FreeFrames(SpriteView* view);
+static void StopPlayback(SpriteView* view);
+static void NotifyParent(HWND hwnd, unsigned code);
+
+BOOL RegisterSpriteView(HINSTANCE hInstance)
+{
+	WNDCLASSEX wcex;
+	wcex.cbSize = sizeof(WNDCLASSEX);
+	wcex.style = 0;
+	wcex.lpfnWndProc = SpriteViewProc;
+	wcex.cbClsExtra = 0;
+	wcex.cbWndExtra = 0;
+	wcex.hInstance = hInstance;
+	wcex.hIcon = NULL;
+	wcex.hCursor = LoadCursor(NULL, IDC_ARROW);
+	wcex.hbrBackground = NULL;
+	wcex.lpszMenuName = NULL;
+	wcex.lpszClassName = SPRITEVIEW_CLASS;
+	wcex.hIconSm = NULL;
+	return RegisterClassEx(&wcex) != 0;
+}
+
+/* Shows the first frame of a sprite, or nothing if "spr" is NULL.
+   The view takes over "spr" and frees it with FreeSprite() when it is
+   done with it.  The sprite's resource data must stay valid until the
+   view is given another sprite.  */
+void SetSpriteViewSprite(HWND hwnd, MhkSprite* spr)
+{
+	SpriteView* view = (SpriteView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (view == NULL)
+	{
+		if (spr != NULL)
+			FreeSprite(spr);
+		return;
+	}
+	StopPlayback(view);
+	FreeFrames(view);
+	if (view->hasSprite)
+		FreeSprite(&view->sprite);
+	view->hasSprite = false;
+	view->haveStats = false;
+	view->frame = 0;
+	if (spr != NULL && spr->numFrames > 0)
+	{
+		view->frames = (CachedFrame*)calloc(spr->numFrames,
+											sizeof(CachedFrame));
+		if (view->frames != NULL)
+		{
+			view->sprite = *spr;
+			view->hasSprite = true;
+			ShowFrame(hwnd, view, 0);
+		}
+	}
+	if (spr != NULL && !view->hasSprite)
+		FreeSprite(spr);
+	InvalidateRect(hwnd, NULL, FALSE);
+}
+
+/* Steps to another frame.  Playback stops first.  */
+void SetSpriteViewFrame(HWND hwnd, unsigned index)
+{
+	SpriteView* view = (SpriteView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (view == NULL || !view->hasSprite || index >= view->sprite.numFrames)
+		return;
+	if (view->player != NULL)
+	{
+		StopPlayback(view);
+		NotifyParent(hwnd, SPN_PLAY);
+	}
+	ShowFrame(hwnd, view, index);
+	InvalidateRect(hwnd, NULL, FALSE);
+	NotifyParent(hwnd, SPN_FRAME);
+}
+
+unsigned GetSpriteViewFrame(HWND hwnd)
+{
+	SpriteView* view = (SpriteView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (view == NULL)
+		return 0;
+	return view->frame;
+}
+
+/* Starts or stops playback.  Stopping keeps the frame that was on
+   display.  */
+void PlaySpriteView(HWND hwnd, bool play)
+{
+	SpriteView* view = (SpriteView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (view == NULL || !view->hasSprite || play == (view->player != NULL))
+		return;
+	if (play)
+	{
+		view->player = CreateSpritePlayer(&view->sprite, view->frame,
+			SPRITEVIEW_FPS, hwnd, WM_SPRITETICK);
+		if (view->player == NULL)
+			return;
+		view->haveStats = false;
+	}
+	else
+	{
+		StopPlayback(view);
+		ShowFrame(hwnd, view, view->frame);
+	}
+	InvalidateRect(hwnd, NULL, FALSE);
+	NotifyParent(hwnd, SPN_PLAY);
+}
+
+bool IsSpriteViewPlaying(HWND hwnd)
+{
+	SpriteView* view = (SpriteView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	return view != NULL && view->player != NULL;
+}
+
+LRESULT CALLBACK SpriteViewProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam)
+{
+	SpriteView* view = (SpriteView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	switch (uMsg)
+	{
+	case WM_CREATE:
+		view = (SpriteView*)calloc(1, sizeof(SpriteView));
+		if (view == NULL)
+			return -1;
+		/* Two threads keep ahead of stepping in both directions.  */
+		view->pool = CreateWorkPool(2);
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)view);
+		return 0;
+	case WM_DESTROY:
+	{
+		unsigned i;
+		/* Let the workers drain the queue before freeing the jobs.
+		   Their completion messages are dropped with the window.  */
+		StopPlayback(view);
+		FreeFrames(view);
+		if (view->hasSprite)
+			FreeSprite(&view->sprite);
+		FreeWorkPool(view->pool);
+		for (i = 0; i < view->numJobs; i++)
+		{
+			free(view->jobs[i]->pixels);
+			free(view->jobs[i]);
+		}
+		free(view);
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+		return 0;
+	}
+	case WM_FRAMEDONE:
+		if (view != NULL)
+			FinishFrameJob(hwnd, view, (FrameJob*)lParam);
+		return 0;
+	case WM_SPRITETICK:
+	{
+		const PalColor* pixels;
+		unsigned index, width, height;
+		size_t stride;
+
+		/* A tick can arrive after playback has stopped.  */
+		if (view == NULL || view->player == NULL ||
+			!AdvanceSpritePlayer(view->player))
+			return 0;
+		pixels = GetSpritePlayerFrame(view->player, &index, &width, &height,
+			&stride);
+		InvalidateRect(hwnd, NULL, FALSE);
+		/* Present right away rather than whenever the queue is
+		   empty.  */
+		UpdateWindow(hwnd);
+		if (pixels != NULL && index != view->frame)
+		{
+			view->frame = index;
+			NotifyParent(hwnd, SPN_FRAME);
+		}
+		return 0;
+	}
+	case WM_ERASEBKGND:
+		return 1;
+	case WM_PAINT:
+		PaintSpriteView(hwnd, view);
+		return 0;
+	case WM_LBUTTONDOWN:
+		SetFocus(hwnd);
+		return 0;
+	case WM_KEYDOWN:
+		if (view == NULL || !view->hasSprite || view->sprite.numFrames == 0)
+			break;
+		switch (wParam)
+		{
+		case VK_SPACE:
+			PlaySpriteView(hwnd, view->player == NULL);
+			return 0;
+		case VK_LEFT:
+			SetSpriteViewFrame(hwnd, (view->frame + view->sprite.numFrames -
+				1) % view->sprite.numFrames);
+			return 0;
+		case VK_RIGHT:
+			SetSpriteViewFrame(hwnd,
+				(view->frame + 1) % view->sprite.numFrames);
+			return 0;
+		}
+		break;
+	}
+	return DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
+
+static void PaintSpriteView(HWND hwnd, SpriteView* view)
+{
+	PAINTSTRUCT ps;
+	const PalColor* pixels = NULL;
+	unsigned index = view->frame;
+	unsigned width = 0, height = 0;
+	size_t stride = 0;
+	char text[200];
+	RECT rt;
+
+	BeginPaint(hwnd, &ps);
+	GetClientRect(hwnd, &rt);
+	if (view->player != NULL)
+		pixels = GetSpritePlayerFrame(view->player, &index, &width,
+			&height, &stride);
+	else if (view->hasSprite && view->frames[index].state == FS_DONE)
+	{
+		CachedFrame* frame = &view->frames[index];
+		pixels = frame->pixels;
+		width = frame->width;
+		height = frame->height;
+		stride = (size_t)width * sizeof(PalColor);
+	}
+
+	/* Draw the frame first and keep the background fill off it, so
+	   that playback does not flicker.  */
+	if (pixels != NULL && width > 0 && height > 0)
+	{
+		BITMAPINFO bmi;
+		int left = (rt.right - (int)width) / 2;
+		int top = (rt.bottom - (int)height) / 2;
+		memset(&bmi, 0, sizeof(bmi));
+		bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		bmi.bmiHeader.biWidth = (LONG)(stride / sizeof(PalColor));
+		bmi.bmiHeader.biHeight = -(LONG)height; /* Top-down */
+		bmi.bmiHeader.biPlanes = 1;
+		bmi.bmiHeader.biBitCount = 32;
+		bmi.bmiHeader.biCompression = BI_RGB;
+		SetDIBitsToDevice(ps.hdc, left, top, width, height, 0, 0, 0, height,
+			pixels, &bmi, DIB_RGB_COLORS);
+		ExcludeClipRect(ps.hdc, left, top, left + width, top + height);
+	}
+	FillRect(ps.hdc, &ps.rcPaint, GetSysColorBrush(COLOR_APPWORKSPACE));
+	SelectClipRgn(ps.hdc, NULL);
+
+	if (view->hasSprite)
+	{
+		SpritePlayStats* stats = &view->stats;
+		int len;
+		if (view->player != NULL)
+		{
+			GetSpritePlayStats(view->player, stats);
+			view->haveStats = true;
+		}
+		len = sprintf(text, "Frame %u of %u", index + 1,
+			view->sprite.numFrames);
+		if (view->haveStats)
+			len += sprintf(text + len, "  %s %.1f fps, %lu dropped, "
+				"decode %.2f ms average, %.2f ms max",
+				view->player != NULL ? "Playing" : "Played", stats->fps,
+				stats->dropped, stats->decodeAvgMs, stats->decodeMaxMs);
+		else
+			len += sprintf(text + len, "  (Space plays)");
+		len += sprintf(text + len, "  %u cached, %lu KB", view->numCached,
+			view->cacheBytes >> 10);
+		SelectObject(ps.hdc, GetStockObject(DEFAULT_GUI_FONT));
+		SetBkColor(ps.hdc, GetSysColor(COLOR_WINDOW));
+		SetTextColor(ps.hdc, GetSysColor(COLOR_WINDOWTEXT));
+		TextOut(ps.hdc, 4, 4, text, len);
+	}
+	EndPaint(hwnd, &ps);
+}
+
+/* Makes "index" the current frame, decoding it now unless it is
+   cached or queued, and starts decoding its neighbors.  Returns NULL
+   if the frame is not decoded yet.  */
+static CachedFrame* ShowFrame(HWND hwnd, SpriteView* view, unsigned index)
+{
+	CachedFrame* frame = &view->frames[index];
+	view->frame = index;
+	/* A frame that is still queued is left to its job, and the
+	   background is drawn until the job is done.  */
+	if (frame->state == FS_NONE)
+		DecodeFrame(view, index);
+	frame->lastUse = ++view->useClock;
+	PrefetchFrames(hwnd, view);
+	TrimFrameCache(view);
+	return frame->state == FS_DONE ? frame : NULL;
+}
+
+/* Decodes a frame on the window thread and caches it.  */
+static void DecodeFrame(SpriteView* view, unsigned index)
+{
+	PalColor* pixels = NULL;
+	MhkBitmap bmp;
+
+	if (GetSpriteFrame(&view->sprite, index, &bmp) == MHK_OK)
+	{
+		pixels = (PalColor*)malloc(
+			(size_t)bmp.width * bmp.height * sizeof(PalColor) + 1);
+		if (pixels != NULL && DecodeBitmapRgb(&bmp, pixels,
+			(size_t)bmp.width * sizeof(PalColor)) != MHK_OK)
+		{
+			free(pixels);
+			pixels = NULL;
+		}
+	}
+	if (pixels == NULL)
+		view->frames[index].state = FS_FAILED;
+	else
+		StoreFrame(view, index, pixels, bmp.width, bmp.height);
+}
+
+/* Cancels the jobs for frames that are too far from the current one
+   now, then queues the frames around it, nearest first.  */
+static void PrefetchFrames(HWND hwnd, SpriteView* view)
+{
+	unsigned numFrames = view->sprite.numFrames;
+	unsigned d, i;
+
+	for (i = 0; i < view->numJobs; i++)
+	{
+		FrameJob* job = view->jobs[i];
+		if (!job->canceled &&
+			FrameDistance(view, job->frame, view->frame) > PREFETCH_RANGE)
+		{
+			InterlockedExchange(&job->canceled, 1);
+			view->frames[job->frame].state = FS_NONE;
+		}
+	}
+	for (d = 1; d <= PREFETCH_RANGE; d++)
+	{
+		StartFrameJob(hwnd, view, (view->frame + d) % numFrames);
+		StartFrameJob(hwnd, view,
+			(view->frame + numFrames - d % numFrames) % numFrames);
+	}
+}
+
+static void StartFrameJob(HWND hwnd, SpriteView* view, unsigned index)
+{
+	const unsigned char* data;
+	FrameJob* job;
+	size_t size;
+
+	if (view->frames[index].state != FS_NONE || view->numJobs >= MAX_JOBS ||
+		GetSpriteFrameData(&view->sprite, index, &data, &size) != MHK_OK)
+		return;
+	job = (FrameJob*)calloc(1, sizeof(FrameJob));
+	if (job == NULL)
+		return;
+	job->data = (unsigned char*)malloc(size);
+	if (job->data == NULL)
+	{
+		free(job);
+		return;
+	}
+	memcpy(job->data, data, size);
+	job->size = size;
+	job->hwnd = hwnd;
+	job->frame = index;
+	view->frames[index].state = FS_QUEUED;
+	view->jobs[view->numJobs++] = job;
+	SubmitWork(view->pool, FrameWork, job);
+}
+
+/* Runs on a worker thread.  */
+static void FrameWork(void* arg)
+{
+	FrameJob* job = (FrameJob*)arg;
+	MhkBitmap bmp;
+
+	if (!job->canceled)
+	{
+		job->error = ParseBitmap(job->data, job->size, &bmp);
+		if (job->error == MHK_OK)
+		{
+			job->pixels = (PalColor*)malloc(
+				(size_t)bmp.width * bmp.height * sizeof(PalColor) + 1);
+			if (job->pixels == NULL)
+				job->error = MHK_ENOMEM;
+			else
+				job->error = DecodeBitmapRgb(&bmp, job->pixels,
+					(size_t)bmp.width * sizeof(PalColor));
+			job->width = bmp.width;
+			job->height = bmp.height;
+		}
+	}
+	free(job->data);
+	job->data = NULL;
+	PostMessage(job->hwnd, WM_FRAMEDONE, 0, (LPARAM)job);
+}
+
+static void FinishFrameJob(HWND hwnd, SpriteView* view, FrameJob* job)
+{
+	unsigned i;
+
+	for (i = 0; i < view->numJobs; i++)
+	{
+		if (view->jobs[i] == job)
+		{
+			view->jobs[i] = view->jobs[--view->numJobs];
+			break;
+		}
+	}
+	if (!job->canceled && view->frames[job->frame].state == FS_QUEUED)
+	{
+		if (job->error != MHK_OK)
+		{
+			free(job->pixels);
+			job->pixels = NULL;
+		}
+		StoreFrame(view, job->frame, job->pixels, job->width, job->height);
+		job->pixels = NULL;
+		TrimFrameCache(view);
+		if (job->frame == view->frame && view->player == NULL)
+			InvalidateRect(hwnd, NULL, FALSE);
+	}
+	free(job->pixels);
+	free(job);
+	/* A slot is free again, so queue anything that did not fit.  */
+	if (view->hasSprite)
+		PrefetchFrames(hwnd, view);
+}
+
+/* Takes over "pixels", which is NULL if the frame failed.  */
+static void StoreFrame(SpriteView* view, unsigned index, PalColor* pixels,
+	unsigned width, unsigned height)
+{
+	CachedFrame* frame = &view->frames[index];
+	if (pixels == NULL)
+	{
+		frame->state = FS_FAILED;
+		return;
+	}
+	frame->pixels = pixels;
+	frame->width = (unsigned short)width;
+	frame->height = (unsigned short)height;
+	frame->state = FS_DONE;
+	frame->lastUse = view->useClock;
+	view->cacheBytes += (unsigned long)width * height * sizeof(PalColor);
+	view->numCached++;
+}
+
+/* Frees the least recently shown frames outside the prefetch range
+   until the cache fits in CACHE_BYTES.  */
+static void TrimFrameCache(SpriteView* view)
+{
+	while (view->cacheBytes > CACHE_BYTES)
+	{
+		CachedFrame* oldest = NULL;
+		unsigned i;
+		for (i = 0; i < view->sprite.numFrames; i++)
+		{
+			CachedFrame* frame = &view->frames[i];
+			if (frame->state == FS_DONE &&
+				FrameDistance(view, i, view->frame) > PREFETCH_RANGE &&
+				(oldest == NULL || frame->lastUse < oldest->lastUse))
+				oldest = frame;
+		}
+		if (oldest == NULL)
+			break;
+		view->cacheBytes -= (unsigned long)oldest->width * oldest->height *
+			sizeof(PalColor);
+		view->numCached--;
+		free(oldest->pixels);
+		oldest->pixels = NULL;
+		oldest->state = FS_NONE;
+	}
+}
+
+/* Returns the number of steps between two frames, counting the steps
+   that wrap around from the last frame to the first.  */
+static unsigned FrameDistance(const SpriteView* view, unsigned a,
+	unsigned b)
+{
+	unsigned d = a > b ? a - b : b - a;
+	if (d > view->sprite.numFrames - d)
+		d = view->sprite.numFrames - d;
+	return d;
+}
+
+/* Cancels all jobs and frees the cache.  */
+static void FreeFrames(SpriteView* view)
+{
+	unsigned i;
+	for (i = 0; i < view->numJobs; i++)
+		InterlockedExchange(&view->jobs[i]->canceled, 1);
+	if (view->frames != NULL)
+	{
+		for (i = 0; i < view->sprite.numFrames; i++)
+			free(view->frames[i].pixels);
+		free(view->frames);
+		view->frames = NULL;
+	}
+	view->cacheBytes = 0;
+	view->numCached = 0;
+}
+
+/* Frees the player, keeping its counters.  */
+static void StopPlayback(SpriteView* view)
+{
+	if (view->player == NULL)
+		return;
+	GetSpritePlayStats(view->player, &view->stats);
+	view->haveStats = true;
+	FreeSpritePlayer(view->player);
+	view->player = NULL;
+}
+
+static void NotifyParent(HWND hwnd, unsigned code)
+{
+	SendMessage(GetParent(hwnd), WM_COMMAND,
+		MAKEWPARAM(GetDlgCtrlID(hwnd), code), (LPARAM)hwnd);
+}
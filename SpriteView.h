@@ -0,0 +1,26 @@
+/* Sprite view window interface */
+/* This is platform dependent code: include windows.h, "bool.h",
+   "MhkBitmap.h", and "MhkSprite.h" before this header.  */
+
+#ifndef SPRITEVIEW_H
+#define SPRITEVIEW_H
+
+#define SPRITEVIEW_CLASS "MhkSpriteView"
+#define SPRITEVIEW_FPS 60 /* Playback rate */
+
+/* Notification codes sent to the parent window in WM_COMMAND, with
+   the view's control ID.  */
+enum SpriteViewNotify
+{
+	SPN_FRAME = 1, /* Another frame is on display */
+	SPN_PLAY /* Playback started or stopped */
+};
+
+BOOL RegisterSpriteView(HINSTANCE hInstance);
+void SetSpriteViewSprite(HWND hwnd, MhkSprite* spr);
+void SetSpriteViewFrame(HWND hwnd, unsigned index);
+unsigned GetSpriteViewFrame(HWND hwnd);
+void PlaySpriteView(HWND hwnd, bool play);
+bool IsSpriteViewPlaying(HWND hwnd);
+
+#endif /* not SPRITEVIEW_H */
@@ -0,0 +1,708 @@
+/* Thumbnail grid window */
+/* Shows the bitmaps of one resource type as a grid of thumbnails.
+   Only the rows on screen are painted, and only the items on screen
+   and a page above and below them have thumbnails made, so a type
+   with thousands of bitmaps opens as quickly as one with a few.
+
+   Thumbnails are made on a pool of worker threads.  The items on
+   screen are queued first, then the page below, then the page above.
+   At most two jobs per thread are queued at a time, so that jobs for
+   items that were scrolled past do not hold up the ones that are now
+   visible.  Jobs for items that leave the prefetch area are canceled:
+   the pool cannot take back queued work, so a canceled job still runs
+   but returns at once.  Thumbnails far from the visible area are
+   freed again, which keeps memory bounded however far the grid is
+   scrolled.
+
+   Finished thumbnails are written to a cache file keyed by the
+   resource contents (see Thumbnail.c), shared by all archives.  The
+   workers use the cache under a lock; everything else belongs to the
+   window thread.  Each job works on a copy of the resource data, so
+   the archive may change or go away while jobs are running.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "PalExpand.h"
+#include "WorkPool.h"
+#include "RecordCache.h"
+#include "Thumbnail.h"
+#include "ScrollBar.h"
+#include "ThumbView.h"
+
+#ifndef WM_MOUSEWHEEL
+#define WM_MOUSEWHEEL 0x020A
+#define WHEEL_DELTA 120
+#endif
+
+#define THUMB_SIZE 96
+#define CELL_PAD 8
+#define LABEL_HEIGHT 16
+#define CELL_WIDTH (THUMB_SIZE + CELL_PAD * 2)
+#define CELL_HEIGHT (THUMB_SIZE + CELL_PAD * 2 + LABEL_HEIGHT)
+#define SCROLL_LINE (CELL_HEIGHT / 4)
+#define MAX_JOBS 64 /* Including canceled jobs that have not returned */
+#define KEEP_PAGES 4 /* Pages above and below that keep thumbnails */
+
+/* Posted by a worker when a job is done, with the job in lParam.  */
+#define WM_THUMBDONE WM_APP
+
+enum ThumbState
+{
+	TS_NONE, /* No thumbnail and no job */
+	TS_QUEUED,
+	TS_DONE,
+	TS_FAILED /* Not a bitmap that can be decoded */
+};
+
+typedef struct ThumbItem_t ThumbItem;
+typedef struct ThumbJob_t ThumbJob;
+typedef struct ThumbView_t ThumbView;
+
+struct ThumbItem_t
+{
+	PalColor* pixels; /* Top-down, or NULL */
+	unsigned short width, height;
+	unsigned char state;
+};
+
+struct ThumbJob_t
+{
+	HWND hwnd;
+	ThumbView* view;
+	unsigned item;
+	unsigned char* data; /* Copy of the resource */
+	size_t size;
+	volatile LONG canceled;
+	int error;
+	unsigned width, height;
+	PalColor pixels[THUMB_SIZE * THUMB_SIZE];
+};
+
+struct ThumbView_t
+{
+	MhkArchive* archive;
+	unsigned first; /* Archive index of the first item */
+	unsigned count;
+	ThumbItem* items;
+	int selected; /* Item index, or -1 */
+	int yPos; /* Scroll position */
+	int clientWidth, clientHeight;
+	unsigned columns;
+	ThumbCache* cache; /* NULL if the cache file can't be used */
+	CRITICAL_SECTION cacheLock;
+	WorkPool* pool;
+	ThumbJob* jobs[MAX_JOBS]; /* Submitted and not yet returned */
+	unsigned numJobs;
+	unsigned maxActive; /* Most jobs that are not canceled */
+};
+
+LRESULT CALLBACK ThumbViewProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam);
+static void PaintThumbView(HWND hwnd, ThumbView* view);
+static void DrawThumbCell(HDC hdc, HWND hwnd, ThumbView* view,
+	unsigned index, const RECT* cell);
+static void ScheduleThumbs(HWND hwnd, ThumbView* view);
+static bool QueueThumbs(HWND hwnd, ThumbView* view, int start, int end,
+	int step);
+static void StartThumbJob(HWND hwnd, ThumbView* view, unsigned index);
+static void ThumbWork(void* arg);
+static void FinishThumbJob(HWND hwnd, ThumbView* view, ThumbJob* job);
+static void CancelThumbJobs(ThumbView* view);
+static void FreeThumbItems(ThumbView* view);
+static void SelectThumb(HWND hwnd, ThumbView* view, int index);
+static void HandleThumbKey(HWND hwnd, ThumbView* view, WPARAM key);
+static int ThumbFromPoint(const ThumbView* view, int x, int y);
+static void GetThumbCellRect(const ThumbView* view, unsigned index,
+	RECT* rt);
+static void InvalidateThumb(HWND hwnd, const ThumbView* view, int index);
+static void UpdateScrollBars(HWND hwnd, ThumbView* view);
+static void ScrollThumbView(HWND hwnd, ThumbView* view, int newY);
+static void NotifyParent(HWND hwnd, unsigned code);
+
+BOOL RegisterThumbView(HINSTANCE hInstance)
+{
+	WNDCLASSEX wcex;
+	wcex.cbSize = sizeof(WNDCLASSEX);
+	wcex.style = CS_DBLCLKS;
+	wcex.lpfnWndProc = ThumbViewProc;
+	wcex.cbClsExtra = 0;
+	wcex.cbWndExtra = 0;
+	wcex.hInstance = hInstance;
+	wcex.hIcon = NULL;
+	wcex.hCursor = LoadCursor(NULL, IDC_ARROW);
+	wcex.hbrBackground = NULL;
+	wcex.lpszMenuName = NULL;
+	wcex.lpszClassName = THUMBVIEW_CLASS;
+	wcex.hIconSm = NULL;
+	return RegisterClassEx(&wcex) != 0;
+}
+
+/* Shows "count" resources starting at archive index "first", which
+   should all be bitmaps.  The archive must stay loaded until the view
+   is given other items; pass NULL to clear the view.  */
+void SetThumbViewItems(HWND hwnd, MhkArchive* archive, unsigned first,
+	unsigned count)
+{
+	ThumbView* view = (ThumbView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (view == NULL)
+		return;
+	CancelThumbJobs(view);
+	FreeThumbItems(view);
+	if (archive == NULL)
+		count = 0;
+	view->items = NULL;
+	if (count > 0)
+		view->items = (ThumbItem*)calloc(count, sizeof(ThumbItem));
+	if (view->items == NULL)
+		count = 0;
+	view->archive = archive;
+	view->first = first;
+	view->count = count;
+	view->selected = -1;
+	view->yPos = 0;
+	UpdateScrollBars(hwnd, view);
+	InvalidateRect(hwnd, NULL, FALSE);
+	ScheduleThumbs(hwnd, view);
+}
+
+/* Returns the archive index of the selected item, or -1.  */
+int GetThumbViewSelection(HWND hwnd)
+{
+	ThumbView* view = (ThumbView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (view == NULL || view->selected < 0)
+		return -1;
+	return (int)view->first + view->selected;
+}
+
+LRESULT CALLBACK ThumbViewProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam)
+{
+	ThumbView* view = (ThumbView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	switch (uMsg)
+	{
+	case WM_CREATE:
+	{
+		/* The creation parameter is the name of the cache file.  */
+		CREATESTRUCT* cs = (CREATESTRUCT*)lParam;
+		unsigned maxActive;
+		view = (ThumbView*)malloc(sizeof(ThumbView));
+		if (view == NULL)
+			return -1;
+		memset(view, 0, sizeof(ThumbView));
+		view->selected = -1;
+		view->columns = 1;
+		InitializeCriticalSection(&view->cacheLock);
+		if (cs->lpCreateParams != NULL)
+			view->cache = OpenThumbCache((const char*)cs->lpCreateParams,
+				THUMB_SIZE, NULL);
+		view->pool = CreateWorkPool(0);
+		maxActive = WorkPoolSize(view->pool) * 2;
+		if (maxActive > MAX_JOBS / 2)
+			maxActive = MAX_JOBS / 2;
+		view->maxActive = maxActive;
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)view);
+		return 0;
+	}
+	case WM_DESTROY:
+	{
+		unsigned i;
+		/* Let the workers drain the queue before freeing the jobs.
+		   Their completion messages are dropped with the window.  */
+		CancelThumbJobs(view);
+		FreeWorkPool(view->pool);
+		for (i = 0; i < view->numJobs; i++)
+			free(view->jobs[i]);
+		FreeThumbItems(view);
+		CloseThumbCache(view->cache);
+		DeleteCriticalSection(&view->cacheLock);
+		free(view);
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+		return 0;
+	}
+	case WM_THUMBDONE:
+		if (view != NULL)
+			FinishThumbJob(hwnd, view, (ThumbJob*)lParam);
+		return 0;
+	case WM_SIZE:
+	{
+		unsigned columns;
+		view->clientWidth = LOWORD(lParam);
+		view->clientHeight = HIWORD(lParam);
+		columns = view->clientWidth / CELL_WIDTH;
+		if (columns == 0)
+			columns = 1;
+		if (columns != view->columns)
+		{
+			view->columns = columns;
+			InvalidateRect(hwnd, NULL, FALSE);
+		}
+		UpdateScrollBars(hwnd, view);
+		/* Resizing can shift the scroll position.  */
+		ScrollThumbView(hwnd, view, view->yPos);
+		ScheduleThumbs(hwnd, view);
+		return 0;
+	}
+	case WM_ERASEBKGND:
+		return 1;
+	case WM_PAINT:
+		PaintThumbView(hwnd, view);
+		return 0;
+	case WM_VSCROLL:
+		ScrollThumbView(hwnd, view,
+			ScrollBarPos(hwnd, SB_VERT, LOWORD(wParam), SCROLL_LINE));
+		return 0;
+	case WM_MOUSEWHEEL:
+	{
+		UINT lines = 3;
+		SystemParametersInfo(SPI_GETWHEELSCROLLLINES, 0, &lines, 0);
+		ScrollThumbView(hwnd, view, view->yPos -
+			(short)HIWORD(wParam) * (int)lines * SCROLL_LINE / WHEEL_DELTA);
+		return 0;
+	}
+	case WM_LBUTTONDOWN:
+	case WM_LBUTTONDBLCLK:
+	{
+		int index = ThumbFromPoint(view,
+			(short)LOWORD(lParam), (short)HIWORD(lParam));
+		SetFocus(hwnd);
+		if (index < 0)
+			return 0;
+		SelectThumb(hwnd, view, index);
+		if (uMsg == WM_LBUTTONDBLCLK)
+			NotifyParent(hwnd, THN_OPEN);
+		return 0;
+	}
+	case WM_KEYDOWN:
+		HandleThumbKey(hwnd, view, wParam);
+		return 0;
+	case WM_SETFOCUS:
+	case WM_KILLFOCUS:
+		/* Redraw the focus rectangle.  */
+		InvalidateThumb(hwnd, view, view->selected);
+		return 0;
+	}
+	return DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
+
+/* Paints only the cells inside the update region.  */
+static void PaintThumbView(HWND hwnd, ThumbView* view)
+{
+	PAINTSTRUCT ps;
+	HFONT hOldFont;
+	int firstRow, lastRow, row;
+
+	BeginPaint(hwnd, &ps);
+	FillRect(ps.hdc, &ps.rcPaint, GetSysColorBrush(COLOR_WINDOW));
+	hOldFont = (HFONT)SelectObject(ps.hdc, GetStockObject(DEFAULT_GUI_FONT));
+	SetBkMode(ps.hdc, TRANSPARENT);
+	firstRow = (view->yPos + ps.rcPaint.top) / CELL_HEIGHT;
+	lastRow = (view->yPos + ps.rcPaint.bottom - 1) / CELL_HEIGHT;
+	for (row = firstRow; row <= lastRow; row++)
+	{
+		unsigned col;
+		for (col = 0; col < view->columns; col++)
+		{
+			unsigned index = row * view->columns + col;
+			RECT cell, clip;
+			if (index >= view->count)
+				break;
+			GetThumbCellRect(view, index, &cell);
+			if (IntersectRect(&clip, &cell, &ps.rcPaint))
+				DrawThumbCell(ps.hdc, hwnd, view, index, &cell);
+		}
+	}
+	SelectObject(ps.hdc, hOldFont);
+	EndPaint(hwnd, &ps);
+}
+
+static void DrawThumbCell(HDC hdc, HWND hwnd, ThumbView* view,
+	unsigned index, const RECT* cell)
+{
+	ThumbItem* item = &view->items[index];
+	MhkResource* rsrc = &view->archive->resources[view->first + index];
+	bool selected = ((int)index == view->selected);
+	char text[80];
+	RECT rt;
+
+	if (selected)
+	{
+		rt = *cell;
+		InflateRect(&rt, -2, -2);
+		FillRect(hdc, &rt, GetSysColorBrush(COLOR_HIGHLIGHT));
+		if (GetFocus() == hwnd)
+			DrawFocusRect(hdc, &rt);
+	}
+
+	rt.left = cell->left + CELL_PAD;
+	rt.top = cell->top + CELL_PAD;
+	rt.right = rt.left + THUMB_SIZE;
+	rt.bottom = rt.top + THUMB_SIZE;
+	if (item->state == TS_DONE)
+	{
+		BITMAPINFO bmi;
+		memset(&bmi, 0, sizeof(bmi));
+		bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		bmi.bmiHeader.biWidth = item->width;
+		bmi.bmiHeader.biHeight = -(LONG)item->height; /* Top-down */
+		bmi.bmiHeader.biPlanes = 1;
+		bmi.bmiHeader.biBitCount = 32;
+		bmi.bmiHeader.biCompression = BI_RGB;
+		SetDIBitsToDevice(hdc,
+			rt.left + (THUMB_SIZE - item->width) / 2,
+			rt.top + (THUMB_SIZE - item->height) / 2,
+			item->width, item->height, 0, 0, 0, item->height,
+			item->pixels, &bmi, DIB_RGB_COLORS);
+	}
+	else
+	{
+		/* Placeholder until the thumbnail arrives */
+		FrameRect(hdc, &rt, GetSysColorBrush(item->state == TS_FAILED ?
+			COLOR_BTNSHADOW : COLOR_BTNFACE));
+		if (item->state == TS_FAILED)
+		{
+			SetTextColor(hdc, GetSysColor(COLOR_GRAYTEXT));
+			DrawText(hdc, "?", 1, &rt, DT_CENTER | DT_VCENTER |
+					 DT_SINGLELINE);
+		}
+	}
+
+	if (rsrc->name != NULL)
+		wsprintf(text, "%u %.64s", rsrc->id, rsrc->name);
+	else
+		wsprintf(text, "%u", rsrc->id);
+	rt.left = cell->left + 4;
+	rt.right = cell->right - 4;
+	rt.top = cell->top + CELL_PAD + THUMB_SIZE;
+	rt.bottom = rt.top + LABEL_HEIGHT;
+	SetTextColor(hdc, GetSysColor(selected ? COLOR_HIGHLIGHTTEXT :
+		COLOR_WINDOWTEXT));
+	DrawText(hdc, text, -1, &rt, DT_CENTER | DT_VCENTER | DT_SINGLELINE |
+			 DT_NOPREFIX | DT_END_ELLIPSIS);
+}
+
+/* Cancels jobs that are no longer wanted, frees thumbnails that are
+   far away, and queues jobs for the visible items and those around
+   them, nearest first.  */
+static void ScheduleThumbs(HWND hwnd, ThumbView* view)
+{
+	int pageRows, firstRow, lastRow;
+	int visFirst, visEnd, preFirst, preEnd, keepFirst, keepEnd;
+	int cols = (int)view->columns;
+	unsigned i;
+
+	if (view->count == 0 || view->clientHeight <= 0)
+		return;
+	pageRows = view->clientHeight / CELL_HEIGHT + 1;
+	firstRow = view->yPos / CELL_HEIGHT;
+	lastRow = (view->yPos + view->clientHeight - 1) / CELL_HEIGHT;
+	visFirst = firstRow * cols;
+	visEnd = (lastRow + 1) * cols;
+	if (visEnd > (int)view->count) visEnd = (int)view->count;
+	if (visFirst > visEnd) visFirst = visEnd;
+	preFirst = visFirst - pageRows * cols;
+	preEnd = visEnd + pageRows * cols;
+	keepFirst = visFirst - KEEP_PAGES * pageRows * cols;
+	keepEnd = visEnd + KEEP_PAGES * pageRows * cols;
+	if (preEnd > (int)view->count) preEnd = (int)view->count;
+	if (preFirst < 0) preFirst = 0;
+
+	for (i = 0; i < view->numJobs; i++)
+	{
+		ThumbJob* job = view->jobs[i];
+		if (!job->canceled &&
+			((int)job->item < preFirst || (int)job->item >= preEnd))
+		{
+			InterlockedExchange(&job->canceled, 1);
+			view->items[job->item].state = TS_NONE;
+		}
+	}
+	for (i = 0; i < view->count; i++)
+	{
+		ThumbItem* item = &view->items[i];
+		if (item->state == TS_DONE &&
+			((int)i < keepFirst || (int)i >= keepEnd))
+		{
+			free(item->pixels);
+			item->pixels = NULL;
+			item->state = TS_NONE;
+		}
+	}
+
+	if (QueueThumbs(hwnd, view, visFirst, visEnd, 1) &&
+		QueueThumbs(hwnd, view, visEnd, preEnd, 1))
+		QueueThumbs(hwnd, view, visFirst - 1, preFirst - 1, -1);
+}
+
+/* Queues jobs for items from "start" up to but not including "end".
+   Returns false once no more jobs may be queued.  */
+static bool QueueThumbs(HWND hwnd, ThumbView* view, int start, int end,
+	int step)
+{
+	unsigned active = 0;
+	unsigned i;
+	int index;
+
+	for (i = 0; i < view->numJobs; i++)
+	{
+		if (!view->jobs[i]->canceled)
+			active++;
+	}
+	for (index = start; index != end; index += step)
+	{
+		if (view->items[index].state != TS_NONE)
+			continue;
+		if (active >= view->maxActive || view->numJobs >= MAX_JOBS)
+			return false;
+		StartThumbJob(hwnd, view, index);
+		active++;
+	}
+	return true;
+}
+
+static void StartThumbJob(HWND hwnd, ThumbView* view, unsigned index)
+{
+	MhkResource* rsrc = &view->archive->resources[view->first + index];
+	MhkFile* file = GetMhkResourceFile(view->archive, rsrc);
+	ThumbJob* job = (ThumbJob*)malloc(sizeof(ThumbJob));
+
+	if (job != NULL)
+		job->data = (unsigned char*)malloc(file->size > 0 ? file->size : 1);
+	if (job == NULL || job->data == NULL)
+	{
+		free(job);
+		view->items[index].state = TS_FAILED;
+		return;
+	}
+	memcpy(job->data, file->data, file->size);
+	job->size = file->size;
+	job->hwnd = hwnd;
+	job->view = view;
+	job->item = index;
+	job->canceled = 0;
+	job->error = MHK_OK;
+	view->jobs[view->numJobs++] = job;
+	view->items[index].state = TS_QUEUED;
+	SubmitWork(view->pool, ThumbWork, job);
+}
+
+/* Runs on a worker thread: finds the thumbnail in the cache, or makes
+   and stores it.  */
+static void ThumbWork(void* arg)
+{
+	ThumbJob* job = (ThumbJob*)arg;
+	ThumbView* view = job->view;
+	CacheKey key;
+	bool found = false;
+
+	if (!job->canceled)
+	{
+		HashCacheKey(job->data, job->size, &key);
+		if (view->cache != NULL)
+		{
+			EnterCriticalSection(&view->cacheLock);
+			found = LookupThumb(view->cache, &key, job->pixels,
+				&job->width, &job->height);
+			LeaveCriticalSection(&view->cacheLock);
+		}
+		if (!found && !job->canceled)
+		{
+			job->error = MakeThumbnail(job->data, job->size, THUMB_SIZE,
+				job->pixels, &job->width, &job->height);
+			if (job->error == MHK_OK && view->cache != NULL)
+			{
+				EnterCriticalSection(&view->cacheLock);
+				StoreThumb(view->cache, &key, job->pixels, job->width,
+					job->height);
+				LeaveCriticalSection(&view->cacheLock);
+			}
+		}
+	}
+	free(job->data);
+	job->data = NULL;
+	PostMessage(job->hwnd, WM_THUMBDONE, 0, (LPARAM)job);
+}
+
+/* Takes the result of a job that has returned.  */
+static void FinishThumbJob(HWND hwnd, ThumbView* view, ThumbJob* job)
+{
+	unsigned i;
+
+	for (i = 0; i < view->numJobs && view->jobs[i] != job; i++);
+	if (i == view->numJobs)
+		return;
+	view->jobs[i] = view->jobs[--view->numJobs];
+	if (!job->canceled)
+	{
+		ThumbItem* item = &view->items[job->item];
+		item->state = TS_FAILED;
+		if (job->error == MHK_OK)
+		{
+			size_t size = job->width * job->height * sizeof(PalColor);
+			item->pixels = (PalColor*)malloc(size);
+			if (item->pixels != NULL)
+			{
+				memcpy(item->pixels, job->pixels, size);
+				item->width = (unsigned short)job->width;
+				item->height = (unsigned short)job->height;
+				item->state = TS_DONE;
+			}
+		}
+		InvalidateThumb(hwnd, view, job->item);
+	}
+	free(job);
+	ScheduleThumbs(hwnd, view);
+}
+
+/* Marks every job canceled.  The jobs stay in the list until they
+   return.  */
+static void CancelThumbJobs(ThumbView* view)
+{
+	unsigned i;
+	for (i = 0; i < view->numJobs; i++)
+	{
+		ThumbJob* job = view->jobs[i];
+		if (!job->canceled)
+		{
+			InterlockedExchange(&job->canceled, 1);
+			view->items[job->item].state = TS_NONE;
+		}
+	}
+}
+
+static void FreeThumbItems(ThumbView* view)
+{
+	unsigned i;
+	for (i = 0; i < view->count; i++)
+		free(view->items[i].pixels);
+	free(view->items);
+	view->items = NULL;
+	view->count = 0;
+}
+
+/* Selects an item and scrolls it into view.  */
+static void SelectThumb(HWND hwnd, ThumbView* view, int index)
+{
+	int top;
+	if (index != view->selected)
+	{
+		InvalidateThumb(hwnd, view, view->selected);
+		view->selected = index;
+		InvalidateThumb(hwnd, view, index);
+	}
+	top = (index / (int)view->columns) * CELL_HEIGHT;
+	if (top < view->yPos)
+		ScrollThumbView(hwnd, view, top);
+	else if (top + CELL_HEIGHT > view->yPos + view->clientHeight)
+		ScrollThumbView(hwnd, view, top + CELL_HEIGHT - view->clientHeight);
+}
+
+static void HandleThumbKey(HWND hwnd, ThumbView* view, WPARAM key)
+{
+	int cols = (int)view->columns;
+	int pageRows = view->clientHeight / CELL_HEIGHT;
+	int index = view->selected;
+
+	if (view->count == 0)
+		return;
+	if (pageRows < 1)
+		pageRows = 1;
+	switch (key)
+	{
+	case VK_LEFT: index--; break;
+	case VK_RIGHT: index++; break;
+	case VK_UP: index -= cols; break;
+	case VK_DOWN: index += cols; break;
+	case VK_PRIOR: index -= cols * pageRows; break;
+	case VK_NEXT: index += cols * pageRows; break;
+	case VK_HOME: index = 0; break;
+	case VK_END: index = (int)view->count - 1; break;
+	case VK_RETURN:
+		if (view->selected >= 0)
+			NotifyParent(hwnd, THN_OPEN);
+		return;
+	default:
+		return;
+	}
+	if (view->selected < 0)
+		index = 0;
+	if (index < 0)
+		index = 0;
+	if (index >= (int)view->count)
+		index = (int)view->count - 1;
+	SelectThumb(hwnd, view, index);
+}
+
+/* Returns the item at a client point, or -1.  */
+static int ThumbFromPoint(const ThumbView* view, int x, int y)
+{
+	int col, index;
+	if (x < 0 || y < 0)
+		return -1;
+	col = x / CELL_WIDTH;
+	if (col >= (int)view->columns)
+		return -1;
+	index = ((y + view->yPos) / CELL_HEIGHT) * (int)view->columns + col;
+	if (index >= (int)view->count)
+		return -1;
+	return index;
+}
+
+static void GetThumbCellRect(const ThumbView* view, unsigned index,
+	RECT* rt)
+{
+	rt->left = (index % view->columns) * CELL_WIDTH;
+	rt->top = (int)(index / view->columns) * CELL_HEIGHT - view->yPos;
+	rt->right = rt->left + CELL_WIDTH;
+	rt->bottom = rt->top + CELL_HEIGHT;
+}
+
+static void InvalidateThumb(HWND hwnd, const ThumbView* view, int index)
+{
+	RECT rt;
+	if (index < 0 || (unsigned)index >= view->count)
+		return;
+	GetThumbCellRect(view, index, &rt);
+	InvalidateRect(hwnd, &rt, FALSE);
+}
+
+static void UpdateScrollBars(HWND hwnd, ThumbView* view)
+{
+	SCROLLINFO si;
+	unsigned rows = (view->count + view->columns - 1) / view->columns;
+	si.cbSize = sizeof(SCROLLINFO);
+	si.fMask = SIF_RANGE | SIF_PAGE | SIF_POS;
+	si.nMin = 0;
+	si.nMax = rows > 0 ? (int)rows * CELL_HEIGHT - 1 : 0;
+	si.nPage = view->clientHeight;
+	si.nPos = view->yPos;
+	SetScrollInfo(hwnd, SB_VERT, &si, TRUE);
+}
+
+/* Scrolls to a new position, which is clamped to the grid, and
+   reschedules the thumbnail jobs for what is now visible.  */
+static void ScrollThumbView(HWND hwnd, ThumbView* view, int newY)
+{
+	unsigned rows = (view->count + view->columns - 1) / view->columns;
+	int maxY = (int)rows * CELL_HEIGHT - view->clientHeight;
+	if (newY > maxY) newY = maxY;
+	if (newY < 0) newY = 0;
+	if (newY == view->yPos)
+		return;
+	ScrollWindowEx(hwnd, 0, view->yPos - newY,
+		NULL, NULL, NULL, NULL, SW_INVALIDATE);
+	view->yPos = newY;
+	SetScrollPos(hwnd, SB_VERT, newY, TRUE);
+	ScheduleThumbs(hwnd, view);
+}
+
+static void NotifyParent(HWND hwnd, unsigned code)
+{
+	SendMessage(GetParent(hwnd), WM_COMMAND,
+		MAKEWPARAM(GetDlgCtrlID(hwnd), code), (LPARAM)hwnd);
+}
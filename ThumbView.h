@@ -0,0 +1,22 @@
+/* Thumbnail grid window interface */
+/* This is platform dependent code: include windows.h, "bool.h", and
+   "MhkArchive.h" before this header.  */
+
+#ifndef THUMBVIEW_H
+#define THUMBVIEW_H
+
+#define THUMBVIEW_CLASS "MhkThumbView"
+
+/* Notification codes sent to the parent window in WM_COMMAND, with
+   the view's control ID.  */
+enum ThumbViewNotify
+{
+	THN_OPEN = 1 /* An item was double-clicked or Enter was pressed */
+};
+
+BOOL RegisterThumbView(HINSTANCE hInstance);
+void SetThumbViewItems(HWND hwnd, MhkArchive* archive, unsigned first,
+	unsigned count);
+int GetThumbViewSelection(HWND hwnd);
+
+#endif /* not THUMBVIEW_H */
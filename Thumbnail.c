@@ -0,0 +1,236 @@
+/* Bitmap thumbnails */
+/* Makes small previews of tBMP resources and keeps them in a record
+   cache file (see RecordCache.c), so that browsing an archive a
+   second time does not have to decode every bitmap again.
+
+   The cache file has the magic "MHKTHUMB" and the thumbnail size as
+   its parameter.  The rest of a record header is u16 width and u16
+   height, and the data is red, green, and blue bytes for every pixel,
+   top row first.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "PalExpand.h"
+#include "BmpDecode.h"
+#include "RecordCache.h"
+#include "Thumbnail.h"
+
+#define CACHE_MAGIC "MHKTHUMB"
+#define CACHE_VERSION 1
+#define EXTRA_SIZE 4 /* Width and height */
+
+struct ThumbCache_t
+{
+	RecordCache* records;
+	unsigned thumbSize;
+};
+
+static long ThumbDataSize(const unsigned char* extra, void* param);
+
+/* Decodes a tBMP resource and shrinks it to fit in a square of
+   "maxSize" pixels, keeping the aspect ratio.  Each thumbnail pixel is
+   the average of the bitmap pixels that it covers.  Bitmaps that are
+   already small enough are not enlarged.  "pixels" must have room for
+   "maxSize" squared pixels.  Returns an MhkError code.  */
+int MakeThumbnail(const unsigned char* rsrc, size_t size, unsigned maxSize,
+	PalColor* pixels, unsigned* width, unsigned* height)
+{
+	MhkBitmap bmp;
+	PalColor* full;
+	unsigned tw, th;
+	unsigned x, y;
+	int error;
+
+	error = ParseBitmap(rsrc, size, &bmp);
+	if (error != MHK_OK)
+		return error;
+	if (!BmpCanDecode(bmp.format))
+		return MHK_EUNSUPPORTED;
+	if (bmp.width == 0 || bmp.height == 0)
+		return MHK_EFORMAT;
+	full = (PalColor*)malloc((size_t)bmp.width * bmp.height *
+							 sizeof(PalColor));
+	if (full == NULL)
+		return MHK_ENOMEM;
+	error = DecodeBitmapRgb(&bmp, full, bmp.width * sizeof(PalColor));
+	if (error != MHK_OK)
+	{
+		free(full);
+		return error;
+	}
+
+	tw = bmp.width;
+	th = bmp.height;
+	if (tw > maxSize || th > maxSize)
+	{
+		if (tw >= th)
+		{
+			th = (unsigned)((unsigned long)th * maxSize / tw);
+			tw = maxSize;
+		}
+		else
+		{
+			tw = (unsigned)((unsigned long)tw * maxSize / th);
+			th = maxSize;
+		}
+		if (tw == 0)
+			tw = 1;
+		if (th == 0)
+			th = 1;
+	}
+
+	for (y = 0; y < th; y++)
+	{
+		unsigned y0 = (unsigned)((unsigned long)y * bmp.height / th);
+		unsigned y1 = (unsigned)((unsigned long)(y + 1) * bmp.height / th);
+		for (x = 0; x < tw; x++)
+		{
+			unsigned x0 = (unsigned)((unsigned long)x * bmp.width / tw);
+			unsigned x1 = (unsigned)((unsigned long)(x + 1) * bmp.width / tw);
+			unsigned long r = 0, g = 0, b = 0;
+			unsigned long n = (unsigned long)(x1 - x0) * (y1 - y0);
+			unsigned sx, sy;
+			for (sy = y0; sy < y1; sy++)
+			{
+				const PalColor* src = full + (size_t)sy * bmp.width;
+				for (sx = x0; sx < x1; sx++)
+				{
+					r += (src[sx] >> 16) & 0xff;
+					g += (src[sx] >> 8) & 0xff;
+					b += src[sx] & 0xff;
+				}
+			}
+			pixels[y * tw + x] = (PalColor)(((r + n / 2) / n) << 16 |
+				((g + n / 2) / n) << 8 | ((b + n / 2) / n));
+		}
+	}
+	free(full);
+	*width = tw;
+	*height = th;
+	return MHK_OK;
+}
+
+/* Opens a cache file for thumbnails of at most "thumbSize" pixels,
+   creating it if needed.  Returns NULL on failure, with an MhkError
+   code in "error" if it is not NULL.  */
+ThumbCache* OpenThumbCache(const char* filename, unsigned thumbSize,
+	int* error)
+{
+	ThumbCache* cache;
+
+	if (thumbSize == 0 || thumbSize > THUMB_MAX_SIZE)
+	{
+		if (error != NULL)
+			*error = MHK_EUNSUPPORTED;
+		return NULL;
+	}
+	cache = (ThumbCache*)malloc(sizeof(ThumbCache));
+	if (cache == NULL)
+	{
+		if (error != NULL)
+			*error = MHK_ENOMEM;
+		return NULL;
+	}
+	cache->thumbSize = thumbSize;
+	cache->records = OpenRecordCache(filename, CACHE_MAGIC, CACHE_VERSION,
+		thumbSize, EXTRA_SIZE, ThumbDataSize, cache, error);
+	if (cache->records == NULL)
+	{
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+/* Reads a cached thumbnail.  "pixels" must have room for the cache's
+   thumbnail size squared.  Returns false if there is none.  */
+bool LookupThumb(ThumbCache* cache, const CacheKey* key, PalColor* pixels,
+	unsigned* width, unsigned* height)
+{
+	const unsigned char* extra = FindCacheRecord(cache->records, key);
+	unsigned char row[THUMB_MAX_SIZE * 3];
+	unsigned tw, th;
+	unsigned x, y;
+
+	if (extra == NULL)
+		return false;
+	tw = MHK_GET16(extra);
+	th = MHK_GET16(extra + 2);
+	for (y = 0; y < th; y++)
+	{
+		PalColor* dst = pixels + y * tw;
+		if (!ReadCacheData(cache->records, key, (long)y * tw * 3, row,
+						   tw * 3))
+			return false;
+		for (x = 0; x < tw; x++)
+			dst[x] = ((PalColor)row[x*3] << 16) |
+				((PalColor)row[x*3+1] << 8) | row[x*3+2];
+	}
+	*width = tw;
+	*height = th;
+	return true;
+}
+
+/* Appends a thumbnail to the cache file.  Returns an MhkError
+   code.  */
+int StoreThumb(ThumbCache* cache, const CacheKey* key,
+	const PalColor* pixels, unsigned width, unsigned height)
+{
+	unsigned char extra[EXTRA_SIZE];
+	unsigned char* data;
+	size_t i, numPixels = (size_t)width * height;
+	int error;
+
+	if (width == 0 || height == 0 || width > cache->thumbSize ||
+		height > cache->thumbSize)
+		return MHK_EUNSUPPORTED;
+	if (FindCacheRecord(cache->records, key) != NULL)
+		return MHK_OK;
+	data = (unsigned char*)malloc(numPixels * 3);
+	if (data == NULL)
+		return MHK_ENOMEM;
+	for (i = 0; i < numPixels; i++)
+	{
+		data[i*3] = (unsigned char)(pixels[i] >> 16);
+		data[i*3+1] = (unsigned char)(pixels[i] >> 8);
+		data[i*3+2] = (unsigned char)pixels[i];
+	}
+	MHK_PUT16(extra, width);
+	MHK_PUT16(extra + 2, height);
+	error = AppendCacheRecord(cache->records, key, extra, data,
+		numPixels * 3);
+	free(data);
+	return error;
+}
+
+/* Returns the number of thumbnails in the cache.  */
+unsigned ThumbCacheCount(const ThumbCache* cache)
+{
+	return CacheRecordCount(cache->records);
+}
+
+void CloseThumbCache(ThumbCache* cache)
+{
+	if (cache == NULL)
+		return;
+	CloseRecordCache(cache->records);
+	free(cache);
+}
+
+/* Returns the pixel data size of a record with the given width and
+   height, if they fit in the cache's thumbnail size.  */
+static long ThumbDataSize(const unsigned char* extra, void* param)
+{
+	const ThumbCache* cache = (const ThumbCache*)param;
+	unsigned width = MHK_GET16(extra);
+	unsigned height = MHK_GET16(extra + 2);
+	if (width == 0 || height == 0 || width > cache->thumbSize ||
+		height > cache->thumbSize)
+		return -1;
+	return (long)width * height * 3;
+}
@@ -0,0 +1,26 @@
+/* Bitmap thumbnail interface */
+/* Include "bool.h", "PalExpand.h", and "RecordCache.h" before this
+   header.  */
+
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include <stddef.h>
+
+#define THUMB_MAX_SIZE 255 /* Largest width or height of a thumbnail */
+
+typedef struct ThumbCache_t ThumbCache;
+
+int MakeThumbnail(const unsigned char* rsrc, size_t size, unsigned maxSize,
+	PalColor* pixels, unsigned* width, unsigned* height);
+
+ThumbCache* OpenThumbCache(const char* filename, unsigned thumbSize,
+	int* error);
+bool LookupThumb(ThumbCache* cache, const CacheKey* key, PalColor* pixels,
+	unsigned* width, unsigned* height);
+int StoreThumb(ThumbCache* cache, const CacheKey* key,
+	const PalColor* pixels, unsigned width, unsigned height);
+unsigned ThumbCacheCount(const ThumbCache* cache);
+void CloseThumbCache(ThumbCache* cache);
+
+#endif /* not THUMBNAIL_H */
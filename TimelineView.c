@@ -0,0 +1,1375 @@
+/* Timeline view window */
+/* Shows a sound as a waveform along a time ruler, one lane per
+   channel, or a group of sprites and sounds as one track each.  The
+   mouse wheel and the up and down arrow keys zoom by powers of two,
+   from everything in the window down to 2^-MIN_ZOOM pixels per sample,
+   and the scroll bar and the left and right arrow keys move along.
+   With a group, the wheel scrolls through the tracks unless Ctrl is
+   down.
+
+   Every pixel column is drawn from the peak pyramid of the sound (see
+   SoundPeaks.c): one bucket per column when the zoom matches a level,
+   or the samples themselves, decoded from the nearest checkpoint, when
+   it is closer in than level 0.  So a paint costs the same at any
+   zoom, whatever the length of the sound.
+
+   The pyramid is built on a worker thread, which reports its progress
+   after every BUILD_FRAMES frames.  Only the columns that the new
+   frames cover are redrawn, so the waveform fills in from the left
+   while the view can already be zoomed and scrolled.  Finished
+   pyramids are written to a cache file next to the thumbnail cache,
+   so a sound that has been seen before shows at once.  As with the
+   other views, the job works on a copy of the resource, and a job for
+   a sound that is no longer shown is canceled and freed when it
+   returns.
+
+   The events on a track are the frames of a sprite, at the rate that
+   the sprite view plays them, or the cue markers of a sound.  A sound
+   on its own gets a track for its cues above the lanes.  The events of
+   each track are kept in an interval tree (see IntervalTree.c), and a
+   paint asks it for the first event in the damaged columns, draws it,
+   and asks again from the column after it.  Events that share a column
+   are drawn once, so a track costs at most one search per column
+   however many events it holds, and only the tracks in the damaged
+   rows are looked at.  A change of selection invalidates just the
+   rectangles of the events and labels it touches.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "MhkArchive.h"
+#include "MhkBitmap.h"
+#include "PalExpand.h"
+#include "WorkPool.h"
+#include "RecordCache.h"
+#include "MhkSound.h"
+#include "MhkSprite.h"
+#include "SoundPeaks.h"
+#include "IntervalTree.h"
+#include "SpriteView.h"
+#include "ScrollBar.h"
+#include "TimelineView.h"
+
+#ifndef WM_MOUSEWHEEL
+#define WM_MOUSEWHEEL 0x020A
+#define WHEEL_DELTA 120
+#endif
+
+#define MIN_ZOOM (-3) /* 8 pixels per sample */
+#define EVENT_MIN_ZOOM 8 /* 256 ticks per pixel in a group */
+#define EVENT_RATE 1000000UL /* Ticks per second in a group */
+#define RULER_HEIGHT 20
+#define TRACK_HEIGHT 20
+#define LABEL_WIDTH 80 /* Track labels to the left of a group */
+#define CUE_LABEL_WIDTH 80
+#define TICK_SPACING 80 /* Least pixels between labeled ticks */
+#define BUILD_FRAMES (1UL << 18) /* Frames between progress reports */
+
+/* Posted by the worker as the pyramid grows, with the frames done in
+   wParam and the sound in lParam.  */
+#define WM_PEAKPROGRESS WM_APP
+/* Posted by the worker when it returns, with the sound in lParam.  */
+#define WM_PEAKDONE (WM_APP + 1)
+
+typedef struct TimelineSound_t TimelineSound;
+typedef struct TimelineTrack_t TimelineTrack;
+typedef struct TimelineView_t TimelineView;
+
+struct TimelineSound_t
+{
+	HWND hwnd;
+	unsigned char* data; /* Copy of the resource */
+	MhkSound snd;
+	CacheKey key;
+	SoundPeaks* peaks;
+	unsigned long framesDone; /* As last reported to the window */
+	bool building; /* Is the job still out? */
+	volatile LONG canceled;
+	TimelineSound* next; /* In the list of canceled sounds */
+};
+
+/* A row of events.  The tag of an event is the index of the frame or
+   of the cue.  */
+struct TimelineTrack_t
+{
+	int index; /* Archive index of the resource, or -1 */
+	unsigned long type;
+	char label[16];
+	IntervalTree* events; /* NULL if the resource can't be read */
+	SoundCue* cues; /* For the names */
+	unsigned long length; /* In ticks */
+	bool bar; /* Draw the length of a sound under its cues? */
+};
+
+/* Times are counted in ticks: sample frames when a sound is shown,
+   and EVENT_RATE to the second in a group.  */
+struct TimelineView_t
+{
+	TimelineSound* sound; /* NULL if none */
+	TimelineSound* canceled; /* Sounds whose jobs have not returned */
+	TimelineTrack* tracks;
+	unsigned numTracks;
+	unsigned long numEvents;
+	unsigned long rate; /* Ticks per second */
+	unsigned long length; /* Ticks to the end of the longest track */
+	int selTrack; /* -1 if none */
+	const Interval* selEvent; /* NULL if none */
+	PeakCache* cache; /* NULL if the cache file can't be used */
+	WorkPool* pool;
+	int zoom; /* 2^zoom ticks per pixel */
+	bool fit; /* Keep everything in view until zoomed */
+	long xPos; /* Scroll position in pixels at this zoom */
+	long yPos; /* Scroll position of the tracks of a group */
+	int clientWidth, clientHeight;
+};
+
+LRESULT CALLBACK TimelineViewProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam);
+static void PaintTimelineView(HWND hwnd, TimelineView* view);
+static void DrawRuler(HDC hdc, const TimelineView* view, const RECT* paint);
+static void DrawTracks(HDC hdc, const TimelineView* view, const RECT* paint);
+static void DrawTrack(HDC hdc, const TimelineView* view, unsigned t,
+	const RECT* paint);
+static void DrawEvent(HDC hdc, const TimelineTrack* track,
+	const Interval* ev, bool selected, int x0, int x1, int left, int top);
+static void DrawLanes(HDC hdc, const TimelineView* view, const RECT* paint);
+static int GetColumnPeaks(const TimelineView* view, int left, int right,
+	SoundPeak* peaks);
+static void DrawSamples(HDC hdc, const TimelineView* view, int left,
+	int right);
+static void PeakWork(void* arg);
+static void ReportProgress(HWND hwnd, TimelineView* view,
+	TimelineSound* sound, unsigned long framesDone);
+static void FinishPeakJob(HWND hwnd, TimelineView* view,
+	TimelineSound* sound);
+static void ClearTimeline(HWND hwnd, TimelineView* view);
+static void DropSound(TimelineView* view);
+static void FreeTimelineSound(TimelineSound* sound);
+static bool FillTrack(TimelineTrack* track, unsigned long type,
+	const unsigned char* rsrc, size_t size, unsigned long rate);
+static void FreeTracks(TimelineView* view);
+static int TrackFromPoint(const TimelineView* view, int y);
+static const Interval* EventFromPoint(const TimelineView* view, unsigned t,
+	int x);
+static void GetEventColumns(const TimelineView* view, const Interval* ev,
+	int* x0, int* x1);
+static void InvalidateEvent(HWND hwnd, const TimelineView* view, int t,
+	const Interval* ev);
+static void SelectEvent(HWND hwnd, TimelineView* view, int t,
+	const Interval* ev);
+static void NotifyParent(HWND hwnd, int code);
+static int TimeLeft(const TimelineView* view);
+static int TrackTop(const TimelineView* view, unsigned t);
+static int LanesTop(const TimelineView* view);
+static int MinZoom(const TimelineView* view);
+static int MaxZoom(const TimelineView* view);
+static long TotalWidth(const TimelineView* view, int zoom);
+static unsigned long ToTicks(double ticks);
+static double TicksPerPixel(int zoom);
+static double TickToX(const TimelineView* view, double tick);
+static unsigned long TickAtX(const TimelineView* view, int x);
+static void FitTimeline(HWND hwnd, TimelineView* view);
+static void ZoomTimeline(HWND hwnd, TimelineView* view, int zoom,
+	int anchorX);
+static void ScrollTimeline(HWND hwnd, TimelineView* view, long newX);
+static void ScrollTracks(HWND hwnd, TimelineView* view, long newY);
+static void UpdateScrollBars(HWND hwnd, TimelineView* view);
+
+BOOL RegisterTimelineView(HINSTANCE hInstance)
+{
+	WNDCLASSEX wcex;
+	wcex.cbSize = sizeof(WNDCLASSEX);
+	wcex.style = CS_DBLCLKS;
+	wcex.lpfnWndProc = TimelineViewProc;
+	wcex.cbClsExtra = 0;
+	wcex.cbWndExtra = 0;
+	wcex.hInstance = hInstance;
+	wcex.hIcon = NULL;
+	wcex.hCursor = LoadCursor(NULL, IDC_ARROW);
+	wcex.hbrBackground = NULL;
+	wcex.lpszMenuName = NULL;
+	wcex.lpszClassName = TIMELINEVIEW_CLASS;
+	wcex.hIconSm = NULL;
+	return RegisterClassEx(&wcex) != 0;
+}
+
+/* Shows a tWAV resource, which is copied, zoomed out to fit.  Pass
+   NULL to clear the view.  Returns false if the resource is not a
+   sound that can be decoded, and clears the view.  */
+bool SetTimelineSound(HWND hwnd, const unsigned char* rsrc, size_t size)
+{
+	TimelineView* view =
+		(TimelineView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	TimelineSound* sound;
+	TimelineTrack* track;
+
+	if (view == NULL)
+		return false;
+	ClearTimeline(hwnd, view);
+	if (rsrc == NULL)
+		return true;
+
+	sound = (TimelineSound*)calloc(1, sizeof(TimelineSound));
+	if (sound == NULL)
+		return false;
+	sound->data = (unsigned char*)malloc(size > 0 ? size : 1);
+	if (sound->data == NULL)
+	{
+		free(sound);
+		return false;
+	}
+	memcpy(sound->data, rsrc, size);
+	sound->hwnd = hwnd;
+	if (ParseSound(sound->data, size, &sound->snd) != MHK_OK ||
+		sound->snd.encoding == SND_MPEG2)
+	{
+		FreeTimelineSound(sound);
+		return false;
+	}
+	HashCacheKey(sound->data, size, &sound->key);
+	if (view->cache != NULL)
+		sound->peaks = LookupPeaks(view->cache, &sound->key, &sound->snd);
+	if (sound->peaks != NULL)
+		sound->framesDone = sound->snd.numFrames;
+	else
+	{
+		sound->peaks = CreateSoundPeaks(&sound->snd);
+		if (sound->peaks == NULL)
+		{
+			FreeTimelineSound(sound);
+			return false;
+		}
+		sound->building = true;
+		SubmitWork(view->pool, PeakWork, sound);
+	}
+	view->sound = sound;
+	view->rate = sound->snd.sampleRate;
+	view->length = sound->snd.numFrames;
+
+	/* The cues, if there are any, go on a track of their own.  */
+	track = (TimelineTrack*)calloc(1, sizeof(TimelineTrack));
+	if (track != NULL)
+	{
+		view->tracks = track;
+		view->numTracks = 1;
+		track->index = -1;
+		track->type = MHK_TWAV;
+		strcpy(track->label, "Cues");
+		if (FillTrack(track, MHK_TWAV, sound->data, size, view->rate) &&
+			IntervalCount(track->events) > 0)
+			view->numEvents = (unsigned long)IntervalCount(track->events);
+		else
+			FreeTracks(view);
+	}
+
+	view->fit = true;
+	FitTimeline(hwnd, view);
+	return true;
+}
+
+/* Shows "count" sprites or sounds of an archive, starting at resource
+   "first", on a track each.  Resources that can't be read get an empty
+   track.  Pass a NULL archive to clear the view.  */
+void SetTimelineItems(HWND hwnd, MhkArchive* archive, unsigned first,
+	unsigned count)
+{
+	TimelineView* view =
+		(TimelineView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	unsigned i;
+
+	if (view == NULL)
+		return;
+	ClearTimeline(hwnd, view);
+	if (archive == NULL || count == 0)
+		return;
+	view->tracks = (TimelineTrack*)calloc(count, sizeof(TimelineTrack));
+	if (view->tracks == NULL)
+		return;
+	view->numTracks = count;
+	view->rate = EVENT_RATE;
+	for (i = 0; i < count; i++)
+	{
+		MhkResource* rsrc = &archive->resources[first + i];
+		MhkFile* file = GetMhkResourceFile(archive, rsrc);
+		TimelineTrack* track = &view->tracks[i];
+		char type[5];
+
+		track->index = (int)(first + i);
+		track->type = rsrc->type;
+		MhkTagToString(rsrc->type, type);
+		sprintf(track->label, "%s %u", type, rsrc->id);
+		if (!FillTrack(track, rsrc->type, file->data, file->size,
+				EVENT_RATE))
+			continue;
+		track->bar = true;
+		view->numEvents += (unsigned long)IntervalCount(track->events);
+		if (track->length > view->length)
+			view->length = track->length;
+	}
+	view->fit = true;
+	FitTimeline(hwnd, view);
+}
+
+/* Returns the archive index of the selected track, or -1.  */
+int GetTimelineSelection(HWND hwnd)
+{
+	TimelineView* view =
+		(TimelineView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (view == NULL || view->selTrack < 0)
+		return -1;
+	return view->tracks[view->selTrack].index;
+}
+
+LRESULT CALLBACK TimelineViewProc(HWND hwnd, UINT uMsg, WPARAM wParam,
+	LPARAM lParam)
+{
+	TimelineView* view =
+		(TimelineView*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	switch (uMsg)
+	{
+	case WM_CREATE:
+	{
+		/* The creation parameter is the name of the cache file.  */
+		CREATESTRUCT* cs = (CREATESTRUCT*)lParam;
+		view = (TimelineView*)calloc(1, sizeof(TimelineView));
+		if (view == NULL)
+			return -1;
+		view->selTrack = -1;
+		if (cs->lpCreateParams != NULL)
+			view->cache = OpenPeakCache((const char*)cs->lpCreateParams,
+				NULL);
+		/* One sound is built at a time.  */
+		view->pool = CreateWorkPool(1);
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)view);
+		return 0;
+	}
+	case WM_DESTROY:
+		/* Let the job return before freeing its sound.  The progress
+		   messages are dropped with the window.  */
+		DropSound(view);
+		FreeTracks(view);
+		FreeWorkPool(view->pool);
+		while (view->canceled != NULL)
+		{
+			TimelineSound* next = view->canceled->next;
+			FreeTimelineSound(view->canceled);
+			view->canceled = next;
+		}
+		ClosePeakCache(view->cache);
+		free(view);
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+		return 0;
+	case WM_PEAKPROGRESS:
+		if (view != NULL)
+			ReportProgress(hwnd, view, (TimelineSound*)lParam,
+				(unsigned long)wParam);
+		return 0;
+	case WM_PEAKDONE:
+		if (view != NULL)
+			FinishPeakJob(hwnd, view, (TimelineSound*)lParam);
+		return 0;
+	case WM_SIZE:
+		view->clientWidth = LOWORD(lParam);
+		view->clientHeight = HIWORD(lParam);
+		/* The lanes scale with the height.  */
+		InvalidateRect(hwnd, NULL, FALSE);
+		if (view->fit)
+			FitTimeline(hwnd, view);
+		UpdateScrollBars(hwnd, view);
+		ScrollTimeline(hwnd, view, view->xPos);
+		ScrollTracks(hwnd, view, view->yPos);
+		return 0;
+	case WM_ERASEBKGND:
+		return 1;
+	case WM_PAINT:
+		PaintTimelineView(hwnd, view);
+		return 0;
+	case WM_HSCROLL:
+		ScrollTimeline(hwnd, view, ScrollBarPos(hwnd, SB_HORZ,
+			LOWORD(wParam), view->clientWidth / 8 + 1));
+		return 0;
+	case WM_VSCROLL:
+		ScrollTracks(hwnd, view, ScrollBarPos(hwnd, SB_VERT,
+			LOWORD(wParam), TRACK_HEIGHT));
+		return 0;
+	case WM_MOUSEWHEEL:
+	{
+		POINT pt;
+		int delta = (short)HIWORD(wParam) / WHEEL_DELTA;
+		if (view->sound == NULL && !(LOWORD(wParam) & MK_CONTROL))
+		{
+			ScrollTracks(hwnd, view, view->yPos - delta * 3 * TRACK_HEIGHT);
+			return 0;
+		}
+		pt.x = (short)LOWORD(lParam);
+		pt.y = (short)HIWORD(lParam);
+		ScreenToClient(hwnd, &pt);
+		/* Zoom in toward the pointer when rolling forward.  */
+		ZoomTimeline(hwnd, view, view->zoom - delta, pt.x);
+		return 0;
+	}
+	case WM_LBUTTONDOWN:
+	case WM_LBUTTONDBLCLK:
+	{
+		int x = (short)LOWORD(lParam);
+		int t = TrackFromPoint(view, (short)HIWORD(lParam));
+		SetFocus(hwnd);
+		SelectEvent(hwnd, view, t, t >= 0 && x >= TimeLeft(view) ?
+			EventFromPoint(view, (unsigned)t, x) : NULL);
+		if (uMsg == WM_LBUTTONDBLCLK && GetTimelineSelection(hwnd) >= 0)
+			NotifyParent(hwnd, TLN_OPEN);
+		return 0;
+	}
+	case WM_KEYDOWN:
+		switch (wParam)
+		{
+		case VK_UP:
+			ZoomTimeline(hwnd, view, view->zoom - 1, view->clientWidth / 2);
+			return 0;
+		case VK_DOWN:
+			ZoomTimeline(hwnd, view, view->zoom + 1, view->clientWidth / 2);
+			return 0;
+		case VK_LEFT:
+			ScrollTimeline(hwnd, view, view->xPos - view->clientWidth / 8);
+			return 0;
+		case VK_RIGHT:
+			ScrollTimeline(hwnd, view, view->xPos + view->clientWidth / 8);
+			return 0;
+		case VK_PRIOR:
+			ScrollTimeline(hwnd, view, view->xPos - view->clientWidth);
+			return 0;
+		case VK_NEXT:
+			ScrollTimeline(hwnd, view, view->xPos + view->clientWidth);
+			return 0;
+		case VK_HOME:
+			ScrollTimeline(hwnd, view, 0);
+			return 0;
+		case VK_END:
+			ScrollTimeline(hwnd, view, TotalWidth(view, view->zoom));
+			return 0;
+		case VK_RETURN:
+			if (GetTimelineSelection(hwnd) >= 0)
+				NotifyParent(hwnd, TLN_OPEN);
+			return 0;
+		}
+		break;
+	}
+	return DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
+
+static void PaintTimelineView(HWND hwnd, TimelineView* view)
+{
+	PAINTSTRUCT ps;
+	HFONT hOldFont;
+
+	BeginPaint(hwnd, &ps);
+	hOldFont = (HFONT)SelectObject(ps.hdc, GetStockObject(DEFAULT_GUI_FONT));
+	SetBkMode(ps.hdc, TRANSPARENT);
+	if (ps.rcPaint.top < RULER_HEIGHT)
+		DrawRuler(ps.hdc, view, &ps.rcPaint);
+	if (ps.rcPaint.bottom > RULER_HEIGHT)
+		DrawTracks(ps.hdc, view, &ps.rcPaint);
+	if (view->sound != NULL && ps.rcPaint.bottom > LanesTop(view))
+		DrawLanes(ps.hdc, view, &ps.rcPaint);
+	SelectObject(ps.hdc, hOldFont);
+	EndPaint(hwnd, &ps);
+}
+
+/* Draws the time ruler with ticks at round times at least
+   TICK_SPACING pixels apart, and the zoom and build progress.  */
+static void DrawRuler(HDC hdc, const TimelineView* view, const RECT* paint)
+{
+	static const unsigned long tickMs[] =
+	{
+		1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000,
+		15000, 30000, 60000, 120000, 300000, 600000
+	};
+	const TimelineSound* sound = view->sound;
+	int left = TimeLeft(view);
+	RECT rt;
+	char text[80];
+	int len;
+
+	rt.left = paint->left;
+	rt.right = paint->right;
+	rt.top = 0;
+	rt.bottom = RULER_HEIGHT;
+	FillRect(hdc, &rt, GetSysColorBrush(COLOR_BTNFACE));
+	SetTextColor(hdc, GetSysColor(COLOR_BTNTEXT));
+	if (view->rate == 0)
+		return;
+
+	{
+		double tpp = TicksPerPixel(view->zoom);
+		double step = 0;
+		double tick, end;
+		unsigned long ms = 0;
+		unsigned i;
+		for (i = 0; i < sizeof(tickMs) / sizeof(tickMs[0]); i++)
+		{
+			ms = tickMs[i];
+			step = (double)ms * view->rate / 1000;
+			if (step / tpp >= TICK_SPACING)
+				break;
+		}
+		/* Start one tick to the left, so that its label shows.  */
+		tick = TickAtX(view, paint->left > left ? paint->left : left) / step;
+		tick = (tick < 1 ? 0 : (unsigned long)tick - 1) * step;
+		end = (double)TickAtX(view, paint->right);
+		if (end > view->length)
+			end = view->length;
+		for (; tick <= end; tick += step)
+		{
+			int x = (int)(TickToX(view, tick) + 0.5);
+			unsigned long t = (unsigned long)((tick + step / 2) / step) * ms;
+			if (x < left)
+				continue;
+			MoveToEx(hdc, x, RULER_HEIGHT - 6, NULL);
+			LineTo(hdc, x, RULER_HEIGHT);
+			len = sprintf(text, "%lu:%02lu.%03lu", t / 60000,
+				t / 1000 % 60, t % 1000);
+			TextOut(hdc, x + 3, 2, text, len);
+		}
+	}
+
+	if (sound == NULL)
+		len = sprintf(text, "%lu events, %.3g ms per pixel",
+			view->numEvents, TicksPerPixel(view->zoom) * 1000 / view->rate);
+	else if (view->zoom >= 0)
+		len = sprintf(text, "%lu frames per pixel", 1UL << view->zoom);
+	else
+		len = sprintf(text, "%lu pixels per frame", 1UL << -view->zoom);
+	if (sound != NULL && sound->framesDone < sound->snd.numFrames)
+		len += sprintf(text + len, ", building overview %lu%%",
+			(unsigned long)((double)sound->framesDone * 100 /
+							sound->snd.numFrames));
+	SetBkMode(hdc, OPAQUE);
+	SetBkColor(hdc, GetSysColor(COLOR_BTNFACE));
+	rt.left = 0;
+	rt.right = view->clientWidth - 4;
+	DrawText(hdc, text, len, &rt, DT_RIGHT | DT_SINGLELINE | DT_VCENTER);
+	SetBkMode(hdc, TRANSPARENT);
+}
+
+/* Draws the tracks in the rows of the paint rectangle.  Below the
+   tracks of a group, the window is left blank.  */
+static void DrawTracks(HDC hdc, const TimelineView* view, const RECT* paint)
+{
+	RECT rt;
+	long row;
+	unsigned t;
+
+	row = (paint->top - RULER_HEIGHT + view->yPos) / TRACK_HEIGHT;
+	for (t = row > 0 ? (unsigned)row : 0; t < view->numTracks; t++)
+	{
+		if (TrackTop(view, t) >= paint->bottom)
+			return;
+		DrawTrack(hdc, view, t, paint);
+	}
+	if (view->sound != NULL)
+		return;
+	rt = *paint;
+	rt.top = TrackTop(view, view->numTracks);
+	if (rt.top < RULER_HEIGHT)
+		rt.top = RULER_HEIGHT;
+	if (rt.top < rt.bottom)
+		FillRect(hdc, &rt, GetSysColorBrush(COLOR_WINDOW));
+}
+
+/* Draws the columns of a track in the paint rectangle, and its label.
+   The interval tree gives the first event that reaches a column, and
+   the search goes on from the column after that event, so that a
+   column is never drawn twice.  */
+static void DrawTrack(HDC hdc, const TimelineView* view, unsigned t,
+	const RECT* paint)
+{
+	const TimelineTrack* track = &view->tracks[t];
+	int left = TimeLeft(view);
+	int top = TrackTop(view, t);
+	RECT rt;
+
+	rt.left = paint->left > left ? paint->left : left;
+	rt.right = paint->right;
+	rt.top = top;
+	rt.bottom = top + TRACK_HEIGHT - 1;
+	if (rt.left < rt.right)
+	{
+		FillRect(hdc, &rt, GetSysColorBrush(COLOR_WINDOW));
+		if (track->bar && track->length > 0)
+		{
+			RECT bar = rt;
+			int end = (int)ceil(TickToX(view, track->length));
+			bar.top = top + TRACK_HEIGHT / 2 - 2;
+			bar.bottom = bar.top + 4;
+			if (bar.right > end)
+				bar.right = end;
+			if (bar.left < bar.right)
+				FillRect(hdc, &bar, GetSysColorBrush(COLOR_BTNSHADOW));
+		}
+		if (track->events != NULL)
+		{
+			unsigned long hi = TickAtX(view, rt.right);
+			int x = rt.left;
+			while (x < rt.right)
+			{
+				const Interval* ev =
+					FindInterval(track->events, TickAtX(view, x), hi);
+				int x0, x1;
+				if (ev == NULL)
+					break;
+				GetEventColumns(view, ev, &x0, &x1);
+				if (x0 >= rt.right)
+					break;
+				DrawEvent(hdc, track, ev, ev == view->selEvent, x0, x1,
+					left, top);
+				x = x1 > x ? x1 : x + 1;
+			}
+		}
+	}
+
+	/* The line between tracks */
+	rt.left = paint->left;
+	rt.top = top + TRACK_HEIGHT - 1;
+	rt.bottom = top + TRACK_HEIGHT;
+	FillRect(hdc, &rt, GetSysColorBrush(COLOR_BTNFACE));
+
+	if (paint->left < left)
+	{
+		bool selected = ((int)t == view->selTrack);
+		rt.left = 0;
+		rt.right = left;
+		rt.top = top;
+		rt.bottom = top + TRACK_HEIGHT - 1;
+		FillRect(hdc, &rt, GetSysColorBrush(selected ?
+			COLOR_HIGHLIGHT : COLOR_BTNFACE));
+		rt.left = 4;
+		SetTextColor(hdc, GetSysColor(selected ?
+			COLOR_HIGHLIGHTTEXT : COLOR_BTNTEXT));
+		DrawText(hdc, track->label, -1, &rt,
+			DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX | DT_END_ELLIPSIS);
+	}
+}
+
+/* Draws an event from column "x0" up to "x1" in the track at "top".
+   Nothing is drawn left of column "left".  A cue is a line with its
+   name after it, and a frame is a box with its number in it when there
+   is room.  */
+static void DrawEvent(HDC hdc, const TimelineTrack* track,
+	const Interval* ev, bool selected, int x0, int x1, int left, int top)
+{
+	RECT rt;
+	char text[16];
+
+	if (track->type == MHK_TWAV)
+	{
+		if (x0 < left)
+			return;
+		rt.left = x0;
+		rt.right = x0 + 1;
+		rt.top = top + 1;
+		rt.bottom = top + TRACK_HEIGHT - 2;
+		FillRect(hdc, &rt, GetSysColorBrush(selected ?
+			COLOR_HIGHLIGHT : COLOR_WINDOWTEXT));
+		if (track->cues[ev->tag].name[0] != '\0')
+		{
+			rt.left = x0 + 3;
+			rt.right = rt.left + CUE_LABEL_WIDTH;
+			SetTextColor(hdc, GetSysColor(COLOR_WINDOWTEXT));
+			DrawText(hdc, track->cues[ev->tag].name, -1, &rt,
+				DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX | DT_END_ELLIPSIS);
+		}
+		return;
+	}
+
+	rt.left = x0 > left ? x0 : left;
+	rt.right = x1;
+	rt.top = top + 3;
+	rt.bottom = top + TRACK_HEIGHT - 4;
+	if (x1 - x0 >= 3)
+	{
+		FillRect(hdc, &rt, GetSysColorBrush(selected ?
+			COLOR_HIGHLIGHT : COLOR_BTNFACE));
+		if (x1 - x0 >= 28)
+		{
+			SetTextColor(hdc, GetSysColor(selected ?
+				COLOR_HIGHLIGHTTEXT : COLOR_BTNTEXT));
+			DrawText(hdc, text, sprintf(text, "%lu", ev->tag), &rt,
+				DT_CENTER | DT_SINGLELINE | DT_VCENTER);
+		}
+	}
+	if (x0 >= left)
+	{
+		/* The edge at the start, or all of a narrow frame */
+		rt.left = x0;
+		rt.right = x0 + 1;
+		FillRect(hdc, &rt, GetSysColorBrush(selected && x1 - x0 < 3 ?
+			COLOR_HIGHLIGHT : COLOR_BTNSHADOW));
+	}
+}
+
+/* Draws the channel lanes in the paint rectangle.  The part of the
+   sound that has not been scanned yet is shaded.  */
+static void DrawLanes(HDC hdc, const TimelineView* view, const RECT* paint)
+{
+	const TimelineSound* sound = view->sound;
+	unsigned channels;
+	int lanesTop = LanesTop(view);
+	int laneHeight;
+	RECT rt;
+	HPEN hPen, hAxisPen, hOldPen;
+	SoundPeak* peaks;
+	int columns;
+	int x;
+	unsigned c;
+
+	rt = *paint;
+	if (rt.top < lanesTop)
+		rt.top = lanesTop;
+	FillRect(hdc, &rt, GetSysColorBrush(COLOR_WINDOW));
+	channels = sound->snd.numChannels;
+	laneHeight = (view->clientHeight - lanesTop) / (int)channels;
+	if (laneHeight < 2)
+		return;
+
+	/* Shade the columns that are past the end or not scanned.  */
+	x = (int)TickToX(view, sound->framesDone);
+	if (x < rt.right)
+	{
+		RECT shade = rt;
+		if (shade.left < x)
+			shade.left = x;
+		FillRect(hdc, &shade, GetSysColorBrush(COLOR_BTNFACE));
+	}
+
+	hAxisPen = CreatePen(PS_SOLID, 1, GetSysColor(COLOR_3DSHADOW));
+	hPen = CreatePen(PS_SOLID, 1, GetSysColor(COLOR_HIGHLIGHT));
+	hOldPen = (HPEN)SelectObject(hdc, hAxisPen);
+	for (c = 0; c < channels; c++)
+	{
+		int mid = lanesTop + laneHeight * (int)c + laneHeight / 2;
+		MoveToEx(hdc, rt.left, mid, NULL);
+		LineTo(hdc, rt.right, mid);
+	}
+	SelectObject(hdc, hPen);
+
+	if (view->zoom < 0)
+		DrawSamples(hdc, view, rt.left, rt.right);
+	else
+	{
+		peaks = (SoundPeak*)malloc((size_t)(rt.right - rt.left) * channels *
+								   sizeof(SoundPeak));
+		columns = 0;
+		if (peaks != NULL)
+			columns = GetColumnPeaks(view, rt.left, rt.right, peaks);
+		for (x = 0; x < columns; x++)
+		{
+			for (c = 0; c < channels; c++)
+			{
+				const SoundPeak* pk = &peaks[x * channels + c];
+				int mid = lanesTop + laneHeight * (int)c + laneHeight / 2;
+				int top = mid - pk->max * (laneHeight / 2) / 32768;
+				int bottom = mid - pk->min * (laneHeight / 2) / 32768;
+				MoveToEx(hdc, rt.left + x, top, NULL);
+				LineTo(hdc, rt.left + x, bottom + 1);
+			}
+		}
+		free(peaks);
+	}
+	SelectObject(hdc, hOldPen);
+	DeleteObject(hPen);
+	DeleteObject(hAxisPen);
+}
+
+/* Gets the peaks of each channel for the columns from "left" up to
+   "right", which must be zoomed out to at least a frame per pixel.
+   Returns the number of columns with scanned frames.  */
+static int GetColumnPeaks(const TimelineView* view, int left, int right,
+	SoundPeak* peaks)
+{
+	const TimelineSound* sound = view->sound;
+	unsigned channels = sound->snd.numChannels;
+	unsigned long first = (unsigned long)(view->xPos + left);
+	int columns = right - left;
+
+	if (view->zoom >= PEAK_BASE_SHIFT)
+	{
+		/* Each column is one bucket of a level.  */
+		unsigned long count;
+		const SoundPeak* level = GetPeakLevel(sound->peaks,
+			view->zoom - PEAK_BASE_SHIFT, sound->framesDone, &count);
+		if (first >= count)
+			return 0;
+		if ((unsigned long)columns > count - first)
+			columns = (int)(count - first);
+		memcpy(peaks, level + (size_t)first * channels,
+			(size_t)columns * channels * sizeof(SoundPeak));
+	}
+	else
+	{
+		/* Closer in than level 0, so scan the samples.  */
+		unsigned long fpp = 1UL << view->zoom;
+		unsigned long start = first << view->zoom;
+		unsigned long numFrames = (unsigned long)columns << view->zoom;
+		short* samples;
+		size_t got;
+		int x;
+		if (start >= sound->framesDone)
+			return 0;
+		if (numFrames > sound->framesDone - start)
+			numFrames = sound->framesDone - start;
+		samples = (short*)malloc((size_t)numFrames * channels *
+								 sizeof(short));
+		if (samples == NULL)
+			return 0;
+		got = ReadPeakSamples(sound->peaks, start, numFrames, samples);
+		columns = (int)((got + fpp - 1) / fpp);
+		for (x = 0; x < columns; x++)
+		{
+			unsigned long i = (unsigned long)x * fpp;
+			unsigned long end = i + fpp;
+			unsigned c;
+			if (end > got)
+				end = got;
+			for (c = 0; c < channels; c++)
+			{
+				SoundPeak* pk = &peaks[x * channels + c];
+				unsigned long j;
+				pk->min = pk->max = samples[i * channels + c];
+				for (j = i + 1; j < end; j++)
+				{
+					short s = samples[j * channels + c];
+					if (s < pk->min)
+						pk->min = s;
+					if (s > pk->max)
+						pk->max = s;
+				}
+			}
+		}
+		free(samples);
+	}
+	return columns;
+}
+
+/* Draws the samples between the columns "left" and "right" as a line
+   through each channel, when zoomed in past a frame per pixel.  */
+static void DrawSamples(HDC hdc, const TimelineView* view, int left,
+	int right)
+{
+	const TimelineSound* sound = view->sound;
+	unsigned channels = sound->snd.numChannels;
+	int lanesTop = LanesTop(view);
+	int laneHeight = (view->clientHeight - lanesTop) / (int)channels;
+	int shift = -view->zoom;
+	/* Include a sample on either side, so the lines reach the edges.  */
+	unsigned long start = (unsigned long)(view->xPos + left) >> shift;
+	unsigned long end = ((unsigned long)(view->xPos + right) >> shift) + 2;
+	short* samples;
+	POINT* points;
+	size_t got, i;
+	unsigned c;
+
+	if (start > 0)
+		start--;
+	if (end > sound->framesDone)
+		end = sound->framesDone;
+	if (start >= end)
+		return;
+	samples = (short*)malloc((end - start) * channels * sizeof(short));
+	points = (POINT*)malloc((end - start) * sizeof(POINT));
+	if (samples != NULL && points != NULL)
+	{
+		got = ReadPeakSamples(sound->peaks, start, end - start, samples);
+		for (c = 0; c < channels && got > 0; c++)
+		{
+			int mid = lanesTop + laneHeight * (int)c + laneHeight / 2;
+			for (i = 0; i < got; i++)
+			{
+				points[i].x = (LONG)((long)((start + i) << shift) -
+									 view->xPos + (1L << shift) / 2);
+				points[i].y = mid - samples[i * channels + c] *
+					(laneHeight / 2) / 32768;
+			}
+			Polyline(hdc, points, (int)got);
+		}
+	}
+	free(samples);
+	free(points);
+}
+
+/* Runs on a worker thread: builds the pyramid a piece at a time until
+   it is done or the job is canceled.  */
+static void PeakWork(void* arg)
+{
+	TimelineSound* sound = (TimelineSound*)arg;
+	unsigned long done = 0;
+	while (!sound->canceled && done < sound->snd.numFrames)
+	{
+		done = BuildSoundPeaks(sound->peaks, BUILD_FRAMES);
+		PostMessage(sound->hwnd, WM_PEAKPROGRESS, (WPARAM)done,
+			(LPARAM)sound);
+	}
+	PostMessage(sound->hwnd, WM_PEAKDONE, 0, (LPARAM)sound);
+}
+
+/* Takes a progress report and redraws the lane columns of the new
+   frames, along with the ruler for the progress text.  Reports for
+   canceled sounds are ignored.  */
+static void ReportProgress(HWND hwnd, TimelineView* view,
+	TimelineSound* sound, unsigned long framesDone)
+{
+	RECT rt;
+	if (sound != view->sound)
+		return;
+	rt.left = (int)TickToX(view, sound->framesDone) - 1;
+	rt.right = (int)TickToX(view, framesDone) + 2;
+	rt.top = LanesTop(view);
+	rt.bottom = view->clientHeight;
+	sound->framesDone = framesDone;
+	if (rt.left < view->clientWidth && rt.right > 0)
+		InvalidateRect(hwnd, &rt, FALSE);
+	rt.left = 0;
+	rt.right = view->clientWidth;
+	rt.bottom = RULER_HEIGHT;
+	InvalidateRect(hwnd, &rt, FALSE);
+}
+
+/* Takes a sound whose job has returned.  A finished pyramid goes into
+   the cache; a canceled sound is freed.  */
+static void FinishPeakJob(HWND hwnd, TimelineView* view,
+	TimelineSound* sound)
+{
+	TimelineSound** link;
+	if (sound == view->sound)
+	{
+		sound->building = false;
+		if (view->cache != NULL)
+			StorePeaks(view->cache, &sound->key, sound->peaks);
+		return;
+	}
+	for (link = &view->canceled; *link != NULL; link = &(*link)->next)
+	{
+		if (*link == sound)
+		{
+			*link = sound->next;
+			FreeTimelineSound(sound);
+			return;
+		}
+	}
+}
+
+/* Stops showing the sound or the tracks.  */
+static void ClearTimeline(HWND hwnd, TimelineView* view)
+{
+	DropSound(view);
+	FreeTracks(view);
+	view->rate = 0;
+	view->length = 0;
+	view->xPos = 0;
+	view->yPos = 0;
+	InvalidateRect(hwnd, NULL, FALSE);
+	UpdateScrollBars(hwnd, view);
+}
+
+/* Stops showing the current sound.  If its job is still out, the job
+   is canceled and the sound is kept until it returns.  */
+static void DropSound(TimelineView* view)
+{
+	TimelineSound* sound = view->sound;
+	if (sound == NULL)
+		return;
+	view->sound = NULL;
+	if (sound->building)
+	{
+		InterlockedExchange(&sound->canceled, 1);
+		sound->next = view->canceled;
+		view->canceled = sound;
+	}
+	else
+		FreeTimelineSound(sound);
+}
+
+static void FreeTimelineSound(TimelineSound* sound)
+{
+	FreeSoundPeaks(sound->peaks);
+	free(sound->data);
+	free(sound);
+}
+
+/* Reads the events of a sprite or sound resource into a track, with
+   "rate" ticks to the second.  Returns false if the resource can't be
+   read or memory runs out.  */
+static bool FillTrack(TimelineTrack* track, unsigned long type,
+	const unsigned char* rsrc, size_t size, unsigned long rate)
+{
+	Interval* events;
+	size_t count, i;
+
+	if (type == MHK_TSPR)
+	{
+		MhkSprite spr;
+		if (ParseSprite(rsrc, size, &spr) != MHK_OK)
+			return false;
+		count = spr.numFrames;
+		FreeSprite(&spr);
+		events = (Interval*)malloc(count > 0 ? count * sizeof(Interval) : 1);
+		if (events == NULL)
+			return false;
+		for (i = 0; i < count; i++)
+		{
+			events[i].first = ToTicks((double)i * rate / SPRITEVIEW_FPS);
+			events[i].last =
+				ToTicks((double)(i + 1) * rate / SPRITEVIEW_FPS) - 1;
+			events[i].tag = (unsigned long)i;
+		}
+		track->length = count > 0 ? events[count - 1].last + 1 : 0;
+	}
+	else if (type == MHK_TWAV)
+	{
+		MhkSound snd;
+		unsigned numCues;
+		double scale;
+		int error = ParseSound(rsrc, size, &snd);
+		/* MPEG-2 sounds can't be decoded, but their timing is known.  */
+		if (error != MHK_OK && error != MHK_EUNSUPPORTED)
+			return false;
+		scale = (double)rate / snd.sampleRate;
+		numCues = ReadSoundCues(rsrc, size, NULL, 0);
+		count = 0;
+		events = (Interval*)malloc(numCues > 0 ?
+			numCues * sizeof(Interval) : 1);
+		track->cues = (SoundCue*)malloc(numCues > 0 ?
+			numCues * sizeof(SoundCue) : 1);
+		if (events == NULL || track->cues == NULL)
+		{
+			free(events);
+			return false;
+		}
+		if (ReadSoundCues(rsrc, size, track->cues, numCues) == numCues)
+			count = numCues;
+		for (i = 0; i < count; i++)
+		{
+			events[i].first = ToTicks(track->cues[i].frame * scale);
+			events[i].last = events[i].first;
+			events[i].tag = (unsigned long)i;
+		}
+		track->length = ToTicks(snd.numFrames * scale);
+	}
+	else
+		return false;
+
+	track->events = CreateIntervalTree(events, count);
+	free(events);
+	return track->events != NULL;
+}
+
+static void FreeTracks(TimelineView* view)
+{
+	unsigned t;
+	for (t = 0; t < view->numTracks; t++)
+	{
+		FreeIntervalTree(view->tracks[t].events);
+		free(view->tracks[t].cues);
+	}
+	free(view->tracks);
+	view->tracks = NULL;
+	view->numTracks = 0;
+	view->numEvents = 0;
+	view->selTrack = -1;
+	view->selEvent = NULL;
+}
+
+/* Returns the track at window row "y", or -1.  */
+static int TrackFromPoint(const TimelineView* view, int y)
+{
+	long row;
+	if (y < RULER_HEIGHT)
+		return -1;
+	row = (y - RULER_HEIGHT + view->yPos) / TRACK_HEIGHT;
+	if (row >= (long)view->numTracks)
+		return -1;
+	return (int)row;
+}
+
+/* Returns the event of a track at column "x", or NULL.  A cue is hard
+   to hit exactly, so it is found a few columns away.  */
+static const Interval* EventFromPoint(const TimelineView* view, unsigned t,
+	int x)
+{
+	const IntervalTree* events = view->tracks[t].events;
+	const Interval* ev;
+	unsigned long lo, hi;
+	if (events == NULL)
+		return NULL;
+	lo = TickAtX(view, x);
+	hi = TickAtX(view, x + 1);
+	ev = FindInterval(events, lo, hi > lo ? hi - 1 : lo);
+	if (ev == NULL)
+		ev = FindInterval(events, TickAtX(view, x - 3), TickAtX(view, x + 4));
+	return ev;
+}
+
+/* Gets the columns that an event covers, from "x0" up to "x1", which
+   is at least one column.  */
+static void GetEventColumns(const TimelineView* view, const Interval* ev,
+	int* x0, int* x1)
+{
+	*x0 = (int)floor(TickToX(view, ev->first));
+	*x1 = (int)ceil(TickToX(view, ev->last + 1.0));
+	if (*x1 <= *x0)
+		*x1 = *x0 + 1;
+}
+
+/* Invalidates the rectangle of an event on track "t", or the label of
+   the track if "ev" is NULL.  */
+static void InvalidateEvent(HWND hwnd, const TimelineView* view, int t,
+	const Interval* ev)
+{
+	RECT rt;
+	int x0, x1;
+	if (t < 0)
+		return;
+	rt.top = TrackTop(view, (unsigned)t);
+	rt.bottom = rt.top + TRACK_HEIGHT;
+	if (ev == NULL)
+	{
+		rt.left = 0;
+		rt.right = TimeLeft(view);
+	}
+	else
+	{
+		GetEventColumns(view, ev, &x0, &x1);
+		rt.left = x0;
+		rt.right = x1;
+		if (view->tracks[t].type == MHK_TWAV)
+			rt.right = x0 + 3 + CUE_LABEL_WIDTH;
+	}
+	if (rt.left < rt.right)
+		InvalidateRect(hwnd, &rt, FALSE);
+}
+
+/* Selects track "t", or none if it is -1, and event "ev" on it, which
+   may be NULL.  Only what changes is redrawn.  */
+static void SelectEvent(HWND hwnd, TimelineView* view, int t,
+	const Interval* ev)
+{
+	if (t == view->selTrack && ev == view->selEvent)
+		return;
+	if (t != view->selTrack)
+	{
+		InvalidateEvent(hwnd, view, view->selTrack, NULL);
+		InvalidateEvent(hwnd, view, t, NULL);
+	}
+	if (view->selEvent != NULL)
+		InvalidateEvent(hwnd, view, view->selTrack, view->selEvent);
+	if (ev != NULL)
+		InvalidateEvent(hwnd, view, t, ev);
+	view->selTrack = t;
+	view->selEvent = ev;
+}
+
+static void NotifyParent(HWND hwnd, int code)
+{
+	SendMessage(GetParent(hwnd), WM_COMMAND,
+		MAKEWPARAM(GetDlgCtrlID(hwnd), code), (LPARAM)hwnd);
+}
+
+/* Returns the column where time starts.  A group keeps its track
+   labels to the left of that.  */
+static int TimeLeft(const TimelineView* view)
+{
+	return view->sound == NULL && view->numTracks > 0 ? LABEL_WIDTH : 0;
+}
+
+static int TrackTop(const TimelineView* view, unsigned t)
+{
+	return RULER_HEIGHT + (int)((long)t * TRACK_HEIGHT - view->yPos);
+}
+
+/* Returns the top of the channel lanes of a sound, below its cues.  */
+static int LanesTop(const TimelineView* view)
+{
+	return RULER_HEIGHT + (int)view->numTracks * TRACK_HEIGHT;
+}
+
+static int MinZoom(const TimelineView* view)
+{
+	return view->sound == NULL ? EVENT_MIN_ZOOM : MIN_ZOOM;
+}
+
+/* Returns the zoom where one column covers the top bucket of the
+   sound, or everything on the tracks.  */
+static int MaxZoom(const TimelineView* view)
+{
+	int zoom;
+	if (view->sound != NULL)
+		return PEAK_BASE_SHIFT +
+			(int)PeakLevelCount(view->sound->peaks) - 1;
+	for (zoom = EVENT_MIN_ZOOM; zoom < 31 && (view->length >> zoom) > 1;
+		 zoom++)
+		;
+	return zoom;
+}
+
+/* Returns the width of everything in pixels at a zoom.  */
+static long TotalWidth(const TimelineView* view, int zoom)
+{
+	if (zoom >= 0)
+		return (long)((view->length >> zoom) +
+			((view->length & ((1UL << zoom) - 1)) != 0));
+	return (long)(view->length << -zoom);
+}
+
+/* Converts a time to ticks, clamped to what an interval can hold.  */
+static unsigned long ToTicks(double ticks)
+{
+	if (ticks >= ULONG_MAX)
+		return ULONG_MAX - 1;
+	return (unsigned long)(ticks + 0.5);
+}
+
+static double TicksPerPixel(int zoom)
+{
+	if (zoom >= 0)
+		return (double)(1UL << zoom);
+	return 1.0 / (double)(1UL << -zoom);
+}
+
+/* Returns the window x coordinate of the left edge of a tick.  */
+static double TickToX(const TimelineView* view, double tick)
+{
+	return tick / TicksPerPixel(view->zoom) - view->xPos + TimeLeft(view);
+}
+
+/* Returns the tick at the left edge of window column "x".  */
+static unsigned long TickAtX(const TimelineView* view, int x)
+{
+	double tick = (double)(view->xPos + x - TimeLeft(view)) *
+		TicksPerPixel(view->zoom);
+	if (tick <= 0)
+		return 0;
+	if (tick >= ULONG_MAX)
+		return ULONG_MAX;
+	return (unsigned long)tick;
+}
+
+/* Zooms out just far enough to show everything.  */
+static void FitTimeline(HWND hwnd, TimelineView* view)
+{
+	view->zoom = MinZoom(view);
+	while (view->zoom < MaxZoom(view) && TotalWidth(view, view->zoom) >
+		   view->clientWidth - TimeLeft(view))
+		view->zoom++;
+	view->xPos = 0;
+	InvalidateRect(hwnd, NULL, FALSE);
+	UpdateScrollBars(hwnd, view);
+}
+
+/* Changes the zoom, clamped to the range of the view, keeping the tick
+   at column "anchorX" where it is.  */
+static void ZoomTimeline(HWND hwnd, TimelineView* view, int zoom,
+	int anchorX)
+{
+	double tick;
+	if (view->rate == 0)
+		return;
+	if (zoom > MaxZoom(view))
+		zoom = MaxZoom(view);
+	if (zoom < MinZoom(view))
+		zoom = MinZoom(view);
+	if (zoom == view->zoom)
+		return;
+	anchorX -= TimeLeft(view);
+	if (anchorX < 0)
+		anchorX = 0;
+	tick = (view->xPos + anchorX) * TicksPerPixel(view->zoom);
+	view->zoom = zoom;
+	view->fit = false;
+	view->xPos = (long)(tick / TicksPerPixel(zoom)) - anchorX;
+	InvalidateRect(hwnd, NULL, FALSE);
+	UpdateScrollBars(hwnd, view);
+	/* Clamp the new position.  */
+	ScrollTimeline(hwnd, view, view->xPos);
+}
+
+/* Scrolls to a new position, which is clamped to the length.  The
+   track labels stay put.  */
+static void ScrollTimeline(HWND hwnd, TimelineView* view, long newX)
+{
+	int left = TimeLeft(view);
+	long width = view->clientWidth - left;
+	long maxX = TotalWidth(view, view->zoom) - width;
+	long dx;
+	if (newX > maxX) newX = maxX;
+	if (newX < 0) newX = 0;
+	dx = view->xPos - newX;
+	if (dx == 0)
+		return;
+	if (dx > -width && dx < width)
+	{
+		RECT rt;
+		rt.left = left;
+		rt.top = 0;
+		rt.right = view->clientWidth;
+		rt.bottom = view->clientHeight;
+		ScrollWindowEx(hwnd, (int)dx, 0, &rt, &rt, NULL, NULL,
+			SW_INVALIDATE);
+	}
+	else
+		InvalidateRect(hwnd, NULL, FALSE);
+	view->xPos = newX;
+	SetScrollPos(hwnd, SB_HORZ, (int)newX, TRUE);
+}
+
+/* Scrolls the tracks of a group to a new position, which is clamped.
+   The ruler stays put.  */
+static void ScrollTracks(HWND hwnd, TimelineView* view, long newY)
+{
+	long height = view->clientHeight - RULER_HEIGHT;
+	long maxY = (long)view->numTracks * TRACK_HEIGHT - height;
+	long dy;
+	if (newY > maxY) newY = maxY;
+	if (newY < 0 || view->sound != NULL) newY = 0;
+	dy = view->yPos - newY;
+	if (dy == 0)
+		return;
+	if (dy > -height && dy < height)
+	{
+		RECT rt;
+		rt.left = 0;
+		rt.top = RULER_HEIGHT;
+		rt.right = view->clientWidth;
+		rt.bottom = view->clientHeight;
+		ScrollWindowEx(hwnd, 0, (int)dy, &rt, &rt, NULL, NULL,
+			SW_INVALIDATE);
+	}
+	else
+		InvalidateRect(hwnd, NULL, FALSE);
+	view->yPos = newY;
+	SetScrollPos(hwnd, SB_VERT, (int)newY, TRUE);
+}
+
+static void UpdateScrollBars(HWND hwnd, TimelineView* view)
+{
+	SCROLLINFO si;
+	long width = TotalWidth(view, view->zoom);
+	long height = view->sound == NULL ?
+		(long)view->numTracks * TRACK_HEIGHT : 0;
+	si.cbSize = sizeof(SCROLLINFO);
+	si.fMask = SIF_RANGE | SIF_PAGE | SIF_POS;
+	si.nMin = 0;
+	si.nMax = width > 0 ? (int)width - 1 : 0;
+	si.nPage = view->clientWidth - TimeLeft(view);
+	si.nPos = (int)view->xPos;
+	SetScrollInfo(hwnd, SB_HORZ, &si, TRUE);
+	si.nMax = height > 0 ? (int)height - 1 : 0;
+	si.nPage = view->clientHeight - RULER_HEIGHT;
+	si.nPos = (int)view->yPos;
+	SetScrollInfo(hwnd, SB_VERT, &si, TRUE);
+}
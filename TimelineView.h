@@ -0,0 +1,25 @@
+/* Timeline view window interface */
+/* This is platform dependent code: include windows.h, "bool.h", and
+   "MhkArchive.h" before this header.  */
+
+#ifndef TIMELINEVIEW_H
+#define TIMELINEVIEW_H
+
+#include <stddef.h>
+
+#define TIMELINEVIEW_CLASS "MhkTimelineView"
+
+/* Notification codes sent to the parent window in WM_COMMAND, with
+   the view's control ID.  */
+enum TimelineViewNotify
+{
+	TLN_OPEN = 1 /* A track was double-clicked or Enter was pressed */
+};
+
+BOOL RegisterTimelineView(HINSTANCE hInstance);
+bool SetTimelineSound(HWND hwnd, const unsigned char* rsrc, size_t size);
+void SetTimelineItems(HWND hwnd, MhkArchive* archive, unsigned first,
+	unsigned count);
+int GetTimelineSelection(HWND hwnd);
+
+#endif /* not TIMELINEVIEW_H */
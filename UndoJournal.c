@@ -0,0 +1,673 @@
+/* Undo journal */
+/* Keeps the edits of a text so that they can be undone and redone.
+   The texts of the entries go one after another into an arena, a chain
+   of blocks that are only ever added to at the end, so adding an entry
+   is a bump of the last block and dropping entries frees whole blocks.
+   A text too big for a block gets a block of its own.
+
+   Undoing moves back through the entries without freeing anything.
+   Adding an entry after undoing drops every entry that could have been
+   redone by rewinding the arena to where the first of them began.
+   Once the blocks grow past the byte budget, the oldest entries are
+   dropped until the blocks that only they used can be freed, although
+   the newest entry is always kept.
+
+   Only the newest blocks, up to a smaller resident budget, stay in
+   memory.  Older blocks are spilled to the end of a temporary file and
+   freed, and read back in when an entry in them is undone or redone.
+   A block keeps its copy in the file until it is written to again, so
+   it can be freed again without another write.  Since the oldest
+   blocks are dropped first, the start of the file goes dead over
+   time, and once more than half of it is dead the live copies are
+   moved to a new file.  Spill files are made in the temporary
+   directory and go away when they are closed.  If one cannot be made,
+   no other is tried, and blocks that cannot be spilled just stay in
+   memory.
+
+   Typing or deleting one character at a time extends the text of the
+   last entry in place.  Characters deleted backwards are stored in
+   reverse, so that they can be added at the end too, and put back in
+   order the first time the entry is undone or redone.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "bool.h"
+#include "UndoJournal.h"
+
+#define UNDO_BLOCK_SIZE 65536 /* Usual size of an arena block */
+/* The spill file is not compacted while it is smaller than this.  */
+#define SPILL_COMPACT_MIN 0x1000000
+
+typedef struct UndoBlock_t UndoBlock;
+typedef struct UndoRecord_t UndoRecord;
+
+struct UndoBlock_t
+{
+	char* data; /* NULL while the block is spilled */
+	size_t size;
+	size_t used;
+	long offset; /* Of the copy in the spill file, or -1 for none */
+	size_t filed; /* Length of that copy */
+};
+
+struct UndoRecord_t
+{
+	UndoEntry entry; /* The text pointers are only kept up to date for
+						the entries that are handed out */
+	/* Where the texts are, as block serial numbers and offsets */
+	size_t dataBlock;
+	size_t dataOffset;
+	size_t oldBlock;
+	size_t oldOffset;
+	/* The end of the arena before the entry was added */
+	size_t markBlock;
+	size_t markUsed;
+	bool reversed; /* The text is stored back to front */
+};
+
+struct UndoJournal_t
+{
+	UndoRecord* records; /* Oldest first, starting at "first" */
+	size_t first;
+	size_t numRecords;
+	size_t maxRecords;
+	size_t cur; /* Records up to this one have been applied */
+	UndoBlock* blocks; /* Oldest first */
+	size_t numBlocks;
+	size_t maxBlocks;
+	size_t firstBlock; /* Serial number of the first block */
+	size_t bytes; /* Total size of the blocks */
+	size_t maxBytes;
+	size_t resident; /* Total size of the blocks in memory */
+	size_t maxResident;
+	size_t spillFrom; /* No block before this one is in memory */
+	FILE* spill; /* Opened the first time a block is spilled */
+	long spillEnd;
+	long spillLive; /* Bytes of the file that blocks still refer to */
+	bool noSpillFile; /* Making a spill file failed */
+};
+
+static bool ReserveRecord(UndoJournal* journal);
+static bool ReserveText(UndoJournal* journal, size_t length,
+	size_t* serial, size_t* offset);
+static char* TextAt(UndoJournal* journal, size_t serial, size_t offset);
+static void TouchBlock(UndoJournal* journal, UndoBlock* block);
+static void FreeBlock(UndoJournal* journal, UndoBlock* block);
+static void Rewind(UndoJournal* journal, size_t markBlock, size_t markUsed);
+static void DropOldest(UndoJournal* journal);
+static void TrimJournal(UndoJournal* journal, const UndoRecord* keep);
+static bool SpillBlock(UndoJournal* journal, UndoBlock* block);
+static bool LoadBlock(UndoJournal* journal, size_t serial);
+static void CompactSpill(UndoJournal* journal);
+static FILE* OpenSpillFile(UndoJournal* journal);
+static bool CopySpill(FILE* src, long offset, size_t length, FILE* dest);
+static const UndoEntry* HandOut(UndoJournal* journal, UndoRecord* rec);
+
+/* Returns an empty journal that keeps the texts of its entries under
+   about "maxBytes", of which no more than about "maxResident" stay in
+   memory.  Returns NULL if out of memory.  */
+UndoJournal* CreateUndoJournal(size_t maxBytes, size_t maxResident)
+{
+	UndoJournal* journal;
+	journal = (UndoJournal*)calloc(1, sizeof(UndoJournal));
+	if (journal == NULL)
+		return NULL;
+	journal->maxBytes = maxBytes;
+	journal->maxResident = maxResident;
+	return journal;
+}
+
+/* Drops every entry.  */
+void ClearUndoJournal(UndoJournal* journal)
+{
+	size_t i;
+	for (i = 0; i < journal->numBlocks; i++)
+		free(journal->blocks[i].data);
+	free(journal->blocks);
+	free(journal->records);
+	journal->records = NULL;
+	journal->first = 0;
+	journal->numRecords = 0;
+	journal->maxRecords = 0;
+	journal->cur = 0;
+	journal->blocks = NULL;
+	journal->firstBlock += journal->numBlocks;
+	journal->numBlocks = 0;
+	journal->maxBlocks = 0;
+	journal->bytes = 0;
+	journal->resident = 0;
+	journal->spillFrom = journal->firstBlock;
+	/* The file is kept for reuse.  */
+	journal->spillEnd = 0;
+	journal->spillLive = 0;
+}
+
+/* Adds an entry after the last one applied, with room for "length"
+   bytes of text in "data" and, if "oldLength" is not zero, that many
+   in "oldData", for the caller to fill in.  Returns the entry, or NULL
+   if out of memory, in which case the whole history is dropped since
+   it would no longer line up with the text.  */
+UndoEntry* AddUndoEntry(UndoJournal* journal, unsigned type,
+	unsigned long opPos, size_t length, size_t oldLength)
+{
+	UndoRecord* rec;
+	size_t markBlock, markUsed;
+	bool ok;
+
+	/* The entries that could have been redone go away.  */
+	if (journal->cur < journal->numRecords)
+	{
+		rec = &journal->records[journal->cur];
+		Rewind(journal, rec->markBlock, rec->markUsed);
+		journal->numRecords = journal->cur;
+	}
+	if (!ReserveRecord(journal))
+	{
+		ClearUndoJournal(journal);
+		return NULL;
+	}
+
+	markBlock = journal->firstBlock + journal->numBlocks;
+	markUsed = 0;
+	if (journal->numBlocks > 0)
+	{
+		markBlock--;
+		markUsed = journal->blocks[journal->numBlocks - 1].used;
+	}
+	rec = &journal->records[journal->numRecords];
+	rec->entry.type = type;
+	rec->entry.caretFirst = false;
+	rec->entry.opPos = opPos;
+	rec->entry.length = length;
+	rec->entry.oldLength = oldLength;
+	rec->markBlock = markBlock;
+	rec->markUsed = markUsed;
+	rec->reversed = false;
+	ok = ReserveText(journal, length, &rec->dataBlock, &rec->dataOffset);
+	if (ok && oldLength != 0)
+		ok = ReserveText(journal, oldLength, &rec->oldBlock, &rec->oldOffset);
+	if (!ok)
+	{
+		ClearUndoJournal(journal);
+		return NULL;
+	}
+	journal->numRecords++;
+	journal->cur = journal->numRecords;
+
+	TrimJournal(journal, rec);
+	rec->entry.data = TextAt(journal, rec->dataBlock, rec->dataOffset);
+	rec->entry.oldData = NULL;
+	if (oldLength != 0)
+		rec->entry.oldData = TextAt(journal, rec->oldBlock, rec->oldOffset);
+	return &rec->entry;
+}
+
+/* Adds the character "c" from text position "pos" to the text of the
+   last entry: before it if "pos" comes before the entry, and after it
+   otherwise.  Returns false if the entry cannot be extended, because
+   it was undone, has old text, would change direction, or there is no
+   memory, so that the caller should add a new entry.  */
+bool ExtendUndoEntry(UndoJournal* journal, unsigned long pos, char c)
+{
+	UndoRecord* rec;
+	UndoBlock* block;
+	bool before;
+	char* end;
+
+	if (journal->cur == journal->first ||
+		journal->cur < journal->numRecords)
+		return false;
+	rec = &journal->records[journal->cur - 1];
+	before = (pos < rec->entry.opPos);
+	/* A reversed entry only grows at the front, and an entry of more
+	   than one character in order only at the back.  */
+	if (rec->entry.oldLength != 0 || (rec->reversed && !before) ||
+		(rec->entry.length > 1 && !rec->reversed && before))
+		return false;
+	/* The text has to be the last thing in the arena.  */
+	block = &journal->blocks[journal->numBlocks - 1];
+	if (rec->dataBlock != journal->firstBlock + journal->numBlocks - 1 ||
+		block->data == NULL ||
+		rec->dataOffset + rec->entry.length + 1 != block->used)
+		return false;
+
+	if (block->used < block->size)
+	{
+		TouchBlock(journal, block);
+		block->used++;
+	}
+	else
+	{
+		/* Move the text to a new block with room to grow.  The copy
+		   left behind is freed with the block.  */
+		const char* text = block->data + rec->dataOffset;
+		size_t serial, offset;
+		if (!ReserveText(journal, rec->entry.length * 2 + 1, &serial,
+						 &offset))
+			return false;
+		block = &journal->blocks[journal->numBlocks - 1];
+		memcpy(block->data + offset, text, rec->entry.length);
+		rec->dataBlock = serial;
+		rec->dataOffset = offset;
+		block->used = offset + rec->entry.length + 2;
+	}
+	end = block->data + rec->dataOffset + rec->entry.length;
+	end[0] = c;
+	end[1] = '\0';
+	rec->entry.length++;
+	if (before)
+	{
+		rec->reversed = true;
+		rec->entry.opPos--;
+	}
+	TrimJournal(journal, rec);
+	return true;
+}
+
+bool CanStepUndo(const UndoJournal* journal)
+{
+	return journal->cur > journal->first;
+}
+
+bool CanStepRedo(const UndoJournal* journal)
+{
+	return journal->cur < journal->numRecords;
+}
+
+/* Moves back past the last entry applied and returns it, or NULL if
+   there is nothing to undo or its text cannot be read back in.  */
+const UndoEntry* StepUndo(UndoJournal* journal)
+{
+	const UndoEntry* entry;
+	if (!CanStepUndo(journal))
+		return NULL;
+	entry = HandOut(journal, &journal->records[journal->cur - 1]);
+	if (entry != NULL)
+		journal->cur--;
+	return entry;
+}
+
+/* Moves forward past the next entry and returns it, or NULL if there
+   is nothing to redo or its text cannot be read back in.  */
+const UndoEntry* StepRedo(UndoJournal* journal)
+{
+	const UndoEntry* entry;
+	if (!CanStepRedo(journal))
+		return NULL;
+	entry = HandOut(journal, &journal->records[journal->cur]);
+	if (entry != NULL)
+		journal->cur++;
+	return entry;
+}
+
+void FreeUndoJournal(UndoJournal* journal)
+{
+	if (journal == NULL)
+		return;
+	ClearUndoJournal(journal);
+	if (journal->spill != NULL)
+		fclose(journal->spill);
+	free(journal);
+}
+
+/* Makes room for one more record.  */
+static bool ReserveRecord(UndoJournal* journal)
+{
+	UndoRecord* records;
+	size_t maxRecords;
+	if (journal->numRecords < journal->maxRecords)
+		return true;
+	/* Reuse the space of the dropped records if they are at least half
+	   of it, so that the move pays for itself.  */
+	if (journal->first > 0 && journal->first >= journal->numRecords / 2)
+	{
+		size_t first = journal->first;
+		memmove(journal->records, &journal->records[first],
+			(journal->numRecords - first) * sizeof(UndoRecord));
+		journal->numRecords -= first;
+		journal->cur -= first;
+		journal->first = 0;
+		return true;
+	}
+	maxRecords = journal->maxRecords * 2 + 16;
+	records = (UndoRecord*)realloc(journal->records,
+		maxRecords * sizeof(UndoRecord));
+	if (records == NULL)
+		return false;
+	journal->records = records;
+	journal->maxRecords = maxRecords;
+	return true;
+}
+
+/* Takes "length" bytes and a null terminator from the end of the
+   arena, and stores where they are in "serial" and "offset".  Returns
+   false if out of memory.  */
+static bool ReserveText(UndoJournal* journal, size_t length,
+	size_t* serial, size_t* offset)
+{
+	UndoBlock* block = NULL;
+	if (journal->numBlocks > 0)
+		block = &journal->blocks[journal->numBlocks - 1];
+	/* A spilled block is not read back in just to add to it.  */
+	if (block == NULL || block->data == NULL ||
+		block->size - block->used < length + 1)
+	{
+		size_t size = (length + 1 > UNDO_BLOCK_SIZE) ?
+			length + 1 : UNDO_BLOCK_SIZE;
+		if (journal->numBlocks >= journal->maxBlocks)
+		{
+			size_t maxBlocks = journal->maxBlocks * 2 + 16;
+			UndoBlock* blocks = (UndoBlock*)realloc(journal->blocks,
+				maxBlocks * sizeof(UndoBlock));
+			if (blocks == NULL)
+				return false;
+			journal->blocks = blocks;
+			journal->maxBlocks = maxBlocks;
+		}
+		block = &journal->blocks[journal->numBlocks];
+		block->data = (char*)malloc(size);
+		if (block->data == NULL)
+			return false;
+		block->size = size;
+		block->used = 0;
+		block->offset = -1;
+		block->filed = 0;
+		journal->numBlocks++;
+		journal->bytes += size;
+		journal->resident += size;
+	}
+	TouchBlock(journal, block);
+	*serial = journal->firstBlock + journal->numBlocks - 1;
+	*offset = block->used;
+	block->data[block->used + length] = '\0';
+	block->used += length + 1;
+	return true;
+}
+
+static char* TextAt(UndoJournal* journal, size_t serial, size_t offset)
+{
+	return journal->blocks[serial - journal->firstBlock].data + offset;
+}
+
+/* Forgets the copy of a block in the spill file before the block is
+   written to.  */
+static void TouchBlock(UndoJournal* journal, UndoBlock* block)
+{
+	if (block->offset < 0)
+		return;
+	journal->spillLive -= (long)block->filed;
+	block->offset = -1;
+	block->filed = 0;
+}
+
+/* Frees a block that is going away for good.  */
+static void FreeBlock(UndoJournal* journal, UndoBlock* block)
+{
+	journal->bytes -= block->size;
+	if (block->data != NULL)
+		journal->resident -= block->size;
+	if (block->offset >= 0)
+		journal->spillLive -= (long)block->filed;
+	free(block->data);
+}
+
+/* Frees everything added to the arena after the given end.  */
+static void Rewind(UndoJournal* journal, size_t markBlock, size_t markUsed)
+{
+	while (journal->numBlocks > 0 &&
+		   journal->firstBlock + journal->numBlocks - 1 > markBlock)
+	{
+		FreeBlock(journal, &journal->blocks[--journal->numBlocks]);
+	}
+	if (journal->numBlocks > 0 &&
+		journal->firstBlock + journal->numBlocks - 1 == markBlock)
+		journal->blocks[journal->numBlocks - 1].used = markUsed;
+	if (journal->spillFrom > journal->firstBlock + journal->numBlocks)
+		journal->spillFrom = journal->firstBlock + journal->numBlocks;
+}
+
+/* Drops the oldest entry, then frees the blocks that no entry uses
+   anymore.  */
+static void DropOldest(UndoJournal* journal)
+{
+	size_t markBlock, numFreed, i;
+	journal->first++;
+	markBlock = journal->records[journal->first].markBlock;
+	numFreed = 0;
+	while (numFreed < journal->numBlocks &&
+		   journal->firstBlock + numFreed < markBlock)
+	{
+		FreeBlock(journal, &journal->blocks[numFreed]);
+		numFreed++;
+	}
+	if (numFreed == 0)
+		return;
+	for (i = numFreed; i < journal->numBlocks; i++)
+		journal->blocks[i - numFreed] = journal->blocks[i];
+	journal->numBlocks -= numFreed;
+	journal->firstBlock += numFreed;
+	if (journal->spillFrom < journal->firstBlock)
+		journal->spillFrom = journal->firstBlock;
+}
+
+/* Brings the journal back under its budgets, first by dropping the
+   oldest entries and then by spilling the oldest blocks in memory.
+   The last block and the blocks of "keep" stay in memory.  */
+static void TrimJournal(UndoJournal* journal, const UndoRecord* keep)
+{
+	size_t serial, last;
+	while (journal->bytes > journal->maxBytes &&
+		   journal->numRecords - journal->first > 1)
+		DropOldest(journal);
+
+	last = journal->firstBlock + journal->numBlocks - 1;
+	for (serial = journal->spillFrom;
+		 journal->resident > journal->maxResident && serial < last;
+		 serial++)
+	{
+		UndoBlock* block = &journal->blocks[serial - journal->firstBlock];
+		if (block->data != NULL && serial != keep->dataBlock &&
+			(keep->entry.oldLength == 0 || serial != keep->oldBlock))
+		{
+			if (!SpillBlock(journal, block))
+				return;
+		}
+		if (block->data == NULL && serial == journal->spillFrom)
+			journal->spillFrom++;
+	}
+}
+
+/* Writes a block to the end of the spill file, unless it is already
+   there, and frees it.  Returns false if the file cannot be used.  */
+static bool SpillBlock(UndoJournal* journal, UndoBlock* block)
+{
+	if (block->offset < 0)
+	{
+		if (journal->spillEnd - journal->spillLive > journal->spillLive &&
+			journal->spillEnd >= SPILL_COMPACT_MIN)
+			CompactSpill(journal);
+		if (journal->spill == NULL)
+			journal->spill = OpenSpillFile(journal);
+		if (journal->spill == NULL ||
+			block->used > (size_t)(LONG_MAX - journal->spillEnd) ||
+			fseek(journal->spill, journal->spillEnd, SEEK_SET) != 0 ||
+			fwrite(block->data, 1, block->used, journal->spill) !=
+				block->used)
+			return false;
+		block->offset = journal->spillEnd;
+		block->filed = block->used;
+		journal->spillEnd += (long)block->used;
+		journal->spillLive += (long)block->used;
+	}
+	free(block->data);
+	block->data = NULL;
+	journal->resident -= block->size;
+	return true;
+}
+
+/* Reads a spilled block back into memory.  Returns false if out of
+   memory or the file cannot be read.  */
+static bool LoadBlock(UndoJournal* journal, size_t serial)
+{
+	UndoBlock* block = &journal->blocks[serial - journal->firstBlock];
+	char* data;
+	if (block->data != NULL)
+		return true;
+	data = (char*)malloc(block->size);
+	if (data == NULL)
+		return false;
+	/* fflush() is needed between writing and reading.  */
+	if (fflush(journal->spill) != 0 ||
+		fseek(journal->spill, block->offset, SEEK_SET) != 0 ||
+		fread(data, 1, block->used, journal->spill) != block->used)
+	{
+		free(data);
+		return false;
+	}
+	block->data = data;
+	journal->resident += block->size;
+	if (journal->spillFrom > serial)
+		journal->spillFrom = serial;
+	return true;
+}
+
+/* Moves the copies of the spilled blocks to the start of a new spill
+   file, and forgets the copies of the blocks in memory.  The old file
+   stays in use if anything goes wrong.  */
+static void CompactSpill(UndoJournal* journal)
+{
+	FILE* fp = OpenSpillFile(journal);
+	long end = 0;
+	size_t i;
+	if (fp == NULL)
+		return;
+	if (fflush(journal->spill) != 0)
+	{
+		fclose(fp);
+		return;
+	}
+	for (i = 0; i < journal->numBlocks; i++)
+	{
+		const UndoBlock* block = &journal->blocks[i];
+		if (block->data != NULL || block->offset < 0)
+			continue;
+		if (!CopySpill(journal->spill, block->offset, block->filed, fp))
+		{
+			fclose(fp);
+			return;
+		}
+	}
+	for (i = 0; i < journal->numBlocks; i++)
+	{
+		UndoBlock* block = &journal->blocks[i];
+		if (block->data != NULL)
+			TouchBlock(journal, block);
+		else if (block->offset >= 0)
+		{
+			block->offset = end;
+			end += (long)block->filed;
+		}
+	}
+	fclose(journal->spill);
+	journal->spill = fp;
+	journal->spillEnd = end;
+	journal->spillLive = end;
+}
+
+/* Makes an empty spill file in the temporary directory, which is
+   deleted when it is closed.  tmpfile() is not used because it puts
+   the file in the root of the drive, which is often read-only.
+   Returns NULL on failure, and after any failure.  */
+static FILE* OpenSpillFile(UndoJournal* journal)
+{
+	char dir[MAX_PATH];
+	char name[MAX_PATH];
+	DWORD dirLen;
+	HANDLE hFile;
+	int fd;
+	FILE* fp;
+
+	if (journal->noSpillFile)
+		return NULL;
+	journal->noSpillFile = true;
+	dirLen = GetTempPath(MAX_PATH, dir);
+	if (dirLen == 0 || dirLen >= MAX_PATH ||
+		GetTempFileName(dir, "mhk", 0, name) == 0)
+		return NULL;
+	hFile = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+		NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		DeleteFile(name);
+		return NULL;
+	}
+	fd = _open_osfhandle((intptr_t)hFile, _O_RDWR | _O_BINARY);
+	if (fd == -1)
+	{
+		CloseHandle(hFile);
+		return NULL;
+	}
+	fp = _fdopen(fd, "w+b");
+	if (fp == NULL)
+	{
+		_close(fd);
+		return NULL;
+	}
+	journal->noSpillFile = false;
+	return fp;
+}
+
+/* Appends "length" bytes from "offset" in "src" to "dest".  */
+static bool CopySpill(FILE* src, long offset, size_t length, FILE* dest)
+{
+	char buf[4096];
+	if (fseek(src, offset, SEEK_SET) != 0)
+		return false;
+	while (length > 0)
+	{
+		size_t n = (length < sizeof(buf)) ? length : sizeof(buf);
+		if (fread(buf, 1, n, src) != n || fwrite(buf, 1, n, dest) != n)
+			return false;
+		length -= n;
+	}
+	return true;
+}
+
+/* Brings the texts of an entry into memory, in order, and points the
+   entry at them.  Returns NULL if they cannot be read back in.  */
+static const UndoEntry* HandOut(UndoJournal* journal, UndoRecord* rec)
+{
+	if (!LoadBlock(journal, rec->dataBlock) ||
+		(rec->entry.oldLength != 0 && !LoadBlock(journal, rec->oldBlock)))
+		return NULL;
+	rec->entry.data = TextAt(journal, rec->dataBlock, rec->dataOffset);
+	rec->entry.oldData = NULL;
+	if (rec->entry.oldLength != 0)
+		rec->entry.oldData = TextAt(journal, rec->oldBlock, rec->oldOffset);
+	if (rec->reversed)
+	{
+		/* Put text that was stored in reverse back in order.  */
+		char* lo = rec->entry.data;
+		char* hi = lo + rec->entry.length - 1;
+		TouchBlock(journal,
+			&journal->blocks[rec->dataBlock - journal->firstBlock]);
+		while (lo < hi)
+		{
+			char t = *lo;
+			*lo++ = *hi;
+			*hi-- = t;
+		}
+		rec->reversed = false;
+	}
+	TrimJournal(journal, rec);
+	return &rec->entry;
+}
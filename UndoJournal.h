@@ -0,0 +1,36 @@
+/* Undo journal interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef UNDOJOURNAL_H
+#define UNDOJOURNAL_H
+
+#include <stddef.h>
+
+typedef struct UndoJournal_t UndoJournal;
+typedef struct UndoEntry_t UndoEntry;
+
+/* One edit.  The texts are null-terminated and stay valid until the
+   next call that changes the journal.  */
+struct UndoEntry_t
+{
+	unsigned type; /* Up to the caller */
+	bool caretFirst; /* Did the caret come before the region beginning? */
+	unsigned long opPos; /* Position to change text */
+	char* data; /* If replace, this is the new data */
+	size_t length;
+	char* oldData; /* Only set on replace operations */
+	size_t oldLength;
+};
+
+UndoJournal* CreateUndoJournal(size_t maxBytes, size_t maxResident);
+void ClearUndoJournal(UndoJournal* journal);
+UndoEntry* AddUndoEntry(UndoJournal* journal, unsigned type,
+	unsigned long opPos, size_t length, size_t oldLength);
+bool ExtendUndoEntry(UndoJournal* journal, unsigned long pos, char c);
+bool CanStepUndo(const UndoJournal* journal);
+bool CanStepRedo(const UndoJournal* journal);
+const UndoEntry* StepUndo(UndoJournal* journal);
+const UndoEntry* StepRedo(UndoJournal* journal);
+void FreeUndoJournal(UndoJournal* journal);
+
+#endif /* not UNDOJOURNAL_H */
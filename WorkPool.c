@@ -0,0 +1,205 @@
+/* Worker thread pool */
+
+/* A fixed set of worker threads that run queued work items in first
+   in, first out order.  All of the long-running batch operations use
+   this so that they scale with the number of processors.
+
+   Wherever a WorkPool* is accepted, NULL is also accepted and means
+   that the work is done immediately on the calling thread.  This
+   keeps the callers free of special cases when a pool could not be
+   created or threading is not wanted.  */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+
+#include <stdlib.h>
+
+#include "bool.h"
+#include "WorkPool.h"
+
+#define MAX_POOL_THREADS 64
+
+typedef struct WorkItem_t WorkItem;
+
+struct WorkItem_t
+{
+	WorkFunc func;
+	void* arg;
+	WorkItem* next;
+};
+
+struct WorkPool_t
+{
+	CRITICAL_SECTION lock;
+	HANDLE workSem; /* Counts the queued work items */
+	HANDLE idleEvent; /* Signaled while no work is pending */
+	HANDLE threads[MAX_POOL_THREADS];
+	unsigned numThreads;
+	WorkItem* head;
+	WorkItem* tail;
+	unsigned pending; /* Queued plus running work items */
+	bool quit;
+};
+
+static unsigned __stdcall WorkerThread(void* param);
+
+/* Creates a pool with the given number of threads, or one thread per
+   processor if "numThreads" is zero.  Returns NULL on failure.  */
+WorkPool* CreateWorkPool(unsigned numThreads)
+{
+	WorkPool* pool;
+	unsigned i;
+
+	if (numThreads == 0)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		numThreads = si.dwNumberOfProcessors;
+	}
+	if (numThreads > MAX_POOL_THREADS)
+		numThreads = MAX_POOL_THREADS;
+
+	pool = (WorkPool*)calloc(1, sizeof(WorkPool));
+	if (pool == NULL)
+		return NULL;
+	InitializeCriticalSection(&pool->lock);
+	pool->workSem = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+	pool->idleEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (pool->workSem == NULL || pool->idleEvent == NULL)
+	{
+		FreeWorkPool(pool);
+		return NULL;
+	}
+
+	for (i = 0; i < numThreads; i++)
+	{
+		pool->threads[i] = (HANDLE)_beginthreadex(NULL, 0, WorkerThread,
+												  pool, 0, NULL);
+		if (pool->threads[i] == NULL)
+			break;
+		pool->numThreads++;
+	}
+	if (pool->numThreads == 0)
+	{
+		FreeWorkPool(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+/* Queues "func" to be called with "arg" on one of the pool's threads.
+   If "pool" is NULL or the work item cannot be allocated, the
+   function is called right away instead.  */
+void SubmitWork(WorkPool* pool, WorkFunc func, void* arg)
+{
+	WorkItem* item;
+
+	if (pool == NULL)
+	{
+		func(arg);
+		return;
+	}
+	item = (WorkItem*)malloc(sizeof(WorkItem));
+	if (item == NULL)
+	{
+		func(arg);
+		return;
+	}
+	item->func = func;
+	item->arg = arg;
+	item->next = NULL;
+
+	EnterCriticalSection(&pool->lock);
+	if (pool->tail != NULL)
+		pool->tail->next = item;
+	else
+		pool->head = item;
+	pool->tail = item;
+	if (pool->pending++ == 0)
+		ResetEvent(pool->idleEvent);
+	LeaveCriticalSection(&pool->lock);
+	ReleaseSemaphore(pool->workSem, 1, NULL);
+}
+
+/* Waits until every submitted work item has finished.  Do not call
+   this from inside a work item.  */
+void WaitWorkPool(WorkPool* pool)
+{
+	if (pool == NULL)
+		return;
+	WaitForSingleObject(pool->idleEvent, INFINITE);
+}
+
+/* Returns the number of threads in the pool, which is one for the
+   NULL pool.  */
+unsigned WorkPoolSize(WorkPool* pool)
+{
+	if (pool == NULL)
+		return 1;
+	return pool->numThreads;
+}
+
+/* Finishes all queued work, then stops the threads and frees the
+   pool.  */
+void FreeWorkPool(WorkPool* pool)
+{
+	unsigned i;
+	if (pool == NULL)
+		return;
+
+	EnterCriticalSection(&pool->lock);
+	pool->quit = true;
+	LeaveCriticalSection(&pool->lock);
+	if (pool->numThreads > 0)
+		ReleaseSemaphore(pool->workSem, pool->numThreads, NULL);
+	for (i = 0; i < pool->numThreads; i++)
+	{
+		WaitForSingleObject(pool->threads[i], INFINITE);
+		CloseHandle(pool->threads[i]);
+	}
+
+	if (pool->workSem != NULL)
+		CloseHandle(pool->workSem);
+	if (pool->idleEvent != NULL)
+		CloseHandle(pool->idleEvent);
+	DeleteCriticalSection(&pool->lock);
+	free(pool);
+}
+
+static unsigned __stdcall WorkerThread(void* param)
+{
+	WorkPool* pool = (WorkPool*)param;
+
+	for (;;)
+	{
+		WorkItem* item;
+
+		WaitForSingleObject(pool->workSem, INFINITE);
+		EnterCriticalSection(&pool->lock);
+		item = pool->head;
+		if (item == NULL)
+		{
+			/* Only the wake-ups from FreeWorkPool() have no work, and
+			   those are sent after all real work was queued.  */
+			bool quit = pool->quit;
+			LeaveCriticalSection(&pool->lock);
+			if (quit)
+				break;
+			continue;
+		}
+		pool->head = item->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+		LeaveCriticalSection(&pool->lock);
+
+		item->func(item->arg);
+		free(item);
+
+		EnterCriticalSection(&pool->lock);
+		if (--pool->pending == 0)
+			SetEvent(pool->idleEvent);
+		LeaveCriticalSection(&pool->lock);
+	}
+	return 0;
+}
@@ -0,0 +1,16 @@
+/* Worker thread pool interface */
+/* Include "bool.h" before this header.  */
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+typedef struct WorkPool_t WorkPool;
+typedef void (*WorkFunc)(void* arg);
+
+WorkPool* CreateWorkPool(unsigned numThreads);
+void SubmitWork(WorkPool* pool, WorkFunc func, void* arg);
+void WaitWorkPool(WorkPool* pool);
+unsigned WorkPoolSize(WorkPool* pool);
+void FreeWorkPool(WorkPool* pool);
+
+#endif /* not WORKPOOL_H */
@@ -5,6 +5,7 @@
 #define WM_CHANGEENTRY	(WM_USER+1)
 #define EM_REDO			(WM_USER+84)
 #define EM_CANREDO		(WM_USER+85)
+#define EM_SETHEXMODE	(WM_USER+86) /* wParam: bytes per row, 0 for text */
 #define EN_SELCHANGE	(WM_USER+2)
 #define NM_CANUNDO		(WM_USER+3)
 
@@ -44,6 +45,11 @@
 #define K_SWITCHPANES	1005
 #define K_SWITCHPANES_BACK	1006
 #define ID_TOOLBAR		1007
+#define BMP_WINDOW		1008
+#define PALEDIT_WINDOW	1009
+#define THUMB_WINDOW	1010
+#define SPRITE_WINDOW	1011
+#define HEX_WINDOW		1012
 
 #define M_FILE_SUBM		0
 #define M_NEW			2001
@@ -96,6 +102,7 @@
 #define T_PASTE			2043
 #define T_UNDO			2044
 #define T_REDO			2045
+#define M_RSRC_OPTIMIZE	2046
 
 #define D_STATIC1		3001
 #define D_STATIC2		3002
@@ -159,3 +166,19 @@
 
 #define D_GM_NONE			2057
 #define D_GM_ORLY			2058
+
+#define D_TBMP_AUTOCMP		2059
+
+#define D_TSPR_PLAY			2060
+#define D_TSPR_UKN9_LBL		2061
+#define D_TSPR_UKN9			2062
+#define D_TSPR_UKN10_LBL	2063
+#define D_TSPR_UKN10		2064
+#define D_TSPR_UKN11_LBL	2065
+#define D_TSPR_UKN11		2066
+#define D_TSPR_UKN12_LBL	2067
+#define D_TSPR_UKN12		2068
+#define D_TSPR_UKN13_LBL	2069
+#define D_TSPR_UKN13		2070
+#define D_TSPR_UKN14_LBL	2071
+#define D_TSPR_UKN14		2072